@@ -22,6 +22,9 @@ $(OUT_PATH)/$(SRC_PATH)/eeprom.o \
 $(OUT_PATH)/$(SRC_PATH)/zigbee.o \
 $(OUT_PATH)/$(SRC_PATH)/comms.o \
 $(OUT_PATH)/$(SRC_PATH)/drawing.o \
+$(OUT_PATH)/$(SRC_PATH)/g5dec.o \
+$(OUT_PATH)/$(SRC_PATH)/imgslots.o \
+$(OUT_PATH)/$(SRC_PATH)/blocktiming.o \
 $(OUT_PATH)/$(SRC_PATH)/syncedproto.o \
 $(OUT_PATH)/$(SRC_PATH)/wdt.o \
 $(OUT_PATH)/$(SRC_PATH)/powermgt.o \
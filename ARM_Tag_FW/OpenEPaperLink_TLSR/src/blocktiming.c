@@ -0,0 +1,37 @@
+// Block transfer timing, kept free of hardware calls so it can be simulated on a host (test/)
+#include "blocktiming.h"
+
+uint16_t blockRxWindowUpdate(uint16_t window, bool complete, uint32_t took)
+{
+    if (complete)
+    {
+        uint32_t target = took * 2 + BLOCK_RX_PART_GAP;
+        if (target < BLOCK_RX_WINDOW_MIN)
+            target = BLOCK_RX_WINDOW_MIN;
+        if (target > BLOCK_RX_WINDOW_MAX)
+            target = BLOCK_RX_WINDOW_MAX;
+        return (window * 3 + target) / 4;
+    }
+    // lost parts, give the next round more time
+    window *= 2;
+    if (window > BLOCK_RX_WINDOW_MAX)
+        window = BLOCK_RX_WINDOW_MAX;
+    return window;
+}
+
+uint16_t blockReqGapBackoff(uint16_t gap)
+{
+    // no answer, the AP is busy, back off
+    return gap * 2 > BLOCK_REQ_GAP_MAX ? BLOCK_REQ_GAP_MAX : gap * 2;
+}
+
+uint16_t blockReqGapLearn(uint16_t learned, uint16_t gap, bool retried)
+{
+    if (retried)
+        learned = gap; // start where it took us next time
+    else
+        learned -= learned / 4; // answered right away, wait less next time
+    if (learned < BLOCK_REQ_GAP_MIN)
+        learned = BLOCK_REQ_GAP_MIN;
+    return learned;
+}
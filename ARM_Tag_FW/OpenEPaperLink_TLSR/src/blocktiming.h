@@ -0,0 +1,24 @@
+#ifndef _BLOCKTIMING_H_
+#define _BLOCKTIMING_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// block transfer timing, learned per link
+#define BLOCK_RX_WINDOW_MIN 60    // ms to wait for the parts of a block
+#define BLOCK_RX_WINDOW_MAX 300
+#define BLOCK_RX_PART_GAP 30      // ms without a new part after which the AP is done sending
+#define BLOCK_REQ_GAP_MIN 20      // ms to wait for a block request ack before sending it again
+#define BLOCK_REQ_GAP_MAX 200
+#define BLOCK_REQ_GAP_START 50
+#define BLOCK_REQ_TIMEOUT 1500    // ms before giving up on a block request ack
+
+// New receive window after a block: towards twice the time the parts took if they all
+// came in (took is from the start of the window to the last part), doubled if some got lost
+uint16_t blockRxWindowUpdate(uint16_t window, bool complete, uint32_t took);
+// gap before sending an unanswered block request again
+uint16_t blockReqGapBackoff(uint16_t gap);
+// gap to start with next time, gap is the one the request was answered in
+uint16_t blockReqGapLearn(uint16_t learned, uint16_t gap, bool retried);
+
+#endif
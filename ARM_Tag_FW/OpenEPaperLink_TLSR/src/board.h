@@ -9,6 +9,10 @@
 #define EEPROM_SETTINGS_AREA_START		(0x40000UL)
 #define EEPROM_SETTINGS_AREA_LEN		(0x03000UL)
 
+// image slot usage log, first sector of the settings area
+#define EEPROM_SLOTLOG_START			(EEPROM_SETTINGS_AREA_START)
+#define EEPROM_SLOTLOG_LEN				(0x01000UL)
+
 #define EEPROM_UPDATA_AREA_START		(0x43000UL)
 #define EEPROM_UPDATE_AREA_LEN			(0x20000UL)
 
@@ -17,6 +21,8 @@
 #define EEPROM_IMG_LEN					(0x20000UL)
 
 #define EEPROM_PAGE_SIZE			(0x01000)
+#define EEPROM_BLOCK32_SIZE			(0x08000)
+#define EEPROM_BLOCK64_SIZE			(0x10000)
 //till end of eeprom really. do not put anything after - it will be erased at pairing time!!!
 #define EEPROM_PROGRESS_BYTES			(128)
 
@@ -28,4 +34,7 @@
 //hw types
 #define HW_TYPE					        0x60
 
+// reported in the AvailDataReq, the AP picks the compression from it (tagtypes g5_compression / zlib_compression)
+#define FW_VERSION					    0x0020
+
 #endif
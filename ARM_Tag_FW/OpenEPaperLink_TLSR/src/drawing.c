@@ -7,6 +7,7 @@
 #include "proto.h"
 #include "screen.h"
 #include "epd.h"
+#include "g5dec.h"
 
 #define LINE_BYTE_COUNTER ((SCREEN_WIDTH/8)*5)// Draw 5 lines
 
@@ -17,10 +18,108 @@ void drawOnOffline(uint8_t state)
     onlineState = state;
 }
 
+#define PLANE_SIZE (SCREEN_HEIGHT * (SCREEN_WIDTH / 8))
+
 static uint8_t mClutMap[256];
+static uint32_t epdSendTicks;
+
+// send the first len bytes of mClutMap to the EPD in one transfer
+static void sendBlock(uint16_t len, bool firstPlane)
+{
+    if (firstPlane)
+    {
+        // the first lines show a pattern while the tag is offline
+        if (onlineState == 0 && byteCounter < LINE_BYTE_COUNTER)
+        {
+            uint32_t n = LINE_BYTE_COUNTER - byteCounter;
+            memset(mClutMap, 0x55, n < len ? n : len);
+        }
+        byteCounter += len;
+    }
+    uint32_t t = clock_time();
+    EPD_Display_buffer(mClutMap, len);
+    epdSendTicks += clock_time() - t;
+}
+
+static void sendRawPlane(uint32_t addr, bool firstPlane)
+{
+    for (uint32_t c = 0; c < PLANE_SIZE; c += sizeof(mClutMap))
+    {
+        uint16_t len = (PLANE_SIZE - c) < sizeof(mClutMap) ? (PLANE_SIZE - c) : sizeof(mClutMap);
+        eepromRead(addr + c, mClutMap, len);
+        sendBlock(len, firstPlane);
+    }
+}
+
+static void sendEmptyPlane(void)
+{
+    for (uint32_t c = 0; c < PLANE_SIZE; c += sizeof(mClutMap))
+    {
+        uint16_t len = (PLANE_SIZE - c) < sizeof(mClutMap) ? (PLANE_SIZE - c) : sizeof(mClutMap);
+        memset(mClutMap, 0x00, len);
+        sendBlock(len, false);
+    }
+}
+
+// addr points at the 6 byte header the AP puts in front of the G5 stream
+static void drawG5(uint32_t addr, uint32_t size)
+{
+    uint8_t header[6];
+    if (size <= sizeof(header))
+        return;
+    eepromRead(addr, header, sizeof(header));
+    uint16_t width = header[1] | (header[2] << 8);
+    uint16_t height = header[3] | (header[4] << 8);
+    uint8_t planes = header[5];
+    uint16_t lineBytes = width / 8;
+    // lines are shifted out as they are decoded, the image has to be in the panel orientation
+    if (header[0] != sizeof(header) || width != SCREEN_WIDTH || height != SCREEN_HEIGHT || planes < 1 || planes > 2)
+    {
+        printf("G5 image %dx%d with %d planes doesn't fit the screen\r\n", width, height, planes);
+        return;
+    }
+    addr += sizeof(header);
+    size -= sizeof(header);
+
+    // decode everything once without drawing, a corrupt image leaves the current one on the screen
+    if (!g5DecodeBegin(addr, size, width, height * planes))
+        return;
+    for (uint32_t y = 0; y < (uint32_t)height * planes; y++)
+    {
+        if (!g5DecodeLine(mClutMap))
+        {
+            printf("G5 data corrupt at line %d\r\n", y);
+            return;
+        }
+    }
+
+    g5DecodeBegin(addr, size, width, height * planes);
+    EPD_Display_start(1);
+    for (uint16_t y = 0; y < height; y++)
+    {
+        g5DecodeLine(mClutMap);
+        sendBlock(lineBytes, true);
+    }
+    EPD_Display_color_change();
+    if (planes == 2)
+    {
+        for (uint16_t y = 0; y < height; y++)
+        {
+            g5DecodeLine(mClutMap);
+            sendBlock(lineBytes, false);
+        }
+    }
+    else
+    {
+        sendEmptyPlane();
+    }
+    EPD_Display_end();
+}
+
 void drawImageAtAddress(uint32_t addr, uint8_t lut)
 {
     byteCounter = 0;
+    epdSendTicks = 0;
     struct EepromImageHeader *eih = (struct EepromImageHeader *)mClutMap;
     eepromRead(addr, mClutMap, sizeof(struct EepromImageHeader));
     switch (eih->dataType)
@@ -28,51 +127,23 @@ void drawImageAtAddress(uint32_t addr, uint8_t lut)
     case DATATYPE_IMG_RAW_1BPP:
         printf("Doing raw 1bpp\r\n");
         EPD_Display_start(1);
-        for (uint32_t c = 0; c < (SCREEN_HEIGHT * (SCREEN_WIDTH / 8)); c++)
-        {
-            if (c % 256 == 0)
-            {
-                eepromRead(addr + sizeof(struct EepromImageHeader) + c, mClutMap, 256);
-            }
-            if (byteCounter < LINE_BYTE_COUNTER && onlineState == 0)
-                EPD_Display_byte(0x55);
-            else
-                EPD_Display_byte(mClutMap[c % 256]);
-            byteCounter++;
-        }
+        sendRawPlane(addr + sizeof(struct EepromImageHeader), true);
         EPD_Display_color_change();
-        for (uint32_t c = 0; c < (SCREEN_HEIGHT * (SCREEN_WIDTH / 8)); c++)
-        {
-            EPD_Display_byte(0x00);
-        }
+        sendEmptyPlane();
         EPD_Display_end();
         break;
     case DATATYPE_IMG_RAW_2BPP:
         printf("Doing raw 2bpp\r\n");
         EPD_Display_start(1);
-        for (uint32_t c = 0; c < (SCREEN_HEIGHT * (SCREEN_WIDTH / 8)); c++)
-        {
-            if (c % 256 == 0)
-            {
-                eepromRead(addr + sizeof(struct EepromImageHeader) + c, mClutMap, 256);
-            }
-            if (byteCounter < LINE_BYTE_COUNTER && onlineState == 0)
-                EPD_Display_byte(0x55);
-            else
-                EPD_Display_byte(mClutMap[c % 256]);
-            byteCounter++;
-        }
+        sendRawPlane(addr + sizeof(struct EepromImageHeader), true);
         EPD_Display_color_change();
-        for (uint32_t c = 0; c < (SCREEN_HEIGHT * (SCREEN_WIDTH / 8)); c++)
-        {
-            if (c % 256 == 0)
-            {
-                eepromRead(addr + sizeof(struct EepromImageHeader) + (SCREEN_HEIGHT * (SCREEN_WIDTH / 8)) + c, mClutMap, 256);
-            }
-            EPD_Display_byte(mClutMap[c % 256]);
-        }
+        sendRawPlane(addr + sizeof(struct EepromImageHeader) + PLANE_SIZE, false);
         EPD_Display_end();
         break;
+    case DATATYPE_IMG_G5:
+        printf("Doing G5\r\n");
+        drawG5(addr + sizeof(struct EepromImageHeader), eih->size);
+        break;
     case DATATYPE_IMG_BMP:;
         printf("sending BMP to EPD - ");
 
@@ -82,4 +153,5 @@ void drawImageAtAddress(uint32_t addr, uint8_t lut)
         printf("Image with type 0x%02X was requested, but we don't know what to do with that currently...\r\n", eih->dataType);
         return;
     }
-}
\ No newline at end of file
+    printf("Image data sent to the EPD in %dus\r\n", epdSendTicks / CLOCK_16M_SYS_TIMER_CLK_1US);
+}
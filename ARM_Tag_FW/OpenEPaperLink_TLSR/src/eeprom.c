@@ -9,6 +9,12 @@
 #include "eeprom.h"
 #include "tl_common.h"
 
+#define FLASH_BLOCK32_ERASE_CMD 0x52
+#define FLASH_BLOCK64_ERASE_CMD 0xD8
+
+// not exported by the SDK's flash.h, flash_erase_sector is a wrapper around it
+unsigned char flash_mspi_write_ram(unsigned char cmd, unsigned long addr, unsigned char addr_en, unsigned char *data, unsigned long data_len);
+
 uint32_t eepromGetSize(void)
 {
     return EEPROM_IMG_LEN;
@@ -42,8 +48,22 @@ bool eepromErase(uint32_t addr, uint32_t len)
     while (len)
     {
         uint32_t now;
-        flash_erase_sector(addr);
-        now = 0x1000;
+        // a block erase takes about as long as a single sector erase, use the largest one that fits
+        if (!(addr % EEPROM_BLOCK64_SIZE) && len >= EEPROM_BLOCK64_SIZE)
+        {
+            flash_mspi_write_ram(FLASH_BLOCK64_ERASE_CMD, addr, 1, NULL, 0);
+            now = EEPROM_BLOCK64_SIZE;
+        }
+        else if (!(addr % EEPROM_BLOCK32_SIZE) && len >= EEPROM_BLOCK32_SIZE)
+        {
+            flash_mspi_write_ram(FLASH_BLOCK32_ERASE_CMD, addr, 1, NULL, 0);
+            now = EEPROM_BLOCK32_SIZE;
+        }
+        else
+        {
+            flash_erase_sector(addr);
+            now = EEPROM_PAGE_SIZE;
+        }
 
         addr += now;
         len -= now;
@@ -342,10 +342,7 @@ uint8_t LUT_BW_213_ice_part[] = {
 
  void EPD_BW_213_ice_Display_buffer(unsigned char *image, int size)
 {
-    for (int i = 0; i < size; i++)
-    {
-        EPD_WriteData(image[i]);
-    }
+    EPD_WriteDataBuffer(image, size);
 }
 
  void EPD_BW_213_ice_Display_end()
@@ -207,10 +207,7 @@ uint8_t LUT_bwr_350_part[] = {
 }
  void EPD_BWR_350_Display_buffer(unsigned char *image, int size)
 {
-    for (int i = 0; i < size; i++)
-    {
-        EPD_WriteData(image[i]);
-    }
+    EPD_WriteDataBuffer(image, size);
 }
  void EPD_BWR_350_Display_end()
 {
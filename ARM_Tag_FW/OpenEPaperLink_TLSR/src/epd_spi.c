@@ -36,11 +36,10 @@
     gpio_setup_up_down_resistor(EPD_ENABLE, PM_PIN_PULLUP_1M);
 }
 
- void EPD_SPI_Write(unsigned char value)
+static inline void EPD_SPI_Shift(unsigned char value)
 {
     unsigned char i;
 
-    WaitUs(10);
     for (i = 0; i < 8; i++)
     {
         gpio_write(EPD_CLK, 0);
@@ -57,6 +56,12 @@
     }
 }
 
+ void EPD_SPI_Write(unsigned char value)
+{
+    WaitUs(10);
+    EPD_SPI_Shift(value);
+}
+
  uint8_t EPD_SPI_read(void)
 {
     unsigned char i;
@@ -100,6 +105,20 @@
     gpio_write(EPD_CS, 1);
 }
 
+// Send a block of data bytes in one chip select cycle, the settle time after
+// CS/DC is only needed once per block instead of once per byte
+ void EPD_WriteDataBuffer(const unsigned char *data, int len)
+{
+    gpio_write(EPD_CS, 0);
+    EPD_ENABLE_WRITE_DATA();
+    WaitUs(10);
+    for (int i = 0; i < len; i++)
+    {
+        EPD_SPI_Shift(data[i]);
+    }
+    gpio_write(EPD_CS, 1);
+}
+
  void EPD_CheckStatus(int max_ms)
 {
     unsigned long timeout_start = clock_time();
@@ -142,11 +161,7 @@
 
  void EPD_LoadImage(unsigned char *image, int size, uint8_t cmd)
 {
-    int i;
     EPD_WriteCmd(cmd);
-    for (i = 0; i < size; i++)
-    {
-        EPD_WriteData(image[i]);
-    }
+    EPD_WriteDataBuffer(image, size);
     WaitMs(2);
 }
\ No newline at end of file
@@ -0,0 +1,277 @@
+// Streaming Group5 line decoder
+//
+// Based on the Group5 decoder by Larry Bank (Copyright (c) 2024 BitBank Software, Inc.)
+// as used on the AP (ESP32_AP-Flasher/src/g5/g5dec.inl). The compressed data is read
+// straight from the image slot in flash through a small window instead of from RAM,
+// and one line is produced per call so it can be shifted out to the EPD right away.
+#include "g5dec.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "tl_common.h"
+#include "eeprom.h"
+
+#define G5_MAX_FLIPS (G5_MAX_LINE_WIDTH + 8)
+#define G5_WINDOW_SIZE 256
+
+/*
+ The code tree that follows has: bit_length, decode routine
+ These codes are for Group 4 (MMR) decoding
+
+ 01 = vertneg1, 11h = vert1, 20h = horiz, 30h = pass, 12h = vert2
+ 02 = vertneg2, 13h = vert3, 03 = vertneg3, 90h = trash
+*/
+static const uint8_t code_table[128] =
+    {0x90, 0, 0x40, 0,                      /* trash, uncompr mode - codes 0 and 1 */
+     3, 7,                                  /* V(-3) pos = 2 */
+     0x13, 7,                               /* V(3)  pos = 3 */
+     2, 6, 2, 6,                            /* V(-2) pos = 4,5 */
+     0x12, 6, 0x12, 6,                      /* V(2)  pos = 6,7 */
+     0x30, 4, 0x30, 4, 0x30, 4, 0x30, 4,    /* pass  pos = 8->F */
+     0x30, 4, 0x30, 4, 0x30, 4, 0x30, 4,
+     0x20, 3, 0x20, 3, 0x20, 3, 0x20, 3,    /* horiz pos = 10->1F */
+     0x20, 3, 0x20, 3, 0x20, 3, 0x20, 3,
+     0x20, 3, 0x20, 3, 0x20, 3, 0x20, 3,
+     0x20, 3, 0x20, 3, 0x20, 3, 0x20, 3,
+     /* V(-1) pos = 20->2F */
+     1, 3, 1, 3, 1, 3, 1, 3,
+     1, 3, 1, 3, 1, 3, 1, 3,
+     1, 3, 1, 3, 1, 3, 1, 3,
+     1, 3, 1, 3, 1, 3, 1, 3,
+     0x11, 3, 0x11, 3, 0x11, 3, 0x11, 3,    /* V(1)   pos = 30->3F */
+     0x11, 3, 0x11, 3, 0x11, 3, 0x11, 3,
+     0x11, 3, 0x11, 3, 0x11, 3, 0x11, 3,
+     0x11, 3, 0x11, 3, 0x11, 3, 0x11, 3};
+
+static int16_t flips[2][G5_MAX_FLIPS];
+static int16_t *pCurFlips, *pRefFlips;
+
+// compressed data window
+static uint8_t window[G5_WINDOW_SIZE];
+static uint32_t windowStart;
+static uint32_t windowLen;
+
+static uint32_t srcAddr;
+static uint32_t srcSize;
+static uint32_t srcPos; // byte offset of the bit reader
+static uint32_t ulBits, ulBitOff;
+static uint16_t xsize;
+static uint16_t linesLeft;
+static uint8_t hLen; // length of 'long' horizontal codes for this width
+
+// 32 bits of compressed data at byte offset pos, big endian, zero past the end
+static uint32_t readLong(uint32_t pos)
+{
+    if (pos < windowStart || pos + 4 > windowStart + windowLen)
+    {
+        windowStart = pos;
+        windowLen = G5_WINDOW_SIZE;
+        memset(window, 0, G5_WINDOW_SIZE);
+        if (pos < srcSize)
+        {
+            uint32_t len = srcSize - pos;
+            if (len > G5_WINDOW_SIZE)
+                len = G5_WINDOW_SIZE;
+            eepromRead(srcAddr + pos, window, len);
+        }
+    }
+    uint8_t *p = &window[pos - windowStart];
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+// move the byte offset up to the bit offset and reload the 32 bit register
+static void refill(void)
+{
+    srcPos += ulBitOff >> 3;
+    ulBitOff &= 7;
+    ulBits = readLong(srcPos);
+}
+
+bool g5DecodeBegin(uint32_t addr, uint32_t size, uint16_t width, uint16_t lines)
+{
+    if (width == 0 || width > G5_MAX_LINE_WIDTH || size == 0)
+        return false;
+    srcAddr = addr;
+    srcSize = size;
+    srcPos = 0;
+    windowStart = 0;
+    windowLen = 0;
+    xsize = width;
+    linesLeft = lines;
+    hLen = 32 - __builtin_clz(width);
+
+    /* Seed the current and reference line with XSIZE for V(0) codes */
+    uint16_t i;
+    for (i = 0; i < G5_MAX_FLIPS - 2; i++)
+    {
+        flips[0][i] = width;
+        flips[1][i] = width;
+    }
+    /* Prefill both lines with 7fff to prevent it from walking off the end if the data gets bunged */
+    flips[0][i] = flips[1][i] = 0x7fff;
+    flips[0][i + 1] = flips[1][i + 1] = 0x7fff;
+    pCurFlips = flips[0];
+    pRefFlips = flips[1];
+
+    ulBitOff = 0;
+    ulBits = readLong(0);
+    return true;
+}
+
+// decode the color changes of one line into pCurFlips
+static bool decodeFlips(void)
+{
+    int16_t *pCur = pCurFlips, *pRef = pRefFlips;
+    // leave room for the two terminating entries of a horizontal code and the line end
+    int16_t *pCurEnd = &pCurFlips[G5_MAX_FLIPS - 4];
+    int32_t a0 = -1, a0_p, b1;
+    uint32_t lBits, sCode, u32Len, tot_run, tot_run1;
+    uint32_t u32RunLen[2];
+
+    u32RunLen[0] = 3;
+    u32RunLen[1] = hLen;
+
+    while (a0 < xsize)
+    {
+        if (pCur >= pCurEnd)
+            return false;
+        if (ulBitOff > (32 - 8)) // need at least 7 unused bits
+            refill();
+        if ((int32_t)(ulBits << ulBitOff) < 0)
+        { /* V(0) code is the most frequent case (1 bit) */
+            a0 = *pRef++;
+            ulBitOff++;
+            *pCur++ = a0;
+            continue;
+        }
+        lBits = (ulBits >> ((32 - 8) - ulBitOff)) & 0xfe; /* Only the first 7 bits are useful */
+        sCode = code_table[lBits];
+        ulBitOff += code_table[lBits + 1];
+        switch (sCode)
+        {
+        case 1: /* V(-1) */
+        case 2: /* V(-2) */
+        case 3: /* V(-3) */
+            a0 = *pRef - sCode; /* A0 = B1 - x */
+            *pCur++ = a0;
+            if (pRef == pRefFlips)
+                pRef += 2;
+            pRef--;
+            while (a0 >= *pRef)
+                pRef += 2;
+            break;
+
+        case 0x11: /* V(1) */
+        case 0x12: /* V(2) */
+        case 0x13: /* V(3) */
+            a0 = *pRef++; /* A0 = B1 */
+            b1 = a0;
+            a0 += sCode & 7; /* A0 = B1 + x */
+            if (b1 != xsize && a0 < xsize)
+            {
+                while (a0 >= *pRef)
+                    pRef += 2;
+            }
+            if (a0 > xsize)
+                a0 = xsize;
+            *pCur++ = a0;
+            break;
+
+        case 0x20: /* Horizontal codes, 2 bit prefix selects a short (3 bit) or long (hLen bit) length per run */
+            if (ulBitOff > (32 - 16))
+                refill();
+            a0_p = a0 < 0 ? 0 : a0;
+            lBits = (ulBits >> ((32 - 2) - ulBitOff)) & 0x3;
+            ulBitOff += 2;
+            u32Len = u32RunLen[lBits >> 1];
+            tot_run = (ulBits >> ((32 - u32Len) - ulBitOff)) & ((1 << u32Len) - 1);
+            ulBitOff += u32Len;
+            if (ulBitOff > (32 - 16))
+                refill();
+            u32Len = u32RunLen[lBits & 1];
+            tot_run1 = (ulBits >> ((32 - u32Len) - ulBitOff)) & ((1 << u32Len) - 1);
+            ulBitOff += u32Len;
+            a0 = a0_p + tot_run;
+            *pCur++ = a0;
+            a0 += tot_run1;
+            if (a0 < xsize)
+            {
+                while (a0 >= *pRef)
+                    pRef += 2;
+            }
+            *pCur++ = a0;
+            break;
+
+        case 0x30: /* Pass code */
+            pRef++; /* A0 = B2, iRef+=2 */
+            a0 = *pRef++;
+            break;
+
+        default: /* ERROR */
+            return false;
+        }
+    }
+    /* Terminate the line properly */
+    *pCur++ = xsize;
+    *pCur++ = xsize;
+    return true;
+}
+
+// draw the black runs of pCurFlips into a white line
+static void drawLine(uint8_t *out)
+{
+    int16_t *pFlips = pCurFlips;
+    int32_t x, run, len;
+    uint8_t lBit, rBit, *p;
+
+    memset(out, 0xff, (xsize + 7) >> 3);
+    x = 0;
+    while (x < xsize)
+    {
+        x = *pFlips++;        // black starting point
+        run = *pFlips++ - x; // get the black run
+        if (x >= xsize || run <= 0)
+            break;
+        if (x < 0)
+        {
+            run += x;
+            x = 0;
+        }
+        if ((x + run) > xsize)
+            run = xsize - x;
+        lBit = 0xff << (8 - (x & 7));
+        rBit = 0xff >> ((x + run) & 7);
+        len = ((x + run) >> 3) - (x >> 3);
+        p = &out[x >> 3];
+        if (len == 0)
+        {
+            *p &= lBit | rBit;
+        }
+        else
+        {
+            *p++ &= lBit;
+            while (len > 1)
+            {
+                *p++ = 0;
+                len--;
+            }
+            *p = rBit;
+        }
+    }
+}
+
+bool g5DecodeLine(uint8_t *out)
+{
+    if (linesLeft == 0 || srcPos >= srcSize)
+        return false;
+    if (!decodeFlips())
+        return false;
+    drawLine(out);
+    /*--- Swap current and reference lines ---*/
+    int16_t *t = pRefFlips;
+    pRefFlips = pCurFlips;
+    pCurFlips = t;
+    linesLeft--;
+    return true;
+}
@@ -0,0 +1,15 @@
+#ifndef _G5DEC_H_
+#define _G5DEC_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// widest line the decoder accepts, covers both orientations of the supported panels
+#define G5_MAX_LINE_WIDTH 400
+
+// start decoding a G5 stream stored in flash, 'lines' counts all planes
+bool g5DecodeBegin(uint32_t addr, uint32_t size, uint16_t width, uint16_t lines);
+// decode the next line into out (width / 8 bytes plus one spare), false on corrupt data or past the last line
+bool g5DecodeLine(uint8_t *out);
+
+#endif
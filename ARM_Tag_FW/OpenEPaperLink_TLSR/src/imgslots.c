@@ -0,0 +1,39 @@
+// Image slot replacement policy, kept free of hardware calls so it can be simulated on a host (test/)
+#include "imgslots.h"
+
+uint8_t imgSlotPick(const struct imgSlotInfo *table, uint8_t slots, uint8_t shown, uint8_t resume, uint8_t preErased, uint8_t fallback)
+{
+    uint8_t best = 0xFF;
+    for (uint8_t c = 0; c < slots; c++)
+    {
+        if (slots > 1 && c == shown)
+            continue;
+        if (c == resume)
+            continue;
+        if (!table[c].valid)
+        {
+            if (best == 0xFF || table[best].valid || c == preErased)
+                best = c;
+            continue;
+        }
+        if (best == 0xFF)
+        {
+            best = c;
+            continue;
+        }
+        if (!table[best].valid)
+            continue;
+        bool reused = table[c].hits != 0;
+        bool bestReused = table[best].hits != 0;
+        if ((!reused && bestReused) || (reused == bestReused && table[c].lastUse < table[best].lastUse))
+            best = c;
+    }
+    return best == 0xFF ? fallback : best;
+}
+
+void imgSlotTouch(struct imgSlotInfo *slot, uint32_t stamp)
+{
+    slot->lastUse = stamp;
+    if (slot->hits < 255)
+        slot->hits++;
+}
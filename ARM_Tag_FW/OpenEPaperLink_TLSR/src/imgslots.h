@@ -0,0 +1,26 @@
+#ifndef _IMGSLOTS_H_
+#define _IMGSLOTS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define IMG_SLOTS_MAX 16
+
+// per slot usage, the download id or the stamp of the last redraw, plus the redraws since the download
+struct imgSlotInfo
+{
+    uint32_t id;      // id from the image header
+    uint32_t lastUse;
+    uint8_t hits;
+    bool valid;
+};
+
+// Pick the slot for the next download: an empty slot if there is one, else the least
+// recently used image that was never shown again, else the least recently used image.
+// The image on screen and a download that can still be resumed (0xFF if none) are left
+// alone, fallback is returned if no slot qualifies.
+uint8_t imgSlotPick(const struct imgSlotInfo *table, uint8_t slots, uint8_t shown, uint8_t resume, uint8_t preErased, uint8_t fallback);
+// count a redraw from a slot
+void imgSlotTouch(struct imgSlotInfo *slot, uint32_t stamp);
+
+#endif
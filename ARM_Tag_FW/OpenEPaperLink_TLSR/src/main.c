@@ -211,6 +211,13 @@ int main(void)
 				currentChannel = 0;
 			}
 
+			// prepare the next image slot while nothing is waiting for us
+			if (currentChannel && batteryVoltage >= BATTERY_VOLTAGE_MINIMUM)
+			{
+				wdt10s();
+				preEraseNextSlot();
+			}
+
 			doSleep(40 * 1000UL);
 			/*// if the AP told us to sleep for a specific period, do so.
 			if (nextCheckInFromAP)
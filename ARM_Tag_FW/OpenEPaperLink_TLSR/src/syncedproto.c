@@ -9,6 +9,8 @@
 #include "eeprom.h"
 #include "drawing.h"
 #include "wdt.h"
+#include "imgslots.h"
+#include "blocktiming.h"
 #include "tl_common.h"
 #include <stdint.h>
 // download-stuff
@@ -18,11 +20,31 @@ RAM struct AvailDataInfo curDataInfo = {0}; // last 'AvailDataInfo' we received
 RAM bool requestPartialBlock = false;       // if we should ask the AP to get this block from the host or not
 #define BLOCK_TRANSFER_ATTEMPTS 5
 
+// block transfer timing (blocktiming.c), kept in retention RAM across sleep
+RAM uint16_t blockRxWindow = BLOCK_RX_WINDOW_MAX;
+RAM uint16_t blockReqGap = BLOCK_REQ_GAP_START;
+
 uint8_t prevImgSlot = 0xFF;
 uint8_t curImgSlot = 0xFF;
 RAM uint32_t curHighSlotId = 0;
 RAM uint8_t nextImgSlot = 0;
 RAM uint8_t imgSlots = 0;
+RAM uint8_t preErasedSlot = 0xFF; // slot known to be erased, 0xFF if none
+
+// usage log in flash so the table survives a reboot, the newest record per image id wins
+struct slotUseRecord
+{
+    uint32_t imageId;
+    uint32_t lastUse;
+    uint16_t hits;
+    uint16_t marker;
+};
+#define SLOT_LOG_MARKER 0x5A17
+#define SLOT_LOG_RECORDS (EEPROM_SLOTLOG_LEN / sizeof(struct slotUseRecord))
+RAM struct imgSlotInfo slotTable[IMG_SLOTS_MAX] = {0};
+RAM uint16_t slotLogPos = 0; // next free record in the usage log
+RAM uint8_t shownSlot = 0xFF;  // slot of the image on screen, never picked for a download
+RAM uint32_t preEraseTime = 0;     // ms it took to erase it, reported when a download uses it
 uint8_t drawWithLut = 0;
 
 // stuff we need to keep track of related to the network/AP
@@ -208,6 +230,7 @@ static void sendAvailDataReq()
     availreq->temperature = temperature;
     availreq->batteryMv = batteryVoltage;
     availreq->capabilities = capabilities;
+    availreq->tagSoftwareVersion = FW_VERSION;
     addCRC(availreq, sizeof(struct AvailDataReq));
     commsTxNoCpy(outBuffer);
 }
@@ -301,12 +324,22 @@ static bool processBlockPart(const struct blockPart *bp)
         return false;
     }
 }
+static bool blockPartsComplete()
+{
+    for (uint8_t c = 0; c < BLOCK_MAX_PARTS; c++)
+    {
+        if (curBlock.requestedParts[c / 8] & (1 << (c % 8)))
+            return false;
+    }
+    return true;
+}
 static bool blockRxLoop(const uint32_t timeout)
 {
     bool success = false;
     // radioRxEnable(true);
     uint32_t t = clock_time();
-    while (!clock_time_exceed(t, timeout * 1000)) // 300 ms is enough here
+    uint32_t lastPart = 0;
+    while (!clock_time_exceed(t, timeout * 1000))
     {
         int8_t ret = commsRxUnencrypted(inBuffer);
         if (ret > 1)
@@ -315,12 +348,23 @@ static bool blockRxLoop(const uint32_t timeout)
             if (getPacketType(inBuffer) == PKT_BLOCK_PART)
             {
                 struct blockPart *bp = (struct blockPart *)(inBuffer + sizeof(struct MacFrameNormal) + 1);
-                success = processBlockPart(bp);
+                if (processBlockPart(bp))
+                {
+                    success = true;
+                    lastPart = clock_time();
+                    if (blockPartsComplete())
+                        break;
+                }
             }
         }
+        // the AP sends the parts back to back, a gap means it's done and the rest got lost
+        if (lastPart && clock_time_exceed(lastPart, BLOCK_RX_PART_GAP * 1000))
+            break;
     }
     // radioRxEnable(false);
     // radioRxFlush();
+
+    blockRxWindow = blockRxWindowUpdate(blockRxWindow, lastPart && blockPartsComplete(), (lastPart - t) / CLOCK_16M_SYS_TIMER_CLK_1MS);
     return success;
 }
 static struct blockRequestAck *continueToRX()
@@ -363,8 +407,12 @@ static void sendBlockRequest()
 }
 static struct blockRequestAck *performBlockRequest()
 {
-    for (uint8_t c = 0; c < 30; c++)
+    uint16_t gap = blockReqGap;
+    uint32_t start = clock_time();
+    for (uint8_t c = 0; !clock_time_exceed(start, BLOCK_REQ_TIMEOUT * 1000); c++)
     {
+        if (c)
+            gap = blockReqGapBackoff(gap);
         sendBlockRequest();
         uint32_t timeout = clock_time();
         do
@@ -376,7 +424,10 @@ static struct blockRequestAck *performBlockRequest()
                 {
                 case PKT_BLOCK_REQUEST_ACK:
                     if (checkCRC((inBuffer + sizeof(struct MacFrameNormal) + 1), sizeof(struct blockRequestAck)))
+                    {
+                        blockReqGap = blockReqGapLearn(blockReqGap, gap, c);
                         return (struct blockRequestAck *)(inBuffer + sizeof(struct MacFrameNormal) + 1);
+                    }
                     break;
                 case PKT_BLOCK_PART:
                     // block already started while we were waiting for a get block reply
@@ -392,7 +443,7 @@ static struct blockRequestAck *performBlockRequest()
                 }
             }
 
-        } while (!clock_time_exceed(timeout, 50 * 1000));
+        } while (!clock_time_exceed(timeout, gap * 1000));
     }
     return continueToRX();
     // return NULL;
@@ -474,10 +525,10 @@ static void getNumSlots()
         while (1)
             ;
     }
-    else if (nSlots >> 8)
+    else if (nSlots > IMG_SLOTS_MAX)
     {
         printf("eeprom is too big, some will be unused\r\n");
-        imgSlots = 254;
+        imgSlots = IMG_SLOTS_MAX;
     }
     else
         imgSlots = nSlots;
@@ -502,10 +553,15 @@ static uint8_t findSlot(const uint8_t *ver)
 }
 static void eraseUpdateBlock()
 {
+    // the update area overlaps the image slots
+    preErasedSlot = 0xFF;
+    for (uint8_t c = 0; c < imgSlots; c++)
+        slotTable[c].valid = false;
     eepromErase(EEPROM_UPDATA_AREA_START, EEPROM_UPDATE_AREA_LEN);
 }
 static void eraseImageBlock(const uint8_t c)
 {
+    slotTable[c].valid = false;
     eepromErase(getAddressForSlot(c), EEPROM_IMG_EACH);
 }
 static void saveUpdateBlockData(uint8_t blockId)
@@ -524,9 +580,59 @@ static void saveImgBlockData(const uint8_t imgSlot, const uint8_t blockId)
 }
 void drawImageFromEeprom(const uint8_t imgSlot)
 {
+    shownSlot = imgSlot;
     drawImageAtAddress(getAddressForSlot(imgSlot), drawWithLut);
     drawWithLut = 0; // default back to the regular ol' stock/OTP LUT
 }
+static void writeSlotUse(const uint8_t slot)
+{
+    struct slotUseRecord rec;
+    rec.imageId = slotTable[slot].id;
+    rec.lastUse = slotTable[slot].lastUse;
+    rec.hits = slotTable[slot].hits;
+    rec.marker = SLOT_LOG_MARKER;
+    eepromWrite(EEPROM_SLOTLOG_START + slotLogPos * sizeof(struct slotUseRecord), (uint8_t *)&rec, sizeof(struct slotUseRecord));
+    slotLogPos++;
+}
+// log full, start over with one record per slot that has been redrawn
+static void compactSlotLog()
+{
+    eepromErase(EEPROM_SLOTLOG_START, EEPROM_SLOTLOG_LEN);
+    slotLogPos = 0;
+    for (uint8_t c = 0; c < imgSlots; c++)
+    {
+        if (slotTable[c].valid && slotTable[c].hits)
+            writeSlotUse(c);
+    }
+}
+static void markSlotUsed(const uint8_t slot)
+{
+    imgSlotTouch(&slotTable[slot], ++curHighSlotId);
+    if (slotLogPos >= SLOT_LOG_RECORDS)
+        compactSlotLog();
+    else
+        writeSlotUse(slot);
+}
+static uint8_t pickSlot()
+{
+    return imgSlotPick(slotTable, imgSlots, shownSlot, curDataInfo.dataSize ? nextImgSlot : 0xFF, preErasedSlot, nextImgSlot);
+}
+// Erase the slot the next download will go to while the tag is idle, so the
+// download doesn't have to wait for it with the AP on the other end. Only a slot
+// without a valid image, evicting a cached image is left to the download itself
+void preEraseNextSlot()
+{
+    if (imgSlots < 2)
+        return;
+    uint8_t slot = pickSlot();
+    if (slot == preErasedSlot || slot == shownSlot || slotTable[slot].valid)
+        return;
+    uint32_t start = clock_time();
+    eraseImageBlock(slot);
+    preEraseTime = (clock_time() - start) / CLOCK_16M_SYS_TIMER_CLK_1MS;
+    preErasedSlot = slot;
+    printf("Pre-erased image slot %d in %dms\r\n", slot, preEraseTime);
+}
 static uint32_t getHighSlotId()
 {
     uint32_t temp = 0;
@@ -535,7 +641,11 @@ static uint32_t getHighSlotId()
     {
         struct EepromImageHeader *eih = (struct EepromImageHeader *)blockXferBuffer;
         eepromRead(getAddressForSlot(c), eih, sizeof(struct EepromImageHeader));
-        if (!memcmp(&eih->validMarker, &markerValid, 4))
+        slotTable[c].valid = !memcmp(&eih->validMarker, &markerValid, 4);
+        slotTable[c].id = eih->id;
+        slotTable[c].lastUse = eih->id;
+        slotTable[c].hits = 0;
+        if (slotTable[c].valid)
         {
             if (temp < eih->id)
             {
@@ -547,6 +657,36 @@ static uint32_t getHighSlotId()
     printf("found high id=%d in slot %d\r\n", temp, nextImgSlot);
     return temp;
 }
+// apply the usage log to the slot table, returns the newest use stamp
+static uint32_t loadSlotLog()
+{
+    uint32_t high = 0;
+    struct slotUseRecord *rec = (struct slotUseRecord *)blockXferBuffer;
+    eepromRead(EEPROM_SLOTLOG_START, blockXferBuffer, SLOT_LOG_RECORDS * sizeof(struct slotUseRecord));
+    slotLogPos = SLOT_LOG_RECORDS;
+    for (uint16_t r = 0; r < SLOT_LOG_RECORDS; r++)
+    {
+        if (rec[r].marker == 0xFFFF && rec[r].hits == 0xFFFF && rec[r].imageId == 0xFFFFFFFF && rec[r].lastUse == 0xFFFFFFFF)
+        {
+            slotLogPos = r;
+            break;
+        }
+        if (rec[r].marker != SLOT_LOG_MARKER)
+            continue;
+        if (rec[r].lastUse > high)
+            high = rec[r].lastUse;
+        for (uint8_t c = 0; c < imgSlots; c++)
+        {
+            if (slotTable[c].valid && slotTable[c].id == rec[r].imageId)
+            {
+                slotTable[c].lastUse = rec[r].lastUse;
+                slotTable[c].hits = rec[r].hits > 255 ? 255 : rec[r].hits;
+            }
+        }
+    }
+    printf("slot log: %d records\r\n", slotLogPos);
+    return high;
+}
 
 static uint8_t partsThisBlock = 0;
 static uint8_t blockAttempts = 0; // these CAN be local to the function, but for some reason, they won't survive sleep?
@@ -603,7 +743,7 @@ static bool getDataBlock(const uint16_t blockSize)
             printf("Cancelled request\r\n");
             return false;
         }
-        if (ack->pleaseWaitMs)
+        if (ack->pleaseWaitMs > 10)
         { // SLEEP - until the AP is ready with the data
             WaitMs(ack->pleaseWaitMs - 10);
         }
@@ -611,7 +751,7 @@ static bool getDataBlock(const uint16_t blockSize)
         {
             // immediately start with the reception of the block data
         }
-        blockRxLoop(300); // BLOCK RX LOOP - receive a block, until the timeout has passed
+        blockRxLoop(blockRxWindow); // BLOCK RX LOOP - receive a block, until all parts are in or the timeout has passed
 
 #ifdef DEBUGBLOCKS
         printf("RX  %d[", curBlock.blockId);
@@ -631,14 +771,7 @@ static bool getDataBlock(const uint16_t blockSize)
         printf("]\r\n");
 #endif
         // check if we got all the parts we needed, e.g: has the block been completed?
-        bool blockComplete = true;
-        for (uint8_t c = 0; c < partsThisBlock; c++)
-        {
-            if (curBlock.requestedParts[c / 8] & (1 << (c % 8)))
-                blockComplete = false;
-        }
-
-        if (blockComplete)
+        if (blockPartsComplete())
         {
 #ifndef DEBUGBLOCKS
             printf("- COMPLETE\r\n");
@@ -731,13 +864,18 @@ static bool downloadImageDataToEEPROM(const struct AvailDataInfo *avail)
     }
     else
     {
-        // go to the next image slot
-        nextImgSlot++;
-        if (nextImgSlot >= imgSlots)
-            nextImgSlot = 0;
+        // replace the least useful cached image
+        nextImgSlot = pickSlot();
         curImgSlot = nextImgSlot;
         printf("Saving to image slot %d\r\n", curImgSlot);
         drawWithLut = avail->dataTypeArgument;
+        if (curImgSlot == preErasedSlot)
+        {
+            printf("Slot was pre-erased, saved %dms\r\n", preEraseTime);
+            preErasedSlot = 0xFF;
+            goto eraseSuccess;
+        }
+        slotTable[curImgSlot].valid = false;
         uint8_t attempt = 5;
         while (attempt--)
         {
@@ -798,6 +936,10 @@ static bool downloadImageDataToEEPROM(const struct AvailDataInfo *avail)
     printf("Now writing datatype 0x%02X to slot %d\r\n", curDataInfo.dataType, curImgSlot);
 #endif
     eepromWrite(getAddressForSlot(curImgSlot), eih, sizeof(struct EepromImageHeader));
+    slotTable[curImgSlot].id = eih->id;
+    slotTable[curImgSlot].lastUse = eih->id;
+    slotTable[curImgSlot].hits = 0;
+    slotTable[curImgSlot].valid = true;
 
     return true;
 }
@@ -812,6 +954,7 @@ bool processAvailDataInfo(struct AvailDataInfo *avail)
         break;
     case DATATYPE_IMG_RAW_1BPP:
     case DATATYPE_IMG_RAW_2BPP:
+    case DATATYPE_IMG_G5:
         printf("RAW_BPP\r\n");
         // check if this download is currently displayed or active
         if (curDataInfo.dataSize == 0 && !memcmp((const void *)&avail->dataVer, (const void *)&curDataInfo.dataVer, 8))
@@ -830,6 +973,7 @@ bool processAvailDataInfo(struct AvailDataInfo *avail)
             sendXferComplete();
 
             printf("already seen, drawing from eeprom slot %d\r\n", curImgSlot);
+            markSlotUsed(curImgSlot);
 
             // mark as completed and draw from EEPROM
             memcpy(&curDataInfo, (void *)avail, sizeof(struct AvailDataInfo));
@@ -940,4 +1084,16 @@ void initializeProto()
 {
     getNumSlots();
     curHighSlotId = getHighSlotId();
+    uint32_t lastUse = loadSlotLog();
+    if (lastUse > curHighSlotId)
+        curHighSlotId = lastUse;
+    // the image drawn last is the newest use in the log (or the newest download), keep it
+    // out of the eviction after a reboot as well
+    shownSlot = 0xFF;
+    for (uint8_t c = 0; c < imgSlots; c++)
+    {
+        if (slotTable[c].valid && (shownSlot == 0xFF || slotTable[c].lastUse > slotTable[shownSlot].lastUse))
+            shownSlot = c;
+    }
+    printf("shown slot %d\r\n", shownSlot);
 }
@@ -17,5 +17,6 @@ extern struct AvailDataInfo *getShortAvailDataInfo();
 extern void drawImageFromEeprom(const uint8_t imgSlot);
 extern bool processAvailDataInfo(struct AvailDataInfo *avail);
 extern void initializeProto();
+extern void preEraseNextSlot();
 extern uint8_t detectAP(const uint8_t channel);
 void write_ota_firmware_to_flash(void);
@@ -0,0 +1,272 @@
+// Radio time of block downloads with the learned request gap and receive window, against the
+// fixed 50ms request gap and 300ms receive window the tag used before. The AP side follows
+// the C6 AP: the ack asks the tag to wait 30ms, then the requested parts are sent in turn
+// until 42 parts went out, a partial request gets the missing parts more than once
+#include <stdio.h>
+#include <string.h>
+#include "blocktiming.h"
+
+#define BLOCKS 500
+#define PARTS 42             // BLOCK_MAX_PARTS
+#define TRANSFER_ATTEMPTS 5  // BLOCK_TRANSFER_ATTEMPTS
+#define RX_LEAD 10           // the tag sleeps pleaseWaitMs - 10, its receive loop starts that much early
+#define PART_MS 5            // a 99 byte part on air with CSMA
+#define OLD_REQ_GAP 50
+#define OLD_REQ_TRIES 30
+#define OLD_RX_WINDOW 300
+
+struct link
+{
+    const char *name;
+    uint16_t busyMin, busyMax; // ms before the AP gets to a request, again before it starts sending
+    uint16_t slowPercent;      // blocks where the AP starts sending late, after slowMs
+    uint16_t slowMs;
+    uint16_t lossPercent;      // requests, acks and parts lost on air
+};
+
+struct stats
+{
+    uint32_t radioMs; // time spent listening, sleeps excluded
+    uint32_t requests;
+    uint32_t retries; // block requests beyond the first per block
+    uint32_t failed;  // blocks not complete after all attempts
+};
+
+// the same channel for both tags: every random choice is a hash of where it is made
+static uint32_t noise(uint32_t block, uint32_t attempt, uint32_t index, uint32_t kind)
+{
+    uint32_t h = block * 0x9E3779B1u ^ attempt * 0x85EBCA77u ^ index * 0xC2B2AE3Du ^ kind * 0x27D4EB2Fu;
+    h ^= h >> 15;
+    h *= 0x2C1B3C6Du;
+    h ^= h >> 12;
+    h *= 0x297A2D39u;
+    h ^= h >> 15;
+    return h;
+}
+
+static bool lost(const struct link *l, uint32_t block, uint32_t attempt, uint32_t index, uint32_t kind)
+{
+    return noise(block, attempt, index, kind) % 100 < l->lossPercent;
+}
+
+static uint32_t busy(const struct link *l, uint32_t block, uint32_t attempt, uint32_t kind)
+{
+    return l->busyMin + noise(block, attempt, 0, kind) % (l->busyMax - l->busyMin + 1);
+}
+
+struct simTag
+{
+    bool learned;
+    uint16_t rxWindow;
+    uint16_t reqGap;
+    uint8_t missing[PARTS];
+    struct stats st;
+};
+
+// block request until acked, returns the ms from the first request to the ack, 0 on timeout.
+// The AP gets to the requests when it is done with what it was busy with, each request that
+// arrives gets its own ack
+static uint32_t simRequest(struct simTag *tag, const struct link *l, uint32_t block, uint32_t attempt)
+{
+    const uint32_t apFree = busy(l, block, attempt, 1);
+    uint32_t gap = tag->learned ? tag->reqGap : OLD_REQ_GAP;
+    uint32_t sent = 0;
+    uint32_t ackAt = UINT32_MAX;
+    for (uint32_t c = 0;; c++)
+    {
+        if (tag->learned ? sent >= BLOCK_REQ_TIMEOUT : c >= OLD_REQ_TRIES)
+            break;
+        if (c && tag->learned)
+            gap = blockReqGapBackoff(gap);
+        tag->st.requests++;
+        if (!lost(l, block, attempt, c, 2) && !lost(l, block, attempt, c, 3))
+        {
+            const uint32_t at = (sent > apFree ? sent : apFree) + 2;
+            if (at < ackAt)
+                ackAt = at;
+        }
+        if (ackAt < sent + gap)
+        {
+            if (tag->learned)
+                tag->reqGap = blockReqGapLearn(tag->reqGap, gap, c);
+            tag->st.radioMs += ackAt;
+            return ackAt;
+        }
+        sent += gap;
+    }
+    tag->st.radioMs += sent;
+    return 0;
+}
+
+static bool partsComplete(const struct simTag *tag)
+{
+    for (uint8_t c = 0; c < PARTS; c++)
+    {
+        if (tag->missing[c])
+            return false;
+    }
+    return true;
+}
+
+// one receive window, returns true when all parts are in
+static bool simReceive(struct simTag *tag, const struct link *l, uint32_t block, uint32_t attempt, bool acked)
+{
+    // the AP may be late on top of the lead
+    uint32_t start = RX_LEAD + busy(l, block, attempt, 4);
+    if (noise(block, attempt, 0, 5) % 100 < l->slowPercent)
+        start += l->slowMs;
+
+    uint8_t requested[PARTS];
+    uint8_t count = 0;
+    for (uint8_t c = 0; c < PARTS; c++)
+    {
+        if (tag->missing[c])
+            requested[count++] = c;
+    }
+    const uint32_t window = tag->learned ? tag->rxWindow : OLD_RX_WINDOW;
+    uint32_t end = window;
+    uint32_t lastPart = 0;
+    for (uint32_t i = 0; acked && i < PARTS; i++)
+    {
+        const uint32_t at = start + (i + 1) * PART_MS;
+        if (at >= end)
+            break;
+        if (lost(l, block, attempt, i, 6))
+            continue;
+        tag->missing[requested[i % count]] = 0;
+        lastPart = at;
+        // the learned window also ends when all parts are in or the AP stopped sending
+        if (tag->learned)
+        {
+            if (partsComplete(tag))
+            {
+                end = at;
+                break;
+            }
+            if (lastPart + BLOCK_RX_PART_GAP < window)
+                end = lastPart + BLOCK_RX_PART_GAP;
+        }
+    }
+    tag->st.radioMs += end;
+    const bool complete = partsComplete(tag);
+    if (tag->learned)
+        tag->rxWindow = blockRxWindowUpdate(tag->rxWindow, lastPart && complete, lastPart);
+    return complete;
+}
+
+static void simBlock(struct simTag *tag, const struct link *l, uint32_t block)
+{
+    memset(tag->missing, 1, sizeof(tag->missing));
+    for (uint32_t attempt = 0; attempt < TRANSFER_ATTEMPTS; attempt++)
+    {
+        if (attempt)
+            tag->st.retries++;
+        const bool acked = simRequest(tag, l, block, attempt) != 0;
+        if (simReceive(tag, l, block, attempt, acked))
+            return;
+    }
+    tag->st.failed++;
+}
+
+static void simInit(struct simTag *tag, bool learned)
+{
+    memset(tag, 0, sizeof(*tag));
+    tag->learned = learned;
+    tag->rxWindow = BLOCK_RX_WINDOW_MAX;
+    tag->reqGap = BLOCK_REQ_GAP_START;
+}
+
+static int failures = 0;
+
+static void runLink(const struct link *l)
+{
+    struct simTag fixed, learned;
+    simInit(&fixed, false);
+    simInit(&learned, true);
+    for (uint32_t b = 0; b < BLOCKS; b++)
+    {
+        simBlock(&fixed, l, b);
+        simBlock(&learned, l, b);
+    }
+    printf("%-22s fixed %6u ms radio %4u req %3u retries %2u failed, learned %6u ms radio %4u req %3u retries %2u failed\n",
+           l->name, fixed.st.radioMs, fixed.st.requests, fixed.st.retries, fixed.st.failed,
+           learned.st.radioMs, learned.st.requests, learned.st.retries, learned.st.failed);
+    if (learned.st.radioMs > fixed.st.radioMs)
+    {
+        printf("FAIL: %s needs more radio time with the learned timing\n", l->name);
+        failures++;
+    }
+    if (learned.st.failed > fixed.st.failed)
+    {
+        printf("FAIL: %s loses more blocks with the learned timing\n", l->name);
+        failures++;
+    }
+}
+
+// the window follows the blocks in, shrinks after quick blocks and is back at the maximum
+// after a lost block, the gap stays within its limits
+static void checkLimits()
+{
+    uint16_t window = BLOCK_RX_WINDOW_MAX;
+    for (int i = 0; i < 50; i++)
+        window = blockRxWindowUpdate(window, true, 5);
+    if (window != BLOCK_RX_WINDOW_MIN)
+    {
+        printf("FAIL: window settled at %u after quick blocks, expected %u\n", window, BLOCK_RX_WINDOW_MIN);
+        failures++;
+    }
+    window = blockRxWindowUpdate(blockRxWindowUpdate(window, false, 0), false, 0);
+    if (window != 4 * BLOCK_RX_WINDOW_MIN)
+    {
+        printf("FAIL: window %u after two lost blocks, expected %u\n", window, 4 * BLOCK_RX_WINDOW_MIN);
+        failures++;
+    }
+    window = blockRxWindowUpdate(window, false, 0);
+    if (window != BLOCK_RX_WINDOW_MAX)
+    {
+        printf("FAIL: window %u after three lost blocks, expected %u\n", window, BLOCK_RX_WINDOW_MAX);
+        failures++;
+    }
+    if (blockRxWindowUpdate(BLOCK_RX_WINDOW_MAX, true, 1000) != BLOCK_RX_WINDOW_MAX)
+    {
+        printf("FAIL: window grew past the maximum\n");
+        failures++;
+    }
+
+    uint16_t gap = BLOCK_REQ_GAP_START;
+    for (int i = 0; i < 10; i++)
+        gap = blockReqGapBackoff(gap);
+    if (gap != BLOCK_REQ_GAP_MAX)
+    {
+        printf("FAIL: backoff reached %u, expected %u\n", gap, BLOCK_REQ_GAP_MAX);
+        failures++;
+    }
+    uint16_t learned = BLOCK_REQ_GAP_START;
+    for (int i = 0; i < 20; i++)
+        learned = blockReqGapLearn(learned, learned, false);
+    if (learned != BLOCK_REQ_GAP_MIN)
+    {
+        printf("FAIL: gap settled at %u after quick acks, expected %u\n", learned, BLOCK_REQ_GAP_MIN);
+        failures++;
+    }
+    if (blockReqGapLearn(learned, 160, true) != 160)
+    {
+        printf("FAIL: gap of a retried request not kept\n");
+        failures++;
+    }
+}
+
+int main(void)
+{
+    static const struct link links[] = {
+        {"quiet AP", 1, 5, 0, 0, 0},
+        {"lossy link", 1, 5, 0, 0, 10},
+        {"busy AP", 20, 150, 0, 0, 2},
+        {"busy AP, lossy link", 20, 150, 0, 0, 10},
+        {"sometimes late start", 1, 5, 10, 150, 2},
+    };
+    checkLimits();
+    for (uint8_t i = 0; i < sizeof(links) / sizeof(links[0]); i++)
+        runLink(&links[i]);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,174 @@
+// Images compressed with the AP's G5 encoder (ESP32_AP-Flasher/src/g5) and decoded with the
+// streaming decoder of the tag, which reads the data from flash through a 256 byte window
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "g5dec.h"
+#include "../../../ESP32_AP-Flasher/src/g5/g5enc.inl"
+
+// the image slot the decoder reads from, starts at an odd address like after the headers
+#define FLASH_SIZE 0x20000
+#define FLASH_OFFSET 0x1013
+
+static uint8_t flash[FLASH_SIZE];
+
+void eepromRead(uint32_t addr, uint8_t *dst, uint32_t len)
+{
+    if (addr + len > FLASH_SIZE)
+    {
+        printf("FAIL: read of %u bytes at 0x%X past the end of flash\n", len, addr);
+        exit(1);
+    }
+    memcpy(dst, flash + addr, len);
+}
+
+enum pattern
+{
+    PATTERN_TEXT,
+    PATTERN_DITHER,
+    PATTERN_NOISE,
+};
+
+static const char *patternNames[] = {"text", "dither", "noise"};
+
+static void makeImage(uint8_t *image, int width, int lines, enum pattern p)
+{
+    const int pitch = width / 8;
+    uint32_t seed = width * 31 + lines + p;
+    for (int y = 0; y < lines; y++)
+    {
+        for (int x = 0; x < pitch; x++)
+        {
+            seed = seed * 1103515245 + 12345;
+            uint8_t b;
+            switch (p)
+            {
+            case PATTERN_TEXT:
+                // white with dark blocks, runs shared between neighbouring lines
+                b = ((x / 3 + y / 12) % 4 == 0 && y % 12 < 9) ? (uint8_t)(0x18 << (y % 3)) : 0xFF;
+                break;
+            case PATTERN_DITHER:
+                b = (y & 1) ? 0xAA : 0x55;
+                break;
+            default:
+                b = seed >> 16;
+                break;
+            }
+            image[y * pitch + x] = b;
+        }
+    }
+}
+
+// encode like the AP does and store the result in flash, returns the compressed size or 0
+static uint32_t encode(const uint8_t *image, int width, int lines)
+{
+    // the encoder writes 32 bit words, its buffer has to be aligned like the AP's malloc
+    static uint32_t out[(FLASH_SIZE - FLASH_OFFSET) / 4];
+    G5ENCIMAGE enc = {0};
+    int rc = g5_encode_init(&enc, width, lines, (uint8_t *)out, sizeof(out));
+    for (int y = 0; y < lines && rc == G5_SUCCESS; y++)
+        rc = g5_encode_encodeLine(&enc, (uint8_t *)image + y * (width / 8));
+    g5_encode_free(&enc);
+    if (rc != G5_ENCODE_COMPLETE)
+        return 0;
+    const uint32_t size = g5_encode_getOutSize(&enc);
+    memset(flash, 0xFF, sizeof(flash));
+    memcpy(flash + FLASH_OFFSET, out, size);
+    return size;
+}
+
+static int failures = 0;
+
+static void roundTrip(int width, int lines, enum pattern p)
+{
+    const int pitch = width / 8;
+    uint8_t *image = malloc(pitch * lines);
+    uint8_t line[G5_MAX_LINE_WIDTH / 8 + 1];
+    makeImage(image, width, lines, p);
+    const uint32_t size = encode(image, width, lines);
+    if (size == 0)
+    {
+        printf("FAIL: %dx%d %s didn't encode\n", width, lines, patternNames[p]);
+        failures++;
+        free(image);
+        return;
+    }
+    if (!g5DecodeBegin(FLASH_OFFSET, size, width, lines))
+    {
+        printf("FAIL: %dx%d %s rejected by g5DecodeBegin\n", width, lines, patternNames[p]);
+        failures++;
+        free(image);
+        return;
+    }
+    for (int y = 0; y < lines; y++)
+    {
+        if (!g5DecodeLine(line) || memcmp(line, image + y * pitch, pitch))
+        {
+            printf("FAIL: %dx%d %s differs at line %d\n", width, lines, patternNames[p], y);
+            failures++;
+            free(image);
+            return;
+        }
+    }
+    if (g5DecodeLine(line))
+    {
+        printf("FAIL: %dx%d %s decodes past the last line\n", width, lines, patternNames[p]);
+        failures++;
+    }
+    free(image);
+}
+
+// broken data must end in a false return, never a read or write outside the buffers
+static void corrupt(int width, int lines)
+{
+    const int pitch = width / 8;
+    uint8_t *image = malloc(pitch * lines);
+    uint8_t line[G5_MAX_LINE_WIDTH / 8 + 1];
+    makeImage(image, width, lines, PATTERN_TEXT);
+    uint32_t seed = 777;
+    for (int i = 0; i < 200; i++)
+    {
+        const uint32_t size = encode(image, width, lines);
+        for (int c = 0; c < 8; c++)
+        {
+            seed = seed * 1103515245 + 12345;
+            flash[FLASH_OFFSET + (seed >> 8) % size] ^= 1 << ((seed >> 4) & 7);
+        }
+        // a truncated stream as well now and then
+        const uint32_t used = (i % 4 == 0) ? size / 2 : size;
+        if (!g5DecodeBegin(FLASH_OFFSET, used, width, lines))
+            continue;
+        for (int y = 0; y < lines; y++)
+        {
+            if (!g5DecodeLine(line))
+                break;
+        }
+    }
+    free(image);
+}
+
+static void checkBegin(void)
+{
+    if (g5DecodeBegin(FLASH_OFFSET, 100, G5_MAX_LINE_WIDTH + 8, 10) || g5DecodeBegin(FLASH_OFFSET, 100, 0, 10) ||
+        g5DecodeBegin(FLASH_OFFSET, 0, 184, 10))
+    {
+        printf("FAIL: g5DecodeBegin accepted a bad width or size\n");
+        failures++;
+    }
+}
+
+int main(void)
+{
+    // the tag panel, both planes in one stream as the AP sends it, and the other widths the decoder takes
+    static const int widths[] = {184, 128, 152, 200, 296, 400};
+    checkBegin();
+    for (int p = PATTERN_TEXT; p <= PATTERN_NOISE; p++)
+    {
+        roundTrip(184, 384 * 2, p);
+        for (unsigned w = 0; w < sizeof(widths) / sizeof(widths[0]); w++)
+            roundTrip(widths[w], p == PATTERN_NOISE ? 40 : 300, p);
+    }
+    corrupt(184, 384);
+    printf("g5 round trips %s\n", failures ? "failed" : "ok");
+    return failures ? 1 : 0;
+}
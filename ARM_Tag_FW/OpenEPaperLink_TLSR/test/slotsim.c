@@ -0,0 +1,181 @@
+// Download counts of the image slot policy under a few display schedules, against the
+// round robin slot choice the tag used before. Slot count as on the TLSR tags (4)
+#include <stdio.h>
+#include <string.h>
+#include "imgslots.h"
+
+#define SLOTS 4
+
+struct simTag
+{
+    struct imgSlotInfo table[SLOTS];
+    uint32_t image[SLOTS]; // image in each slot, stands in for the dataVer
+    uint8_t shown;
+    uint8_t next;
+    uint32_t high;
+    uint32_t downloads;
+    bool lru;
+};
+
+static void simInit(struct simTag *tag, bool lru)
+{
+    memset(tag, 0, sizeof(*tag));
+    tag->shown = 0xFF;
+    tag->lru = lru;
+}
+
+// what the tag does when the AP announces an image: redraw from a slot or download it
+static void simShow(struct simTag *tag, uint32_t image)
+{
+    // the image on screen is only acknowledged
+    if (tag->shown != 0xFF && tag->image[tag->shown] == image)
+        return;
+    for (uint8_t c = 0; c < SLOTS; c++)
+    {
+        if (tag->table[c].valid && tag->image[c] == image)
+        {
+            imgSlotTouch(&tag->table[c], ++tag->high);
+            tag->shown = c;
+            return;
+        }
+    }
+    uint8_t slot;
+    if (tag->lru)
+    {
+        slot = imgSlotPick(tag->table, SLOTS, tag->shown, 0xFF, 0xFF, tag->next);
+    }
+    else
+    {
+        slot = tag->next + 1;
+        if (slot >= SLOTS)
+            slot = 0;
+    }
+    tag->next = slot;
+    tag->table[slot].id = ++tag->high;
+    tag->table[slot].lastUse = tag->high;
+    tag->table[slot].hits = 0;
+    tag->table[slot].valid = true;
+    tag->image[slot] = image;
+    tag->shown = slot;
+    tag->downloads++;
+}
+
+// hour h of the schedule, returns the image shown, one-off images get ids from 1000 up
+typedef uint32_t (*schedule_t)(uint32_t h);
+
+// promo and price screen alternating every hour, an announcement every 6 hours
+static uint32_t promoPrice(uint32_t h)
+{
+    if (h % 6 == 5)
+        return 1000 + h;
+    return h & 1;
+}
+
+// new content every 6 hours in the day, the same "closed" screen every night
+static uint32_t nightlyClosed(uint32_t h)
+{
+    const uint32_t hour = h % 24;
+    if (hour < 8 || hour >= 20)
+        return 0;
+    return 1000 + h / 6;
+}
+
+// the same with new content every 2 hours, more one-off images between two nights than
+// there are slots, so the closed screen is evicted before it is shown again
+static uint32_t nightlyClosedBusy(uint32_t h)
+{
+    const uint32_t hour = h % 24;
+    if (hour < 8 || hour >= 20)
+        return 0;
+    return 1000 + h / 2;
+}
+
+// two screens in turn, the price on the second one changes once a day
+static uint32_t dailyPrice(uint32_t h)
+{
+    if (h & 1)
+        return 1000 + h / 24;
+    return 0;
+}
+
+// three screens in turn with a weather image that changes every 3 hours
+static uint32_t rotationWeather(uint32_t h)
+{
+    if (h % 4 == 3)
+        return 1000 + h / 3;
+    return h % 4;
+}
+
+// five screens in turn, more than fit, every policy downloads every time
+static uint32_t tooMany(uint32_t h)
+{
+    return h % 5;
+}
+
+static int failures = 0;
+
+static void runSchedule(const char *name, schedule_t schedule)
+{
+    struct simTag roundRobin, lru;
+    simInit(&roundRobin, false);
+    simInit(&lru, true);
+    const uint32_t hours = 30 * 24;
+    for (uint32_t h = 0; h < hours; h++)
+    {
+        simShow(&roundRobin, schedule(h));
+        simShow(&lru, schedule(h));
+    }
+    printf("%-18s %4u hours, round robin %4u downloads, lru %4u downloads\n", name, hours, roundRobin.downloads, lru.downloads);
+    if (lru.downloads > roundRobin.downloads)
+    {
+        printf("FAIL: %s needs more downloads with lru\n", name);
+        failures++;
+    }
+}
+
+// the slot on screen and a resumable download are never picked, empty slots go first
+static void checkPick()
+{
+    struct imgSlotInfo table[SLOTS] = {0};
+    for (uint8_t c = 0; c < SLOTS; c++)
+    {
+        table[c].valid = true;
+        table[c].id = table[c].lastUse = c + 1;
+    }
+    table[1].hits = 3;
+    const struct
+    {
+        uint8_t shown, resume, expect;
+    } cases[] = {
+        {0xFF, 0xFF, 0}, // oldest without redraws
+        {0, 0xFF, 2},    // oldest is on screen
+        {0, 2, 3},       // next one is being resumed
+    };
+    for (uint8_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        const uint8_t slot = imgSlotPick(table, SLOTS, cases[i].shown, cases[i].resume, 0xFF, 0xFF);
+        if (slot != cases[i].expect)
+        {
+            printf("FAIL: pick case %d gave slot %d, expected %d\n", i, slot, cases[i].expect);
+            failures++;
+        }
+    }
+    table[3].valid = false;
+    if (imgSlotPick(table, SLOTS, 0xFF, 0xFF, 0xFF, 0xFF) != 3)
+    {
+        printf("FAIL: empty slot not picked first\n");
+        failures++;
+    }
+}
+
+int main(void)
+{
+    checkPick();
+    runSchedule("promo/price", promoPrice);
+    runSchedule("nightly closed", nightlyClosed);
+    runSchedule("nightly, busy day", nightlyClosedBusy);
+    runSchedule("daily price", dailyPrice);
+    runSchedule("rotation+weather", rotationWeather);
+    runSchedule("5 screens", tooMany);
+    return failures ? 1 : 0;
+}
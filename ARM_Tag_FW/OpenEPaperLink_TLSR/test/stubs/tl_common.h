@@ -0,0 +1,2 @@
+// Host stand-in for the Telink SDK header, the code under test only needs the C library
+#pragma once
@@ -212,9 +212,27 @@ int CheckSubGigState(void);
 void SubGig_CC1101_reset(void);
 void SubGig_CC1101_SetConfig(const RfSetting *pConfig);
 
+// Set by the GDO2 interrupt when the RX FIFO reaches the threshold
+static volatile bool gRxThreshold;
+
 static void IRAM_ATTR gpio_isr_handler(void *arg)
 {
+   if(CC1101_TxEventFromISR()) {
+      return;
+   }
    gSubGigData.RxAvailable = true;
+   radioPostRxEventFromISR(RX_RADIO_SUBGHZ,NULL);
+}
+
+static void IRAM_ATTR gdo2_isr_handler(void *arg)
+{
+   if(CC1101_TxEventFromISR()) {
+      return;
+   }
+   if(gpio_get_level(CONFIG_GDO2_GPIO) == 1) {
+      gRxThreshold = true;
+      radioPostRxEventFromISR(RX_RADIO_SUBGHZ,NULL);
+   }
 }
 
 // return SUBGIG_ERR_NONE aka ESP_OK aka 0 if CC1101 is detected and all is good
@@ -270,8 +288,9 @@ SubGigErr SubGig_radio_init(uint8_t ch)
          break;
       }
 
-   // Configure GDO2, interrupts disabled
-      io_conf.intr_type = GPIO_INTR_DISABLE;
+   // Configure GDO2, interrupt on both edges: falling for TX FIFO
+   // refills, rising to drain the RX FIFO
+      io_conf.intr_type = GPIO_INTR_ANYEDGE;
       io_conf.pin_bit_mask = 1ULL<<CONFIG_GDO2_GPIO;
       if((Err = gpio_config(&io_conf)) != 0) {
          ErrLine = __LINE__;
@@ -290,6 +309,12 @@ SubGigErr SubGig_radio_init(uint8_t ch)
          ErrLine = __LINE__;
          break;
       }
+      Err = gpio_isr_handler_add(CONFIG_GDO2_GPIO,gdo2_isr_handler,
+                                 (void*) CONFIG_GDO2_GPIO);
+      if(Err != 0) {
+         ErrLine = __LINE__;
+         break;
+      }
       // Check Chip ID
       if(!CC1101_Present()) {
          LOGE("CC1101 not detected\n");
@@ -422,6 +447,7 @@ int8_t SubGig_commsRxUnencrypted(uint8_t *data)
 {
    int RxBytes;
    int8_t Ret = 0;
+   bool Draining = false;
 
    do {
       if(CheckSubGigState() != SUBGIG_ERR_NONE) {
@@ -433,7 +459,14 @@ int8_t SubGig_commsRxUnencrypted(uint8_t *data)
       }
       CC1101_logState();
 
-      if(!gSubGigData.RxAvailable && gpio_get_level(CONFIG_GDO0_GPIO) == 1) {
+      if(gRxThreshold) {
+         gRxThreshold = false;
+         CC1101_RxDrain();
+         Draining = true;
+      }
+
+   // GDO0 is expected to be high while a packet is being drained
+      if(!Draining && !gSubGigData.RxAvailable && gpio_get_level(CONFIG_GDO0_GPIO) == 1) {
       // Did we miss an interrupt?
          if(gpio_get_level(CONFIG_GDO0_GPIO) == 1) {
          // Yup!
@@ -43,6 +43,7 @@
 #include <string.h>
 
 #include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "freertos/task.h"
 
 #include <driver/spi_master.h>
@@ -135,6 +136,10 @@ enum RFSTATE {
 
 // IOCFG2 GDO2: high when TX FIFO at or above the TX FIFO threshold
 #define CC1101_DEFVAL_IOCFG2           0x02
+#define CC1101_GDO2_TX_THRESHOLD       0x02
+// IOCFG2 GDO2: high when RX FIFO at or above the RX FIFO threshold,
+// used to drain the FIFO during reception
+#define CC1101_GDO2_RX_THRESHOLD       0x00
 
 // IOCFG1 GDO1: High impedance (3-state)
 #define CC1101_DEFVAL_IOCFG1           0x2E
@@ -144,7 +149,7 @@ enum RFSTATE {
 // In TX mode the pin will go low if the TX FIFO underflows.
 #define CC1101_DEFVAL_IOCFG0           0x06
 
-// Threshold = 32 bytes (1/2 of FIFO len)
+// Threshold = 33 bytes TX, 32 bytes RX (1/2 of FIFO len)
 #define CC1101_DEFVAL_FIFOTHR          0x07
 #define CC1101_DEFVAL_RCCTRL1          0x41
 #define CC1101_DEFVAL_RCCTRL0          0x00
@@ -168,7 +173,13 @@ RfSetting gFixedConfig[] = {
    {0xff,0},
 };
 
+#define CC1101_FIFO_SIZE               64
+
+// Give up waiting for a GDO edge during TX after this many milliseconds
+#define TX_GDO_TIMEOUT                 50
+
 void CC1101_readBurstReg(uint8_t *buffer,uint8_t regAddr,uint8_t len);
+void CC1101_writeBurstReg(const uint8_t *buffer,uint8_t regAddr,uint8_t len);
 void CC1101_cmdStrobe(uint8_t cmd);
 void CC1101_wakeUp(void);
 uint8_t CC1101_readReg(uint8_t regAddr, uint8_t regType);
@@ -179,11 +190,32 @@ static void setIdleState(void);
 
 spi_device_handle_t gSpiHndl;
 
+// Header and data of a register or FIFO access, sent as one SPI transaction
+static DMA_ATTR uint8_t gSpiTx[CC1101_FIFO_SIZE + 1];
+static DMA_ATTR uint8_t gSpiRx[CC1101_FIFO_SIZE + 1];
+
+// Woken by the GDO0/GDO2 edges while CC1101_Tx is running
+static SemaphoreHandle_t gTxWake;
+static volatile bool gTxActive;
+
+// Packet being received, moved out of the RX FIFO as it fills up so
+// packets can be longer than the FIFO
+static uint8_t gRxPkt[256];
+static int gRxPktLen = -1;    // -1: length byte not read yet
+static int gRxPktGot;
+
 #define readConfigReg(regAddr)   CC1101_readReg(regAddr, CC1101_CONFIG_REGISTER)
 #define readStatusReg(regAddr)   CC1101_readReg(regAddr, CC1101_STATUS_REGISTER)
 #define flushRxFifo()            CC1101_cmdStrobe(CC1101_SFRX)
 #define flushTxFifo()            CC1101_cmdStrobe(CC1101_SFTX)
 
+// Forget a partly drained packet, called whenever the radio leaves RX
+static void resetRxPkt(void)
+{
+   gRxPktLen = -1;
+   gRxPktGot = 0;
+}
+
 const char *RegNamesCC1101[] = {
    "IOCFG2",   // 0x00 GDO2 output pin configuration
    "IOCFG1",   // 0x01 GDO1 output pin configuration
@@ -318,6 +350,34 @@ bool spi_read_byte(uint8_t* Datain,uint8_t* Dataout,size_t DataLength)
    return true;
 }
 
+// Send a header byte followed by Len data bytes in one transaction,
+// Out and In may be NULL
+static void spi_burst(uint8_t Header,const uint8_t *Out,uint8_t *In,uint8_t Len)
+{
+   spi_transaction_t SPITransaction;
+
+   gSpiTx[0] = Header;
+   if(Out != NULL) {
+      memcpy(&gSpiTx[1],Out,Len);
+   }
+   else {
+      memset(&gSpiTx[1],0,Len);
+   }
+   memset(&SPITransaction,0,sizeof(spi_transaction_t));
+   SPITransaction.length = (Len + 1) * 8;
+   SPITransaction.tx_buffer = gSpiTx;
+   SPITransaction.rx_buffer = gSpiRx;
+
+   cc1101_Select();
+   wait_Miso();
+   spi_device_transmit(gSpiHndl,&SPITransaction);
+   cc1101_Deselect();
+
+   if(In != NULL) {
+      memcpy(In,&gSpiRx[1],Len);
+   }
+}
+
 uint8_t spi_transfer(uint8_t address)
 {
    uint8_t datain[1];
@@ -364,11 +424,7 @@ void CC1101_writeReg(uint8_t regAddr, uint8_t value)
    else {
       LOGV("0x%x -> 0x%x\n",value,regAddr);
    }
-   cc1101_Select();                                // Select CC1101
-   wait_Miso();                                       // Wait until MISO goes low
-   spi_transfer(regAddr);                       // Send register address
-   spi_transfer(value);                         // Send value
-   cc1101_Deselect();                              // Deselect CC1101
+   spi_burst(regAddr,&value,NULL,1);
 }
 
 
@@ -381,10 +437,7 @@ void CC1101_writeReg(uint8_t regAddr, uint8_t value)
  */         
 void CC1101_cmdStrobe(uint8_t cmd) 
 {
-   cc1101_Select();
-   wait_Miso();
-   spi_transfer(cmd);
-   cc1101_Deselect();
+   spi_burst(cmd,NULL,NULL,0);
 }
 
 /**
@@ -400,14 +453,9 @@ void CC1101_cmdStrobe(uint8_t cmd)
  */
 uint8_t CC1101_readReg(uint8_t regAddr,uint8_t regType)
 {
-   uint8_t addr, val;
+   uint8_t val;
 
-   addr = regAddr | regType;
-   cc1101_Select();
-   wait_Miso();
-   spi_transfer(addr);
-   val = spi_transfer(0x00);  // Read result
-   cc1101_Deselect();
+   spi_burst(regAddr | regType,NULL,&val,1);
 
    return val;
 }
@@ -423,16 +471,31 @@ uint8_t CC1101_readReg(uint8_t regAddr,uint8_t regType)
  */
 void CC1101_readBurstReg(uint8_t *buffer,uint8_t regAddr,uint8_t len) 
 {
-   uint8_t addr, i;
+   while(len > 0) {
+      uint8_t Chunk = len > CC1101_FIFO_SIZE ? CC1101_FIFO_SIZE : len;
+      spi_burst(regAddr | READ_BURST,NULL,buffer,Chunk);
+      buffer += Chunk;
+      len -= Chunk;
+   }
+}
 
-   addr = regAddr | READ_BURST;
-   cc1101_Select();
-   wait_Miso();
-   spi_transfer(addr);     // Send register address
-   for(i = 0; i < len; i++) {
-      buffer[i] = spi_transfer(0x00);        // Read result uint8_t by uint8_t
+/**
+ * CC1101_writeBurstReg
+ * 
+ * Write burst data to CC1101 via SPI
+ * 
+ * @param buffer Data to write
+ * @param regAddr Register address
+ * @param len Data length
+ */
+void CC1101_writeBurstReg(const uint8_t *buffer,uint8_t regAddr,uint8_t len) 
+{
+   while(len > 0) {
+      uint8_t Chunk = len > CC1101_FIFO_SIZE ? CC1101_FIFO_SIZE : len;
+      spi_burst(regAddr | WRITE_BURST,buffer,NULL,Chunk);
+      buffer += Chunk;
+      len -= Chunk;
    }
-   cc1101_Deselect();
 }
 
 /**
@@ -456,6 +519,7 @@ void CC1101_reset(void)
    spi_transfer(CC1101_SRES); // Send reset command strobe
    wait_Miso();
    cc1101_Deselect();
+   resetRxPkt();
 }
 
 
@@ -466,6 +530,11 @@ void CC1101_reset(void)
  */
 void CC1101_setRxState(void)
 {
+// Start from an empty RX FIFO, SFRX is only allowed in IDLE
+   setIdleState();
+   flushRxFifo();
+   resetRxPkt();
+   CC1101_writeReg(CC1101_IOCFG2,CC1101_GDO2_RX_THRESHOLD);
    CC1101_cmdStrobe(CC1101_SRX);
    gRfState = RFSTATE_RX;
 }
@@ -504,40 +573,80 @@ void CC1101_DumpRegs()
 }
 
 
+// Called from the GDO0 and GDO2 interrupt handlers, returns true when
+// the edge belongs to a transmission in progress
+bool IRAM_ATTR CC1101_TxEventFromISR(void)
+{
+   BaseType_t Woken = pdFALSE;
+
+   if(!gTxActive) {
+      return false;
+   }
+   xSemaphoreGiveFromISR(gTxWake,&Woken);
+   if(Woken) {
+      portYIELD_FROM_ISR();
+   }
+   return true;
+}
+
+// Sleep until a GDO pin is at Level, woken by the pin's edge interrupt
+static bool waitGdoLevel(gpio_num_t Gpio,int Level)
+{
+   uint32_t Start = getMillis();
+
+   while(gpio_get_level(Gpio) != Level) {
+      if((getMillis() - Start) >= TX_GDO_TIMEOUT) {
+         return false;
+      }
+      xSemaphoreTake(gTxWake,pdMS_TO_TICKS(TX_GDO_TIMEOUT));
+   }
+   return true;
+}
+
 bool CC1101_Tx(uint8_t *TxData)
 {
    bool Ret = false;
    int ErrLine = 0;
-   spi_transaction_t SPITransaction;
    uint8_t BytesSent = 0;
    uint8_t Bytes2Send;
    uint8_t len;
    uint8_t CanSend;
-   esp_err_t Err;
+   uint32_t Start;
+
+   if(gTxWake == NULL) {
+      gTxWake = xSemaphoreCreateBinary();
+   }
 
    do {
    // The first byte in the buffer is the number of data bytes to send,
    // we also need to send the first byte
       len = 1 + *TxData;
-      memset(&SPITransaction,0,sizeof(spi_transaction_t));
-      SPITransaction.tx_buffer = TxData;
 
       setIdleState();
+   // Anything CC1101_RxDrain moved out of the RX FIFO is lost now
+      flushRxFifo();
+      resetRxPkt();
       flushTxFifo();
+      CC1101_writeReg(CC1101_IOCFG2,CC1101_GDO2_TX_THRESHOLD);
+   // Drop an edge left over from the previous packet
+      xSemaphoreTake(gTxWake,0);
+      gTxActive = true;
 
       while(BytesSent < len) {
          Bytes2Send = len - BytesSent;
          if(BytesSent == 0) {
          // First chunk, the FIFO is empty and can take 64 bytes
-            if(Bytes2Send > 64) {
-               Bytes2Send = 64;
+            if(Bytes2Send > CC1101_FIFO_SIZE) {
+               Bytes2Send = CC1101_FIFO_SIZE;
             }
          }
          else {
-         // Not the first chunk, we can only send FIFO_THRESHOLD bytes 
-         // and only when GDO2 says we can
-            if(getGDO2state()) {
-               wait_GDO2_low();
+         // Not the first chunk, sleep until GDO2 says the FIFO has
+         // drained below the threshold
+            if(!waitGdoLevel(CONFIG_GDO2_GPIO,0)) {
+               LOGE("GDO2 timeout, BytesSent %d\n",BytesSent);
+               ErrLine = __LINE__;
+               break;
             }
             CanSend = readStatusReg(CC1101_TXBYTES);
             if(CanSend & 0x80) {
@@ -545,7 +654,7 @@ bool CC1101_Tx(uint8_t *TxData)
                ErrLine = __LINE__;
                break;
             }
-            CanSend = 64 - CanSend;
+            CanSend = CC1101_FIFO_SIZE - CanSend;
             if(CanSend == 0) {
                LOGE("CanSend == 0, GDO2 problem\n");
                ErrLine = __LINE__;
@@ -556,36 +665,43 @@ bool CC1101_Tx(uint8_t *TxData)
                Bytes2Send = CanSend;
             }
          }
-         SPITransaction.length = Bytes2Send * 8;
-         SPITransaction.rxlength = 0;
-         cc1101_Select();
-         wait_Miso();
-         spi_transfer(CC1101_TXFIFO | WRITE_BURST);
-         if((Err = spi_device_transmit(gSpiHndl,&SPITransaction)) != ESP_OK) {
-            ErrLine = __LINE__;
-            LOGE("spi_device_transmit failed %d\n",Err);
-            break;
-         }
-         cc1101_Deselect();
+         CC1101_writeBurstReg(&TxData[BytesSent],CC1101_TXFIFO,Bytes2Send);
 //       LOG("Sending %d bytes\n",Bytes2Send);
          if(BytesSent == 0) {
          // some or all of the tx data has been written to the FIFO, 
          // start transmitting
 //          LOG("Start tx\n");
             CC1101_setTxState();
-         // Wait for the sync word to be transmitted
-            wait_GDO0_high();
+         // Wait for the sync word to be transmitted, there's no interrupt
+         // on this edge and it only takes calibration + preamble time
+            Start = getMillis();
+            while(!getGDO0state()) {
+               if((getMillis() - Start) >= TX_GDO_TIMEOUT) {
+                  break;
+               }
+            }
+            if(!getGDO0state()) {
+               LOGE("Sync word timeout\n");
+               ErrLine = __LINE__;
+               break;
+            }
          }
-         SPITransaction.tx_buffer += Bytes2Send;
          BytesSent += Bytes2Send;
       }
+      if(ErrLine != 0) {
+         break;
+      }
 
-   // Wait until the end of the TxData transmission
-      wait_GDO0_low();
+   // Sleep until the end of the TxData transmission
+      if(!waitGdoLevel(CONFIG_GDO0_GPIO,0)) {
+         LOGE("End of packet timeout\n");
+         ErrLine = __LINE__;
+         break;
+      }
       Ret = true;
    } while(false);
 
-   setIdleState();
+   gTxActive = false;
    CC1101_setRxState();
 
    if(ErrLine != 0) {
@@ -595,13 +711,72 @@ bool CC1101_Tx(uint8_t *TxData)
    return Ret;
 }
 
+// RXBYTES can be wrong while it's being updated, read it until two
+// reads agree (CC1101 errata)
+static uint8_t readRxBytes(void)
+{
+   uint8_t Last;
+   uint8_t RxBytes = readStatusReg(CC1101_RXBYTES);
+
+   do {
+      Last = RxBytes;
+      RxBytes = readStatusReg(CC1101_RXBYTES);
+   } while(RxBytes != Last);
+
+   return RxBytes;
+}
+
+// Move up to Avail bytes of the packet from the RX FIFO into gRxPkt.
+// The RSSI and LQI bytes that follow the data are left in the FIFO.
+static void drainRxFifo(uint8_t Avail)
+{
+   int Want;
+
+   if(gRxPktLen < 0 && Avail > 0) {
+      gRxPktLen = readConfigReg(CC1101_RXFIFO);
+      Avail--;
+   }
+   if(gRxPktLen >= 0) {
+      Want = gRxPktLen - gRxPktGot;
+      if(Avail > Want) {
+         Avail = Want;
+      }
+      if(Avail > 0) {
+         CC1101_readBurstReg(&gRxPkt[gRxPktGot],CC1101_RXFIFO,Avail);
+         gRxPktGot += Avail;
+      }
+   }
+}
+
+// Called when GDO2 reports the RX FIFO reached the threshold while a
+// packet is still being received, empties the FIFO so packets longer
+// than 64 bytes fit.
+void CC1101_RxDrain(void)
+{
+   uint8_t rxBytes;
+
+   if(!getGDO0state()) {
+   // End of packet already, CC1101_Rx will read all of it
+      return;
+   }
+   rxBytes = readRxBytes();
+   if(rxBytes & CC1101_RXFIFO_OVERFLOW_MASK) {
+      return;
+   }
+   rxBytes &= CC1101_NUM_RXBYTES_MASK;
+// Don't read the last byte while the packet is still coming in (errata)
+   if(rxBytes > 1) {
+      drainRxFifo(rxBytes - 1);
+   }
+}
+
 // Called when GDO0 goes low, i.e. end of packet.
-// Everything has been received.
-// NB: this means the entire packet must fit in the FIFO so maximum
-// message length is 64 bytes.
+// Everything has been received, possibly partly moved to gRxPkt
+// already by CC1101_RxDrain.
 int CC1101_Rx(uint8_t *RxBuf,size_t RxBufLen,uint8_t *pRssi,uint8_t *pLqi)
 {
-   uint8_t rxBytes = readStatusReg(CC1101_RXBYTES);
+   uint8_t rxBytes = readRxBytes();
+   uint8_t Status[2];
    uint8_t Rssi;
    uint8_t Lqi;
    int Ret;
@@ -615,27 +790,33 @@ int CC1101_Rx(uint8_t *RxBuf,size_t RxBufLen,uint8_t *pRssi,uint8_t *pLqi)
          Ret = -2;
          break;
       }
+      rxBytes &= CC1101_NUM_RXBYTES_MASK;
 
-      if(rxBytes < 2) {
+      if(gRxPktLen < 0 && rxBytes < 2) {
       // should have at least 2 bytes, packet len and one byte of data
          Ret = -2;
          break;
       }
 
-   // Get packet length
-      Ret = readConfigReg(CC1101_RXFIFO);
+   // Get the rest of the data
+      drainRxFifo(rxBytes);
+   // The length byte must match what was drained and exactly the
+   // RSSI/LQI status bytes must be left, otherwise they can't be trusted
+      if(gRxPktGot != gRxPktLen || readRxBytes() != sizeof(Status)) {
+         Ret = -2;
+         break;
+      }
+      Ret = gRxPktLen;
       if(Ret > RxBufLen) {
       // Toss the data
          LOGE("RxBuf too small %d < %d\n",RxBufLen,Ret);
          Ret = -1;
          break;
       }
-   // Read the data
-      CC1101_readBurstReg(RxBuf,CC1101_RXFIFO,Ret);
-   // Read RSSI
-      Rssi = readConfigReg(CC1101_RXFIFO);
-   // Read LQI and CRC_OK
-      Lqi = readConfigReg(CC1101_RXFIFO);
+   // Read RSSI, LQI and CRC_OK
+      CC1101_readBurstReg(Status,CC1101_RXFIFO,sizeof(Status));
+      Rssi = Status[0];
+      Lqi = Status[1];
       if(!(Lqi & CC1101_CRC_OK_MASK)) {
       // Crc error, ignore the packet
          LOG("Ignoring %d byte packet, CRC error\n",Ret);
@@ -643,6 +824,7 @@ int CC1101_Rx(uint8_t *RxBuf,size_t RxBufLen,uint8_t *pRssi,uint8_t *pLqi)
          break;
       }
    // CRC is valid
+      memcpy(RxBuf,gRxPkt,Ret);
       if(pRssi != NULL) {
          *pRssi = Rssi;
       }
@@ -665,8 +847,6 @@ int CC1101_Rx(uint8_t *RxBuf,size_t RxBufLen,uint8_t *pRssi,uint8_t *pLqi)
       }
    } while(false);
 
-   setIdleState();
-   flushRxFifo();
    CC1101_setRxState();
 
    return Ret;
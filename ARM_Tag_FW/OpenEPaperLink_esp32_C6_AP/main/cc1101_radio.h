@@ -115,7 +115,9 @@ extern spi_device_handle_t gSpiHndl;
 
 void CC1101_SetConfig(const RfSetting *pConfig);
 int  CC1101_Rx(uint8_t *RxBuf,size_t RxBufLen,uint8_t *pRssi,uint8_t *pLqi);
+void CC1101_RxDrain(void);
 bool CC1101_Tx(uint8_t *TxData);
+bool CC1101_TxEventFromISR(void);
 bool CC1101_Present(void);
 void CC1101_DumpRegs(void);
 void CC1101_reset(void);
@@ -456,6 +456,9 @@ void espNotifyAPInfo() {
     countSlots();
     pr("PEN>%02X", curPendingData);
     pr("NOP>%02X", curNoUpdate);
+    radioPrintRxLatency();
+    radioPrintTxStats();
+    uartPrintStats();
 }
 
 void espNotifyTagReturnData(uint8_t *src, uint8_t len) {
@@ -788,7 +791,14 @@ void app_main(void) {
     housekeepingTimer = getMillis();
     while (1) {
         while ((getMillis() - housekeepingTimer) < ((1000 * HOUSEKEEPING_INTERVAL) - 100)) {
-            int32_t ret = commsRxUnencrypted(radiorxbuffer);
+            // sleep until a frame or serial data arrives, or a pending block is due
+            uint32_t waitMs = 100;
+            if (blockStartTimer) {
+                uint32_t now = getMillis();
+                waitMs = blockStartTimer >= now ? blockStartTimer - now + 1 : 0;
+                if (waitMs > 100) waitMs = 100;
+            }
+            int32_t ret = commsRxUnencrypted(radiorxbuffer, waitMs);
             if (ret > 1) {
                 led_flash(0);
 
@@ -848,8 +858,6 @@ void app_main(void) {
                         ESP_LOGI(TAG, "t=%02X" , getPacketType(radiorxbuffer));
                         break;
                 }
-            } else if (blockStartTimer == 0) {
-                vTaskDelay(10 / portTICK_PERIOD_MS);
             }
 
             uint8_t curr_char;
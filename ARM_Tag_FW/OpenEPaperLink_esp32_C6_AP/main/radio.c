@@ -10,6 +10,7 @@
 #include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "freertos/task.h"
 #include "led.h"
 #include "main.h"
@@ -27,42 +28,130 @@
 #include <stdarg.h>
 #include <string.h>
 #include "SubGigRadio.h"
+#include "second_uart.h"
 
 
 static const char *TAG = "RADIO";
 
+// upper bounds (us) of the latency histogram buckets, the last bucket catches the rest
+static const uint32_t rxLatencyLimits[RX_LATENCY_BUCKETS - 1] = {250, 500, 1000, 2000, 5000, 10000, 20000, 50000, 100000};
+
+// both radios post into this queue from their interrupt, so neither waits on the other
+struct rxEvent {
+    int64_t timestamp;
+    uint8_t radio;
+    uint8_t pkt[130];  // 802.15.4 frame, length first. Sub-GHz data is read from the CC1101 FIFO by the handler
+};
+
 uint8_t mSelfMac[8];
-volatile uint8_t isInTransmit = 0;
-QueueHandle_t packet_buffer = NULL;
+static QueueHandle_t rx_events = NULL;
+// frames waiting for the 802.15.4 radio, sent one at a time by txTask
+static QueueHandle_t tx_ring = NULL;
+static TaskHandle_t txTaskHandle = NULL;
+// held by txTask while a frame is on air, radio_init takes it to retune
+static SemaphoreHandle_t txLock = NULL;
+static volatile bool txFailed;
+static uint8_t txChannel;
+static uint32_t txSent[TX_STATS_CHANNELS];
+static uint32_t txFail[TX_STATS_CHANNELS];
+static uint32_t txCcaBusy[TX_STATS_CHANNELS];
+static uint32_t rxLatency[RX_RADIO_COUNT][RX_LATENCY_BUCKETS];
+
+void IRAM_ATTR radioPostRxEventFromISR(uint8_t radio, const uint8_t *frame) {
+    // on the stack, the two radio interrupts may preempt each other
+    struct rxEvent event;
+    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+    if (rx_events == NULL) return;
+    event.timestamp = esp_timer_get_time();
+    event.radio = radio;
+    if (frame != NULL) memcpy(event.pkt, frame, frame[0] + 1);
+    xQueueSendFromISR(rx_events, (void *)&event, &xHigherPriorityTaskWoken);
+    portYIELD_FROM_ISR_ARG(xHigherPriorityTaskWoken);
+}
+
+void radioWakeRx() {
+    struct rxEvent event;
+    // anything already queued wakes the main loop as well, don't crowd out radio events
+    if (rx_events == NULL || uxQueueMessagesWaiting(rx_events) != 0) return;
+    event.timestamp = esp_timer_get_time();
+    event.radio = RX_WAKE_SERIAL;
+    xQueueSend(rx_events, (void *)&event, 0);
+}
+
 void esp_ieee802154_receive_done(uint8_t *frame, esp_ieee802154_frame_info_t *frame_info) {
     ESP_EARLY_LOGI(TAG, "RX %d", frame[0]);
-    BaseType_t xHigherPriorityTaskWoken;
-    static uint8_t inner_rxPKT[130];
-    memcpy(inner_rxPKT, &frame[0], frame[0] + 1);
-    xQueueSendFromISR(packet_buffer, (void *)&inner_rxPKT, &xHigherPriorityTaskWoken);
-    portYIELD_FROM_ISR_ARG(xHigherPriorityTaskWoken);
+    radioPostRxEventFromISR(RX_RADIO_IEEE802154, frame);
     if(esp_ieee802154_receive_handle_done(frame)) {
         ESP_EARLY_LOGI(TAG, "esp_ieee802154_receive_handle_done() failed");
     }
 }
 
+static void IRAM_ATTR txCompleteFromISR() {
+    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+    if (txTaskHandle != NULL) vTaskNotifyGiveFromISR(txTaskHandle, &xHigherPriorityTaskWoken);
+    portYIELD_FROM_ISR_ARG(xHigherPriorityTaskWoken);
+}
+
 void esp_ieee802154_transmit_failed(const uint8_t *frame, esp_ieee802154_tx_error_t error) {
-    isInTransmit = 0;
     ESP_EARLY_LOGE(TAG, "TX Err: %d", error);
+    if (txChannel >= TX_STATS_FIRST_CHANNEL && txChannel < TX_STATS_FIRST_CHANNEL + TX_STATS_CHANNELS) {
+        if (error == ESP_IEEE802154_TX_ERR_CCA_BUSY) {
+            txCcaBusy[txChannel - TX_STATS_FIRST_CHANNEL]++;
+        } else {
+            txFail[txChannel - TX_STATS_FIRST_CHANNEL]++;
+        }
+    }
+    txFailed = true;
+    txCompleteFromISR();
 }
 
 void esp_ieee802154_transmit_done(const uint8_t *frame, const uint8_t *ack, esp_ieee802154_frame_info_t *ack_frame_info) {
-    isInTransmit = 0;
     ESP_EARLY_LOGI(TAG, "TX %d", frame[0]);
     if(ack != NULL) {
        if(esp_ieee802154_receive_handle_done(ack)) {
           ESP_EARLY_LOGI(TAG, "esp_ieee802154_receive_handle_done() failed");
        }
     }
+    txCompleteFromISR();
+}
+
+static void txTask(void *arg) {
+    static uint8_t txPKT[TX_FRAME_SIZE];
+    while (1) {
+        // only peek while waiting, radio_init may drop the frame before we get the lock
+        if (xQueuePeek(tx_ring, (void *)txPKT, portMAX_DELAY) != pdTRUE) continue;
+        xSemaphoreTake(txLock, portMAX_DELAY);
+        if (xQueueReceive(tx_ring, (void *)txPKT, 0) != pdTRUE) {
+            xSemaphoreGive(txLock);
+            continue;
+        }
+        // a done/failed callback arriving after the last timeout must not end this wait
+        ulTaskNotifyValueClear(NULL, UINT32_MAX);
+        txFailed = false;
+        esp_ieee802154_transmit(txPKT, false);
+        // the longest frame plus CCA backoffs takes well under this
+        if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(TX_DONE_TIMEOUT_MS)) == 0) {
+            ESP_LOGE(TAG, "TX timeout");
+            txFailed = true;
+        }
+        if (!txFailed && txChannel >= TX_STATS_FIRST_CHANNEL && txChannel < TX_STATS_FIRST_CHANNEL + TX_STATS_CHANNELS) {
+            txSent[txChannel - TX_STATS_FIRST_CHANNEL]++;
+        }
+        xSemaphoreGive(txLock);
+    }
 }
 static bool zigbee_is_enabled = false;
 void radio_init(uint8_t ch) {
-    if (packet_buffer == NULL) packet_buffer = xQueueCreate(32, 130);
+    if (rx_events == NULL) rx_events = xQueueCreate(32, sizeof(struct rxEvent));
+    if (tx_ring == NULL) {
+        tx_ring = xQueueCreate(TX_RING_SIZE, TX_FRAME_SIZE);
+        txLock = xSemaphoreCreateMutex();
+        xTaskCreate(txTask, "radio tx", 3072, NULL, 5, &txTaskHandle);
+    }
+    // wait for the frame on air, frames still queued were meant for the old channel
+    xSemaphoreTake(txLock, portMAX_DELAY);
+    xQueueReset(tx_ring);
+    txChannel = ch;
 
     // this will trigger a "IEEE802154 MAC sleep init failed" when called a second time, but it works
     if(zigbee_is_enabled)
@@ -105,21 +194,15 @@ void radio_init(uint8_t ch) {
              mSelfMac[0], mSelfMac[1], mSelfMac[2], mSelfMac[3],
              mSelfMac[4], mSelfMac[5], mSelfMac[6], mSelfMac[7],
              esp_ieee802154_get_short_address());
+    xSemaphoreGive(txLock);
 }
 
 // uint32_t lastZbTx = 0;
 bool radioTx(uint8_t *packet) {
-#ifdef CONFIG_OEPL_SUBGIG_SUPPORT
-// The subghz driver uses DMA 
-    static DMA_ATTR uint8_t txPKT[130];
-#else
-    static uint8_t txPKT[130];
-#endif
     led_flash(1);
 	// while (getMillis() - lastZbTx < 6) {
 	// }
 	// lastZbTx = getMillis();
-	memcpy(txPKT, packet, packet[0]);
 #ifdef CONFIG_OEPL_SUBGIG_SUPPORT
 	struct MacFrameNormal  *txHeader = (struct MacFrameNormal *) (packet + 1);
 
@@ -127,10 +210,17 @@ bool radioTx(uint8_t *packet) {
 		return SubGig_radioTx(packet);
 	}
 #endif
-	while (isInTransmit) {
+	// the frame is copied, the caller can reuse its buffer right away
+	uint8_t frame[TX_FRAME_SIZE];
+	if (packet[0] >= TX_FRAME_SIZE) {
+		ESP_LOGE(TAG, "TX frame too long (%d), dropped", packet[0]);
+		return false;
+	}
+	memcpy(frame, packet, packet[0] + 1);
+	if (xQueueSend(tx_ring, (void *)frame, pdMS_TO_TICKS(TX_RING_WAIT_MS)) != pdTRUE) {
+		ESP_LOGE(TAG, "TX ring full, frame dropped");
+		return false;
 	}
-	isInTransmit = 1;
-	esp_ieee802154_transmit(txPKT, false);
 	return true;
 }
 
@@ -140,13 +230,36 @@ void radioSetChannel(uint8_t ch) {
 
 void radioSetTxPower(uint8_t power) {}
 
-int8_t commsRxUnencrypted(uint8_t *data) {
-    static uint8_t inner_rxPKT_out[130];
-    if (xQueueReceive(packet_buffer, (void *)&inner_rxPKT_out, pdMS_TO_TICKS(100)) == pdTRUE) {
-        memcpy(data, &inner_rxPKT_out[1], inner_rxPKT_out[0] + 1);
-        return inner_rxPKT_out[0] - 2;
+static void recordRxLatency(const struct rxEvent *event) {
+    uint32_t latency = (uint32_t)(esp_timer_get_time() - event->timestamp);
+    uint8_t bucket = 0;
+    while (bucket < RX_LATENCY_BUCKETS - 1 && latency >= rxLatencyLimits[bucket]) bucket++;
+    rxLatency[event->radio][bucket]++;
+}
+
+int8_t commsRxUnencrypted(uint8_t *data, uint32_t waitMs) {
+    static struct rxEvent event;
+    if (xQueueReceive(rx_events, (void *)&event, pdMS_TO_TICKS(waitMs)) == pdTRUE) {
+        if (event.radio == RX_WAKE_SERIAL) return 0;
+        if (event.radio == RX_RADIO_IEEE802154) {
+            recordRxLatency(&event);
+            memcpy(data, &event.pkt[1], event.pkt[0] + 1);
+            return event.pkt[0] - 2;
+        }
+#ifdef CONFIG_OEPL_SUBGIG_SUPPORT
+        // GDO0 also toggles on TX FIFO underflows, in that case there's nothing to read
+        if (gSubGigData.Enabled) {
+            int8_t Ret = SubGig_commsRxUnencrypted(data);
+            if (Ret > 0) {
+                recordRxLatency(&event);
+                return Ret;
+            }
+        }
+#endif
+        return 0;
     }
 #ifdef CONFIG_OEPL_SUBGIG_SUPPORT
+    // nothing posted for a while, check for a GDO0 edge we might have missed
     if(gSubGigData.Enabled) {
        int8_t Ret = SubGig_commsRxUnencrypted(data);
        if(Ret > 0) {
@@ -156,3 +269,20 @@ int8_t commsRxUnencrypted(uint8_t *data) {
 #endif
     return 0;
 }
+
+void radioPrintTxStats() {
+    for (uint8_t c = 0; c < TX_STATS_CHANNELS; c++) {
+        if (txSent[c] == 0 && txFail[c] == 0 && txCcaBusy[c] == 0) continue;
+        pr("TXS>%d,%lu,%lu,%lu\n", c + TX_STATS_FIRST_CHANNEL, txSent[c], txFail[c], txCcaBusy[c]);
+    }
+}
+
+void radioPrintRxLatency() {
+    for (uint8_t radio = 0; radio < RX_RADIO_COUNT; radio++) {
+        pr("RXL>%d", radio);
+        for (uint8_t bucket = 0; bucket < RX_LATENCY_BUCKETS; bucket++) {
+            pr(",%lu", rxLatency[radio][bucket]);
+        }
+        pr("\n");
+    }
+}
@@ -3,13 +3,45 @@
 #include <stdint.h>
 
 #define RAW_PKT_PADDING 2
+
+// radios posting into the receive queue
+#define RX_RADIO_IEEE802154 0
+#define RX_RADIO_SUBGHZ 1
+#define RX_RADIO_COUNT 2
+// not a radio, wakes the main loop to handle received serial data
+#define RX_WAKE_SERIAL 0xFF
+
+// 802.15.4 frames queued for transmission, enough for a full block plus some replies
+#define TX_RING_SIZE 48
+// one queued frame, length byte plus the largest 802.15.4 PSDU
+#define TX_FRAME_SIZE 128
+// how long radioTx waits for room in the ring before dropping the frame
+#define TX_RING_WAIT_MS 100
+// how long the TX task waits for the done/failed callback
+#define TX_DONE_TIMEOUT_MS 20
+// per channel TX statistics cover 802.15.4 channels 11-26
+#define TX_STATS_FIRST_CHANNEL 11
+#define TX_STATS_CHANNELS 16
+
+// ISR to handler latency histogram: <250us, <500us, <1ms, <2ms, <5ms, <10ms, <20ms, <50ms, <100ms, rest
+#define RX_LATENCY_BUCKETS 10
+
 extern uint8_t mSelfMac[8];
 
 void radio_init(uint8_t ch);
 bool radioTx(uint8_t *packet);
 void radioSetChannel(uint8_t ch);
 void radioSetTxPower(uint8_t power);
-int8_t commsRxUnencrypted(uint8_t *data);
+// waits up to waitMs for a received frame or a wake event
+int8_t commsRxUnencrypted(uint8_t *data, uint32_t waitMs);
+// called from interrupt context, frame is NULL if the radio's handler reads the data itself
+void radioPostRxEventFromISR(uint8_t radio, const uint8_t *frame);
+// called from task context when serial data arrived, returns the main loop from commsRxUnencrypted
+void radioWakeRx();
+// print the latency histograms, one RXL> line per radio
+void radioPrintRxLatency();
+// print sent/failed/CCA busy counts, one TXS> line per used channel
+void radioPrintTxStats();
 
 #ifdef SUBGIG_SUPPORT
 void SubGig_radio_init(uint8_t ch);
@@ -17,6 +17,7 @@
 #include "nvs.h"
 #include "nvs_flash.h"
 #include "proto.h"
+#include "radio.h"
 #include "sdkconfig.h"
 #include "soc/uart_struct.h"
 #ifdef CONFIG_IDF_TARGET_ESP32C6
@@ -26,73 +27,92 @@ static const char *TAG = "SECOND_UART";
 #include "second_uart.h"
 
 
-#define BUF_SIZE    (1024)
-#define RD_BUF_SIZE (BUF_SIZE)
+// received data stays in the driver buffer until the main loop reads it,
+// with RTS/CTS wired the driver holds off the ESP32 before it overflows
+#define RX_BUF_SIZE 8192
+#define TX_BUF_SIZE 2048
+#define RD_CHUNK_SIZE 128
+// RTS is raised when the hardware FIFO holds this many bytes
+#define RX_FLOW_CTRL_THRESH 100
+// wake the main loop after the line has been idle for this many symbols
+#define RX_TIMEOUT_SYMBOLS 2
 static QueueHandle_t uart0_queue;
 
-#define MAX_BUFF_POS 8000
-volatile int     curr_buff_pos   = 0;
-volatile int     worked_buff_pos = 0;
-volatile uint8_t buff_pos[MAX_BUFF_POS + 5];
+static uint8_t rdChunk[RD_CHUNK_SIZE];
+static int     rdChunkLen = 0;
+static int     rdChunkPos = 0;
+static uint32_t rxOverflows = 0;
 
 static void uart_event_task(void *pvParameters);
 void init_second_uart() {
+    bool flowCtrl = CONFIG_OEPL_HARDWARE_UART_RTS >= 0 && CONFIG_OEPL_HARDWARE_UART_CTS >= 0;
     uart_config_t uart_config = {
         .baud_rate  = 115200,
         .data_bits  = UART_DATA_8_BITS,
         .parity     = UART_PARITY_DISABLE,
         .stop_bits  = UART_STOP_BITS_1,
-        .flow_ctrl  = UART_HW_FLOWCTRL_DISABLE,
+        .flow_ctrl  = flowCtrl ? UART_HW_FLOWCTRL_CTS_RTS : UART_HW_FLOWCTRL_DISABLE,
+        .rx_flow_ctrl_thresh = RX_FLOW_CTRL_THRESH,
         .source_clk = UART_SCLK_DEFAULT,
     };
-    ESP_LOGI(TAG, "HARDWARE_UART_TX %d, CONFIG_OEPL_HARDWARE_UART_RX %d", 
-             CONFIG_OEPL_HARDWARE_UART_TX,CONFIG_OEPL_HARDWARE_UART_RX);
-    ESP_ERROR_CHECK(uart_driver_install(1, BUF_SIZE * 2, BUF_SIZE * 2, 20, &uart0_queue, 0));
+    ESP_LOGI(TAG, "HARDWARE_UART_TX %d, CONFIG_OEPL_HARDWARE_UART_RX %d, flow control %s", 
+             CONFIG_OEPL_HARDWARE_UART_TX,CONFIG_OEPL_HARDWARE_UART_RX, flowCtrl ? "on" : "off");
+    ESP_ERROR_CHECK(uart_driver_install(1, RX_BUF_SIZE, TX_BUF_SIZE, 20, &uart0_queue, 0));
     ESP_ERROR_CHECK(uart_param_config(1, &uart_config));
-	ESP_ERROR_CHECK(uart_set_pin(1, CONFIG_OEPL_HARDWARE_UART_TX, CONFIG_OEPL_HARDWARE_UART_RX, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE));
+	ESP_ERROR_CHECK(uart_set_pin(1, CONFIG_OEPL_HARDWARE_UART_TX, CONFIG_OEPL_HARDWARE_UART_RX,
+	                             flowCtrl ? CONFIG_OEPL_HARDWARE_UART_RTS : UART_PIN_NO_CHANGE,
+	                             flowCtrl ? CONFIG_OEPL_HARDWARE_UART_CTS : UART_PIN_NO_CHANGE));
+	ESP_ERROR_CHECK(uart_set_rx_timeout(1, RX_TIMEOUT_SYMBOLS));
 
-	xTaskCreate(uart_event_task, "uart_event_task", 16384, NULL, 12, NULL);
+	xTaskCreate(uart_event_task, "uart_event_task", 4096, NULL, 12, NULL);
 }
 
 void uart_switch_speed(int baudrate) {
-	uart_config_t uart_config = {
-		.baud_rate = baudrate,
-		.data_bits = UART_DATA_8_BITS,
-		.parity = UART_PARITY_DISABLE,
-		.stop_bits = UART_STOP_BITS_1,
-		.flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
-		.source_clk = UART_SCLK_DEFAULT,
-	};
-	ESP_ERROR_CHECK(uart_param_config(1, &uart_config));
+	// only the baudrate, keeps the flow control and timeout settings
+	ESP_ERROR_CHECK(uart_set_baudrate(1, baudrate));
 }
 
 void uartTx(uint8_t data) { uart_write_bytes(1, (const char *) &data, 1); }
 
 
 bool getRxCharSecond(uint8_t *newChar) {
-    if (curr_buff_pos != worked_buff_pos) {
-        *newChar = buff_pos[worked_buff_pos];
-        worked_buff_pos++;
-        worked_buff_pos %= MAX_BUFF_POS;
-        return true;
+    if (rdChunkPos == rdChunkLen) {
+        size_t avail = 0;
+        uart_get_buffered_data_len(1, &avail);
+        if (avail == 0) return false;
+        if (avail > RD_CHUNK_SIZE) avail = RD_CHUNK_SIZE;
+        rdChunkLen = uart_read_bytes(1, rdChunk, avail, 0);
+        rdChunkPos = 0;
+        if (rdChunkLen <= 0) {
+            rdChunkLen = 0;
+            return false;
+        }
     }
-    return false;
+    *newChar = rdChunk[rdChunkPos++];
+    return true;
+}
+
+void uartPrintStats() {
+    pr("UOV>%lu\n", rxOverflows);
 }
 
+// the data itself is read by the main loop, this task only wakes it up
 static void uart_event_task(void *pvParameters) {
     uart_event_t event;
-    uint8_t     *dtmp = (uint8_t *) malloc(RD_BUF_SIZE);
     for (;;) {
         if (xQueueReceive(uart0_queue, (void *) &event, (TickType_t) portMAX_DELAY)) {
-            bzero(dtmp, RD_BUF_SIZE);
             switch (event.type) {
                 case UART_DATA:
-                    uart_read_bytes(1, dtmp, event.size, portMAX_DELAY);
-                    for (int i = 0; i < event.size; i++) {
-                        buff_pos[curr_buff_pos] = dtmp[i];
-                        curr_buff_pos++;
-                        curr_buff_pos %= MAX_BUFF_POS;
-                    }
+                    radioWakeRx();
+                    break;
+                case UART_FIFO_OVF:
+                case UART_BUFFER_FULL:
+                    rxOverflows++;
+                    ESP_LOGW(TAG, "uart rx overflow");
+                    // the ESP32 resends what was lost, start over with an empty buffer
+                    uart_flush_input(1);
+                    xQueueReset(uart0_queue);
+                    radioWakeRx();
                     break;
                 default:
                     // ESP_LOGI(TAG, "uart event type: %d", event.type);
@@ -100,8 +120,6 @@ static void uart_event_task(void *pvParameters) {
             }
         }
     }
-    free(dtmp);
-    dtmp = NULL;
     vTaskDelete(NULL);
 }
 
@@ -7,6 +7,8 @@ void uart_switch_speed(int baudrate);
 
 void uartTx(uint8_t data);
 bool getRxCharSecond(uint8_t *newChar);
+// print the number of receive overflows as an UOV> line
+void uartPrintStats();
 
 void uart_printf(const char *format, ...);
 
@@ -29,3 +31,11 @@ void uart_printf(const char *format, ...);
     #error "No UART TX / RX pins defined. Please check menuconfig" 
   #endif
 #endif
+
+// RTS/CTS are only wired on custom boards
+#ifndef CONFIG_OEPL_HARDWARE_UART_RTS
+  #define CONFIG_OEPL_HARDWARE_UART_RTS -1
+#endif
+#ifndef CONFIG_OEPL_HARDWARE_UART_CTS
+  #define CONFIG_OEPL_HARDWARE_UART_CTS -1
+#endif
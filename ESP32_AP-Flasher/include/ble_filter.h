@@ -4,8 +4,12 @@
 
 uint8_t gicToOEPLtype(uint8_t gicType);
 bool BLE_filter_add_device(BLEAdvertisedDevice advertisedDevice);
-bool BLE_is_image_pending(uint8_t address[8]);
+// fills addresses with up to maxCount BLE tags that have an image pending, returns the count
+uint8_t BLE_get_pending(uint8_t addresses[][8], uint8_t maxCount);
+// packs the pending image into the Gicisky format, reusing the cached result while the image md5 is unchanged
 uint32_t compress_image(uint8_t address[8], uint8_t* buffer, uint32_t max_len);
+// removes the cached packed image of a tag once its transfer ended
+void BLE_drop_packed(uint8_t address[8]);
 uint32_t get_ATC_BLE_OEPL_image(uint8_t address[8], uint8_t* buffer, uint32_t max_len, uint8_t* dataType, uint8_t* dataTypeArgument, uint16_t* nextCheckIn);
 
 #endif
@@ -0,0 +1,100 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+
+// Line packing for the Gicisky BLE image format, kept free of Arduino so the host
+// tests can compare it with the per byte version it replaced (test/test_ble_pack).
+namespace BlePack {
+
+/// @brief Reverse the bit order of a byte
+inline uint8_t swapBits(uint8_t num) {
+    uint8_t result = 0;
+    for (int i = 0; i < 8; ++i) {
+        result |= ((num >> i) & 0x01) << (7 - i);
+    }
+    return result;
+}
+
+/// @brief Reverse all 32 bits, equal to swapBits on each byte plus a byte swap
+inline uint32_t reverseBits32(uint32_t w) {
+    w = ((w >> 1) & 0x55555555) | ((w & 0x55555555) << 1);
+    w = ((w >> 2) & 0x33333333) | ((w & 0x33333333) << 2);
+    w = ((w >> 4) & 0x0F0F0F0F) | ((w & 0x0F0F0F0F) << 4);
+    return __builtin_bswap32(w);
+}
+
+/// @brief Copy one display line of n bytes, a word at a time
+/// @details Mirroring reverses the bit order of the whole line. Input past avail is
+/// treated as 0x00, so a short file never reads outside the buffer
+/// @param in start of the line in the image
+/// @param avail bytes left in the image from in
+/// @param out packed line, n bytes
+/// @param n bytes per line
+/// @param invert invert every bit, used for the black plane
+/// @param mirror mirror the line
+inline void packLine(const uint8_t* in, uint32_t avail, uint8_t* out, uint32_t n, bool invert, bool mirror) {
+    const uint32_t mask = invert ? 0xFFFFFFFF : 0x00000000;
+    if (avail > n) avail = n;
+    uint32_t b = 0;
+    for (; b + 4 <= avail; b += 4) {
+        uint32_t w;
+        memcpy(&w, in + b, 4);
+        w ^= mask;
+        if (mirror) {
+            w = reverseBits32(w);
+            memcpy(out + n - 4 - b, &w, 4);
+        } else {
+            memcpy(out + b, &w, 4);
+        }
+    }
+    for (; b < n; b++) {
+        uint8_t v = (b < avail ? in[b] : 0x00) ^ (uint8_t)mask;
+        if (mirror)
+            out[n - 1 - b] = swapBits(v);
+        else
+            out[b] = v;
+    }
+}
+
+/// @brief Pack a 1bpp image, one plane after the other, into display lines
+/// @details The black plane is inverted, the color plane is sent as is. A short image
+/// is padded with white (black plane) and no color
+/// @param data image, lines * bytesPerLine bytes per plane
+/// @param len size of data
+/// @param buffer output, see packedSize
+/// @param lines display lines per plane
+/// @param bytesPerLine bytes per display line
+/// @param planes 1 or 2
+/// @param lineHeaders prefix every line with the 7 byte header of the compressed format
+/// @param mirror mirror every line
+/// @return bytes written to buffer
+inline uint32_t packImage(const uint8_t* data, uint32_t len, uint8_t* buffer, uint32_t lines, uint32_t bytesPerLine, uint32_t planes, bool lineHeaders, bool mirror) {
+    uint32_t out = 0;
+    uint32_t pos = 0;
+    for (uint32_t plane = 0; plane < planes; plane++) {
+        const bool invert = plane == 0;
+        for (uint32_t i = 0; i < lines; i++) {
+            if (lineHeaders) {
+                buffer[out++] = 0x75;
+                buffer[out++] = bytesPerLine + 7;
+                buffer[out++] = bytesPerLine;
+                buffer[out++] = 0x00;
+                buffer[out++] = 0x00;
+                buffer[out++] = 0x00;
+                buffer[out++] = 0x00;
+            }
+            const uint32_t avail = len > pos ? len - pos : 0;
+            packLine(data + pos, avail, buffer + out, bytesPerLine, invert, mirror);
+            pos += avail < bytesPerLine ? avail : bytesPerLine;
+            out += bytesPerLine;
+        }
+    }
+    return out;
+}
+
+/// @brief Size packImage writes
+inline uint32_t packedSize(uint32_t lines, uint32_t bytesPerLine, uint32_t planes, bool lineHeaders) {
+    return planes * lines * ((lineHeaders ? 7 : 0) + bytesPerLine);
+}
+
+}  // namespace BlePack
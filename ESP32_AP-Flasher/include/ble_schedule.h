@@ -0,0 +1,81 @@
+#pragma once
+#include <stdint.h>
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+// Retry and ordering policy of the BLE sessions, kept free of the BLE stack so the host
+// tests can run it (test/test_ble_schedule).
+
+// first retry after a failure, doubled for every following failure
+#define BLE_RETRY_BASE_MS 10000
+#define BLE_RETRY_MAX_SHIFT 5
+// give up on the pending image after this many failures in a row
+#define BLE_MAX_FAILURES 5
+
+namespace BleSchedule {
+
+/// @brief Scheduler view of a tag
+struct TagState {
+    uint32_t pendingSince = 0;
+    uint32_t nextAttempt = 0;
+    uint8_t failures = 0;
+    // the last session found no queue item yet, nextAttempt holds it back
+    bool notReady = false;
+    bool active = false;
+};
+
+enum Result {
+    RESULT_COMPLETE,
+    // the tag had no queue item yet, not counted as a failure
+    RESULT_NOT_READY,
+    RESULT_FAILED,
+};
+
+/// @brief Update the tag when its session ended
+/// @return true if the tag is given up on, it is reported like a completed transfer so it isn't retried forever
+inline bool finish(TagState &state, Result result, uint32_t now) {
+    state.active = false;
+    state.notReady = false;
+    switch (result) {
+        case RESULT_COMPLETE:
+            state.failures = 0;
+            state.pendingSince = 0;
+            return false;
+        case RESULT_NOT_READY:
+            // don't restart it right away
+            state.notReady = true;
+            state.nextAttempt = now + BLE_RETRY_BASE_MS;
+            return false;
+        default:
+            if (++state.failures >= BLE_MAX_FAILURES) {
+                state.failures = 0;
+                state.pendingSince = 0;
+                return true;
+            }
+            state.nextAttempt = now + (BLE_RETRY_BASE_MS << std::min<uint8_t>(state.failures - 1, BLE_RETRY_MAX_SHIFT));
+            return false;
+    }
+}
+
+/// @brief Note a pending tag and check if it can get a session
+/// @details The first call starts the wait the ordering goes by
+/// @return false while the tag has a session or waits out a retry
+inline bool ready(TagState &state, uint32_t now) {
+    if (state.active) return false;
+    if (state.pendingSince == 0) state.pendingSince = now ? now : 1;
+    return !((state.failures || state.notReady) && (int32_t)(now - state.nextAttempt) < 0);
+}
+
+/// @brief Time left before a retry, 0 if the tag can start
+inline uint32_t retryIn(const TagState &state, uint32_t now) {
+    return (state.failures || state.notReady) && (int32_t)(state.nextAttempt - now) > 0 ? state.nextAttempt - now : 0;
+}
+
+/// @brief Order candidates, pairs of ms waited and tag index, longest waiting first
+inline void oldestFirst(std::vector<std::pair<uint32_t, uint8_t>> &candidates) {
+    std::stable_sort(candidates.begin(), candidates.end(), [](const std::pair<uint32_t, uint8_t> &a, const std::pair<uint32_t, uint8_t> &b) { return a.first > b.first; });
+}
+
+}  // namespace BleSchedule
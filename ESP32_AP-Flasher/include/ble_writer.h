@@ -1,6 +1,23 @@
 #pragma once
 #ifdef HAS_BLE_WRITER
+#include <Arduino.h>
+#include <ArduinoJson.h>
 
 void BLETask(void* parameter);
 
+/// @brief Updates several BLE tags at once, oldest pending image first
+namespace BleScheduler {
+
+/// @brief Number of tags with a pending image waiting for a free connection
+uint32_t getQueueDepth();
+
+/// @brief Number of transfers in progress
+uint8_t getActiveCount();
+
+/// @brief Add the scheduler state and the last result per tag to the given json object
+/// @param obj Json object to fill
+void fillStats(JsonObject &obj);
+
+}  // namespace BleScheduler
+
 #endif
@@ -15,8 +15,12 @@ struct contentTypes {
     String optionList;
 };
 
+bool needRedraw(uint8_t contentMode, uint8_t wakeupReason);
 void contentRunner();
+bool renderDueTag(tagRecord *taginfo, const bool canRender);
+void finishDueTag(tagRecord *taginfo);
 void checkVars();
+void invalidateVarIndex();
 void drawNew(const uint8_t mac[8], tagRecord *&taginfo);
 bool updateTagImage(String &filename, const uint8_t *dst, uint16_t nextCheckin, tagRecord *&taginfo, imgParam &imageParams);
 void drawString(TFT_eSprite &spr, String content, int16_t posx, int16_t posy, String font, byte align = 0, uint16_t color = TFT_BLACK, uint16_t size = 30, uint16_t bgcolor = TFT_WHITE);
@@ -21,6 +21,8 @@ class flasher {
     uint8_t tagtype;
     uint8_t *infoblock = nullptr;
     bool includeInfoBlock = false;
+    // pages that failed the burst verify and were completed in byte mode
+    uint16_t pageFallbacks = 0;
 
     // Infoblock structure:
     // 0x00-0x0F - Calibration data
@@ -59,7 +61,8 @@ class flasher {
     bool writeInfoBlock();
 
    protected:
-    bool writeBlock256(uint16_t offset, uint8_t *flashbuffer);
+    bool writePage(uint16_t offset, uint8_t *flashbuffer, uint16_t len);
+    bool verifyPage(uint16_t offset, const uint8_t *flashbuffer, uint16_t len);
     void get_mac_format1();
     void get_mac_format2();
 };
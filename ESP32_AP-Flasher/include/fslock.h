@@ -0,0 +1,60 @@
+/// @file fslock.h
+/// @brief Per-path reader/writer locking for the content filesystem
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+/// @brief Reader/writer locks keyed on the file (or directory) path
+///
+/// Operations on different paths run concurrently, so a long running saveDB
+/// or image generation no longer stalls block requests for an image being
+/// sent to a tag. Readers are never queued behind a waiting writer, which
+/// gives the radio's block reads priority over background writes. A task
+/// must not take a lock on a path it already holds, nor call @ref lockAll
+/// while holding a path lock.
+namespace FsLock {
+
+/// @brief Lock mode
+enum Mode : uint8_t {
+    /// @brief Shared with other readers
+    READ,
+    /// @brief Exclusive
+    WRITE
+};
+
+/// @brief Contention statistics per lock holder, shown in /sysinfo
+struct HolderStats {
+    /// @brief Number of times the lock was taken
+    uint32_t count = 0;
+    /// @brief Number of times the holder had to wait
+    uint32_t contended = 0;
+    /// @brief Total time spent waiting (us)
+    uint64_t waitUs = 0;
+    /// @brief Longest wait (us)
+    uint32_t maxWaitUs = 0;
+};
+
+/// @brief Lock a path, blocks until it is available
+/// @param path Path on the content filesystem
+/// @param mode READ or WRITE
+/// @param holder Static name of the caller, used for the statistics
+extern void lock(const String &path, const Mode mode, const char *holder);
+
+/// @brief Release a path locked with @ref lock
+/// @param path Path on the content filesystem
+/// @param mode Mode it was locked with
+extern void unlock(const String &path, const Mode mode);
+
+/// @brief Lock the whole filesystem, e.g. while (re)initialising the storage
+/// @param holder Static name of the caller, used for the statistics
+extern void lockAll(const char *holder);
+
+/// @brief Release the lock taken with @ref lockAll
+extern void unlockAll();
+
+/// @brief Add the lock statistics to the given json object
+/// @param obj Json object to fill
+extern void fillStats(JsonObject &obj);
+
+}  // namespace FsLock
@@ -0,0 +1,66 @@
+/// @file httpcache.h
+/// @brief Shared cache for upstream content feed responses
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <FS.h>
+
+/// @brief Directory holding the cached response bodies and their metadata
+#define HTTPCACHE_DIR "/temp/cache"
+/// @brief Maximum number of cached responses kept on the filesystem
+#define HTTPCACHE_MAX_ENTRIES 48
+/// @brief How long (s) an expired entry may still be served when upstream is unreachable
+#define HTTPCACHE_MAX_STALE (24 * 3600)
+
+/// @brief Keyed cache for upstream HTTP GET responses
+///
+/// Tags sharing the same weather location, calendar or day-ahead feed resolve
+/// to the same URL, so only the first tag due for an update hits the network.
+/// Entries are kept in @ref HTTPCACHE_DIR so a reboot does not cause every tag
+/// to refetch at once, expired entries are revalidated with ETag/Last-Modified
+/// and concurrent requests for the same URL wait for the one in flight.
+namespace HttpCache {
+
+/// @brief Cache statistics, shown in /sysinfo
+struct Stats {
+    /// @brief Served from a fresh entry
+    uint32_t hits = 0;
+    /// @brief Expired entry confirmed unchanged by upstream (304)
+    uint32_t revalidated = 0;
+    /// @brief Fetched from upstream
+    uint32_t misses = 0;
+    /// @brief Waited for an identical request already in flight
+    uint32_t deduplicated = 0;
+    /// @brief Upstream failed, expired entry served instead
+    uint32_t stale = 0;
+    /// @brief Upstream failed and nothing usable was cached
+    uint32_t errors = 0;
+};
+
+/// @brief Load the persisted cache index and drop entries that are too old
+extern void begin();
+
+/// @brief GET the given url, served from the cache when possible
+/// @param url Request URL, including all query parameters
+/// @param ttl Time in seconds a response stays fresh
+/// @param body Opened for reading on success, caller must release it with @ref close
+/// @param timeout Request timeout in ms
+/// @return HTTP status code, 200 if @ref body holds the response
+extern int fetch(const String &url, const uint32_t ttl, File &body, const uint16_t timeout = 5000);
+
+/// @brief Close a body returned by @ref fetch
+///
+/// The body is read locked until then, so a concurrent refresh or eviction
+/// doesn't replace or remove it while it is being parsed.
+/// @param body File opened by @ref fetch
+extern void close(File &body);
+
+/// @brief Add the cache statistics to the given json object
+/// @param obj Json object to fill
+extern void fillStats(JsonObject &obj);
+
+/// @brief Current cache statistics
+extern Stats stats;
+
+}  // namespace HttpCache
@@ -140,6 +140,9 @@ extern uint8_t YellowSense;
 extern bool tftOverride;
 
 void TFTLog(String text);
+/// @brief Serialize access to the display, the render task draws the AP's own image on it
+void tftLock();
+void tftUnlock();
 void sendAvail(uint8_t wakeupReason);
 
 #endif
\ No newline at end of file
@@ -42,6 +42,7 @@ bool dequeueItem(const uint8_t* targetMac, const uint64_t dataVer);
 uint16_t countQueueItem(const uint8_t* targetMac);
 extern PendingItem* getQueueItem(const uint8_t* targetMac);
 extern PendingItem* getQueueItem(const uint8_t* targetMac, const uint64_t dataVer);
+bool copyQueueItem(const uint8_t* targetMac, const uint64_t dataVer, PendingItem& copy);
 void checkQueue(const uint8_t* targetMac);
 bool queueDataAvail(struct pendingData* pending, bool local);
 uint8_t* getDataForFile(fs::File& file);
@@ -0,0 +1,82 @@
+/// @file renderpipeline.h
+/// @brief Render and publish tasks for content generation
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+#include "tag_db.h"
+
+/// @brief Number of due tags that can wait for the render task
+#define RENDER_QUEUE_SIZE 16
+/// @brief Number of rendered images that can wait for the publish task
+#define PUBLISH_QUEUE_SIZE 16
+#ifdef BOARD_HAS_PSRAM
+/// @brief Render task stack, drawing needs as much as the loop task
+#define RENDER_TASK_STACK (16 * 1024)
+/// @brief Publish task stack
+#define PUBLISH_TASK_STACK 6000
+#else
+#define RENDER_TASK_STACK (12 * 1024)
+#define PUBLISH_TASK_STACK 5000
+#endif
+/// @brief Core the render task is pinned to, the Arduino loop runs on the other one
+#if portNUM_PROCESSORS > 1 && defined(ARDUINO_RUNNING_CORE)
+#define RENDER_TASK_CORE (ARDUINO_RUNNING_CORE == 0 ? 1 : 0)
+#else
+#define RENDER_TASK_CORE 0
+#endif
+
+/// @brief Two stage pipeline for generating tag content outside the Arduino loop
+///
+/// The loop task pops due tags from the scheduler and hands them to the render
+/// task, which fetches and draws the content and quantizes/compresses it into a
+/// file. The publish task hashes that file, queues it for the tag and finally
+/// sends the tag's idle request, so one tag can be published while the next is
+/// being drawn. Per tag the order render -> publish -> idle stays the same as
+/// when everything ran in the loop.
+namespace RenderPipeline {
+
+/// @brief Stages timings are collected for
+enum Stage {
+    /// @brief Upstream requests (http cache, json feeds)
+    STAGE_FETCH,
+    /// @brief Drawing the sprite, everything in drawNew not covered by the other stages
+    STAGE_DRAW,
+    /// @brief Dithering/quantizing and compressing into the image file (spr2buffer)
+    STAGE_ENCODE,
+    /// @brief Hashing and queueing the image for the tag (prepareDataAvail)
+    STAGE_PUBLISH,
+    STAGE_COUNT,
+};
+
+/// @brief Start the render and publish tasks
+extern void begin();
+
+/// @brief Check if the render queue can take another tag
+extern bool hasRoom();
+
+/// @brief Hand a due tag to the render task
+/// @param taginfo Tag
+/// @param canRender Result of the global render conditions for this run
+/// @return False if the pipeline is not running or full, the caller should retry the tag later
+extern bool enqueue(tagRecord *taginfo, const bool canRender);
+
+/// @brief Drop the queued jobs of a tag that is being deleted
+/// @param mac Tag mac, jobs queued for it later run as usual
+extern void forget(const uint8_t mac[8]);
+
+/// @brief Publish a rendered image, deferred to the publish task when called from the render task
+/// @return Result of prepareDataAvail, true if deferred
+extern bool publish(String &filename, const uint8_t dataType, const uint8_t dataTypeArgument, const uint8_t *dst, const uint16_t nextCheckin);
+
+/// @brief Add time spent in a stage to the tag currently being rendered
+/// @param stage Stage
+/// @param ms Time in ms
+extern void addStageTime(const Stage stage, const uint32_t ms);
+
+/// @brief Add the per stage timing histograms to the given json object
+/// @param obj Json object to fill
+extern void fillStats(JsonObject &obj);
+
+}  // namespace RenderPipeline
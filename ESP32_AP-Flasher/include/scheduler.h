@@ -0,0 +1,87 @@
+/// @file scheduler.h
+/// @brief Due-time scheduler for content generation and idle requests
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+#include "tag_db.h"
+
+/// @brief Seconds between full rebuilds of the schedule, as a safety net for missed wakes
+#define SCHEDULER_REBUILD_INTERVAL 60
+/// @brief Seconds to defer a tag whose render is due but currently not allowed
+#define SCHEDULER_RENDER_RETRY 30
+/// @brief Seconds to defer a tag whose idle request is due but could not be sent
+#define SCHEDULER_IDLE_RETRY 5
+
+/// @brief Min-heap of tags keyed on their next due time
+///
+/// Instead of polling every tag on every content runner tick, each tag is
+/// queued at the earliest of its @ref tagRecord::nextupdate (deferred until
+/// shortly before the tag checks in) and the start of its idle request
+/// window. Anything changing these fields should call @ref wake, which is
+/// done centrally from wsSendTaginfo.
+namespace ContentScheduler {
+
+/// @brief Scheduler statistics, shown in /sysinfo
+struct Stats {
+    /// @brief Number of renders started by the scheduler
+    uint32_t renders = 0;
+    /// @brief Seconds the last render started after its due time
+    uint32_t lastLag = 0;
+    /// @brief Largest lag seen since boot
+    uint32_t maxLag = 0;
+    /// @brief Moving average of the lag
+    float avgLag = 0;
+    /// @brief Number of tags popped in the last run
+    uint16_t lastPopped = 0;
+};
+
+/// @brief Time a tag needs attention next
+/// @param taginfo Tag
+/// @param now Current time
+/// @param processed True if the tag was just handled, pushes still-due work into the future
+/// @return Due time (unix time)
+extern uint32_t dueTime(const tagRecord *taginfo, const time_t now, const bool processed = false);
+
+/// @brief Time the tag's content should be (or should have been) rendered
+/// @param taginfo Tag
+/// @return Due time (unix time), UINT32_MAX if it has nothing to render
+extern uint32_t renderDueTime(const tagRecord *taginfo);
+
+/// @brief (Re)schedule a tag after its state changed
+/// @param taginfo Tag
+/// @param processed True if called right after the tag was handled, also releases it from @ref popDue
+extern void wake(tagRecord *taginfo, const bool processed = false);
+
+/// @brief Drop a tag that is about to be deleted
+/// @param taginfo Tag
+extern void forget(tagRecord *taginfo);
+
+/// @brief Drop all tags, e.g. when the database is destroyed
+extern void clear();
+
+/// @brief Rebuild the schedule from the tag database
+extern void rebuild();
+
+/// @brief Pop the next tag that is due
+///
+/// The tag is marked busy until it is woken with processed set, tags that
+/// become due again while busy are skipped.
+/// @param now Current time
+/// @param taginfo Set to the due tag
+/// @return False if no tag is due
+extern bool popDue(const time_t now, tagRecord *&taginfo);
+
+/// @brief Record how late a render started
+/// @param lag Seconds after due time
+extern void recordLag(const uint32_t lag);
+
+/// @brief Add the scheduler statistics to the given json object
+/// @param obj Json object to fill
+extern void fillStats(JsonObject &obj);
+
+/// @brief Current scheduler statistics
+extern Stats stats;
+
+}  // namespace ContentScheduler
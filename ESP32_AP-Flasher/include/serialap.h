@@ -1,4 +1,5 @@
 #include <Arduino.h>
+#include <ArduinoJson.h>
 
 extern struct espSetChannelPower curChannel;
 
@@ -40,6 +41,26 @@ enum ApSerialState {
 
 extern volatile ApSerialState gSerialTaskState;
 
+/// @brief Throughput and latency of the link to the radio, shown in /sysinfo
+struct SerialApStats {
+    /// @brief Commands answered with ACK>, NOK> or NOQ>
+    uint32_t commands = 0;
+    /// @brief Commands without a reply
+    uint32_t timeouts = 0;
+    /// @brief Total command round trip time (us)
+    uint64_t rttUs = 0;
+    /// @brief Longest command round trip (us)
+    uint32_t maxRttUs = 0;
+    /// @brief Blocks sent to the radio
+    uint32_t blocks = 0;
+    /// @brief Total time spent sending blocks (us)
+    uint64_t blockUs = 0;
+};
+
+/// @brief Add the serial link statistics to the given json object
+/// @param obj Json object to fill
+void fillSerialApStats(JsonObject& obj);
+
 void APTask(void* parameter);
 
 bool sendCancelPending(struct pendingData* pending);
@@ -25,23 +25,66 @@
 #endif
 #endif
 
+/// @brief Seconds between measurements of the free space, correcting the tracked value
+#define FREESPACE_RECONCILE_INTERVAL 60
+
 class DynStorage {
    public:
     DynStorage();
     void begin();
     void end();
     void listFiles();
+    /// @brief Free space on the content filesystem
+    ///
+    /// Returns the tracked value, measuring the filesystem walks the allocation
+    /// tables and is only done in the background every @ref FREESPACE_RECONCILE_INTERVAL seconds.
     uint64_t freeSpace();
+    /// @brief Account for a change of the used space since the last measurement
+    /// @param bytes Bytes written (positive) or released (negative)
+    void trackUsage(const int64_t bytes);
+    /// @brief Measure the free space of the content filesystem and reset the tracked value
+    void updateFreeSpace();
 
    private:
     bool isInited;
 };
 
-extern SemaphoreHandle_t fsMutex;
 extern DynStorage Storage;
 extern fs::FS *contentFS;
 #ifndef SD_CARD_ONLY
-extern void copyFile(File in, File out);
+/// @brief Buffer used for copying files, a multiple of the flash/SD sector size
+#ifdef BOARD_HAS_PSRAM
+#define COPY_BUFFER_SIZE (32 * 1024)
+#else
+#define COPY_BUFFER_SIZE (4 * 1024)
+#endif
+
+/// @brief Copy the remaining contents of a file
+/// @return Number of bytes copied
+extern size_t copyFile(File in, File out);
+
+#ifdef HAS_SDCARD
+/// @brief Counters of a (recursive) copy between filesystems
+struct CopyStats {
+    uint32_t files = 0;
+    uint32_t skipped = 0;
+    uint32_t errors = 0;
+    uint64_t bytes = 0;
+    uint32_t lastReport = 0;
+};
+
+/// @brief Copy a file or directory tree to the same path on another filesystem
+/// @param incremental Skip files the target already has, unless the source is newer
+/// @param stats Optional counters, updated while copying
+extern void copyBetweenFS(fs::FS &sourceFS, const char *source_path, fs::FS &targetFS, const bool incremental = false, CopyStats *stats = nullptr);
+
+/// @brief Run copyBetweenFS in a background task, progress is reported to the web interface log
+/// @return False if another background copy is still running
+extern bool copyInBackground(fs::FS &sourceFS, const char *path, fs::FS &targetFS, const bool incremental = true);
+
+/// @brief Check if a background copy is running
+extern bool copyInProgress();
+#endif
 #endif
 
 #endif
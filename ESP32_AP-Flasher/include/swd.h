@@ -1,4 +1,5 @@
 #include <Arduino.h>
+#include <driver/gpio.h>
 #include <stdint.h>
 
 /*
@@ -18,8 +19,16 @@ class swd {
     bool DP_Write(unsigned addr, uint32_t data);
     bool DP_Read(unsigned addr, uint32_t &data);
 
+    // memory access through the AHB-AP with CSW auto-increment, TAR is only reloaded at 1KB boundaries
+    bool AP_WriteBlock(uint32_t address, const uint32_t *data, uint32_t words, uint16_t wordDelayUs = 0);
+    bool AP_ReadBlock(uint32_t address, uint32_t *data, uint32_t words);
+
     uint32_t idCode;
 
+    // block transfer throughput counters
+    uint32_t blockBytes = 0;
+    uint32_t blockMicros = 0;
+
    protected:
     void swd_Begin();
     void swd_Direction(bool WorR);
@@ -29,8 +38,8 @@ class swd {
     void swd_Write(uint32_t in_data, uint8_t bits);
     uint32_t swd_Read(uint8_t bits);
 
-    uint8_t swdio_pin;
-    uint8_t swdclk_pin;
+    gpio_num_t swdio_pin;
+    gpio_num_t swdclk_pin;
     bool cur_swd_direction = 0;
 };
 
@@ -60,6 +69,8 @@ class nrfswd : protected swd {
     uint8_t erase_uicr();
     uint8_t erase_page(uint32_t page);
     void nrf_soft_reset();
+    // bytes moved by block transfers and the time it took since the last call
+    void take_block_stats(uint32_t &bytes, uint32_t &us);
 
     bool isConnected = false;
     bool isLocked = false;
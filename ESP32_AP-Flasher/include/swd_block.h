@@ -0,0 +1,66 @@
+#pragma once
+#include <stdint.h>
+
+// Memory block transfers through the AHB-AP. Templated on the debug port so the host tests can
+// run them against an emulated DAP (test/test_swd_block).
+
+#define AP_CSW 0x00
+#define AP_TAR 0x04
+#define AP_DRW 0x0c
+#define DP_RDBUFF 0x0c
+
+#define CSW_32BIT_AUTOINC 0xa2000012
+#define CSW_32BIT 0xa2000002
+
+// auto-increment of the TAR is only guaranteed within a 1KB block
+#define TAR_AUTOINC_BOUNDARY 1024
+
+namespace SwdBlock {
+
+/// @brief Write words to target memory with CSW auto-increment, TAR is only reloaded at 1KB boundaries
+/// @param dap debug port, needs AP_Write and DP_Read
+/// @param now microsecond clock for the word delay
+/// @param wordDelayUs time the target needs per word, counted from the start of its DRW write
+/// @return false if a transfer failed, the words after it are not written
+template <class DAP, class CLOCK>
+bool writeBlock(DAP &dap, CLOCK now, uint32_t address, const uint32_t *data, uint32_t words, uint16_t wordDelayUs) {
+    uint32_t temp;
+    bool ok = dap.AP_Write(AP_CSW, CSW_32BIT_AUTOINC);
+    for (uint32_t i = 0; ok && i < words; i++) {
+        if (i == 0 || (address % TAR_AUTOINC_BOUNDARY) == 0)
+            ok = dap.AP_Write(AP_TAR, address);
+        uint32_t end_micros = now() + wordDelayUs;
+        ok = ok && dap.AP_Write(AP_DRW, data[i]);
+        while ((int32_t)(end_micros - now()) > 0) {
+        };
+        address += 4;
+    }
+    dap.AP_Write(AP_CSW, CSW_32BIT);
+    return dap.DP_Read(DP_RDBUFF, temp) && ok;
+}
+
+/// @brief Read words from target memory with CSW auto-increment, TAR is only reloaded at 1KB boundaries
+/// @details AP reads are posted: each DRW read returns the previous word, the last one is collected
+/// from RDBUFF so nothing past the end is read
+/// @param dap debug port, needs AP_Write, AP_Read and DP_Read
+/// @return false if a transfer failed
+template <class DAP>
+bool readBlock(DAP &dap, uint32_t address, uint32_t *data, uint32_t words) {
+    uint32_t temp;
+    bool ok = dap.AP_Write(AP_CSW, CSW_32BIT_AUTOINC);
+    for (uint32_t i = 0; ok && i < words; i++) {
+        if (i == 0 || (address % TAR_AUTOINC_BOUNDARY) == 0) {
+            if (i) ok = dap.DP_Read(DP_RDBUFF, data[i - 1]);
+            ok = ok && dap.AP_Write(AP_TAR, address);
+            ok = ok && dap.AP_Read(AP_DRW, temp);
+        } else {
+            ok = dap.AP_Read(AP_DRW, data[i - 1]);
+        }
+        address += 4;
+    }
+    if (ok && words) ok = dap.DP_Read(DP_RDBUFF, data[words - 1]);
+    dap.AP_Write(AP_CSW, CSW_32BIT);
+    return ok;
+}
+
+}  // namespace SwdBlock
@@ -4,6 +4,8 @@
 #include <ArduinoJson.h>
 #include <HTTPClient.h>
 
+#include "httpcache.h"
+#include "renderpipeline.h"
 #include "system.h"
 #include "web.h"
 
@@ -71,25 +73,60 @@ static void printLargestFreeBlock() {
 /// @param timeout Request timeout
 /// @return True on success, false on error (httpCode != 200 || deserialization error)
 static bool httpGetJson(String &url, JsonDocument &json, const uint16_t timeout, JsonDocument *filter = nullptr) {
+    const uint32_t t = millis();
     HTTPClient http;
     // logLine("http httpGetJson " + url);
+    // HTTP/1.0 avoids chunked transfer encoding, so the body can be parsed straight from the stream
+    http.useHTTP10(true);
     http.begin(url);
     http.setTimeout(timeout);
     http.setFollowRedirects(HTTPC_STRICT_FOLLOW_REDIRECTS);
     const int httpCode = http.GET();
     if (httpCode != 200) {
         http.end();
+        RenderPipeline::addStageTime(RenderPipeline::STAGE_FETCH, millis() - t);
         wsErr(String("[httpGetJson] http ") + url + " code " + httpCode);
         return false;
     }
 
     DeserializationError error;
     if (filter) {
-        error = deserializeJson(json, http.getString(), DeserializationOption::Filter(*filter));
+        error = deserializeJson(json, http.getStream(), DeserializationOption::Filter(*filter));
     } else {
-        error = deserializeJson(json, http.getString());
+        error = deserializeJson(json, http.getStream());
     }
     http.end();
+    RenderPipeline::addStageTime(RenderPipeline::STAGE_FETCH, millis() - t);
+    if (error) {
+        Serial.printf("[httpGetJson] JSON: %s\r\n", error.c_str());
+        wsErr("[httpGetJson] JSON: " + String(error.c_str()));
+        return false;
+    }
+    return true;
+}
+
+/// @brief Like @ref httpGetJson, but served from the shared @ref HttpCache
+/// @param url Request URL, all parameters included as they form the cache key
+/// @param json Json document to fill
+/// @param ttl Time in seconds a cached response stays fresh
+/// @param timeout Request timeout
+/// @param filter Optional deserialization filter
+/// @return True on success, false on error (no usable response || deserialization error)
+static bool httpGetJsonCached(const String &url, JsonDocument &json, const uint32_t ttl, const uint16_t timeout, JsonDocument *filter = nullptr) {
+    File body;
+    const int httpCode = HttpCache::fetch(url, ttl, body, timeout);
+    if (httpCode != 200) {
+        wsErr(String("[httpGetJson] http ") + url + " code " + httpCode);
+        return false;
+    }
+
+    DeserializationError error;
+    if (filter) {
+        error = deserializeJson(json, body, DeserializationOption::Filter(*filter));
+    } else {
+        error = deserializeJson(json, body);
+    }
+    HttpCache::close(body);
     if (error) {
         Serial.printf("[httpGetJson] JSON: %s\r\n", error.c_str());
         wsErr("[httpGetJson] JSON: " + String(error.c_str()));
@@ -20,6 +20,11 @@ public:
     uint8_t read_byte(uint8_t cmd, uint8_t addr);
     void write_flash(uint16_t addr, uint8_t data);
     uint8_t read_flash(uint16_t addr);
+    // programs len bytes from addr with the bus held for the whole page, skips 0xFF bytes so the page must be erased
+    void write_flash_page(uint16_t addr, const uint8_t* data, uint16_t len);
+    // reads len bytes from addr with the bus held for the whole page. Bytes that are 0xFF in
+    // expected (if given) are not read and come back as 0xFF
+    void read_flash_page(uint16_t addr, uint8_t* data, uint16_t len, const uint8_t* expected = nullptr);
     void write_ram(uint8_t addr, uint8_t data);
     uint8_t read_ram(uint8_t addr);
     void write_sfr(uint8_t addr, uint8_t data);
@@ -44,6 +49,9 @@ private:
     uint8_t spi_ready = 0;
     uint32_t after_byte_delay = 10;
 
+    void begin_burst();
+    uint8_t burst_byte(uint8_t data);
+
     typedef enum
     {
         ZBS_CMD_W_RAM = 0x02,
@@ -0,0 +1,57 @@
+#pragma once
+#include <stdint.h>
+
+// Page programming for the ZBS243 debug interface. Templated on the programmer so the
+// host tests can run it against an emulated interface (test/test_zbs_pageprog).
+//
+// Bytes that are 0xFF in the image are never programmed, the flash is erased before.
+// They are not read back either, a page that is mostly empty verifies in a few bytes.
+namespace ZbsPageProg {
+
+/// @brief Program an erased page in one burst and verify it with one burst read back
+/// @details A byte that reads back wrong is read again in byte mode first, the burst read is
+/// faster but less forgiving. Only bytes that are really wrong are rewritten in byte mode.
+/// @param zbs programmer, needs write_flash_page, read_flash_page, write_flash and read_flash
+/// @param offset flash address of the page
+/// @param data image of the page
+/// @param len page length, at most 256
+/// @param maxAttempts byte mode writes per byte before giving up
+/// @param fallbacks incremented when the page needed byte mode
+/// @return false if a byte could not be programmed
+template <class ZBS>
+bool writePage(ZBS &zbs, uint16_t offset, const uint8_t *data, uint16_t len, uint8_t maxAttempts, uint16_t &fallbacks) {
+    uint8_t readback[256];
+    if (len > sizeof(readback)) return false;
+    zbs.write_flash_page(offset, data, len);
+    zbs.read_flash_page(offset, readback, len, data);
+
+    bool fallback = false;
+    for (uint16_t c = 0; c < len; c++) {
+        if (readback[c] == data[c]) continue;
+        if (zbs.read_flash(offset + c) == data[c]) continue;
+        fallback = true;
+        uint8_t i = 0;
+        for (; i < maxAttempts; i++) {
+            zbs.write_flash(offset + c, data[c]);
+            if (zbs.read_flash(offset + c) == data[c]) break;
+        }
+        if (i == maxAttempts) return false;
+    }
+    if (fallback) fallbacks++;
+    return true;
+}
+
+/// @brief Read a programmed page back, mismatches are checked again in byte mode before failing
+/// @return true if the page matches data
+template <class ZBS>
+bool verifyPage(ZBS &zbs, uint16_t offset, const uint8_t *data, uint16_t len) {
+    uint8_t readback[256];
+    if (len > sizeof(readback)) return false;
+    zbs.read_flash_page(offset, readback, len, data);
+    for (uint16_t c = 0; c < len; c++) {
+        if (readback[c] != data[c] && zbs.read_flash(offset + c) != data[c]) return false;
+    }
+    return true;
+}
+
+}  // namespace ZbsPageProg
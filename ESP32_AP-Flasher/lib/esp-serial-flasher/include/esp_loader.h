@@ -174,6 +174,38 @@ esp_loader_error_t esp_loader_flash_write(void *payload, uint32_t size);
   *     - ESP_LOADER_ERROR_INVALID_RESPONSE Internal error
   */
 esp_loader_error_t esp_loader_flash_finish(bool reboot);
+
+/**
+  * @brief Initiates a compressed flash operation
+  *
+  * @param offset[in]          Address from which flash operation will be performed.
+  * @param image_size[in]      Uncompressed size of the binary, this region is erased.
+  * @param compressed_size[in] Size of the zlib stream that will be sent.
+  * @param block_size[in]      Size of the blocks sent with esp_loader_flash_deflate_write.
+  *
+  * @note  The data has to be a zlib stream (with header). No FLASH_DEFL_END is sent,
+  *        as that would make the ROM loader start the application.
+  *
+  * @return
+  *     - ESP_LOADER_SUCCESS Success
+  *     - ESP_LOADER_ERROR_TIMEOUT Timeout
+  *     - ESP_LOADER_ERROR_INVALID_RESPONSE Internal error
+  *     - ESP_LOADER_ERROR_UNSUPPORTED_FUNC Unsupported on the target
+  */
+esp_loader_error_t esp_loader_flash_deflate_start(uint32_t offset, uint32_t image_size, uint32_t compressed_size, uint32_t block_size);
+
+/**
+  * @brief Writes a block of compressed data to the target's flash memory.
+  *
+  * @param payload[in]      Compressed data.
+  * @param size[in]         Size of payload in bytes, only the last block may be shorter than block_size.
+  *
+  * @return
+  *     - ESP_LOADER_SUCCESS Success
+  *     - ESP_LOADER_ERROR_TIMEOUT Timeout
+  *     - ESP_LOADER_ERROR_INVALID_RESPONSE Internal error
+  */
+esp_loader_error_t esp_loader_flash_deflate_write(const void *payload, uint32_t size);
 #endif /* SERIAL_FLASHER_INTERFACE_UART */
 
 
@@ -269,6 +301,27 @@ esp_loader_error_t esp_loader_read_register(uint32_t address, uint32_t *reg_valu
   */
 esp_loader_error_t esp_loader_change_transmission_rate(uint32_t transmission_rate);
 
+/**
+  * @brief Switch to the fastest of a list of baud rates the link carries.
+  *
+  * Each rate is checked with a register read after the change. If that fails,
+  * the host goes back to base_rate and the target is reset into the bootloader
+  * before the next rate is tried.
+  *
+  * @param rates[in]        Baud rates to try, fastest first.
+  * @param count[in]        Number of entries in rates.
+  * @param base_rate[in]    Baud rate of the bootloader after a reset.
+  * @param rate[inout]      Rate in use. If it is not base_rate, the target is
+  *                         reconnected first and only lower rates are tried.
+  *                         Set to base_rate if no rate works.
+  *
+  * @return
+  *     - ESP_LOADER_SUCCESS Success, *rate holds the rate in use
+  *     - ESP_LOADER_ERROR_TIMEOUT Target lost while reconnecting
+  *     - ESP_LOADER_ERROR_INVALID_RESPONSE Internal error
+  */
+esp_loader_error_t esp_loader_negotiate_transmission_rate(const uint32_t *rates, uint32_t count, uint32_t base_rate, uint32_t *rate);
+
 /**
   * @brief Verify target's flash integrity by checking MD5.
   *        MD5 checksum is computed from data pushed to target's memory by calling
@@ -287,6 +340,22 @@ esp_loader_error_t esp_loader_change_transmission_rate(uint32_t transmission_rat
   */
 #if MD5_ENABLED
 esp_loader_error_t esp_loader_flash_verify(void);
+
+/**
+  * @brief Compare the MD5 of a region of the target's flash with a known MD5.
+  *
+  * @param address[in]      Start of the region.
+  * @param size[in]         Size of the region.
+  * @param expected_md5[in] Raw (16 byte) MD5 to compare with.
+  *
+  * @return
+  *     - ESP_LOADER_SUCCESS Region matches
+  *     - ESP_LOADER_ERROR_INVALID_MD5 MD5 does not match
+  *     - ESP_LOADER_ERROR_TIMEOUT Timeout
+  *     - ESP_LOADER_ERROR_INVALID_RESPONSE Internal error
+  *     - ESP_LOADER_ERROR_UNSUPPORTED_FUNC Unsupported on the target
+  */
+esp_loader_error_t esp_loader_flash_verify_known_md5(uint32_t address, uint32_t size, const uint8_t *expected_md5);
 #endif
 /**
   * @brief Toggles reset pin.
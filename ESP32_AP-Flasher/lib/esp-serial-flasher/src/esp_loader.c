@@ -250,10 +250,8 @@ static uint32_t calc_erase_size(const target_chip_t target, const uint32_t offse
     }
 }
 
-esp_loader_error_t esp_loader_flash_start(uint32_t offset, uint32_t image_size, uint32_t block_size)
+static esp_loader_error_t set_flash_parameters(uint32_t image_size)
 {
-    s_flash_write_size = block_size;
-
     size_t flash_size = 0;
     if (detect_flash_size(&flash_size) == ESP_LOADER_SUCCESS) {
         if (image_size > flash_size) {
@@ -264,6 +262,14 @@ esp_loader_error_t esp_loader_flash_start(uint32_t offset, uint32_t image_size,
     } else {
         loader_port_debug_print("Flash size detection failed, falling back to default");
     }
+    return ESP_LOADER_SUCCESS;
+}
+
+esp_loader_error_t esp_loader_flash_start(uint32_t offset, uint32_t image_size, uint32_t block_size)
+{
+    s_flash_write_size = block_size;
+
+    RETURN_ON_ERROR( set_flash_parameters(image_size) );
 
     init_md5(offset, image_size);
 
@@ -277,6 +283,41 @@ esp_loader_error_t esp_loader_flash_start(uint32_t offset, uint32_t image_size,
 }
 
 
+esp_loader_error_t esp_loader_flash_deflate_start(uint32_t offset, uint32_t image_size, uint32_t compressed_size, uint32_t block_size)
+{
+    if (s_target == ESP8266_CHIP) {
+        return ESP_LOADER_ERROR_UNSUPPORTED_FUNC;
+    }
+
+    s_flash_write_size = block_size;
+
+    RETURN_ON_ERROR( set_flash_parameters(image_size) );
+
+    bool encryption_in_cmd = encryption_in_begin_flash_cmd(s_target);
+    /* The ROM loader expects the erase size rounded up to whole blocks */
+    const uint32_t erase_size = ROUNDUP(image_size, block_size) * block_size;
+    const uint32_t blocks_to_write = (compressed_size + block_size - 1) / block_size;
+
+    const uint32_t erase_region_timeout_per_mb = 10000;
+    loader_port_start_timer(timeout_per_mb(erase_size, erase_region_timeout_per_mb));
+    return loader_flash_defl_begin_cmd(offset, erase_size, block_size, blocks_to_write, encryption_in_cmd);
+}
+
+
+esp_loader_error_t esp_loader_flash_deflate_write(const void *payload, uint32_t size)
+{
+    if (size > s_flash_write_size) {
+        return ESP_LOADER_ERROR_INVALID_PARAM;
+    }
+
+    /* A block can inflate to many times its size, allow for the erase and write of that */
+    const uint32_t write_timeout_per_mb = 10000;
+    loader_port_start_timer(timeout_per_mb(s_flash_write_size * 32, write_timeout_per_mb));
+
+    return loader_flash_defl_data_cmd((const uint8_t *)payload, size);
+}
+
+
 esp_loader_error_t esp_loader_flash_write(void *payload, uint32_t size)
 {
     uint32_t padding_bytes = s_flash_write_size - size;
@@ -357,6 +398,50 @@ esp_loader_error_t esp_loader_change_transmission_rate(uint32_t transmission_rat
     return loader_change_baudrate_cmd(transmission_rate);
 }
 
+static esp_loader_error_t reconnect(uint32_t base_rate)
+{
+    esp_loader_connect_args_t connect_args = ESP_LOADER_CONNECT_DEFAULT();
+
+    RETURN_ON_ERROR( loader_port_change_transmission_rate(base_rate) );
+
+    return esp_loader_connect(&connect_args);
+}
+
+esp_loader_error_t esp_loader_negotiate_transmission_rate(const uint32_t *rates, uint32_t count, uint32_t base_rate, uint32_t *rate)
+{
+    const uint32_t current = *rate;
+
+    if (current != base_rate) {
+        RETURN_ON_ERROR( reconnect(base_rate) );
+    }
+    *rate = base_rate;
+
+    if (s_target == ESP8266_CHIP) {
+        return ESP_LOADER_SUCCESS;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (current != base_rate && rates[i] >= current) {
+            continue;
+        }
+        if (esp_loader_change_transmission_rate(rates[i]) == ESP_LOADER_SUCCESS &&
+            loader_port_change_transmission_rate(rates[i]) == ESP_LOADER_SUCCESS) {
+            uint32_t reg_value;
+            loader_port_delay_ms(20);
+            /* Any register read proves the link works at this rate */
+            if (esp_loader_read_register(0x40001000, &reg_value) == ESP_LOADER_SUCCESS) {
+                *rate = rates[i];
+                return ESP_LOADER_SUCCESS;
+            }
+        }
+        /* The target may have switched even if it didn't answer */
+        loader_port_debug_print("Transmission rate change failed, reconnecting\n");
+        RETURN_ON_ERROR( reconnect(base_rate) );
+    }
+
+    return ESP_LOADER_SUCCESS;
+}
+
 #if MD5_ENABLED
 
 static void hexify(const uint8_t raw_md5[16], uint8_t hex_md5_out[32])
@@ -409,6 +494,24 @@ esp_loader_error_t esp_loader_flash_verify(void)
     return ESP_LOADER_SUCCESS;
 }
 
+esp_loader_error_t esp_loader_flash_verify_known_md5(uint32_t address, uint32_t size, const uint8_t *expected_md5)
+{
+    if (s_target == ESP8266_CHIP) {
+        return ESP_LOADER_ERROR_UNSUPPORTED_FUNC;
+    }
+
+    uint8_t hex_md5[MD5_SIZE + 1] = {0};
+    uint8_t received_md5[MD5_SIZE + 1] = {0};
+
+    hexify(expected_md5, hex_md5);
+
+    loader_port_start_timer(timeout_per_mb(size, MD5_TIMEOUT_PER_MB));
+
+    RETURN_ON_ERROR( loader_md5_cmd(address, size, received_md5) );
+
+    return memcmp(hex_md5, received_md5, MD5_SIZE) == 0 ? ESP_LOADER_SUCCESS : ESP_LOADER_ERROR_INVALID_MD5;
+}
+
 #endif
 
 void esp_loader_reset_target(void)
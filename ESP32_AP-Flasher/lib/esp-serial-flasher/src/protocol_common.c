@@ -53,16 +53,17 @@ void log_loader_internal_error(error_code_t error)
 }
 
 
-esp_loader_error_t loader_flash_begin_cmd(uint32_t offset,
-                                          uint32_t erase_size,
-                                          uint32_t block_size,
-                                          uint32_t blocks_to_write,
-                                          bool encryption)
+static esp_loader_error_t flash_begin(command_t command,
+                                      uint32_t offset,
+                                      uint32_t erase_size,
+                                      uint32_t block_size,
+                                      uint32_t blocks_to_write,
+                                      bool encryption)
 {
     flash_begin_command_t flash_begin_cmd = {
         .common = {
             .direction = WRITE_DIRECTION,
-            .command = FLASH_BEGIN,
+            .command = command,
             .size = CMD_SIZE(flash_begin_cmd) - (encryption ? 0 : sizeof(uint32_t)),
             .checksum = 0
         },
@@ -81,12 +82,12 @@ esp_loader_error_t loader_flash_begin_cmd(uint32_t offset,
 }
 
 
-esp_loader_error_t loader_flash_data_cmd(const uint8_t *data, uint32_t size)
+static esp_loader_error_t flash_data(command_t command, const uint8_t *data, uint32_t size)
 {
     data_command_t data_cmd = {
         .common = {
             .direction = WRITE_DIRECTION,
-            .command = FLASH_DATA,
+            .command = command,
             .size = CMD_SIZE(data_cmd) + size,
             .checksum = compute_checksum(data, size)
         },
@@ -98,6 +99,38 @@ esp_loader_error_t loader_flash_data_cmd(const uint8_t *data, uint32_t size)
 }
 
 
+esp_loader_error_t loader_flash_begin_cmd(uint32_t offset,
+                                          uint32_t erase_size,
+                                          uint32_t block_size,
+                                          uint32_t blocks_to_write,
+                                          bool encryption)
+{
+    return flash_begin(FLASH_BEGIN, offset, erase_size, block_size, blocks_to_write, encryption);
+}
+
+
+esp_loader_error_t loader_flash_data_cmd(const uint8_t *data, uint32_t size)
+{
+    return flash_data(FLASH_DATA, data, size);
+}
+
+
+esp_loader_error_t loader_flash_defl_begin_cmd(uint32_t offset,
+                                               uint32_t erase_size,
+                                               uint32_t block_size,
+                                               uint32_t blocks_to_write,
+                                               bool encryption)
+{
+    return flash_begin(FLASH_DEFL_BEGIN, offset, erase_size, block_size, blocks_to_write, encryption);
+}
+
+
+esp_loader_error_t loader_flash_defl_data_cmd(const uint8_t *data, uint32_t size)
+{
+    return flash_data(FLASH_DEFL_DATA, data, size);
+}
+
+
 esp_loader_error_t loader_flash_end_cmd(bool stay_in_loader)
 {
     flash_end_command_t end_cmd = {
@@ -0,0 +1,2 @@
+// Host stand-in, the library sources include Arduino.h but use nothing from it
+#pragma once
@@ -0,0 +1,334 @@
+/* Host tests for compressed flashing, the MD5 check of a flash region and the
+ * baud rate negotiation, against the mocked serial port in serial_io_mock.cpp
+ */
+
+#include "catch.hpp"
+#include "protocol.h"
+#include "serial_io_mock.h"
+#include "esp_loader.h"
+#include "esp_loader_io.h"
+#include <string.h>
+#include <vector>
+
+using namespace std;
+
+#define REQUIRE_SUCCESS(exp) REQUIRE( (exp) == ESP_LOADER_SUCCESS )
+
+namespace {
+
+struct __attribute__((packed)) response {
+    response(command_t cmd, uint32_t value = 0)
+    {
+        data.common.direction = READ_DIRECTION;
+        data.common.command = cmd;
+        data.common.size = 16;
+        data.common.value = value;
+        data.status.failed = STATUS_SUCCESS;
+        data.status.error = 0;
+    }
+
+    response_t data;
+};
+
+struct __attribute__((packed)) md5_response {
+    md5_response(const char *hex_md5)
+    {
+        data.common.direction = READ_DIRECTION;
+        data.common.command = SPI_FLASH_MD5;
+        data.common.size = 16;
+        data.common.value = 0;
+        memcpy(data.md5, hex_md5, MD5_SIZE);
+        data.status.failed = STATUS_SUCCESS;
+        data.status.error = 0;
+    }
+
+    rom_md5_response_t data;
+};
+
+template <class T> void queue(const T &response)
+{
+    set_read_buffer(&response, sizeof(response));
+}
+
+const uint32_t c6_magic_value = 0x2ce0806f;
+
+// An ESP32-C6 answering esp_loader_connect, it reads no efuse for the SPI pins
+void queue_c6_connect()
+{
+    queue(response(SYNC));
+    queue(response(READ_REG, c6_magic_value));
+    queue(response(SPI_ATTACH));
+}
+
+void connect_c6()
+{
+    esp_loader_connect_args_t connect_config = ESP_LOADER_CONNECT_DEFAULT();
+    clear_buffers();
+    serial_reset_rates(115200);
+    queue_c6_connect();
+    REQUIRE_SUCCESS( esp_loader_connect(&connect_config) );
+    REQUIRE( esp_loader_get_target() == ESP32C6_CHIP );
+    clear_buffers();
+    serial_reset_rates(115200);
+}
+
+// The SPI flash READ_ID sequence of detect_flash_size and the SPI_SET_PARAMS after it
+void queue_flash_size(uint8_t size_id)
+{
+    queue(response(READ_REG));  // save usr
+    queue(response(READ_REG));  // save usr2
+    queue(response(WRITE_REG)); // miso length
+    queue(response(WRITE_REG)); // usr
+    queue(response(WRITE_REG)); // usr2
+    queue(response(WRITE_REG)); // clear w0
+    queue(response(WRITE_REG)); // start
+    queue(response(READ_REG, 0)); // done
+    queue(response(READ_REG, (uint32_t)size_id << 16 | 0x40ef)); // flash id
+    queue(response(WRITE_REG)); // restore usr
+    queue(response(WRITE_REG)); // restore usr2
+    queue(response(SPI_SET_PARAMS));
+}
+
+// The last packet the host sent, SLIP decoded
+vector<uint8_t> last_packet()
+{
+    const uint8_t *data = (const uint8_t *)write_buffer_data();
+    size_t end = write_buffer_size() - 1;
+    size_t start = end;
+    while (start > 0 && data[start - 1] != 0xc0) {
+        start--;
+    }
+
+    vector<uint8_t> packet;
+    for (size_t i = start; i < end; i++) {
+        if (data[i] == 0xdb) {
+            packet.push_back(data[++i] == 0xdc ? 0xc0 : 0xdb);
+        } else {
+            packet.push_back(data[i]);
+        }
+    }
+    return packet;
+}
+
+template <class T> T packet_as(const vector<uint8_t> &packet)
+{
+    T cmd;
+    REQUIRE( packet.size() >= sizeof(T) );
+    memcpy(&cmd, packet.data(), sizeof(T));
+    return cmd;
+}
+
+}
+
+// --------------------  Compressed flashing  -----------------------
+
+TEST_CASE( "FLASH_DEFL_BEGIN is framed like FLASH_BEGIN" )
+{
+    clear_buffers();
+    queue(response(FLASH_DEFL_BEGIN));
+
+    REQUIRE_SUCCESS( loader_flash_defl_begin_cmd(0x10000, 0x4000, 0x400, 9, true) );
+
+    auto packet = last_packet();
+    REQUIRE( packet.size() == sizeof(flash_begin_command_t) );
+    auto cmd = packet_as<flash_begin_command_t>(packet);
+    REQUIRE( cmd.common.direction == WRITE_DIRECTION );
+    REQUIRE( cmd.common.command == FLASH_DEFL_BEGIN );
+    REQUIRE( cmd.common.size == 20 );
+    REQUIRE( cmd.erase_size == 0x4000 );
+    REQUIRE( cmd.packet_count == 9 );
+    REQUIRE( cmd.packet_size == 0x400 );
+    REQUIRE( cmd.offset == 0x10000 );
+    REQUIRE( cmd.encrypted == 0 );
+
+    SECTION( "Without the encryption field" ) {
+        clear_buffers();
+        queue(response(FLASH_DEFL_BEGIN));
+        REQUIRE_SUCCESS( loader_flash_defl_begin_cmd(0x10000, 0x4000, 0x400, 9, false) );
+        REQUIRE( last_packet().size() == sizeof(flash_begin_command_t) - sizeof(uint32_t) );
+    }
+}
+
+TEST_CASE( "FLASH_DEFL_DATA carries a checksum and the sequence number" )
+{
+    const uint8_t block[] = { 0x78, 0xda, 0xc0, 0xdb, 0x01, 0x02, 0x03 };
+
+    clear_buffers();
+    queue(response(FLASH_DEFL_BEGIN));
+    queue(response(FLASH_DEFL_DATA));
+    queue(response(FLASH_DEFL_DATA));
+    REQUIRE_SUCCESS( loader_flash_defl_begin_cmd(0, 0x1000, 0x400, 2, false) );
+
+    for (uint32_t seq = 0; seq < 2; seq++) {
+        REQUIRE_SUCCESS( loader_flash_defl_data_cmd(block, sizeof(block)) );
+
+        auto packet = last_packet();
+        REQUIRE( packet.size() == sizeof(data_command_t) + sizeof(block) );
+        auto cmd = packet_as<data_command_t>(packet);
+        uint8_t checksum = 0xef;
+        for (uint8_t b : block) {
+            checksum ^= b;
+        }
+        REQUIRE( cmd.common.command == FLASH_DEFL_DATA );
+        REQUIRE( cmd.common.size == 16 + sizeof(block) );
+        REQUIRE( cmd.common.checksum == checksum );
+        REQUIRE( cmd.data_size == sizeof(block) );
+        REQUIRE( cmd.sequence_number == seq );
+        REQUIRE( memcmp(&packet[sizeof(data_command_t)], block, sizeof(block)) == 0 );
+    }
+}
+
+TEST_CASE( "Compressed flashing erases whole blocks and counts compressed ones" )
+{
+    connect_c6();
+    queue_flash_size(0x16);
+    queue(response(FLASH_DEFL_BEGIN));
+
+    // 16000 bytes inflate into 16 blocks of 1K, 2500 compressed bytes are sent in 3
+    REQUIRE_SUCCESS( esp_loader_flash_deflate_start(0x4000, 16000, 2500, 0x400) );
+
+    auto cmd = packet_as<flash_begin_command_t>(last_packet());
+    REQUIRE( cmd.common.command == FLASH_DEFL_BEGIN );
+    REQUIRE( cmd.erase_size == 16 * 0x400 );
+    REQUIRE( cmd.packet_count == 3 );
+    REQUIRE( cmd.packet_size == 0x400 );
+    REQUIRE( cmd.offset == 0x4000 );
+
+    SECTION( "Blocks larger than announced are refused" ) {
+        vector<uint8_t> block(0x401);
+        REQUIRE( esp_loader_flash_deflate_write(block.data(), block.size()) == ESP_LOADER_ERROR_INVALID_PARAM );
+    }
+
+    SECTION( "Images larger than the flash are refused" ) {
+        clear_buffers();
+        queue_flash_size(0x14);
+        REQUIRE( esp_loader_flash_deflate_start(0, 2 * 1024 * 1024, 1000, 0x400) == ESP_LOADER_ERROR_IMAGE_SIZE );
+    }
+}
+
+// --------------------  MD5 of a flash region  -----------------------
+
+TEST_CASE( "A flash region is compared with a known MD5" )
+{
+    const uint8_t md5[16] = { 0x0f, 0x1e, 0x2d, 0x3c, 0x4b, 0x5a, 0x69, 0x78,
+                              0x87, 0x96, 0xa5, 0xb4, 0xc3, 0xd2, 0xe1, 0xf0 };
+    const char *hex_md5 = "0f1e2d3c4b5a69788796a5b4c3d2e1f0";
+
+    connect_c6();
+
+    SECTION( "Matching region" ) {
+        queue(md5_response(hex_md5));
+        REQUIRE_SUCCESS( esp_loader_flash_verify_known_md5(0x10000, 0x4000, md5) );
+
+        auto cmd = packet_as<spi_flash_md5_command_t>(last_packet());
+        REQUIRE( cmd.common.command == SPI_FLASH_MD5 );
+        REQUIRE( cmd.address == 0x10000 );
+        REQUIRE( cmd.size == 0x4000 );
+    }
+
+    SECTION( "Changed region" ) {
+        queue(md5_response("0f1e2d3c4b5a69788796a5b4c3d2e1f1"));
+        REQUIRE( esp_loader_flash_verify_known_md5(0x10000, 0x4000, md5) == ESP_LOADER_ERROR_INVALID_MD5 );
+    }
+
+    SECTION( "No answer" ) {
+        REQUIRE( esp_loader_flash_verify_known_md5(0x10000, 0x4000, md5) == ESP_LOADER_ERROR_TIMEOUT );
+    }
+}
+
+// --------------------  Baud rate negotiation  -----------------------
+
+TEST_CASE( "The fastest working baud rate is used" )
+{
+    const uint32_t rates[] = { 921600, 460800 };
+    uint32_t rate = 115200;
+
+    connect_c6();
+
+    SECTION( "First rate works" ) {
+        queue(response(CHANGE_BAUDRATE));
+        queue(response(READ_REG, c6_magic_value));
+
+        REQUIRE_SUCCESS( esp_loader_negotiate_transmission_rate(rates, 2, 115200, &rate) );
+        REQUIRE( rate == 921600 );
+        REQUIRE( serial_rate_changes() == vector<uint32_t>({ 921600 }) );
+        REQUIRE( serial_bootloader_entries() == 0 );
+    }
+
+    SECTION( "Target is reset after a failed rate, the next one works" ) {
+        serial_set_failing_rate(921600);
+        queue(response(CHANGE_BAUDRATE));
+        queue_c6_connect();
+        queue(response(CHANGE_BAUDRATE));
+        queue(response(READ_REG, c6_magic_value));
+
+        REQUIRE_SUCCESS( esp_loader_negotiate_transmission_rate(rates, 2, 115200, &rate) );
+        REQUIRE( rate == 460800 );
+        REQUIRE( serial_rate_changes() == vector<uint32_t>({ 921600, 115200, 460800 }) );
+        REQUIRE( serial_bootloader_entries() == 1 );
+    }
+
+    SECTION( "No rate works, the base rate stays" ) {
+        serial_set_failing_rate(921600);
+        serial_set_failing_rate(460800);
+        queue(response(CHANGE_BAUDRATE));
+        queue_c6_connect();
+        queue(response(CHANGE_BAUDRATE));
+        queue_c6_connect();
+
+        REQUIRE_SUCCESS( esp_loader_negotiate_transmission_rate(rates, 2, 115200, &rate) );
+        REQUIRE( rate == 115200 );
+        REQUIRE( serial_rate() == 115200 );
+        REQUIRE( serial_bootloader_entries() == 2 );
+    }
+
+    SECTION( "Target refuses the change" ) {
+        auto refused = response(CHANGE_BAUDRATE);
+        refused.data.status.failed = STATUS_FAILURE;
+        refused.data.status.error = INVALID_COMMAND;
+        queue(refused);
+        queue_c6_connect();
+        queue(response(CHANGE_BAUDRATE));
+        queue(response(READ_REG, c6_magic_value));
+
+        REQUIRE_SUCCESS( esp_loader_negotiate_transmission_rate(rates, 2, 115200, &rate) );
+        REQUIRE( rate == 460800 );
+        REQUIRE( serial_rate_changes() == vector<uint32_t>({ 115200, 460800 }) );
+    }
+
+    SECTION( "Target lost while reconnecting" ) {
+        serial_set_failing_rate(921600);
+        queue(response(CHANGE_BAUDRATE));
+
+        REQUIRE( esp_loader_negotiate_transmission_rate(rates, 2, 115200, &rate) == ESP_LOADER_ERROR_TIMEOUT );
+    }
+}
+
+TEST_CASE( "Falling back reconnects and only tries lower rates" )
+{
+    const uint32_t rates[] = { 921600, 460800 };
+
+    connect_c6();
+    serial_reset_rates(921600);
+
+    SECTION( "From the fastest rate" ) {
+        uint32_t rate = 921600;
+        queue_c6_connect();
+        queue(response(CHANGE_BAUDRATE));
+        queue(response(READ_REG, c6_magic_value));
+
+        REQUIRE_SUCCESS( esp_loader_negotiate_transmission_rate(rates, 2, 115200, &rate) );
+        REQUIRE( rate == 460800 );
+        REQUIRE( serial_rate_changes() == vector<uint32_t>({ 115200, 460800 }) );
+        REQUIRE( serial_bootloader_entries() == 1 );
+    }
+
+    SECTION( "From the slowest rate" ) {
+        uint32_t rate = 460800;
+        queue_c6_connect();
+
+        REQUIRE_SUCCESS( esp_loader_negotiate_transmission_rate(rates, 2, 115200, &rate) );
+        REQUIRE( rate == 115200 );
+        REQUIRE( serial_rate_changes() == vector<uint32_t>({ 115200 }) );
+    }
+}
@@ -2,6 +2,8 @@
 
 #include <FS.h>
 
+#include "contentmanager.h"
+
 #define SPIFFS_MAXLENGTH_FILEPATH 32
 
 SPIFFSEditor::SPIFFSEditor(const fs::FS &fs, const String &username, const String &password)
@@ -161,6 +163,7 @@ void SPIFFSEditor::handleUpload(AsyncWebServerRequest *request, const String &fi
         }
         if (final) {
             request->_tempFile.close();
+            invalidateVarIndex();
         }
     }
 }
@@ -3,6 +3,8 @@
 #include <FS.h>
 
 #include "BLEDevice.h"
+#include "ble_pack.h"
+#include "fslock.h"
 #include "newproto.h"
 #include "serialap.h"
 #include "settings.h"
@@ -14,8 +16,6 @@
 #include "util.h"
 #include "web.h"
 
-uint8_t* Mirrorbuffer;
-
 uint8_t gicToOEPLtype(uint8_t gicType) {
     switch (gicType) {
         case 0xA0:
@@ -237,54 +237,106 @@ bool BLE_filter_add_device(BLEAdvertisedDevice advertisedDevice) {
     return false;
 }
 
-bool BLE_is_image_pending(uint8_t address[8]) {
-    for (int16_t c = 0; c < tagDB.size(); c++) {
+uint8_t BLE_get_pending(uint8_t addresses[][8], uint8_t maxCount) {
+    uint8_t count = 0;
+    for (int16_t c = 0; c < tagDB.size() && count < maxCount; c++) {
         tagRecord* taginfo = tagDB.at(c);
-        if (taginfo->pendingCount > 0 && taginfo->version == 0 && ((taginfo->hwType & 0xB0) == 0xB0)) {
-            memcpy(address, taginfo->mac, 8);
-            return true;
+        // tags of another AP carry its pendingCount, but the queue item is over there
+        if (taginfo->pendingCount == 0 || taginfo->version != 0 || taginfo->isExternal) continue;
+        // Gicisky displays and ATC BLE OEPL displays
+        if (((taginfo->hwType & 0xB0) == 0xB0) || (taginfo->mac[7] == 0x13 && taginfo->mac[6] == 0x37)) {
+            memcpy(addresses[count++], taginfo->mac, 8);
         }
     }
-    for (int16_t c = 0; c < tagDB.size(); c++) {
-        tagRecord* taginfo = tagDB.at(c);
-        if (taginfo->pendingCount > 0 && taginfo->version == 0 && (taginfo->mac[7] == 0x13) && (taginfo->mac[6] == 0x37)) {
-            memcpy(address, taginfo->mac, 8);
-            Serial.printf("ATC BLE OEPL data Waiting\r\n");
-            return true;
+    return count;
+}
+
+struct GicPackedHeader {
+    uint64_t dataVer;
+    uint16_t giciType;
+    uint32_t len;
+} __packed;
+
+static String packedCachePath(const uint8_t address[8]) {
+    char path[40];
+    snprintf(path, sizeof(path), "/current/%02X%02X%02X%02X%02X%02X%02X%02X.gic", address[7], address[6], address[5], address[4], address[3], address[2], address[1], address[0]);
+    return String(path);
+}
+
+// the packed image of the last attempt, valid as long as the pending image didn't change
+static uint32_t readPackedCache(const String& path, uint64_t dataVer, uint16_t giciType, uint8_t* buffer, uint32_t max_len) {
+    uint32_t len = 0;
+    FsLock::lock(path, FsLock::READ, "blefilter");
+    fs::File file;
+    if (contentFS->exists(path)) file = contentFS->open(path, "r");
+    if (file) {
+        struct GicPackedHeader header;
+        if (file.read((uint8_t*)&header, sizeof(header)) == sizeof(header) && header.dataVer == dataVer && header.giciType == giciType &&
+            header.len <= max_len && file.read(buffer, header.len) == header.len) {
+            len = header.len;
         }
+        file.close();
     }
-    return false;
+    FsLock::unlock(path, FsLock::READ);
+    return len;
 }
 
-uint8_t swapBits(uint8_t num) {
-    uint8_t result = 0;
-    for (int i = 0; i < 8; ++i) {
-        result |= ((num >> i) & 0x01) << (7 - i);
+static void writePackedCache(const String& path, uint64_t dataVer, uint16_t giciType, const uint8_t* buffer, uint32_t len) {
+    struct GicPackedHeader header = {dataVer, giciType, len};
+    FsLock::lock(path, FsLock::WRITE, "blefilter");
+    fs::File file = contentFS->open(path, "w");
+    if (file) {
+        const bool ok = file.write((const uint8_t*)&header, sizeof(header)) == sizeof(header) && file.write(buffer, len) == len;
+        file.close();
+        if (!ok) contentFS->remove(path);
     }
-    return result;
+    FsLock::unlock(path, FsLock::WRITE);
 }
 
-uint32_t compress_image(uint8_t address[8], uint8_t* buffer, uint32_t max_len) {
+void BLE_drop_packed(uint8_t address[8]) {
+    const String path = packedCachePath(address);
+    FsLock::lock(path, FsLock::WRITE, "blefilter");
+    if (contentFS->exists(path)) contentFS->remove(path);
+    FsLock::unlock(path, FsLock::WRITE);
+}
+
+// reads the image of a copied queue item unless the queue had it loaded already
+static bool loadQueueItemData(uint8_t address[8], PendingItem& queueItem) {
+    if (queueItem.data != nullptr) return true;
     uint32_t t = millis();
-    PendingItem* queueItem = getQueueItem(address, 0);
-    if (queueItem == nullptr) {
+    const String filename = queueItem.filename;
+    FsLock::lock(filename, FsLock::READ, "blefilter");
+    fs::File file = contentFS->open(filename);
+    if (!file) {
+        FsLock::unlock(filename, FsLock::READ);
+        Serial.print("No current file. " + filename + " Canceling request\r\n");
         prepareCancelPending(address);
+        return false;
+    }
+    queueItem.data = getDataForFile(file);
+    file.close();
+    FsLock::unlock(filename, FsLock::READ);
+    Serial.println("Reading file " + filename + " in  " + String(millis() - t) + "ms");
+    return queueItem.data != nullptr;
+}
+
+uint32_t compress_image(uint8_t address[8], uint8_t* buffer, uint32_t max_len) {
+    uint32_t t = millis();
+    PendingItem queueItem;
+    if (!copyQueueItem(address, 0, queueItem)) {
+        // not queued (yet), nothing to cancel
         Serial.printf("blockrequest: couldn't find taginfo %02X%02X%02X%02X%02X%02X%02X%02X\r\n", address[7], address[6], address[5], address[4], address[3], address[2], address[1], address[0]);
         return 0;
     }
-    if (queueItem->data == nullptr) {
-        fs::File file = contentFS->open(queueItem->filename);
-        if (!file) {
-            Serial.print("No current file. " + String(queueItem->filename) + " Canceling request\r\n");
-            prepareCancelPending(address);
-            return 0;
-        }
-        queueItem->data = getDataForFile(file);
-        Serial.println("Reading file " + String(queueItem->filename) + " in  " + String(millis() - t) + "ms");
-        file.close();
-    }
 
-    uint16_t giciType = (address[7] << 8) | address[6];  // here we "extract" the display info again
+    const uint16_t giciType = (address[7] << 8) | address[6];  // here we "extract" the display info again
+    const uint64_t dataVer = queueItem.pendingdata.availdatainfo.dataVer;
+    const String cachePath = packedCachePath(address);
+    uint32_t cachedLen = readPackedCache(cachePath, dataVer, giciType, buffer, max_len);
+    if (cachedLen) {
+        Serial.printf("BLE using packed image from cache, %d bytes in %dms\r\n", cachedLen, millis() - t);
+        return cachedLen;
+    }
 
     uint8_t screenResolution = (giciType >> 5) & 63;
     uint8_t dispPtype = (giciType >> 3) & 3;
@@ -389,16 +441,13 @@ uint32_t compress_image(uint8_t address[8], uint8_t* buffer, uint32_t max_len) {
             break;
     }
 
-    uint32_t len_compressed = 0;
-    if (canDoCompression)
-        len_compressed = 4;
-    uint32_t curr_input_posi = 0;
     uint32_t byte_per_line = (height_display / 8);
     if (height_display % 8 != 0)
         byte_per_line++;
-    Mirrorbuffer = (uint8_t*)malloc(byte_per_line + 1);
-    if (Mirrorbuffer == nullptr) {
-        Serial.println("BLE Could not create Mirrorbuffer!");
+    const uint32_t planes = extra_color ? 2 : 1;
+    const uint32_t total_len = (canDoCompression ? 4 : 0) + BlePack::packedSize(width_display, byte_per_line, planes, canDoCompression);
+    if (total_len > max_len) {
+        Serial.printf("BLE packed image too big, %d > %d\r\n", total_len, max_len);
         return 0;
     }
     Serial.printf("BLE Filter options:\r\n");
@@ -412,102 +461,44 @@ uint32_t compress_image(uint8_t address[8], uint8_t* buffer, uint32_t max_len) {
     Serial.printf("width_display %d\r\n", width_display);
     Serial.printf("height_display %d\r\n", height_display);
     Serial.printf("mirror_width %d\r\n", mirror_width);
-    for (int i = 0; i < width_display; i++) {
-        if (canDoCompression) {
-            buffer[len_compressed++] = 0x75;
-            buffer[len_compressed++] = byte_per_line + 7;
-            buffer[len_compressed++] = byte_per_line;
-            buffer[len_compressed++] = 0x00;
-            buffer[len_compressed++] = 0x00;
-            buffer[len_compressed++] = 0x00;
-            buffer[len_compressed++] = 0x00;
-        }
-        if (mirror_width) {
-            for (int b = 0; b < byte_per_line; b++) {
-                Mirrorbuffer[b] = ~queueItem->data[curr_input_posi++];
-            }
-            for (int b = byte_per_line - 1; b >= 0; b--) {
-                buffer[len_compressed++] = swapBits(Mirrorbuffer[b]);
-            }
-        } else {
-            for (int b = 0; b < byte_per_line; b++) {
-                buffer[len_compressed++] = ~queueItem->data[curr_input_posi++];
-            }
-        }
-    }
-    if (extra_color) {
-        for (int i = 0; i < width_display; i++) {
-            if (canDoCompression) {
-                buffer[len_compressed++] = 0x75;
-                buffer[len_compressed++] = byte_per_line + 7;
-                buffer[len_compressed++] = byte_per_line;
-                buffer[len_compressed++] = 0x00;
-                buffer[len_compressed++] = 0x00;
-                buffer[len_compressed++] = 0x00;
-                buffer[len_compressed++] = 0x00;
-            }
-            if (mirror_width) {
-                for (int b = 0; b < byte_per_line; b++) {
-                    if (queueItem->len <= curr_input_posi)
-                        Mirrorbuffer[b] = 0x00;  // Do not anything outside of the buffer!
-                    else
-                        Mirrorbuffer[b] = queueItem->data[curr_input_posi++];
-                }
-                for (int b = byte_per_line - 1; b >= 0; b--) {
-                    buffer[len_compressed++] = swapBits(Mirrorbuffer[b]);
-                }
-            } else {
-                for (int b = 0; b < byte_per_line; b++) {
-                    if (queueItem->len <= curr_input_posi) {
-                        buffer[len_compressed++] = 0x00;  // Do not anything outside of the buffer!
-                    } else {
-                        buffer[len_compressed++] = queueItem->data[curr_input_posi++];
-                    }
-                }
-            }
-        }
-    }
+
+    if (!loadQueueItemData(address, queueItem)) return 0;
+    t = millis();
+    uint32_t len_compressed = canDoCompression ? 4 : 0;
+    len_compressed += BlePack::packImage(queueItem.data, queueItem.len, buffer + len_compressed, width_display, byte_per_line, planes, canDoCompression, mirror_width);
     if (canDoCompression) {
         buffer[0] = len_compressed & 0xff;
         buffer[1] = (len_compressed >> 8) & 0xff;
         buffer[2] = (len_compressed >> 16) & 0xff;
         buffer[3] = (len_compressed >> 24) & 0xff;
     }
-    free(Mirrorbuffer);
+    free(queueItem.data);
+    Serial.printf("BLE packed %d bytes in %dms\r\n", len_compressed, millis() - t);
+    writePackedCache(cachePath, dataVer, giciType, buffer, len_compressed);
     return len_compressed;
 }
 
 uint32_t get_ATC_BLE_OEPL_image(uint8_t address[8], uint8_t* buffer, uint32_t max_len, uint8_t* dataType, uint8_t* dataTypeArgument, uint16_t* nextCheckIn) {
-    uint32_t t = millis();
-    PendingItem* queueItem = getQueueItem(address, 0);
-    if (queueItem == nullptr) {
-        prepareCancelPending(address);
+    PendingItem queueItem;
+    if (!copyQueueItem(address, 0, queueItem)) {
+        // not queued (yet), nothing to cancel
         Serial.printf("blockrequest: couldn't find taginfo %02X%02X%02X%02X%02X%02X%02X%02X\r\n", address[7], address[6], address[5], address[4], address[3], address[2], address[1], address[0]);
         return 0;
     }
-    if (queueItem->data == nullptr) {
-        fs::File file = contentFS->open(queueItem->filename);
-        if (!file) {
-            Serial.print("No current file. " + String(queueItem->filename) + " Canceling request\r\n");
-            prepareCancelPending(address);
-            return 0;
-        }
-        queueItem->data = getDataForFile(file);
-        Serial.println("Reading file " + String(queueItem->filename) + " in  " + String(millis() - t) + "ms");
-        file.close();
-    }
-    if (queueItem->len > max_len) {
+    if (!loadQueueItemData(address, queueItem)) return 0;
+    if (queueItem.len > max_len) {
         Serial.print("The upload is too big better cencel it\r\n");
+        free(queueItem.data);
         prepareCancelPending(address);
         return 0;
     }
-    *dataType = queueItem->pendingdata.availdatainfo.dataType;
-    *dataTypeArgument = queueItem->pendingdata.availdatainfo.dataTypeArgument;
-    *nextCheckIn = queueItem->pendingdata.availdatainfo.nextCheckIn;
-    uint32_t len_compressed = queueItem->len;
-    memcpy(buffer, queueItem->data, queueItem->len);
-    Serial.print("Data is prepared Len: " + String(queueItem->len) + "\r\n");
-    return queueItem->len;
+    *dataType = queueItem.pendingdata.availdatainfo.dataType;
+    *dataTypeArgument = queueItem.pendingdata.availdatainfo.dataTypeArgument;
+    *nextCheckIn = queueItem.pendingdata.availdatainfo.nextCheckIn;
+    memcpy(buffer, queueItem.data, queueItem.len);
+    free(queueItem.data);
+    Serial.print("Data is prepared Len: " + String(queueItem.len) + "\r\n");
+    return queueItem.len;
 }
 
 #endif
@@ -1,29 +1,48 @@
 #ifdef HAS_BLE_WRITER
+#include "ble_writer.h"
+
 #include <Arduino.h>
 #include <MD5Builder.h>
 
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <new>
+#include <vector>
+
 #include "BLEDevice.h"
 #include "ble_filter.h"
+#include "ble_schedule.h"
 #include "newproto.h"
+#include "web.h"
 
 #define INTERVAL_BLE_SCANNING_SECONDS 60
 #define INTERVAL_HANDLE_PENDING_SECONDS 10
 #define BUFFER_MAX_SIZE_COMPRESSING 135000
 
-#define BLE_MAIN_STATE_IDLE 0
-#define BLE_MAIN_STATE_PREPARE 1
-#define BLE_MAIN_STATE_CONNECT 2
-#define BLE_MAIN_STATE_UPLOAD 3
-#define BLE_MAIN_STATE_ATC_BLE_OEPL_UPLOAD 4
+// MTU requested at connect, large enough for the biggest part of both protocols
+#define BLE_MTU_WANTED 255
+// how long to wait for the connection and MTU exchange to complete
+#define BLE_CONNECT_READY_TIMEOUT 3000
+// ATC block parts written without response before an ACK is needed
+#define BLE_PART_WINDOW 4
+// notifications received but not handled yet
+#define BLE_NOTIFY_QUEUE_LEN 16
+#define BLE_NOTIFY_TIMEOUT_MS 30000
 
-int ble_main_state = BLE_MAIN_STATE_IDLE;
-uint32_t last_ble_scan = 0;
+// concurrent connections, each one holds a compressed image buffer
+#if defined(CONFIG_BT_ACL_CONNECTIONS) && CONFIG_BT_ACL_CONNECTIONS < 3
+#define BLE_MAX_SESSIONS CONFIG_BT_ACL_CONNECTIONS
+#else
+#define BLE_MAX_SESSIONS 3
+#endif
+// pending tags looked at per scheduling round
+#define BLE_MAX_CANDIDATES 32
 
 #define BLE_UPLOAD_STATE_INIT 0
 #define BLE_UPLOAD_STATE_SIZE 1
 #define BLE_UPLOAD_STATE_START 2
 #define BLE_UPLOAD_STATE_UPLOAD 5
-int BLE_upload_state = BLE_UPLOAD_STATE_INIT;
 
 #define BLE_CMD_ACK_CMD 99
 #define BLE_CMD_AVAILDATA 100
@@ -35,11 +54,8 @@ int BLE_upload_state = BLE_UPLOAD_STATE_INIT;
 #define BLE_CMD_ACK_IS_SHOWN 200
 #define BLE_CMD_ACK_FW_UPDATED 201
 
-struct AvailDataInfo BLEavaildatainfo = {0};
-struct blockRequest BLEblkRequst = {0};
-
-bool BLE_connected = false;
-bool BLE_new_notify = false;
+#define BLOCK_DATA_SIZE_BLE 4096
+#define BLOCK_PART_DATA_SIZE_BLE 230
 
 static BLEUUID ATC_BLE_OEPL_ServiceUUID((uint16_t)0x1337);
 static BLEUUID ATC_BLE_OEPL_CtrlUUID((uint16_t)0x1337);
@@ -48,24 +64,86 @@ static BLEUUID gicServiceUUID((uint16_t)0xfef0);
 static BLEUUID gicCtrlUUID((uint16_t)0xfef1);
 static BLEUUID gicImgUUID((uint16_t)0xfef2);
 
-BLERemoteCharacteristic* ctrlChar;
-BLERemoteCharacteristic* imgChar;
-BLEAdvertisedDevice* myDevice;
-BLEClient* pClient;
+uint32_t last_ble_scan = 0;
+uint32_t BLE_last_pending_check = 0;
 
-uint8_t BLE_notify_buffer[256] = {0};
+enum BLE_CONNECTION_TYPE {
+    BLE_TYPE_GICISKY = 0,
+    BLE_TYPE_ATC_BLE_OEPL
+};
 
-uint32_t BLE_err_counter = 0;
-uint32_t BLE_curr_part = 0;
-uint32_t BLE_max_block_parts = 0;
-uint8_t BLE_mini_buff[256];
+// millis() timestamps of a transfer
+struct BLETransferTiming {
+    uint32_t start;
+    uint32_t connected;
+    uint32_t lastData;
+    uint32_t done;
+};
 
-uint32_t BLE_last_notify = 0;
-uint32_t BLE_last_pending_check = 0;
-uint8_t BLE_curr_address[8] = {0};
+// a single tag being updated, runs in its own task
+struct BLESession {
+    uint8_t address[8];
+    BLE_CONNECTION_TYPE type;
+    TaskHandle_t task = nullptr;
+    BLEClient* client = nullptr;
+    BLERemoteCharacteristic* ctrlChar = nullptr;
+    BLERemoteCharacteristic* imgChar = nullptr;
+    QueueHandle_t notifyQueue = nullptr;
+    volatile bool connected = false;
+    volatile bool finished = false;
+    bool newNotify = false;
+    const char* result = nullptr;
+    bool reportComplete = false;
+    // the image wasn't queued yet, not counted as a failure
+    bool notReady = false;
+    uint8_t notifyBuffer[256];
+    uint8_t miniBuff[256];
+    uint8_t* imageBuffer = nullptr;
+    uint32_t compressedLen = 0;
+    struct AvailDataInfo availDataInfo;
+    struct blockRequest blkRequest;
+    int uploadState = BLE_UPLOAD_STATE_INIT;
+    uint32_t errCounter = 0;
+    // ATC block parts written, currPart counts the acknowledged ones
+    uint32_t currPart = 0;
+    uint32_t partsSent = 0;
+    uint32_t maxBlockParts = 0;
+    uint32_t lastNotify = 0;
+    uint16_t mtu = ESP_GATT_DEF_BLE_MTU_SIZE;
+    BLETransferTiming timing = {0};
+    uint8_t blockBuffer[BLOCK_DATA_SIZE_BLE + 4];
+    uint8_t packetBuffer[2 + 3 + BLOCK_PART_DATA_SIZE_BLE];
+};
+
+// scheduler view of a tag, kept after the transfer for the web UI
+struct BLETagStatus : BleSchedule::TagState {
+    const char* lastResult = nullptr;
+    time_t lastTime = 0;
+    BLETransferTiming timing = {0};
+};
+
+static TaskHandle_t schedulerTask = nullptr;
+static BLESession* sessions[BLE_MAX_SESSIONS] = {nullptr};
+static uint8_t maxSessions = 1;
+static uint32_t queueDepth = 0;
+// guards sessions[] and tagStatus, the BLE callbacks look sessions up by client
+static std::mutex sessionMutex;
+static std::map<uint64_t, BLETagStatus> tagStatus;
+// one connection setup or scan at a time, the controller can't run them in parallel
+static SemaphoreHandle_t connectMutex = nullptr;
 
-uint32_t BLE_compressed_len = 0;
-uint8_t* BLE_image_buffer;
+static uint64_t macKey(const uint8_t address[8]) {
+    uint64_t key;
+    memcpy(&key, address, 8);
+    return key;
+}
+
+static BLESession* findSession(BLEClient* client) {
+    for (uint8_t i = 0; i < BLE_MAX_SESSIONS; i++) {
+        if (sessions[i] && sessions[i]->client == client) return sessions[i];
+    }
+    return nullptr;
+}
 
 static void notifyCallback(
     BLERemoteCharacteristic* pBLERemoteCharacteristic,
@@ -77,88 +155,118 @@ static void notifyCallback(
     Serial.print(" of data length ");
     Serial.println(length);
     Serial.print("data: ");
+    uint8_t notification[sizeof(BLESession::notifyBuffer)];
+    if (length > sizeof(notification) - 1) length = sizeof(notification) - 1;
     for (int i = 0; i < length; i++) {
         Serial.printf("%02X", pData[i]);
-        BLE_notify_buffer[1 + i] = pData[i];
+        notification[1 + i] = pData[i];
     }
-    BLE_notify_buffer[0] = length;
+    notification[0] = length;
     Serial.println();
-    BLE_new_notify = true;
+    std::lock_guard<std::mutex> lock(sessionMutex);
+    BLESession* session = findSession(pBLERemoteCharacteristic->getRemoteService()->getClient());
+    // with several parts in flight every ACK counts, so don't overwrite a pending one
+    if (session == nullptr || xQueueSend(session->notifyQueue, notification, 0) != pdTRUE) {
+        Serial.println("BLE notification dropped");
+    }
 }
 
 class MyClientCallback : public BLEClientCallbacks {
     void onConnect(BLEClient* pclient) {
         Serial.println("BLE onConnect");
-        BLE_connected = true;
+        std::lock_guard<std::mutex> lock(sessionMutex);
+        BLESession* session = findSession(pclient);
+        if (session) session->connected = true;
     }
 
     void onDisconnect(BLEClient* pclient) {
         Serial.println("BLE onDisconnect");
         pclient->disconnect();
-        BLE_connected = false;
-        ble_main_state = BLE_MAIN_STATE_IDLE;
+        std::lock_guard<std::mutex> lock(sessionMutex);
+        BLESession* session = findSession(pclient);
+        if (session) session->connected = false;
     }
 };
 
-enum BLE_CONNECTION_TYPE {
-    BLE_TYPE_GICISKY = 0,
-    BLE_TYPE_ATC_BLE_OEPL
-};
+static MyClientCallback clientCallbacks;
 
-bool BLE_connect(uint8_t addr[8], BLE_CONNECTION_TYPE conn_type) {
-    BLE_err_counter = 0;
+bool BLE_connect(BLESession* s) {
+    uint8_t* addr = s->address;
     uint8_t temp_Address[] = {addr[5], addr[4], addr[3], addr[2], addr[1], addr[0]};
     Serial.printf("BLE Connecting to: %02X:%02X:%02X:%02X:%02X:%02X\r\n", addr[5], addr[4], addr[3], addr[2], addr[1], addr[0]);
-    pClient = BLEDevice::createClient();
-    pClient->setClientCallbacks(new MyClientCallback());
-    if (!pClient->connect(BLEAddress(temp_Address))) {
+    s->timing = {millis(), 0, 0, 0};
+    xQueueReset(s->notifyQueue);
+    BLEClient* client = BLEDevice::createClient();
+    client->setClientCallbacks(&clientCallbacks);
+    {
+        std::lock_guard<std::mutex> lock(sessionMutex);
+        s->client = client;
+    }
+    if (!client->connect(BLEAddress(temp_Address))) {
         Serial.printf("BLE connection failed\r\n");
-        pClient->disconnect();
+        client->disconnect();
         return false;
     }
+    // the MTU exchange runs right after connecting, wait until it's done instead of a fixed delay
     uint32_t timeStart = millis();
-    while (millis() - timeStart <= 5000) {  // We wait for a few seconds as otherwise the connection might not be ready!
-        delay(100);
+    while (millis() - timeStart <= BLE_CONNECT_READY_TIMEOUT && (!s->connected || client->getMTU() == ESP_GATT_DEF_BLE_MTU_SIZE)) {
+        delay(10);
     }
-    if (!BLE_connected)
+    if (!s->connected)
         return false;
+    s->mtu = client->getMTU();
     Serial.printf("BLE starting to get service\r\n");
-    BLERemoteService* pRemoteService = pClient->getService((conn_type == BLE_TYPE_GICISKY) ? gicServiceUUID : ATC_BLE_OEPL_ServiceUUID);
+    BLERemoteService* pRemoteService = client->getService((s->type == BLE_TYPE_GICISKY) ? gicServiceUUID : ATC_BLE_OEPL_ServiceUUID);
     if (pRemoteService == nullptr) {
         Serial.printf("BLE Service failed\r\n");
-        pClient->disconnect();
+        client->disconnect();
         return false;
     }
-    if (conn_type == BLE_TYPE_GICISKY) {
-        imgChar = pRemoteService->getCharacteristic(gicImgUUID);
-        if (imgChar == nullptr) {
+    if (s->type == BLE_TYPE_GICISKY) {
+        s->imgChar = pRemoteService->getCharacteristic(gicImgUUID);
+        if (s->imgChar == nullptr) {
             Serial.printf("BLE IMG Char failed\r\n");
-            pClient->disconnect();
+            client->disconnect();
             return false;
         }
     }
-    ctrlChar = pRemoteService->getCharacteristic((conn_type == BLE_TYPE_GICISKY) ? gicCtrlUUID : ATC_BLE_OEPL_CtrlUUID);
-    if (ctrlChar == nullptr) {
+    s->ctrlChar = pRemoteService->getCharacteristic((s->type == BLE_TYPE_GICISKY) ? gicCtrlUUID : ATC_BLE_OEPL_CtrlUUID);
+    if (s->ctrlChar == nullptr) {
         Serial.printf("BLE ctrl Char failed\r\n");
-        pClient->disconnect();
+        client->disconnect();
         return false;
     }
-    if (ctrlChar->canNotify()) {
-        ctrlChar->registerForNotify(notifyCallback);
+    if (s->ctrlChar->canNotify()) {
+        s->ctrlChar->registerForNotify(notifyCallback);
     } else {
         Serial.printf("BLE Notify failed\r\n");
-        pClient->disconnect();
+        client->disconnect();
         return false;
     }
-    if (pClient->setMTU(255) == false) {
-        Serial.printf("BLE MTU failed\r\n");
-        pClient->disconnect();
+    // a part has to fit in a single write, ATT header is 3 bytes
+    const uint16_t partSize = (s->type == BLE_TYPE_GICISKY) ? (4 + 240) : (5 + BLOCK_PART_DATA_SIZE_BLE);
+    if (s->mtu - 3 < partSize) {
+        Serial.printf("BLE MTU %d too small for %d byte parts\r\n", s->mtu, partSize);
+        client->disconnect();
         return false;
     }
-    Serial.printf("BLE Connected fully to: %02X:%02X:%02X:%02X:%02X:%02X\r\n", addr[5], addr[4], addr[3], addr[2], addr[1], addr[0]);
+    s->timing.connected = millis();
+    Serial.printf("BLE Connected fully to: %02X:%02X:%02X:%02X:%02X:%02X, MTU %d\r\n", addr[5], addr[4], addr[3], addr[2], addr[1], addr[0], s->mtu);
     return true;
 }
 
+void BLE_report_timing(BLESession* s, const char* result) {
+    const uint32_t now = millis();
+    const uint32_t lastData = s->timing.lastData ? s->timing.lastData : now;
+    s->timing.lastData = lastData;
+    s->timing.done = now;
+    char buffer[128];
+    snprintf(buffer, sizeof(buffer), "BLE %02X%02X%02X%02X%02X%02X %s: connect %lums, transfer %lums (%lu bytes), display %lums",
+             s->address[5], s->address[4], s->address[3], s->address[2], s->address[1], s->address[0], result,
+             s->timing.connected - s->timing.start, lastData - s->timing.connected, s->compressedLen, now - lastData);
+    wsLog(buffer);
+}
+
 class MyAdvertisedDeviceCallbacks : public BLEAdvertisedDeviceCallbacks {
     void onResult(BLEAdvertisedDevice advertisedDevice) {
         BLE_filter_add_device(advertisedDevice);
@@ -174,284 +282,414 @@ void BLE_startScan(uint32_t timeout) {
     pBLEScan->start(timeout, false);
 }
 
-#define BLOCK_DATA_SIZE_BLE 4096
-#define BLOCK_PART_DATA_SIZE_BLE 230
-uint8_t tempBlockBuffer[BLOCK_DATA_SIZE_BLE + 4];
-uint8_t tempPacketBuffer[2 + 3 + BLOCK_PART_DATA_SIZE_BLE];
-void ATC_BLE_OEPL_PrepareBlk(uint8_t indexBlockId) {
-    if (BLE_image_buffer == nullptr) {
+void ATC_BLE_OEPL_PrepareBlk(BLESession* s, uint8_t indexBlockId) {
+    if (s->imageBuffer == nullptr) {
         return;
     }
     uint32_t bufferPosition = (BLOCK_DATA_SIZE_BLE * indexBlockId);
     uint32_t lenNow = BLOCK_DATA_SIZE_BLE;
     uint16_t crcCalc = 0;
-    if ((BLE_compressed_len - bufferPosition) < BLOCK_DATA_SIZE_BLE)
-        lenNow = (BLE_compressed_len - bufferPosition);
-    tempBlockBuffer[0] = lenNow & 0xff;
-    tempBlockBuffer[1] = (lenNow >> 8) & 0xff;
+    if ((s->compressedLen - bufferPosition) < BLOCK_DATA_SIZE_BLE)
+        lenNow = (s->compressedLen - bufferPosition);
+    s->blockBuffer[0] = lenNow & 0xff;
+    s->blockBuffer[1] = (lenNow >> 8) & 0xff;
     for (uint16_t c = 0; c < lenNow; c++) {
-        tempBlockBuffer[4 + c] = BLE_image_buffer[c + bufferPosition];
-        crcCalc += tempBlockBuffer[4 + c];
+        s->blockBuffer[4 + c] = s->imageBuffer[c + bufferPosition];
+        crcCalc += s->blockBuffer[4 + c];
     }
-    tempBlockBuffer[2] = crcCalc & 0xff;
-    tempBlockBuffer[3] = (crcCalc >> 8) & 0xff;
-    BLE_max_block_parts = (4 + lenNow) / BLOCK_PART_DATA_SIZE_BLE;
+    s->blockBuffer[2] = crcCalc & 0xff;
+    s->blockBuffer[3] = (crcCalc >> 8) & 0xff;
+    s->maxBlockParts = (4 + lenNow) / BLOCK_PART_DATA_SIZE_BLE;
     if ((4 + lenNow) % BLOCK_PART_DATA_SIZE_BLE)
-        BLE_max_block_parts++;
-    Serial.println("Preparing block: " + String(indexBlockId) + " BuffPos: " + String(bufferPosition) + " LenNow: " + String(lenNow) + " MaxBLEparts: " + String(BLE_max_block_parts));
-    BLE_curr_part = 0;
+        s->maxBlockParts++;
+    Serial.println("Preparing block: " + String(indexBlockId) + " BuffPos: " + String(bufferPosition) + " LenNow: " + String(lenNow) + " MaxBLEparts: " + String(s->maxBlockParts));
+    s->currPart = 0;
 }
 
-void ATC_BLE_OEPL_SendPart(uint8_t indexBlockId, uint8_t indexPkt) {
+void ATC_BLE_OEPL_SendPart(BLESession* s, uint8_t indexBlockId, uint8_t indexPkt) {
     uint8_t crcCalc = indexBlockId + indexPkt;
     for (uint16_t c = 0; c < BLOCK_PART_DATA_SIZE_BLE; c++) {
-        tempPacketBuffer[5 + c] = tempBlockBuffer[c + (BLOCK_PART_DATA_SIZE_BLE * indexPkt)];
-        crcCalc += tempPacketBuffer[5 + c];
-    }
-    tempPacketBuffer[0] = 0x00;
-    tempPacketBuffer[1] = 0x65;
-    tempPacketBuffer[2] = crcCalc;
-    tempPacketBuffer[3] = indexBlockId;
-    tempPacketBuffer[4] = indexPkt;
-    Serial.println("BLE Sending packet Len " + String(sizeof(tempPacketBuffer)));
-    ctrlChar->writeValue(tempPacketBuffer, sizeof(tempPacketBuffer), true);
+        s->packetBuffer[5 + c] = s->blockBuffer[c + (BLOCK_PART_DATA_SIZE_BLE * indexPkt)];
+        crcCalc += s->packetBuffer[5 + c];
+    }
+    s->packetBuffer[0] = 0x00;
+    s->packetBuffer[1] = 0x65;
+    s->packetBuffer[2] = crcCalc;
+    s->packetBuffer[3] = indexBlockId;
+    s->packetBuffer[4] = indexPkt;
+    Serial.println("BLE Sending packet Len " + String(sizeof(s->packetBuffer)));
+    s->ctrlChar->writeValue(s->packetBuffer, sizeof(s->packetBuffer), false);
+    s->timing.lastData = millis();
 }
 
-void BLETask(void* parameter) {
-    vTaskDelay(5000 / portTICK_PERIOD_MS);
-    Serial.println("BLE task started");
-    BLEDevice::init("");
-    while (1) {
-        switch (ble_main_state) {
-            default:
-            case BLE_MAIN_STATE_IDLE:
-                if (millis() - last_ble_scan > (INTERVAL_BLE_SCANNING_SECONDS * 1000)) {
-                    last_ble_scan = millis();
-                    Serial.println("Doing the BLE Scan");
-                    BLE_startScan(10);  // timeout in seconds, this is blocking but only for this thread!
-                }
-                if (millis() - BLE_last_pending_check >= (INTERVAL_HANDLE_PENDING_SECONDS * 1000)) {
-                    if (BLE_is_image_pending(BLE_curr_address)) {
-                        Serial.println("BLE Image is pending but we wait a bit");
-                        delay(5000);                                                       // We better wait here, since the pending image needs to be created first
-                        if (BLE_curr_address[7] == 0x13 && BLE_curr_address[6] == 0x37) {  // This is an ATC BLE OEPL display
-                            // Here we create the compressed buffer
-                            BLE_image_buffer = (uint8_t*)malloc(BUFFER_MAX_SIZE_COMPRESSING);
-                            if (BLE_image_buffer == nullptr) {
-                                Serial.println("BLE Could not create buffer!");
-                                BLE_compressed_len = 0;
-                            } else {
-                                uint8_t dataType = 0x00;
-                                uint8_t dataTypeArgument = 0x00;
-                                uint16_t nextCheckin = 0x00;
-                                BLE_compressed_len = get_ATC_BLE_OEPL_image(BLE_curr_address, BLE_image_buffer, BUFFER_MAX_SIZE_COMPRESSING, &dataType, &dataTypeArgument, &nextCheckin);
-                                Serial.printf("BLE data Length: %i\r\n", BLE_compressed_len);
-                                // then we connect to BLE to send the compressed data
-                                if (BLE_compressed_len && BLE_connect(BLE_curr_address, BLE_TYPE_ATC_BLE_OEPL)) {
-                                    BLE_err_counter = 0;
-                                    BLE_curr_part = 0;
-                                    memset(BLE_notify_buffer, 0x00, sizeof(BLE_notify_buffer));
-
-                                    uint8_t md5bytes[16];
-                                    MD5Builder md5;
-                                    md5.begin();
-                                    md5.add(BLE_image_buffer, BLE_compressed_len);
-                                    md5.calculate();
-                                    md5.getBytes(md5bytes);
-
-                                    BLEavaildatainfo.dataType = dataType;
-                                    BLEavaildatainfo.dataVer = *((uint64_t*)md5bytes);
-                                    BLEavaildatainfo.dataSize = BLE_compressed_len;
-                                    BLEavaildatainfo.dataTypeArgument = dataTypeArgument;
-                                    BLEavaildatainfo.nextCheckIn = nextCheckin;
-                                    BLEavaildatainfo.checksum = 0;
-                                    for (uint16_t c = 1; c < sizeof(struct AvailDataInfo); c++) {
-                                        BLEavaildatainfo.checksum += (uint8_t)((uint8_t*)&BLEavaildatainfo)[c];
-                                    }
-                                    BLE_upload_state = BLE_UPLOAD_STATE_INIT;
-                                    ble_main_state = BLE_MAIN_STATE_ATC_BLE_OEPL_UPLOAD;
-                                    BLE_new_notify = true;  // trigger the upload here
-                                } else {
-                                    free(BLE_image_buffer);
-                                    if (BLE_err_counter++ >= 5) {  // 5 Retries for a BLE Connection
-                                        struct espXferComplete reportStruct;
-                                        memcpy((uint8_t*)&reportStruct.src, BLE_curr_address, 8);
-                                        processXferComplete(&reportStruct, true);
-                                    }
-                                }
-                            }
-                        } else {  // This is a Gicisky display
-                            // Here we create the compressed buffer
-                            BLE_image_buffer = (uint8_t*)malloc(BUFFER_MAX_SIZE_COMPRESSING);
-                            if (BLE_image_buffer == nullptr) {
-                                Serial.println("BLE Could not create buffer!");
-                                BLE_compressed_len = 0;
-                            } else {
-                                BLE_compressed_len = compress_image(BLE_curr_address, BLE_image_buffer, BUFFER_MAX_SIZE_COMPRESSING);
-                                Serial.printf("BLE Compressed Length: %i\r\n", BLE_compressed_len);
-                                // then we connect to BLE to send the compressed data
-                                if (BLE_compressed_len && BLE_connect(BLE_curr_address, BLE_TYPE_GICISKY)) {
-                                    BLE_err_counter = 0;
-                                    BLE_curr_part = 0;
-                                    memset(BLE_notify_buffer, 0x00, sizeof(BLE_notify_buffer));
-                                    BLE_upload_state = BLE_UPLOAD_STATE_INIT;
-                                    ble_main_state = BLE_MAIN_STATE_UPLOAD;
-                                    BLE_new_notify = true;  // trigger the upload here
-                                } else {
-                                    free(BLE_image_buffer);
-                                    if (BLE_err_counter++ >= 5) {  // 5 Retries for a BLE Connection
-                                        struct espXferComplete reportStruct;
-                                        memcpy((uint8_t*)&reportStruct.src, BLE_curr_address, 8);
-                                        processXferComplete(&reportStruct, true);
-                                    }
-                                }
-                            }
-                        }
-                        BLE_last_pending_check = millis();
-                    }
-                }
-                break;
-            case BLE_MAIN_STATE_UPLOAD: {
-                if (BLE_connected && BLE_new_notify) {
-                    BLE_new_notify = false;
-                    BLE_last_notify = millis();
-                    BLE_upload_state = BLE_notify_buffer[1];
-
-                    switch (BLE_upload_state) {
-                        default:
-                        case BLE_UPLOAD_STATE_INIT:
-                            BLE_mini_buff[0] = 1;
-                            ctrlChar->writeValue(BLE_mini_buff, 1);
-                            break;
-                        case BLE_UPLOAD_STATE_SIZE:
-                            BLE_mini_buff[0] = 0x02;
-                            BLE_mini_buff[1] = BLE_compressed_len & 0xff;
-                            BLE_mini_buff[2] = (BLE_compressed_len >> 8) & 0xff;
-                            BLE_mini_buff[3] = (BLE_compressed_len >> 16) & 0xff;
-                            BLE_mini_buff[4] = (BLE_compressed_len >> 24) & 0xff;
-                            BLE_mini_buff[5] = 0x00;
-                            ctrlChar->writeValue(BLE_mini_buff, 6);
-                            break;
-                        case BLE_UPLOAD_STATE_START:
-                            BLE_mini_buff[0] = 0x03;
-                            ctrlChar->writeValue(BLE_mini_buff, 1);
-                            break;
-                        case BLE_UPLOAD_STATE_UPLOAD:
-                            if (BLE_notify_buffer[2] == 0x08) {
-                                free(BLE_image_buffer);
-                                pClient->disconnect();
-                                ble_main_state = BLE_MAIN_STATE_IDLE;
-                                BLE_last_pending_check = millis();
-                                // Done and the image is refreshing now
-                                struct espXferComplete reportStruct;
-                                memcpy((uint8_t*)&reportStruct.src, BLE_curr_address, 8);
-                                processXferComplete(&reportStruct, true);
-                                BLE_err_counter = 0;
-                                BLE_curr_part = 0;
-                            } else {
-                                uint32_t req_curr_part = (BLE_notify_buffer[6] << 24) | (BLE_notify_buffer[5] << 24) | (BLE_notify_buffer[4] << 24) | BLE_notify_buffer[3];
-                                if (req_curr_part != BLE_curr_part) {
-                                    Serial.printf("Something went wrong, expected req part: %i but got: %i we better abort here.\r\n", req_curr_part, BLE_curr_part);
-                                    free(BLE_image_buffer);
-                                    pClient->disconnect();
-                                    ble_main_state = BLE_MAIN_STATE_IDLE;
-                                    BLE_last_pending_check = millis();
-                                }
-                                uint32_t curr_len = 240;
-                                if (BLE_compressed_len - (BLE_curr_part * 240) < 240)
-                                    curr_len = BLE_compressed_len - (BLE_curr_part * 240);
-                                BLE_mini_buff[0] = BLE_curr_part & 0xff;
-                                BLE_mini_buff[1] = (BLE_curr_part >> 8) & 0xff;
-                                BLE_mini_buff[2] = (BLE_curr_part >> 16) & 0xff;
-                                BLE_mini_buff[3] = (BLE_curr_part >> 24) & 0xff;
-                                memcpy((uint8_t*)&BLE_mini_buff[4], (uint8_t*)&BLE_image_buffer[BLE_curr_part * 240], curr_len);
-                                imgChar->writeValue(BLE_mini_buff, curr_len + 4);
-                                Serial.printf("BLE sending part: %i\r\n", BLE_curr_part);
-                                BLE_curr_part++;
-                            }
-                            break;
-                    }
-                } else {
-                    if (millis() - BLE_last_notify > 30000) {  // Something odd, better reset connection!
-                        Serial.println("BLE err going back to IDLE");
-                        free(BLE_image_buffer);
-                        pClient->disconnect();
-                        BLE_err_counter = 0;
-                        ble_main_state = BLE_MAIN_STATE_IDLE;
-                        BLE_last_pending_check = millis();
-                    }
+// keep up to BLE_PART_WINDOW parts of the current block in flight, the tag acknowledges them in order
+void ATC_BLE_OEPL_FillWindow(BLESession* s) {
+    while (s->partsSent <= s->maxBlockParts && s->partsSent - s->currPart < BLE_PART_WINDOW) {
+        ATC_BLE_OEPL_SendPart(s, s->blkRequest.blockId, s->partsSent);
+        s->partsSent++;
+    }
+}
+
+// compress or load the image for the tag, returns false if there's nothing to send
+static bool BLE_prepare_image(BLESession* s) {
+    s->imageBuffer = (uint8_t*)malloc(BUFFER_MAX_SIZE_COMPRESSING);
+    if (s->imageBuffer == nullptr) {
+        Serial.println("BLE Could not create buffer!");
+        s->compressedLen = 0;
+        return false;
+    }
+    if (s->type == BLE_TYPE_ATC_BLE_OEPL) {
+        uint8_t dataType = 0x00;
+        uint8_t dataTypeArgument = 0x00;
+        uint16_t nextCheckin = 0x00;
+        s->compressedLen = get_ATC_BLE_OEPL_image(s->address, s->imageBuffer, BUFFER_MAX_SIZE_COMPRESSING, &dataType, &dataTypeArgument, &nextCheckin);
+        Serial.printf("BLE data Length: %i\r\n", s->compressedLen);
+        if (s->compressedLen == 0) return false;
+
+        uint8_t md5bytes[16];
+        MD5Builder md5;
+        md5.begin();
+        md5.add(s->imageBuffer, s->compressedLen);
+        md5.calculate();
+        md5.getBytes(md5bytes);
+
+        s->availDataInfo.dataType = dataType;
+        s->availDataInfo.dataVer = *((uint64_t*)md5bytes);
+        s->availDataInfo.dataSize = s->compressedLen;
+        s->availDataInfo.dataTypeArgument = dataTypeArgument;
+        s->availDataInfo.nextCheckIn = nextCheckin;
+        s->availDataInfo.checksum = 0;
+        for (uint16_t c = 1; c < sizeof(struct AvailDataInfo); c++) {
+            s->availDataInfo.checksum += (uint8_t)((uint8_t*)&s->availDataInfo)[c];
+        }
+    } else {
+        s->compressedLen = compress_image(s->address, s->imageBuffer, BUFFER_MAX_SIZE_COMPRESSING);
+        Serial.printf("BLE Compressed Length: %i\r\n", s->compressedLen);
+        if (s->compressedLen == 0) return false;
+    }
+    return true;
+}
+
+// handle one Gicisky notification, returns the result once the transfer ended
+static const char* BLE_gicisky_step(BLESession* s) {
+    s->uploadState = s->notifyBuffer[1];
+
+    switch (s->uploadState) {
+        default:
+        case BLE_UPLOAD_STATE_INIT:
+            s->miniBuff[0] = 1;
+            s->ctrlChar->writeValue(s->miniBuff, 1);
+            break;
+        case BLE_UPLOAD_STATE_SIZE:
+            s->miniBuff[0] = 0x02;
+            s->miniBuff[1] = s->compressedLen & 0xff;
+            s->miniBuff[2] = (s->compressedLen >> 8) & 0xff;
+            s->miniBuff[3] = (s->compressedLen >> 16) & 0xff;
+            s->miniBuff[4] = (s->compressedLen >> 24) & 0xff;
+            s->miniBuff[5] = 0x00;
+            s->ctrlChar->writeValue(s->miniBuff, 6);
+            break;
+        case BLE_UPLOAD_STATE_START:
+            s->miniBuff[0] = 0x03;
+            s->ctrlChar->writeValue(s->miniBuff, 1);
+            break;
+        case BLE_UPLOAD_STATE_UPLOAD:
+            if (s->notifyBuffer[2] == 0x08) {
+                // Done and the image is refreshing now
+                s->reportComplete = true;
+                return "done";
+            } else {
+                uint32_t req_curr_part = (s->notifyBuffer[6] << 24) | (s->notifyBuffer[5] << 24) | (s->notifyBuffer[4] << 24) | s->notifyBuffer[3];
+                if (req_curr_part != s->currPart) {
+                    Serial.printf("Something went wrong, expected req part: %i but got: %i we better abort here.\r\n", req_curr_part, s->currPart);
+                    return "failed";
                 }
+                uint32_t curr_len = 240;
+                if (s->compressedLen - (s->currPart * 240) < 240)
+                    curr_len = s->compressedLen - (s->currPart * 240);
+                s->miniBuff[0] = s->currPart & 0xff;
+                s->miniBuff[1] = (s->currPart >> 8) & 0xff;
+                s->miniBuff[2] = (s->currPart >> 16) & 0xff;
+                s->miniBuff[3] = (s->currPart >> 24) & 0xff;
+                memcpy((uint8_t*)&s->miniBuff[4], (uint8_t*)&s->imageBuffer[s->currPart * 240], curr_len);
+                s->imgChar->writeValue(s->miniBuff, curr_len + 4, false);
+                s->timing.lastData = millis();
+                Serial.printf("BLE sending part: %i\r\n", s->currPart);
+                s->currPart++;
+            }
+            break;
+    }
+    return nullptr;
+}
+
+// handle one ATC BLE OEPL notification, returns the result once the transfer ended
+static const char* BLE_atc_step(BLESession* s) {
+    switch (s->uploadState) {
+        default:
+        case BLE_UPLOAD_STATE_INIT:
+            s->miniBuff[0] = 0x00;
+            s->miniBuff[1] = 0x64;
+            memcpy((uint8_t*)&s->miniBuff[2], &s->availDataInfo, sizeof(struct AvailDataInfo));
+            s->ctrlChar->writeValue(s->miniBuff, sizeof(struct AvailDataInfo) + 2);
+            s->uploadState = BLE_UPLOAD_STATE_UPLOAD;
+            break;
+        case BLE_UPLOAD_STATE_UPLOAD: {
+            uint8_t notifyLen = s->notifyBuffer[0];
+            uint16_t notifyCMD = (s->notifyBuffer[1] << 8) | s->notifyBuffer[2];
+            Serial.println("BLE CMD " + String(notifyCMD));
+            // tags that echo block and part id (as in the part header) are matched to the part,
+            // otherwise parts are acknowledged in order
+            const bool partNotify = notifyCMD == BLE_CMD_ACK_BLKPRT || notifyCMD == BLE_CMD_ERR_BLKPRT;
+            const bool hasPart = partNotify && notifyLen >= 4;
+            const uint32_t part = hasPart ? s->notifyBuffer[4] : s->currPart;
+            if (hasPart && (s->notifyBuffer[3] != s->blkRequest.blockId || part < s->currPart || part >= s->partsSent)) {
+                Serial.println("BLE ignoring stale part " + String(part));
                 break;
             }
-            case BLE_MAIN_STATE_ATC_BLE_OEPL_UPLOAD: {
-                if (BLE_connected && BLE_new_notify) {
-                    BLE_new_notify = false;
-                    BLE_last_notify = millis();
-                    switch (BLE_upload_state) {
-                        default:
-                        case BLE_UPLOAD_STATE_INIT:
-                            BLE_mini_buff[0] = 0x00;
-                            BLE_mini_buff[1] = 0x64;
-                            memcpy((uint8_t*)&BLE_mini_buff[2], &BLEavaildatainfo, sizeof(struct AvailDataInfo));
-                            ctrlChar->writeValue(BLE_mini_buff, sizeof(struct AvailDataInfo) + 2);
-                            BLE_upload_state = BLE_UPLOAD_STATE_UPLOAD;
-                            break;
-                        case BLE_UPLOAD_STATE_UPLOAD: {
-                            uint8_t notifyLen = BLE_notify_buffer[0];
-                            uint16_t notifyCMD = (BLE_notify_buffer[1] << 8) | BLE_notify_buffer[2];
-                            Serial.println("BLE CMD " + String(notifyCMD));
-                            switch (notifyCMD) {
-                                case BLE_CMD_REQ:
-                                    if (notifyLen == (sizeof(struct blockRequest) + 2)) {
-                                        Serial.println("We got a request for a BLK");
-                                        memcpy(&BLEblkRequst, &BLE_notify_buffer[3], sizeof(struct blockRequest));
-                                        BLE_curr_part = 0;
-                                        ATC_BLE_OEPL_PrepareBlk(BLEblkRequst.blockId);
-                                        ATC_BLE_OEPL_SendPart(BLEblkRequst.blockId, BLE_curr_part);
-                                    }
-                                    break;
-                                case BLE_CMD_ACK_BLKPRT:
-                                    BLE_curr_part++;
-                                    BLE_err_counter = 0;
-                                case BLE_CMD_ERR_BLKPRT:
-                                    if (BLE_curr_part <= BLE_max_block_parts && BLE_err_counter++ < 15) {
-                                        ATC_BLE_OEPL_SendPart(BLEblkRequst.blockId, BLE_curr_part);
-                                        break;
-                                    }  // FALLTROUGH!!! We cancel the upload if we land here since we dont have so many parts of a block!
-                                case BLE_CMD_ACK:
-                                case BLE_CMD_ACK_IS_SHOWN:
-                                case BLE_CMD_ACK_FW_UPDATED:
-                                    Serial.println("BLE Upload done");
-                                    free(BLE_image_buffer);
-                                    pClient->disconnect();
-                                    ble_main_state = BLE_MAIN_STATE_IDLE;
-                                    BLE_last_pending_check = millis();
-                                    // Done and the image is refreshing now
-                                    struct espXferComplete reportStruct;
-                                    memcpy((uint8_t*)&reportStruct.src, BLE_curr_address, 8);
-                                    processXferComplete(&reportStruct, true);
-                                    BLE_err_counter = 0;
-                                    BLE_max_block_parts = 0;
-                                    BLE_curr_part = 0;
-                                    break;
-                            }
-                        } break;
+            switch (notifyCMD) {
+                case BLE_CMD_REQ:
+                    if (notifyLen == (sizeof(struct blockRequest) + 2)) {
+                        Serial.println("We got a request for a BLK");
+                        memcpy(&s->blkRequest, &s->notifyBuffer[3], sizeof(struct blockRequest));
+                        s->currPart = 0;
+                        s->partsSent = 0;
+                        ATC_BLE_OEPL_PrepareBlk(s, s->blkRequest.blockId);
+                        ATC_BLE_OEPL_FillWindow(s);
                     }
-                } else {
-                    if (millis() - BLE_last_notify > 30000) {  // Something odd, better reset connection!
-                        Serial.println("BLE err going back to IDLE");
-                        free(BLE_image_buffer);
-                        pClient->disconnect();
-                        BLE_err_counter = 0;
-                        ble_main_state = BLE_MAIN_STATE_IDLE;
-                        BLE_last_pending_check = millis();
+                    break;
+                case BLE_CMD_ACK_BLKPRT:
+                    s->currPart = part + 1;
+                    s->errCounter = 0;
+                    if (s->currPart <= s->maxBlockParts) {
+                        ATC_BLE_OEPL_FillWindow(s);
+                        break;
                     }
-                }
-                break;
+                case BLE_CMD_ERR_BLKPRT:
+                    if (s->currPart <= s->maxBlockParts && s->errCounter++ < 15) {
+                        // resend from the part that failed
+                        s->partsSent = part;
+                        ATC_BLE_OEPL_FillWindow(s);
+                        break;
+                    }  // FALLTROUGH!!! We cancel the upload if we land here since we dont have so many parts of a block!
+                case BLE_CMD_ACK:
+                case BLE_CMD_ACK_IS_SHOWN:
+                case BLE_CMD_ACK_FW_UPDATED:
+                    Serial.println("BLE Upload done");
+                    // Done and the image is refreshing now
+                    s->reportComplete = true;
+                    return notifyCMD == BLE_CMD_ERR_BLKPRT ? "failed" : "done";
             }
+        } break;
+    }
+    return nullptr;
+}
+
+static const char* BLE_session_run(BLESession* s) {
+    if (countQueueItem(s->address) == 0) {
+        s->notReady = true;
+        return "not ready";
+    }
+    if (!BLE_prepare_image(s)) return "no data";
+
+    xSemaphoreTake(connectMutex, portMAX_DELAY);
+    const bool connected = BLE_connect(s);
+    xSemaphoreGive(connectMutex);
+    if (!connected) return "connect failed";
+
+    s->uploadState = BLE_UPLOAD_STATE_INIT;
+    s->newNotify = true;  // trigger the upload here
+    s->lastNotify = millis();
+    memset(s->notifyBuffer, 0x00, sizeof(s->notifyBuffer));
+    while (1) {
+        // sleep until the tag notifies
+        if (!s->newNotify && xQueueReceive(s->notifyQueue, s->notifyBuffer, 100 / portTICK_PERIOD_MS) == pdTRUE) {
+            s->newNotify = true;
+        }
+        if (!s->connected) return "disconnected";
+        if (s->newNotify) {
+            s->newNotify = false;
+            s->lastNotify = millis();
+            const char* result = (s->type == BLE_TYPE_GICISKY) ? BLE_gicisky_step(s) : BLE_atc_step(s);
+            if (result) return result;
+        } else if (millis() - s->lastNotify > BLE_NOTIFY_TIMEOUT_MS) {  // Something odd, better reset connection!
+            Serial.println("BLE err going back to IDLE");
+            return "timeout";
+        }
+    }
+}
+
+static void BLESessionTask(void* parameter) {
+    BLESession* s = (BLESession*)parameter;
+    s->result = BLE_session_run(s);
+    if (s->timing.connected) BLE_report_timing(s, s->result);
+    if (s->client) s->client->disconnect();
+    free(s->imageBuffer);
+    s->imageBuffer = nullptr;
+    // the scheduler frees the session, don't touch it after this
+    s->finished = true;
+    xTaskNotifyGive(schedulerTask);
+    vTaskDelete(NULL);
+}
+
+// collect finished sessions and update their tag status, called by the scheduler
+static void BLE_reap_sessions() {
+    for (uint8_t i = 0; i < BLE_MAX_SESSIONS; i++) {
+        BLESession* s;
+        {
+            std::lock_guard<std::mutex> lock(sessionMutex);
+            s = sessions[i];
+            if (s == nullptr || !s->finished) continue;
+            sessions[i] = nullptr;
+        }
+        bool giveUp = false;
+        {
+            std::lock_guard<std::mutex> lock(sessionMutex);
+            BLETagStatus& status = tagStatus[macKey(s->address)];
+            status.lastResult = s->result;
+            status.lastTime = time(nullptr);
+            status.timing = s->timing;
+            const BleSchedule::Result result = s->reportComplete ? BleSchedule::RESULT_COMPLETE
+                                               : s->notReady     ? BleSchedule::RESULT_NOT_READY
+                                                                 : BleSchedule::RESULT_FAILED;
+            giveUp = BleSchedule::finish(status, result, millis());
+        }
+        if (s->reportComplete || giveUp) {
+            BLE_drop_packed(s->address);
+            struct espXferComplete reportStruct;
+            memcpy((uint8_t*)&reportStruct.src, s->address, 8);
+            processXferComplete(&reportStruct, true);
+        }
+        vQueueDelete(s->notifyQueue);
+        delete s;
+    }
+}
+
+// start sessions for the tags that waited longest, as long as there are free slots
+static void BLE_schedule() {
+    static uint8_t addresses[BLE_MAX_CANDIDATES][8];
+    const uint8_t count = BLE_get_pending(addresses, BLE_MAX_CANDIDATES);
+    const uint32_t now = millis();
+    std::vector<std::pair<uint32_t, uint8_t>> candidates;
+    uint8_t freeSlot = BLE_MAX_SESSIONS;
+    uint8_t active = 0;
+
+    std::lock_guard<std::mutex> lock(sessionMutex);
+    for (uint8_t i = 0; i < BLE_MAX_SESSIONS; i++) {
+        if (sessions[i]) active++;
+    }
+    // tags that are no longer pending start over when they come back
+    for (auto& entry : tagStatus) {
+        if (entry.second.active || entry.second.pendingSince == 0) continue;
+        bool stillPending = false;
+        for (uint8_t c = 0; c < count && !stillPending; c++) {
+            stillPending = macKey(addresses[c]) == entry.first;
+        }
+        if (!stillPending) entry.second.pendingSince = 0;
+    }
+    for (uint8_t c = 0; c < count; c++) {
+        BLETagStatus& status = tagStatus[macKey(addresses[c])];
+        if (!BleSchedule::ready(status, now)) continue;
+        candidates.push_back({now - status.pendingSince, c});
+    }
+    queueDepth = candidates.size();
+    BleSchedule::oldestFirst(candidates);
+
+    for (const auto& candidate : candidates) {
+        if (active >= maxSessions) break;
+        for (freeSlot = 0; freeSlot < BLE_MAX_SESSIONS && sessions[freeSlot]; freeSlot++);
+        if (freeSlot == BLE_MAX_SESSIONS) break;
+
+        BLESession* s = new (std::nothrow) BLESession();
+        if (s == nullptr) break;
+        memcpy(s->address, addresses[candidate.second], 8);
+        s->type = (s->address[7] == 0x13 && s->address[6] == 0x37) ? BLE_TYPE_ATC_BLE_OEPL : BLE_TYPE_GICISKY;
+        s->notifyQueue = xQueueCreate(BLE_NOTIFY_QUEUE_LEN, sizeof(s->notifyBuffer));
+        if (s->notifyQueue == nullptr || xTaskCreate(BLESessionTask, "BLE session", 8000, s, 5, &s->task) != pdPASS) {
+            if (s->notifyQueue) vQueueDelete(s->notifyQueue);
+            delete s;
+            break;
+        }
+        sessions[freeSlot] = s;
+        tagStatus[macKey(s->address)].active = true;
+        active++;
+        queueDepth--;
+    }
+}
+
+void BLETask(void* parameter) {
+    vTaskDelay(5000 / portTICK_PERIOD_MS);
+    Serial.println("BLE task started");
+    schedulerTask = xTaskGetCurrentTaskHandle();
+    connectMutex = xSemaphoreCreateMutex();
+    // every session holds a compressed image, without PSRAM only one fits
+    maxSessions = psramFound() ? BLE_MAX_SESSIONS : 1;
+    BLEDevice::init("");
+    BLEDevice::setMTU(BLE_MTU_WANTED);
+    while (1) {
+        BLE_reap_sessions();
+        bool idle;
+        {
+            std::lock_guard<std::mutex> lock(sessionMutex);
+            idle = std::all_of(std::begin(sessions), std::end(sessions), [](BLESession* s) { return s == nullptr; });
+        }
+        // only scan while no transfers run, the scan blocks new connections for its duration
+        if (idle && millis() - last_ble_scan > (INTERVAL_BLE_SCANNING_SECONDS * 1000)) {
+            last_ble_scan = millis();
+            Serial.println("Doing the BLE Scan");
+            xSemaphoreTake(connectMutex, portMAX_DELAY);
+            BLE_startScan(10);  // timeout in seconds, this is blocking but only for this thread!
+            xSemaphoreGive(connectMutex);
+        }
+        BLE_last_pending_check = millis();
+        BLE_schedule();
+        // woken early when a session finishes
+        ulTaskNotifyTake(pdTRUE, (INTERVAL_HANDLE_PENDING_SECONDS * 1000) / portTICK_PERIOD_MS);
+    }
+}
+
+namespace BleScheduler {
+
+uint32_t getQueueDepth() {
+    return queueDepth;
+}
+
+uint8_t getActiveCount() {
+    std::lock_guard<std::mutex> lock(sessionMutex);
+    uint8_t active = 0;
+    for (uint8_t i = 0; i < BLE_MAX_SESSIONS; i++) {
+        if (sessions[i]) active++;
+    }
+    return active;
+}
+
+void fillStats(JsonObject &obj) {
+    obj["maxsessions"] = maxSessions;
+    obj["active"] = getActiveCount();
+    obj["queue"] = queueDepth;
+    const uint32_t now = millis();
+    std::lock_guard<std::mutex> lock(sessionMutex);
+    JsonObject tags = obj["tags"].to<JsonObject>();
+    for (const auto& entry : tagStatus) {
+        const BLETagStatus& status = entry.second;
+        uint8_t mac[8];
+        memcpy(mac, &entry.first, 8);
+        char macStr[17];
+        snprintf(macStr, sizeof(macStr), "%02X%02X%02X%02X%02X%02X%02X%02X", mac[7], mac[6], mac[5], mac[4], mac[3], mac[2], mac[1], mac[0]);
+        JsonObject tag = tags[macStr].to<JsonObject>();
+        tag["active"] = status.active;
+        tag["result"] = status.lastResult ? status.lastResult : "";
+        tag["time"] = status.lastTime;
+        tag["failures"] = status.failures;
+        tag["pendingms"] = status.pendingSince ? now - status.pendingSince : 0;
+        tag["retryms"] = BleSchedule::retryIn(status, now);
+        if (status.timing.connected) {
+            tag["connectms"] = status.timing.connected - status.timing.start;
+            tag["transferms"] = status.timing.lastData - status.timing.connected;
+            tag["displayms"] = status.timing.done - status.timing.lastData;
         }
-        vTaskDelay(15 / portTICK_PERIOD_MS);
     }
 }
 
+}  // namespace BleScheduler
+
 #endif
@@ -17,6 +17,9 @@
 #include <Arduino.h>
 #include <ArduinoJson.h>
 #include <HTTPClient.h>
+#if defined HAS_SDCARD && !defined SD_CARD_ONLY
+#include <LittleFS.h>
+#endif
 #include <MD5Builder.h>
 #include <locale.h>
 #ifdef CONTENT_RSS
@@ -25,11 +28,18 @@
 #include <TJpg_Decoder.h>
 #include <time.h>
 
+#include <algorithm>
 #include <map>
+#include <unordered_map>
+#include <vector>
 
 #include "commstructs.h"
+#include "fslock.h"
+#include "httpcache.h"
 #include "makeimage.h"
 #include "newproto.h"
+#include "renderpipeline.h"
+#include "scheduler.h"
 #include "storage.h"
 #ifdef CONTENT_QR
 #include "QRCodeGenerator.h"
@@ -44,95 +54,252 @@
 
 // https://csvjson.com/json_beautifier
 
+// seconds a shared upstream response is reused by other tags with the same source
+#define CACHE_TTL_WEATHER 600
+#define CACHE_TTL_GEOCODING (7 * 24 * 3600)
+#define CACHE_TTL_CALENDAR 120
+#define CACHE_TTL_DAYAHEAD 900
+
 bool needRedraw(uint8_t contentMode, uint8_t wakeupReason) {
     // contentmode 26, timestamp
     if ((wakeupReason == WAKEUP_REASON_BUTTON1 || wakeupReason == WAKEUP_REASON_BUTTON2 || wakeupReason == WAKEUP_REASON_BUTTON3) && contentMode == 26) return true;
     return false;
 }
 
+static bool isApTag(const tagRecord *taginfo) {
+    uint8_t wifimac[8];
+    WiFi.macAddress(wifimac);
+    memset(&wifimac[6], 0, 2);
+    return memcmp(taginfo->mac, wifimac, 8) == 0;
+}
+
+bool renderDueTag(tagRecord *taginfo, const bool canRender) {
+    time_t now;
+    time(&now);
+    const uint32_t renderDue = ContentScheduler::renderDueTime(taginfo);
+    if (!canRender || renderDue > now) return false;
+
+    ContentScheduler::recordLag(now - renderDue);
+    drawNew(taginfo->mac, taginfo);
+    taginfo->wakeupReason = 0;
+    return true;
+}
+
+void finishDueTag(tagRecord *taginfo) {
+    time_t now;
+    time(&now);
+
+    if (taginfo->expectedNextCheckin > now - 10 && taginfo->expectedNextCheckin < now + 30 && taginfo->pendingIdle == 0 && taginfo->pendingCount == 0 && !isApTag(taginfo)) {
+        int32_t minutesUntilNextUpdate = (taginfo->nextupdate - now) / 60;
+        if (minutesUntilNextUpdate > config.maxsleep) {
+            minutesUntilNextUpdate = config.maxsleep;
+        }
+        if (util::isSleeping(config.sleepTime1, config.sleepTime2)) {
+            struct tm timeinfo;
+            getLocalTime(&timeinfo);
+            struct tm nextSleepTimeinfo = timeinfo;
+            nextSleepTimeinfo.tm_hour = config.sleepTime2;
+            nextSleepTimeinfo.tm_min = 0;
+            nextSleepTimeinfo.tm_sec = 0;
+            time_t nextWakeTime = mktime(&nextSleepTimeinfo);
+            if (nextWakeTime < now) nextWakeTime += 24 * 3600;
+            minutesUntilNextUpdate = (nextWakeTime - now) / 60 - 2;
+        }
+        if (minutesUntilNextUpdate > 1 && (wsClientCount() == 0 || config.stopsleep == 0)) {
+            taginfo->pendingIdle = minutesUntilNextUpdate * 60;
+            taginfo->expectedNextCheckin = now + taginfo->pendingIdle;
+            if (taginfo->isExternal == false) {
+                prepareIdleReq(taginfo->mac, minutesUntilNextUpdate);
+            }
+        }
+    }
+
+    ContentScheduler::wake(taginfo, true);
+}
+
 void contentRunner() {
     if (config.runStatus == RUNSTATUS_STOP) return;
 
     time_t now;
     time(&now);
-    uint8_t wifimac[8];
-    WiFi.macAddress(wifimac);
-    memset(&wifimac[6], 0, 2);
 
-    for (tagRecord *taginfo : tagDB) {
+    // global conditions are the same for every tag, evaluate them once per run
+    const bool canRender = config.runStatus == RUNSTATUS_RUN && Storage.freeSpace() > 31000 && !util::isSleeping(config.sleepTime1, config.sleepTime2);
+
+    uint16_t popped = 0;
+    tagRecord *taginfo;
+    // tags stay in the scheduler's busy set until finishDueTag, so a full queue just defers them
+    while (RenderPipeline::hasRoom() && ContentScheduler::popDue(now, taginfo)) {
+        popped++;
+        // all drawing happens in the render task, a tag that doesn't fit is left for the next run
+        if (!RenderPipeline::enqueue(taginfo, canRender)) {
+            ContentScheduler::wake(taginfo, true);
+            break;
+        }
+    }
+    ContentScheduler::stats.lastPopped = popped;
+}
 
-        const bool isAp = memcmp(taginfo->mac, wifimac, 8) == 0;
-        if (taginfo->RSSI &&
-            (now >= taginfo->nextupdate || needRedraw(taginfo->contentMode, taginfo->wakeupReason)) &&
-            config.runStatus == RUNSTATUS_RUN && 
-            (taginfo->expectedNextCheckin < now + 300 || isAp || (wsClientCount() && config.stopsleep == 1)) &&
-            Storage.freeSpace() > 31000 && !util::isSleeping(config.sleepTime1, config.sleepTime2)) {
-                drawNew(taginfo->mac, taginfo);
-                taginfo->wakeupReason = 0;
+/// @brief Signature of an indexed json template file
+struct TemplateSignature {
+    time_t mtime;
+    size_t size;
+};
+
+// varDB key -> tags (contentmode 19) whose template references {key}
+static std::unordered_map<std::string, std::vector<tagRecord *>> varDependents;
+// template file -> signature at the time it was indexed
+static std::unordered_map<std::string, TemplateSignature> indexedTemplates;
+static uint32_t indexedTagsHash = 0;
+static volatile bool varIndexValid = false;
+
+void invalidateVarIndex() {
+    varIndexValid = false;
+}
+
+/// @brief Hash over all contentmode 19 tags and their config, changes whenever the index would
+static uint32_t templateTagsHash() {
+    uint32_t hash = 2166136261u;
+    auto mix = [&hash](const uint8_t *data, const size_t len) {
+        for (size_t i = 0; i < len; i++) {
+            hash ^= data[i];
+            hash *= 16777619u;
         }
+    };
+    for (const tagRecord *tag : tagDB) {
+        if (tag->contentMode != 19) continue;
+        mix((const uint8_t *)&tag, sizeof(tag));
+        mix((const uint8_t *)tag->modeConfigJson.c_str(), tag->modeConfigJson.length());
+    }
+    return hash;
+}
 
-        if (taginfo->expectedNextCheckin > now - 10 && taginfo->expectedNextCheckin < now + 30 && taginfo->pendingIdle == 0 && taginfo->pendingCount == 0 && !isAp) {
-            int32_t minutesUntilNextUpdate = (taginfo->nextupdate - now) / 60;
-            if (minutesUntilNextUpdate > config.maxsleep) {
-                minutesUntilNextUpdate = config.maxsleep;
-            }
-            if (util::isSleeping(config.sleepTime1, config.sleepTime2)) {
-                struct tm timeinfo;
-                getLocalTime(&timeinfo);
-                struct tm nextSleepTimeinfo = timeinfo;
-                nextSleepTimeinfo.tm_hour = config.sleepTime2;
-                nextSleepTimeinfo.tm_min = 0;
-                nextSleepTimeinfo.tm_sec = 0;
-                time_t nextWakeTime = mktime(&nextSleepTimeinfo);
-                if (nextWakeTime < now) nextWakeTime += 24 * 3600;
-                minutesUntilNextUpdate = (nextWakeTime - now) / 60 - 2;
-            }
-            if (minutesUntilNextUpdate > 1 && (wsClientCount() == 0 || config.stopsleep == 0)) {
-                taginfo->pendingIdle = minutesUntilNextUpdate * 60;
-                taginfo->expectedNextCheckin = now + taginfo->pendingIdle;
-                if (taginfo->isExternal == false) {
-                    prepareIdleReq(taginfo->mac, minutesUntilNextUpdate);
+static bool readTemplateSignature(const String &jsonfile, TemplateSignature &signature) {
+    File file = contentFS->open(jsonfile, "r");
+    if (!file) return false;
+    signature.mtime = file.getLastWrite();
+    signature.size = file.size();
+    file.close();
+    return true;
+}
+
+/// @brief Collect all {variable} references of a template without loading it into memory
+static void scanTemplateVars(const String &jsonfile, std::vector<std::string> &vars) {
+    File file = contentFS->open(jsonfile, "r");
+    if (!file) return;
+    uint8_t buf[256];
+    std::string name;
+    bool inBrace = false;
+    size_t n;
+    while ((n = file.read(buf, sizeof(buf))) > 0) {
+        for (size_t i = 0; i < n; i++) {
+            const char c = buf[i];
+            if (c == '{') {
+                inBrace = true;
+                name.clear();
+            } else if (inBrace && c == '}') {
+                if (!name.empty() && std::find(vars.begin(), vars.end(), name) == vars.end()) {
+                    vars.push_back(name);
+                }
+                inBrace = false;
+            } else if (inBrace) {
+                // json objects also use braces, those are never valid variable names
+                if (c == '"' || c == '\n' || name.length() >= 64) {
+                    inBrace = false;
+                } else {
+                    name += c;
                 }
             }
         }
-
-        vTaskDelay(1 / portTICK_PERIOD_MS);  // add a small delay to allow other threads to run
     }
+    file.close();
 }
 
-void checkVars() {
+/// @brief Rebuild the variable -> dependent tags index
+static void buildVarIndex() {
+    const uint32_t start = millis();
+    varDependents.clear();
+    indexedTemplates.clear();
+
+    std::unordered_map<std::string, std::vector<std::string>> templateVars;
     JsonDocument cfgobj;
     for (tagRecord *tag : tagDB) {
-        if (tag->contentMode == 19) {
-            deserializeJson(cfgobj, tag->modeConfigJson);
-            const String jsonfile = cfgobj["filename"].as<String>();
-            if (!util::isEmptyOrNull(jsonfile)) {
-                File file = contentFS->open(jsonfile, "r");
-                if (file) {
-                    const size_t fileSize = file.size();
-                    std::unique_ptr<char[]> fileContent(new char[fileSize + 1]);
-                    file.readBytes(fileContent.get(), fileSize);
-                    file.close();
-                    fileContent[fileSize] = '\0';
-                    const char *contentPtr = fileContent.get();
-                    for (const auto &entry : varDB) {
-                        if (entry.second.changed && strstr(contentPtr, entry.first.c_str()) != nullptr) {
-                            Serial.println("updating " + jsonfile + " because of var " + entry.first.c_str());
-                            tag->nextupdate = 0;
-                        }
-                    }
-                }
-                file.close();
+        if (tag->contentMode != 19) continue;
+        deserializeJson(cfgobj, tag->modeConfigJson);
+        const String jsonfile = cfgobj["filename"].as<String>();
+        if (util::isEmptyOrNull(jsonfile)) continue;
+
+        const std::string key = jsonfile.c_str();
+        auto vars = templateVars.find(key);
+        if (vars == templateVars.end()) {
+            TemplateSignature signature;
+            if (!readTemplateSignature(jsonfile, signature)) continue;
+            indexedTemplates[key] = signature;
+            vars = templateVars.emplace(key, std::vector<std::string>()).first;
+            scanTemplateVars(jsonfile, vars->second);
+        }
+        for (const std::string &var : vars->second) {
+            varDependents[var].push_back(tag);
+        }
+    }
+
+    indexedTagsHash = templateTagsHash();
+    varIndexValid = true;
+    Serial.printf("[checkVars] indexed %d templates, %d variables in %lu ms\r\n", indexedTemplates.size(), varDependents.size(), millis() - start);
+}
+
+/// @brief Check whether the index still matches the tag configs and template files
+static bool varIndexCurrent() {
+    if (!varIndexValid || templateTagsHash() != indexedTagsHash) return false;
+    for (const auto &entry : indexedTemplates) {
+        TemplateSignature signature;
+        if (!readTemplateSignature(entry.first.c_str(), signature) ||
+            signature.mtime != entry.second.mtime || signature.size != entry.second.size) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void checkVars() {
+    bool anyChanged = false;
+    for (const auto &entry : varDB) {
+        if (entry.second.changed) {
+            anyChanged = true;
+            break;
+        }
+    }
+    if (!anyChanged) return;
+
+    if (!varIndexCurrent()) {
+        buildVarIndex();
+    }
+
+    for (auto &entry : varDB) {
+        if (!entry.second.changed) continue;
+        const auto dependents = varDependents.find(entry.first);
+        if (dependents != varDependents.end()) {
+            for (tagRecord *tag : dependents->second) {
+                char hexmac[17];
+                mac2hex(tag->mac, hexmac);
+                Serial.printf("updating %s because of var %s\r\n", hexmac, entry.first.c_str());
+                tag->nextupdate = 0;
+                ContentScheduler::wake(tag);
             }
         }
-        if (tag->contentMode == 21) {
-            if (varDB["ap_tagcount"].changed || varDB["ap_ip"].changed || varDB["ap_ch"].changed) {
+    }
+
+    if (varDB["ap_tagcount"].changed || varDB["ap_ip"].changed || varDB["ap_ch"].changed) {
+        for (tagRecord *tag : tagDB) {
+            if (tag->contentMode == 21) {
                 tag->nextupdate = 0;
+                ContentScheduler::wake(tag);
             }
         }
     }
-    for (const auto &entry : varDB) {
-        if (entry.second.changed) varDB[entry.first].changed = false;
+
+    for (auto &entry : varDB) {
+        entry.second.changed = false;
     }
 }
 
@@ -649,7 +816,7 @@ bool updateTagImage(String &filename, const uint8_t *dst, uint16_t nextCheckin,
             Serial.println("datatype: DATATYPE_IMG_RAW_2BPP");
         }
         if (nextCheckin > 0x7fff) nextCheckin = 0;
-        prepareDataAvail(filename, imageParams.dataType, imageParams.lut, dst, nextCheckin);
+        RenderPipeline::publish(filename, imageParams.dataType, imageParams.lut, dst, nextCheckin);
     }
     return true;
 }
@@ -666,6 +833,14 @@ uint8_t processFontPath(String &font) {
     return 3;
 }
 
+/// @brief Filesystem to load a font from, the SD card copy may be incomplete while the fonts are being synced
+static fs::FS &fontFS(const String &path) {
+#if defined HAS_SDCARD && !defined SD_CARD_ONLY
+    if (copyInProgress() && LittleFS.exists(path)) return LittleFS;
+#endif
+    return *contentFS;
+}
+
 void replaceVariables(String &format) {
     size_t startIndex = 0;
     size_t openBraceIndex, closeBraceIndex;
@@ -725,9 +900,11 @@ void drawString(TFT_eSprite &spr, String content, int16_t posx, int16_t posy, St
             truetypeClass truetype = truetypeClass();
             void *framebuffer = spr.getPointer();
             truetype.setFramebuffer(spr.width(), spr.height(), spr.getColorDepth(), static_cast<uint8_t *>(framebuffer));
-            File fontFile = contentFS->open(font, "r");
+            FsLock::lock(font, FsLock::READ, "drawString");
+            File fontFile = fontFS(font).open(font, "r");
             if (!truetype.setTtfFile(fontFile)) {
                 Serial.println("read ttf failed");
+                FsLock::unlock(font, FsLock::READ);
                 return;
             }
 
@@ -747,15 +924,24 @@ void drawString(TFT_eSprite &spr, String content, int16_t posx, int16_t posy, St
             }
             truetype.textDraw(posx, posy, content);
             truetype.end();
+            FsLock::unlock(font, FsLock::READ);
         } break;
         case 3: {
             // vlw bitmap font
+            // the font file stays open until unloadFont
+            const String fontFile = font + ".vlw";
             spr.setTextDatum(align);
-            if (font != "") spr.loadFont(font.substring(1), *contentFS);
+            if (font != "") {
+                FsLock::lock(fontFile, FsLock::READ, "drawString");
+                spr.loadFont(font.substring(1), fontFS(fontFile));
+            }
             spr.setTextColor(color, bgcolor);
             spr.setTextWrap(false, false);
             spr.drawString(content, posx, posy);
-            if (font != "") spr.unloadFont();
+            if (font != "") {
+                spr.unloadFont();
+                FsLock::unlock(fontFile, FsLock::READ);
+            }
         }
     }
 }
@@ -770,8 +956,12 @@ void drawTextBox(TFT_eSprite &spr, String &content, int16_t &posx, int16_t &posy
         case 3: {
             // vlw bitmap font
             // spr.drawRect(posx, posy, boxwidth, boxheight, TFT_BLACK);
+            const String fontFile = font + ".vlw";
             spr.setTextDatum(align);
-            if (font != "") spr.loadFont(font.substring(1), *contentFS);
+            if (font != "") {
+                FsLock::lock(fontFile, FsLock::READ, "drawTextBox");
+                spr.loadFont(font.substring(1), fontFS(fontFile));
+            }
             spr.setTextWrap(false, false);
             spr.setTextColor(color, bgcolor);
 
@@ -799,7 +989,10 @@ void drawTextBox(TFT_eSprite &spr, String &content, int16_t &posx, int16_t &posy
                     startPos++;
                 }
             }
-            if (font != "") spr.unloadFont();
+            if (font != "") {
+                spr.unloadFont();
+                FsLock::unlock(fontFile, FsLock::READ);
+            }
         }
     }
 }
@@ -1052,8 +1245,10 @@ void drawWeather(String &filename, JsonObject &cfgobj, const tagRecord *taginfo,
         units += "&temperature_unit=fahrenheit&windspeed_unit=mph&precipitation_unit=inch";
     }
 
+    JsonDocument filter;
+    filter["current_weather"] = true;
     JsonDocument doc;
-    const bool success = util::httpGetJson("https://api.open-meteo.com/v1/forecast?latitude=" + lat + "&longitude=" + lon + "&current_weather=true&windspeed_unit=ms&timezone=" + tz + units, doc, 5000);
+    const bool success = util::httpGetJsonCached("https://api.open-meteo.com/v1/forecast?latitude=" + lat + "&longitude=" + lon + "&current_weather=true&windspeed_unit=ms&timezone=" + tz + units, doc, CACHE_TTL_WEATHER, 5000, &filter);
     if (!success) {
         return;
     }
@@ -1082,8 +1277,12 @@ void drawForecast(String &filename, JsonObject &cfgobj, const tagRecord *taginfo
         units += "&temperature_unit=fahrenheit&windspeed_unit=mph&precipitation_unit=inch";
     }
 
+    JsonDocument filter;
+    filter["current_weather"] = true;
+    filter["daily"] = true;
+    filter["utc_offset_seconds"] = true;
     JsonDocument doc;
-    const bool success = util::httpGetJson("https://api.open-meteo.com/v1/forecast?latitude=" + lat + "&longitude=" + lon + "&daily=weathercode,temperature_2m_max,temperature_2m_min,precipitation_sum,windspeed_10m_max,winddirection_10m_dominant&current_weather=true&windspeed_unit=ms&timeformat=unixtime&timezone=" + tz + units, doc, 5000);
+    const bool success = util::httpGetJsonCached("https://api.open-meteo.com/v1/forecast?latitude=" + lat + "&longitude=" + lon + "&daily=weathercode,temperature_2m_max,temperature_2m_min,precipitation_sum,windspeed_10m_max,winddirection_10m_dominant&current_weather=true&windspeed_unit=ms&timeformat=unixtime&timezone=" + tz + units, doc, CACHE_TTL_WEATHER, 5000, &filter);
     if (!success) {
         return;
     }
@@ -1172,15 +1371,15 @@ int getImgURL(String &filename, String URL, time_t fetched, imgParam &imageParam
     http.setTimeout(5000);  // timeout in ms
     const int httpCode = http.GET();
     if (httpCode == 200) {
-        xSemaphoreTake(fsMutex, portMAX_DELAY);
+        FsLock::lock("/temp/temp.jpg", FsLock::WRITE, "getimgurl");
         File f = contentFS->open("/temp/temp.jpg", "w");
         if (f) {
             http.writeToStream(&f);
             f.close();
-            xSemaphoreGive(fsMutex);
+            FsLock::unlock("/temp/temp.jpg", FsLock::WRITE);
             jpg2buffer("/temp/temp.jpg", filename, imageParams);
         } else {
-            xSemaphoreGive(fsMutex);
+            FsLock::unlock("/temp/temp.jpg", FsLock::WRITE);
         }
     } else {
         if (httpCode != 304) {
@@ -1329,23 +1528,27 @@ bool getCalFeed(String &filename, JsonObject &cfgobj, tagRecord *&taginfo, imgPa
     char dateString[40];
     strftime(dateString, sizeof(dateString), languageDateFormat[0].c_str(), &timeinfo);
 
-    HTTPClient http;
-    // logLine("http getCalFeed " + URL);
-    http.begin(URL);
-    http.setTimeout(10000);
-    http.setFollowRedirects(HTTPC_STRICT_FOLLOW_REDIRECTS);
-    int httpCode = http.GET();
+    File body;
+    int httpCode = HttpCache::fetch(URL, CACHE_TTL_CALENDAR, body, 10000);
     if (httpCode != 200) {
         wsErr("getCalFeed http error " + String(httpCode));
         return false;
     }
 
+    // only keep the event fields the calendar drawers use
+    JsonDocument filter;
+    filter[0]["title"] = true;
+    filter[0]["start"] = true;
+    filter[0]["end"] = true;
+    filter[0]["isallday"] = true;
+    filter[0]["calendar"] = true;
+
     JsonDocument doc;
-    DeserializationError error = deserializeJson(doc, http.getString());
+    DeserializationError error = deserializeJson(doc, body, DeserializationOption::Filter(filter));
     if (error) {
         wsErr(error.c_str());
     }
-    http.end();
+    HttpCache::close(body);
 
     TFT_eSprite spr = TFT_eSprite(&tft);
 
@@ -1963,22 +2166,23 @@ bool getDayAheadFeed(String& filename, JsonObject& cfgobj, tagRecord*& taginfo,
     time_t now;
     time(&now);
 
-    HTTPClient http;
-    http.begin(URL);
-    http.setTimeout(10000);
-    http.setFollowRedirects(HTTPC_STRICT_FOLLOW_REDIRECTS);
-    int httpCode = http.GET();
+    File body;
+    int httpCode = HttpCache::fetch(URL, CACHE_TTL_DAYAHEAD, body, 10000);
     if (httpCode != 200) {
         wsErr("getDayAhead http error " + String(httpCode));
         return false;
     }
 
+    JsonDocument filter;
+    filter[0]["time"] = true;
+    filter[0]["price"] = true;
+
     JsonDocument doc;
-    DeserializationError error = deserializeJson(doc, http.getString());
+    DeserializationError error = deserializeJson(doc, body, DeserializationOption::Filter(filter));
     if (error) {
         wsErr(error.c_str());
     }
-    http.end();
+    HttpCache::close(body);
 
     TFT_eSprite spr = TFT_eSprite(&tft);
 
@@ -3050,7 +3254,7 @@ void getLocation(JsonObject &cfgobj) {
         filter["results"][0]["longitude"] = true;
         filter["results"][0]["timezone"] = true;
         JsonDocument doc;
-        if (util::httpGetJson("https://geocoding-api.open-meteo.com/v1/search?name=" + urlEncode(cfgobj["location"]) + "&count=1", doc, 5000, &filter)) {
+        if (util::httpGetJsonCached("https://geocoding-api.open-meteo.com/v1/search?name=" + urlEncode(cfgobj["location"]) + "&count=1", doc, CACHE_TTL_GEOCODING, 5000, &filter)) {
             cfgobj["#lat"] = doc["results"][0]["latitude"].as<String>();
             cfgobj["#lon"] = doc["results"][0]["longitude"].as<String>();
             cfgobj["#tz"] = doc["results"][0]["timezone"].as<String>();
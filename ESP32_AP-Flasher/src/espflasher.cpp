@@ -2,10 +2,13 @@
 #include <ArduinoJson.h>
 #include <FS.h>
 #include <HTTPClient.h>
+#include <MD5Builder.h>
 #include <esp_loader.h>
 
 #include "esp32_port.h"
 #include "esp_littlefs.h"
+#include "fslock.h"
+#include "miniz-oepl.h"
 #include "storage.h"
 #include "tag_db.h"
 #include "web.h"
@@ -18,6 +21,14 @@
 #define FLASHER_DEBUG_PORT 2
 #endif
 
+// the firmware is compared, compressed and written in segments of this size
+#define FLASH_SEGMENT_SIZE 0x4000
+// largest block the ROM loader accepts
+#define FLASH_BLOCK_SIZE 1024
+
+// tried in this order, the link falls back to 115200 if none of them works
+static const uint32_t flashBaudRates[] = {921600, 460800};
+
 esp_loader_error_t connect_to_target(uint32_t higher_transmission_rate) {
     esp_loader_connect_args_t connect_config = ESP_LOADER_CONNECT_DEFAULT();
     esp_loader_error_t err = esp_loader_connect(&connect_config);
@@ -47,13 +58,15 @@ esp_loader_error_t connect_to_target(uint32_t higher_transmission_rate) {
     return ESP_LOADER_SUCCESS;
 }
 
+#define BAUD_RATE_COUNT (sizeof(flashBaudRates) / sizeof(flashBaudRates[0]))
+
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 
-esp_loader_error_t flash_binary(String &file_path, size_t address) {
+esp_loader_error_t flash_binary_uncompressed(String &file_path, size_t address) {
     esp_loader_error_t err;
 
-    wsSerial("Flashing " + String(file_path));
+    wsSerial("Flashing " + String(file_path) + " uncompressed");
 
     File file = contentFS->open(file_path, "rb");
     if (!file) {
@@ -126,6 +139,107 @@ esp_loader_error_t flash_binary(String &file_path, size_t address) {
     return ESP_LOADER_SUCCESS;
 }
 
+// write one segment as a zlib stream, the ROM loader inflates it while writing
+static esp_loader_error_t flash_segment_deflated(Miniz::tdefl_compressor *comp, uint8_t *in, size_t len, uint8_t *out, size_t outSize, size_t address, size_t &sent) {
+    if (Miniz::tdefl_initOEPL(comp, NULL, NULL, Miniz::TDEFL_WRITE_ZLIB_HEADER | Miniz::TDEFL_DEFAULT_MAX_PROBES) != Miniz::TDEFL_STATUS_OKAY) {
+        return ESP_LOADER_ERROR_FAIL;
+    }
+    size_t inBytes = len;
+    size_t outBytes = outSize;
+    if (Miniz::tdefl_compressOEPL(comp, in, &inBytes, out, &outBytes, Miniz::TDEFL_FINISH) != Miniz::TDEFL_STATUS_DONE) {
+        return ESP_LOADER_ERROR_FAIL;
+    }
+
+    RETURN_ON_ERROR(esp_loader_flash_deflate_start(address, len, outBytes, FLASH_BLOCK_SIZE));
+    for (size_t pos = 0; pos < outBytes; pos += FLASH_BLOCK_SIZE) {
+        RETURN_ON_ERROR(esp_loader_flash_deflate_write(out + pos, MIN(outBytes - pos, FLASH_BLOCK_SIZE)));
+    }
+    sent = outBytes;
+    return ESP_LOADER_SUCCESS;
+}
+
+// Compressed flashing, segments that already hold the right data (same MD5) are skipped,
+// written segments are verified against the MD5 of the file
+esp_loader_error_t flash_binary(String &file_path, size_t address) {
+    esp_loader_error_t err = ESP_LOADER_SUCCESS;
+    const size_t outSize = FLASH_SEGMENT_SIZE + FLASH_SEGMENT_SIZE / 8 + 64;
+    uint8_t *in = (uint8_t *)malloc(FLASH_SEGMENT_SIZE);
+    uint8_t *out = (uint8_t *)malloc(outSize);
+    Miniz::tdefl_compressor *comp = (Miniz::tdefl_compressor *)malloc(sizeof(Miniz::tdefl_compressor));
+    File file = contentFS->open(file_path, "rb");
+
+    if (in == nullptr || out == nullptr || comp == nullptr || !file) {
+        if (file) file.close();
+        free(in);
+        free(out);
+        free(comp);
+        if (!file) {
+            wsSerial("Failed to open file");
+            return ESP_LOADER_ERROR_FAIL;
+        }
+        util::printLargestFreeBlock();
+        return flash_binary_uncompressed(file_path, address);
+    }
+
+    wsSerial("Flashing " + String(file_path));
+    const size_t size = file.size();
+    size_t done = 0, skipped = 0, sent = 0;
+    const uint32_t start = millis();
+    uint32_t t = 0;
+
+    while (done < size) {
+        const size_t len = MIN(size - done, FLASH_SEGMENT_SIZE);
+        if (file.read(in, len) != len) {
+            wsSerial("Failed to read file.");
+            err = ESP_LOADER_ERROR_FAIL;
+            break;
+        }
+        // the ROM loader works on whole words
+        const size_t padded = (len + 3) & ~3;
+        memset(in + len, 0xFF, padded - len);
+
+        uint8_t md5[16];
+        MD5Builder md5builder;
+        md5builder.begin();
+        md5builder.add(in, padded);
+        md5builder.calculate();
+        md5builder.getBytes(md5);
+
+        if (esp_loader_flash_verify_known_md5(address + done, padded, md5) == ESP_LOADER_SUCCESS) {
+            skipped += len;
+        } else {
+            size_t segmentSent = 0;
+            err = flash_segment_deflated(comp, in, padded, out, outSize, address + done, segmentSent);
+            if (err != ESP_LOADER_SUCCESS) {
+                wsSerial("Writing at 0x" + String(address + done, HEX) + " failed");
+                break;
+            }
+            sent += segmentSent;
+            err = esp_loader_flash_verify_known_md5(address + done, padded, md5);
+            if (err != ESP_LOADER_SUCCESS) {
+                wsSerial("MD5 does not match at 0x" + String(address + done, HEX));
+                break;
+            }
+        }
+        done += len;
+
+        if (millis() - t > 250 || done == size) {
+            const uint32_t elapsed = millis() - start;
+            wsSerial("Progress: " + String(done * 100 / size) + "% " + String(elapsed ? (done - skipped) / elapsed : 0) + " kB/s");
+            t = millis();
+        }
+    }
+    file.close();
+    free(in);
+    free(out);
+    free(comp);
+
+    if (err == ESP_LOADER_SUCCESS) {
+        wsSerial("Flash verified, " + String(skipped) + " of " + String(size) + " bytes unchanged, " + String(done - skipped) + " bytes sent as " + String(sent) + " in " + String((millis() - start) / 1000.0, 1) + "s");
+    }
+    return err;
+}
+
 bool downloadAndWriteBinary(String &filename, const char *url) {
     HTTPClient binaryHttp;
     bool Ret = false;
@@ -146,7 +260,7 @@ bool downloadAndWriteBinary(String &filename, const char *url) {
             wsSerial("Couldn't get contentLength");
             break;
         }
-        xSemaphoreTake(fsMutex, portMAX_DELAY);
+        FsLock::lock(filename, FsLock::WRITE, "espflasher");
         bHaveFsMutex = true;
         File file = contentFS->open(filename, "wb");
         if(!file) {
@@ -197,7 +311,7 @@ bool downloadAndWriteBinary(String &filename, const char *url) {
     binaryHttp.setReuse(false);
     binaryHttp.end();
     if(bHaveFsMutex) {
-        xSemaphoreGive(fsMutex);
+        FsLock::unlock(filename, FsLock::WRITE);
     }
 
     return Ret;
@@ -279,10 +393,16 @@ bool FlashC6_H2(const char *RepoUrl) {
             break;
         }
 
-        if(connect_to_target(115200) != ESP_LOADER_SUCCESS) {
+        if(connect_to_target(0) != ESP_LOADER_SUCCESS) {
             wsSerial("Connection to the " SHORT_CHIP_NAME " failed");
             break;
         }
+        uint32_t rate = 115200;
+        if(esp_loader_negotiate_transmission_rate(flashBaudRates, BAUD_RATE_COUNT, 115200, &rate) != ESP_LOADER_SUCCESS) {
+            wsSerial("Connection to the " SHORT_CHIP_NAME " lost while changing baud rate");
+            break;
+        }
+        wsSerial("Using " + String(rate) + " baud");
 
         if(esp_loader_get_target() != ESP_CHIP_TYPE) {
             wsSerial("Connected to wrong ESP32 type");
@@ -305,6 +425,15 @@ bool FlashC6_H2(const char *RepoUrl) {
                    break;
                 }
                 Serial.printf("Flash failed with error %d. Retrying...\n", err);
+                // failed twice at this rate, the link may not carry it reliably
+                if(retry % 2 == 1 && rate > 115200) {
+                    // reconnects and uses the next lower rate
+                    if(esp_loader_negotiate_transmission_rate(flashBaudRates, BAUD_RATE_COUNT, 115200, &rate) != ESP_LOADER_SUCCESS) {
+                        wsSerial("Connection to the " SHORT_CHIP_NAME " lost while changing baud rate");
+                        break;
+                    }
+                    wsSerial("Falling back to " + String(rate) + " baud");
+                }
                 delay(1000);
             }
             if(err != ESP_LOADER_SUCCESS) {
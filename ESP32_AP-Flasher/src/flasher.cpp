@@ -5,11 +5,13 @@
 #include <MD5Builder.h>
 
 #include "LittleFS.h"
+#include "fslock.h"
 #include "leds.h"
 #include "settings.h"
 #include "storage.h"
 #include "time.h"
 #include "zbs_interface.h"
+#include "zbs_pageprog.h"
 #include <WiFi.h>
 
 #ifdef HAS_EXT_FLASHER
@@ -22,6 +24,12 @@ extern Logger logger;
 
 #define FINGERPRINT_FLASH_SIZE 10240
 
+// read the whole image back once more after the last page, in case a page write disturbed
+// an earlier page. Each page is already verified right after it is written
+#ifndef ZBS_FLASH_FULL_VERIFY
+#define ZBS_FLASH_FULL_VERIFY 0
+#endif
+
 #ifdef HAS_EXT_FLASHER
 bool extTagConnected() {
     // checks if the TEST (P1.0) pin on the ZBS243 will come up high. If it doesn't, there's probably a tag connected.
@@ -273,13 +281,14 @@ bool flasher::backupFlash() {
     getFirmwareMD5();
     if (!zbs->select_flash(0)) return false;
     md5char[16] = 0x00;
-    xSemaphoreTake(fsMutex, portMAX_DELAY);
-    fs::File backup = contentFS->open("/" + (String)md5char + "_backup.bin", "w", true);
+    const String backupPath = "/" + (String)md5char + "_backup.bin";
+    FsLock::lock(backupPath, FsLock::WRITE, "flasher");
+    fs::File backup = contentFS->open(backupPath, "w", true);
     for (uint32_t c = 0; c < 65535; c++) {
         backup.write(zbs->read_flash(c));
     }
     backup.close();
-    xSemaphoreGive(fsMutex);
+    FsLock::unlock(backupPath, FsLock::WRITE);
     return true;
 }
 
@@ -325,43 +334,37 @@ bool flasher::writeFlash(uint8_t *flashbuffer, uint16_t size) {
     zbs->erase_flash();
     if (!zbs->select_flash(0)) return false;
     Seriallog.printf("Starting flash, size=%d\r\n", size);
-    for (uint16_t c = 0; c < size; c++) {
-        if (flashbuffer[c] == 0xFF) goto flashWriteSuccess;
-        for (uint8_t i = 0; i < MAX_WRITE_ATTEMPTS; i++) {
-            zbs->write_flash(c, flashbuffer[c]);
-            if (zbs->read_flash(c) == flashbuffer[c]) {
-                goto flashWriteSuccess;
-            }
-        }
-        return false;
-    flashWriteSuccess:
-        if (c % 256 == 0) {
+    pageFallbacks = 0;
+    for (uint32_t c = 0; c < size; c += 256) {
+        const uint16_t len = (size - c > 256) ? 256 : size - c;
+        if (!writePage(c, flashbuffer + c, len)) return false;
 #ifdef HAS_RGB_LED
-            shortBlink(CRGB::White);
+        shortBlink(CRGB::White);
 #else
-            quickBlink(2);
+        quickBlink(2);
 #endif
-            Seriallog.printf("\rNow flashing, %d/%d  ", c, size);
-            vTaskDelay(1 / portTICK_PERIOD_MS);
+        Seriallog.printf("\rNow flashing, %d/%d  ", c, size);
+        vTaskDelay(1 / portTICK_PERIOD_MS);
+    }
+#if ZBS_FLASH_FULL_VERIFY
+    for (uint32_t c = 0; c < size; c += 256) {
+        const uint16_t len = (size - c > 256) ? 256 : size - c;
+        if (!verifyPage(c, flashbuffer + c, len)) {
+            Seriallog.printf("\r\nVerify failed at 0x%04X\r\n", c);
+            return false;
         }
     }
+#endif
     return true;
 }
 
-bool flasher::writeBlock256(uint16_t offset, uint8_t *flashbuffer) {
-    for (uint16_t c = 0; c < 256; c++) {
-        if (flashbuffer[c] == 0xFF) goto flashWriteSuccess;
-        for (uint8_t i = 0; i < MAX_WRITE_ATTEMPTS; i++) {
-            zbs->write_flash(offset + c, flashbuffer[c]);
-            if (zbs->read_flash(offset + c) == flashbuffer[c]) {
-                goto flashWriteSuccess;
-            }
-        }
-        return false;
-    flashWriteSuccess:
-        continue;
-    }
-    return true;
+bool flasher::verifyPage(uint16_t offset, const uint8_t *flashbuffer, uint16_t len) {
+    return ZbsPageProg::verifyPage(*zbs, offset, flashbuffer, len);
+}
+
+// program an erased page in one burst, bytes that didn't stick are rewritten in byte mode
+bool flasher::writePage(uint16_t offset, uint8_t *flashbuffer, uint16_t len) {
+    return ZbsPageProg::writePage(*zbs, offset, flashbuffer, len, MAX_WRITE_ATTEMPTS, pageFallbacks);
 }
 
 // get info from infoblock (eeprom flash, kinda)
@@ -385,17 +388,8 @@ bool flasher::writeInfoBlock() {
     if (!zbs->select_flash(1)) return false;
     // select info page
 
-    for (uint16_t c = 0; c < 1024; c++) {
-        if (infoblock[c] == 0xFF) goto ifBlockWriteSuccess;
-        for (uint8_t i = 0; i < MAX_WRITE_ATTEMPTS; i++) {
-            zbs->write_flash(c, infoblock[c]);
-            if (zbs->read_flash(c) == infoblock[c]) {
-                goto ifBlockWriteSuccess;
-            }
-        }
-        return false;
-    ifBlockWriteSuccess:
-        continue;
+    for (uint16_t c = 0; c < 1024; c += 256) {
+        if (!writePage(c, infoblock + c, 256)) return false;
     }
     return true;
 }
@@ -419,15 +413,17 @@ bool flasher::writeFlashFromPackOffset(fs::File *file, uint16_t length) {
     Seriallog.printf("Starting flash, size=%d\r\n", length);
 
     uint8_t *buf = (uint8_t *)malloc(256);
+    if (buf == nullptr) return false;
+#if ZBS_FLASH_FULL_VERIFY
+    const size_t start = file->position();
+    const uint16_t total = length;
+#endif
     uint16_t offset = 0;
+    pageFallbacks = 0;
     while (length) {
-        if (length > 256) {
-            file->read(buf, 256);
-            length -= 256;
-        } else {
-            file->read(buf, length);
-            length = 0;
-        }
+        const uint16_t blockLen = (length > 256) ? 256 : length;
+        file->read(buf, blockLen);
+        length -= blockLen;
 #ifdef HAS_RGB_LED
         shortBlink(CRGB::White);
 #else
@@ -435,15 +431,29 @@ bool flasher::writeFlashFromPackOffset(fs::File *file, uint16_t length) {
 #endif
         Seriallog.printf("\r[Flashing %d bytes]    ", length);
 
-        bool res = writeBlock256(offset, buf);
+        bool res = writePage(offset, buf, blockLen);
         offset += 256;
         if (!res) {
             Seriallog.printf("Failed writing block to tag, probably a hardware failure\r\n");
+            free(buf);
             return false;
         }
         vTaskDelay(1 / portTICK_PERIOD_MS);
     }
-    Seriallog.printf("\r\nFlashing done\r\n");
+#if ZBS_FLASH_FULL_VERIFY
+    file->seek(start);
+    for (uint32_t c = 0; c < total; c += 256) {
+        const uint16_t blockLen = (total - c > 256) ? 256 : total - c;
+        file->read(buf, blockLen);
+        if (!verifyPage(c, buf, blockLen)) {
+            Seriallog.printf("\r\nVerify failed at 0x%04X\r\n", c);
+            free(buf);
+            return false;
+        }
+    }
+#endif
+    free(buf);
+    Seriallog.printf("\r\nFlashing done, %d pages needed byte mode\r\n", pageFallbacks);
     return true;
 }
 
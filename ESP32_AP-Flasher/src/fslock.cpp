@@ -0,0 +1,109 @@
+#include "fslock.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace FsLock {
+
+/// @brief Current holders of a single path, removed when released
+struct PathState {
+    uint16_t readers = 0;
+    bool writer = false;
+};
+
+static std::mutex stateMutex;
+static std::condition_variable released;
+static std::unordered_map<std::string, PathState> paths;
+// set while lockAll is waiting or holding, blocks new path locks
+static bool exclusive = false;
+// holder names are string literals, keyed on the pointer
+static std::unordered_map<const char *, HolderStats> holders;
+
+static void record(const char *holder, const bool waited, const uint32_t waitUs) {
+    HolderStats &stats = holders[holder];
+    stats.count++;
+    if (waited) {
+        stats.contended++;
+        stats.waitUs += waitUs;
+        if (waitUs > stats.maxWaitUs) stats.maxWaitUs = waitUs;
+    }
+}
+
+void lock(const String &path, const Mode mode, const char *holder) {
+    const uint32_t start = micros();
+    const std::string key(path.c_str());
+    std::unique_lock<std::mutex> guard(stateMutex);
+
+    auto available = [&]() {
+        if (exclusive) return false;
+        const auto it = paths.find(key);
+        if (it == paths.end()) return true;
+        // readers only wait for an active writer, not for queued ones
+        if (mode == READ) return !it->second.writer;
+        return !it->second.writer && it->second.readers == 0;
+    };
+
+    const bool waited = !available();
+    if (waited) {
+        released.wait(guard, available);
+    }
+    PathState &state = paths[key];
+    if (mode == READ) {
+        state.readers++;
+    } else {
+        state.writer = true;
+    }
+    record(holder, waited, micros() - start);
+}
+
+void unlock(const String &path, const Mode mode) {
+    {
+        std::lock_guard<std::mutex> guard(stateMutex);
+        const auto it = paths.find(std::string(path.c_str()));
+        if (it == paths.end()) return;
+        if (mode == READ) {
+            if (it->second.readers) it->second.readers--;
+        } else {
+            it->second.writer = false;
+        }
+        if (it->second.readers == 0 && !it->second.writer) {
+            paths.erase(it);
+        }
+    }
+    released.notify_all();
+}
+
+void lockAll(const char *holder) {
+    const uint32_t start = micros();
+    std::unique_lock<std::mutex> guard(stateMutex);
+    const bool waited = exclusive || !paths.empty();
+    released.wait(guard, [] { return !exclusive; });
+    exclusive = true;
+    released.wait(guard, [] { return paths.empty(); });
+    record(holder, waited, micros() - start);
+}
+
+void unlockAll() {
+    {
+        std::lock_guard<std::mutex> guard(stateMutex);
+        exclusive = false;
+    }
+    released.notify_all();
+}
+
+void fillStats(JsonObject &obj) {
+    std::lock_guard<std::mutex> guard(stateMutex);
+    obj["held"] = paths.size();
+    JsonObject holderObj = obj["holders"].to<JsonObject>();
+    for (const auto &entry : holders) {
+        JsonObject stats = holderObj[entry.first].to<JsonObject>();
+        stats["count"] = entry.second.count;
+        stats["contended"] = entry.second.contended;
+        stats["waitms"] = (uint32_t)(entry.second.waitUs / 1000);
+        stats["maxwaitms"] = entry.second.maxWaitUs / 1000;
+    }
+}
+
+}  // namespace FsLock
@@ -37,23 +37,14 @@
 // 11 = long, long (N+N bits)
 // The rest of the code works identically to Group4 2D FAX
 //
-// Caution - this is the maximum number of color changes per line
-// The default value is set low to work embedded systems with little RAM
-// for font compression, this is plenty since each line of a character should have
-// a maximum of 7 color changes
-// You can define this in your compiler macros to override the default vlaue
+// The flip (color change) buffers are allocated at init time and sized
+// from the image width, a line can never have more color changes than
+// pixels, so encoding can no longer fail halfway through a busy image
+// (e.g. a dithered photo on a large panel). Call g5_encode_free() /
+// g5_decode_free() when done to release them.
 //
+#define G5_FLIPS_FOR_WIDTH(w) ((w) + 8)
 
-
-#define MAX_IMAGE_FLIPS 640
-
-#ifndef MAX_IMAGE_FLIPS
-#ifdef __AVR__
-#define MAX_IMAGE_FLIPS 32
-#else
-#define MAX_IMAGE_FLIPS 512
-#endif // __AVR__
-#endif
 // Horizontal prefix bits
 enum {
     HORIZ_SHORT_SHORT=0,
@@ -89,8 +80,9 @@ typedef struct g5_dec_image_tag
     uint32_t ulBitOff, ulBits; // vlc decode variables
     uint8_t *pSrc, *pBuf; // starting & current buffer pointer
     int16_t *pCur, *pRef; // current state of current vs reference flips
-    int16_t CurFlips[MAX_IMAGE_FLIPS];
-    int16_t RefFlips[MAX_IMAGE_FLIPS];
+    int iMaxFlips; // number of entries in each flip buffer
+    int16_t *CurFlips;
+    int16_t *RefFlips;
 } G5DECIMAGE;
 
 // Due to unaligned memory causing an exception, we have to do these macros the slow way
@@ -136,8 +128,9 @@ typedef struct g5_enc_image_tag
     uint8_t *pOutBuf;
     int16_t *pCur, *pRef; // pointers to swap current and reference lines
     BUFFERED_BITS bb;
-    int16_t CurFlips[MAX_IMAGE_FLIPS];
-    int16_t RefFlips[MAX_IMAGE_FLIPS];
+    int iMaxFlips; // number of entries in each flip buffer
+    int16_t *CurFlips;
+    int16_t *RefFlips;
 } G5ENCIMAGE;
 
 // 16-bit marker at the start of a BB_FONT file
@@ -46,8 +46,17 @@ static const uint8_t code_table[128]  =
 
 static int g5_decode_init(G5DECIMAGE *pImage, int iWidth, int iHeight, uint8_t *pData, int iDataSize)
 {
-    if (pImage == NULL || iWidth < 1 || iHeight < 1 || pData == NULL || iDataSize < 1)
+    if (pImage == NULL)
         return G5_INVALID_PARAMETER;
+    // g5_decode_free is safe to call whatever init returns
+    pImage->CurFlips = pImage->RefFlips = NULL;
+    if (iWidth < 1 || iHeight < 1 || pData == NULL || iDataSize < 1)
+        return G5_INVALID_PARAMETER;
+    pImage->iMaxFlips = G5_FLIPS_FOR_WIDTH(iWidth);
+    pImage->CurFlips = (int16_t *)malloc(2 * pImage->iMaxFlips * sizeof(int16_t));
+    if (pImage->CurFlips == NULL)
+        return G5_INVALID_PARAMETER;
+    pImage->RefFlips = &pImage->CurFlips[pImage->iMaxFlips];
     
     pImage->iVLCSize = iDataSize;
     pImage->pSrc = pData;
@@ -59,6 +68,16 @@ static int g5_decode_init(G5DECIMAGE *pImage, int iWidth, int iHeight, uint8_t *
     return G5_SUCCESS;
 
 } /* g5_decode_init() */
+//
+// Release the flip buffers allocated by g5_decode_init()
+//
+static void g5_decode_free(G5DECIMAGE *pImage)
+{
+    if (pImage != NULL && pImage->CurFlips != NULL) {
+        free(pImage->CurFlips);
+        pImage->CurFlips = pImage->RefFlips = NULL;
+    }
+} /* g5_decode_free() */
 
 static void G5DrawLine(G5DECIMAGE *pPage, int16_t *pCurFlips, uint8_t *pOut)
 {
@@ -122,7 +141,7 @@ static void Decode_Begin(G5DECIMAGE *pPage)
     CurFlips = pPage->CurFlips;
     
     /* Seed the current and reference line with XSIZE for V(0) codes */
-     for (i=0; i<MAX_IMAGE_FLIPS-2; i++) {
+     for (i=0; i<pPage->iMaxFlips-2; i++) {
          RefFlips[i] = xsize;
          CurFlips[i] = xsize;
      }
@@ -150,26 +169,32 @@ static void Decode_Begin(G5DECIMAGE *pPage)
 static int DecodeLine(G5DECIMAGE *pPage)
 {
     signed int a0, a0_p, b1;
-    int16_t *pCur, *pRef, *RefFlips, *CurFlips;
+    int16_t *pCur, *pRef, *RefFlips, *CurFlips, *pCurEnd;
     int xsize, tot_run=0, tot_run1 = 0;
     int32_t sCode;
     uint32_t lBits;
     uint32_t ulBits, ulBitOff;
     uint8_t *pBuf/*, *pBufEnd*/;
-    uint32_t u32HMask, u32HLen; // horizontal code mask and length
+    uint32_t u32RunLen[2], u32Len; // short and long horizontal run code lengths
 
     pCur = CurFlips = pPage->pCur;
     pRef = RefFlips = pPage->pRef;
+    // leave room for the two entries of a horizontal code and the line end
+    pCurEnd = &CurFlips[pPage->iMaxFlips - 4];
     ulBits = pPage->ulBits;
     ulBitOff = pPage->ulBitOff;
     pBuf = pPage->pBuf;
     // pBufEnd = &pPage->pSrc[pPage->iVLCSize];
-    u32HLen = pPage->iHLen;
-    u32HMask = (1 << u32HLen) - 1;
+    u32RunLen[0] = 3;
+    u32RunLen[1] = pPage->iHLen;
     a0 = -1;
     xsize = pPage->iWidth;
     
     while (a0 < xsize) {  /* Decode this line */
+        if (pCur >= pCurEnd) { // corrupt data, more flips than the line can have
+            pPage->iError = G5_DECODE_ERROR;
+            goto pilreadg5z;
+        }
         if (ulBitOff > (REGISTER_WIDTH-8)) { // need at least 7 unused bits
             pBuf += (ulBitOff >> 3);
             ulBitOff &= 7;
@@ -229,38 +254,19 @@ static int DecodeLine(G5DECIMAGE *pPage)
                     // There are 4 possible horizontal cases: short/short, short/long, long/short, long/long
                     // These are encoded in a 2-bit prefix code, followed by 3 bits for short or N bits for long code
                     // N is the log base 2 of the image width (e.g. 320 pixels requires 9 bits)
+                    // Each prefix bit selects the length of one run from the table instead of branching per case
                     ulBitOff += 2;
-                    switch (lBits) {
-                        case HORIZ_SHORT_SHORT:
-                            tot_run = (ulBits >> ((REGISTER_WIDTH - 3) - ulBitOff)) & 0x7; // get 3-bit short length
-                            ulBitOff += 3;
-                            tot_run1 = (ulBits >> ((REGISTER_WIDTH - 3) - ulBitOff)) & 0x7; // get 3-bit short length
-                            ulBitOff += 3;
-                            break;
-                        case HORIZ_SHORT_LONG:
-                            tot_run = (ulBits >> ((REGISTER_WIDTH - 3) - ulBitOff)) & 0x7; // get 3-bit short length
-                            ulBitOff += 3;
-                            tot_run1 = (ulBits >> ((REGISTER_WIDTH - u32HLen) - ulBitOff)) & u32HMask; // get long length
-                            ulBitOff += u32HLen;
-                            break;
-                        case HORIZ_LONG_SHORT:
-                            tot_run = (ulBits >> ((REGISTER_WIDTH - u32HLen) - ulBitOff)) & u32HMask; // get long length
-                            ulBitOff += u32HLen;
-                            tot_run1 = (ulBits >> ((REGISTER_WIDTH - 3) - ulBitOff)) & 0x7; // get 3-bit short length
-                            ulBitOff += 3;
-                            break;
-                        case HORIZ_LONG_LONG:
-                            tot_run = (ulBits >> ((REGISTER_WIDTH - u32HLen) - ulBitOff)) & u32HMask; // get long length
-                            ulBitOff += u32HLen;
-                            if (ulBitOff > (REGISTER_WIDTH-16)) { // need at least 16 unused bits
-                                pBuf += (ulBitOff >> 3);
-                                ulBitOff &= 7;
-                                ulBits = TIFFMOTOLONG(pBuf);
-                            }
-                            tot_run1 = (ulBits >> ((REGISTER_WIDTH - u32HLen) - ulBitOff)) & u32HMask; // get long length
-                            ulBitOff += u32HLen;
-                            break;
-                    } // switch on lBits
+                    u32Len = u32RunLen[lBits >> 1];
+                    tot_run = (ulBits >> ((REGISTER_WIDTH - u32Len) - ulBitOff)) & ((1 << u32Len) - 1);
+                    ulBitOff += u32Len;
+                    if (ulBitOff > (REGISTER_WIDTH-16)) { // need at least 16 unused bits
+                        pBuf += (ulBitOff >> 3);
+                        ulBitOff &= 7;
+                        ulBits = TIFFMOTOLONG(pBuf);
+                    }
+                    u32Len = u32RunLen[lBits & 1];
+                    tot_run1 = (ulBits >> ((REGISTER_WIDTH - u32Len) - ulBitOff)) & ((1 << u32Len) - 1);
+                    ulBitOff += u32Len;
                     a0 = a0_p + tot_run;
                     *pCur++ = a0;
                     a0 += tot_run1;
@@ -14,25 +14,6 @@
 // ./APL.txt.
 #include "Group5.h"
 
-/* Number of consecutive 1 bits in a byte from MSB to LSB */
-static uint8_t bitcount[256] =
-        {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,  /* 0-15 */
-         0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,  /* 16-31 */
-         0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,  /* 32-47 */
-         0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,  /* 48-63 */
-         0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,  /* 64-79 */
-         0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,  /* 80-95 */
-         0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,  /* 96-111 */
-         0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,  /* 112-127 */
-         1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,  /* 128-143 */
-         1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,  /* 144-159 */
-         1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,  /* 160-175 */
-         1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,  /* 176-191 */
-         2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,  /* 192-207 */
-         2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,  /* 208-223 */
-         3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,3,  /* 224-239 */
-         4,4,4,4,4,4,4,4,5,5,5,5,6,6,7,8}; /* 240-255 */
-
 /* Table of vertical codes for G5 encoding */
 /* code followed by length, starting with v(-3) */
 static const uint8_t vtable[14] =
@@ -81,8 +62,17 @@ int g5_encode_init(G5ENCIMAGE *pImage, int iWidth, int iHeight, uint8_t *pOut, i
 {
     int iError = G5_SUCCESS;
     
-    if (pImage == NULL || iHeight <= 0)
+    if (pImage == NULL)
+        return G5_INVALID_PARAMETER;
+    // g5_encode_free is safe to call whatever init returns
+    pImage->CurFlips = pImage->RefFlips = NULL;
+    if (iWidth <= 0 || iHeight <= 0)
+        return G5_INVALID_PARAMETER;
+    pImage->iMaxFlips = G5_FLIPS_FOR_WIDTH(iWidth);
+    pImage->CurFlips = (int16_t *)malloc(2 * pImage->iMaxFlips * sizeof(int16_t));
+    if (pImage->CurFlips == NULL)
         return G5_INVALID_PARAMETER;
+    pImage->RefFlips = &pImage->CurFlips[pImage->iMaxFlips];
     pImage->iWidth = iWidth; // image size
     pImage->iHeight = iHeight;
     pImage->pCur = pImage->CurFlips;
@@ -91,7 +81,7 @@ int g5_encode_init(G5ENCIMAGE *pImage, int iWidth, int iHeight, uint8_t *pOut, i
     pImage->iOutSize = iOutSize; // output buffer pre-allocated size
     pImage->iDataSize = 0; // no data yet
     pImage->y = 0;
-    for (int i=0; i<MAX_IMAGE_FLIPS; i++) {
+    for (int i=0; i<pImage->iMaxFlips; i++) {
         pImage->RefFlips[i] = iWidth;
         pImage->CurFlips[i] = iWidth;
     }
@@ -102,86 +92,65 @@ int g5_encode_init(G5ENCIMAGE *pImage, int iWidth, int iHeight, uint8_t *pOut, i
     return iError;
 } /* g5_encode_init() */
 //
+// Release the flip buffers allocated by g5_encode_init()
+//
+void g5_encode_free(G5ENCIMAGE *pImage)
+{
+    if (pImage != NULL && pImage->CurFlips != NULL) {
+        free(pImage->CurFlips);
+        pImage->CurFlips = pImage->RefFlips = NULL;
+    }
+} /* g5_encode_free() */
+//
 // Internal function to convert uncompressed 1-bit per pixel data
 // into the run-end data needed to feed the G5 encoder
+// The line is scanned 32 bits at a time; XOR-ing each word with itself
+// shifted right by one (carrying in the last pixel of the previous word)
+// leaves a 1 at every color change, which are then taken off with
+// count-leading-zeros instead of per-bit tests
 //
-static int G5ENCEncodeLine(unsigned char *buf, int xsize, int16_t *pDest)
+static int G5ENCEncodeLine(unsigned char *buf, int xsize, int16_t *pDest, int iMaxFlips)
 {
-int iCount, xborder;
-uint8_t i, c;
-int8_t cBits;
-int iLen;
-int16_t x;
-int16_t *pLimit = pDest + (MAX_IMAGE_FLIPS-4);
-
-   xborder = xsize;
-   iCount = (xsize + 7) >> 3; /* Number of bytes per line */
-   cBits = 8;
-   iLen = 0; /* Current run length */
-   x = 0;
+int iBytes, iBits, iPos, iValid, iByte;
+uint32_t u32, u32Flips, u32Last;
+uint8_t *s;
+int16_t *pLimit = pDest + (iMaxFlips-4);
 
-   c = *buf++;  /* Get the first byte to start */
-   iCount--;
-   while (iCount >=0) {
-      if (pDest >= pLimit) return G5_MAX_FLIPS_EXCEEDED;
-      i = bitcount[c]; /* Get the number of consecutive bits */
-      iLen += i; /* Add this length to total run length */
-      c <<= i;
-      cBits -= i; /* Minus the number in a byte */
-      if (cBits <= 0)
-         {
-         iLen += cBits; /* Adjust length */
-         cBits = 8;
-         c = *buf++;  /* Get another data byte */
-         iCount--;
-         continue; /* Keep doing white until color change */
-         }
-      c = ~c; /* flip color to count black pixels */
-   /* Store the white run length */
-      xborder -= iLen;
-      if (xborder < 0)
-         {
-         iLen += xborder; /* Make sure run length is not past end */
-         break;
-         }
-      x += iLen;
-      *pDest++ = x;
-      iLen = 0;
-doblack:
-      i = bitcount[c]; /* Get consecutive bits */
-      iLen += i; /* Add to total run length */
-      c <<= i;
-      cBits -= i;
-      if (cBits <= 0)
-         {
-         iLen += cBits; /* Adjust length */
-         cBits = 8;
-         c = *buf++;  /* Get another data byte */
-         c = ~c;   /* Flip color to find black */
-         iCount--;
-         if (iCount < 0)
-            break;
-         goto doblack;
-         }
-   /* Store the black run length */
-      c = ~c;       /* Flip color again to find white pixels */
-      xborder -= iLen;
-      if (xborder < 0)
-         {
-         iLen += xborder; /* Make sure run length is not past end */
-         break;
+   iBytes = (xsize + 7) >> 3; /* Number of bytes per line */
+   iBits = iBytes << 3; /* runs extend into the padding bits of the last byte */
+   u32Last = 1; /* Each line starts with a run of 1 (white) bits */
+   for (iByte = 0; iByte < iBytes; iByte += 4) {
+      s = &buf[iByte];
+      if (iByte + 4 <= iBytes) {
+         u32 = TIFFMOTOLONG(s);
+         iValid = REGISTER_WIDTH;
+      } else { /* Don't read past the end of the line */
+         u32 = (uint32_t)s[0] << 24;
+         if (iByte + 1 < iBytes) u32 |= (uint32_t)s[1] << 16;
+         if (iByte + 2 < iBytes) u32 |= (uint32_t)s[2] << 8;
+         iValid = (iBytes - iByte) << 3;
+      }
+      u32Flips = u32 ^ ((u32 >> 1) | (u32Last << 31)); /* A 1 where the color changes */
+      if (iValid < REGISTER_WIDTH) u32Flips &= ~(MAX_VALUE >> iValid);
+      u32Last = u32 & 1;
+      while (u32Flips) {
+         iPos = (iByte << 3) + __builtin_clz(u32Flips); /* End of the current run */
+         if (iPos > xsize) { /* Make sure run length is not past end */
+            iBits = xsize;
+            goto done;
          }
-      x += iLen;
-      *pDest++ = x;
-      iLen = 0;
-      } /* while */
+         if (pDest >= pLimit) return G5_MAX_FLIPS_EXCEEDED;
+         *pDest++ = (int16_t)iPos;
+         u32Flips &= ~(0x80000000 >> __builtin_clz(u32Flips));
+      }
+   } /* for */
 
-   x += iLen;
+done:
    if (pDest >= pLimit) return G5_MAX_FLIPS_EXCEEDED;
-   *pDest++ = x;
-   *pDest++ = x; // Store a few more XSIZE to end the line
-   *pDest++ = x; // so that the compressor doesn't go past
-   *pDest++ = x; // the end of the line
+   *pDest++ = iBits;
+   *pDest++ = iBits; // Store a few more XSIZE to end the line
+   *pDest++ = iBits; // so that the compressor doesn't go past
+   *pDest++ = iBits; // the end of the line
    return G5_SUCCESS;
 } /* G5ENCEncodeLine() */
 //
@@ -211,7 +180,7 @@ BUFFERED_BITS bb;
     xsize = pImage->iWidth; /* For performance reasons */
 
     // Convert the incoming line of pixels into run-end data
-    iErr = G5ENCEncodeLine(pPixels, pImage->iWidth, CurFlips);
+    iErr = G5ENCEncodeLine(pPixels, pImage->iWidth, CurFlips, pImage->iMaxFlips);
     if (iErr != G5_SUCCESS) return iErr; // exceeded the maximum number of color changes
     /* Encode this line as G5 */
     a0 = a0_c = 0;
@@ -0,0 +1,267 @@
+#include "httpcache.h"
+
+#include <HTTPClient.h>
+
+#include <unordered_map>
+
+#include "fslock.h"
+#include "renderpipeline.h"
+#include "storage.h"
+#include "web.h"
+
+namespace HttpCache {
+
+/// @brief Metadata of a single cached response
+struct Entry {
+    String url;
+    String etag;
+    String lastModified;
+    time_t fetched = 0;
+    uint32_t lastUsed = 0;
+    bool inFlight = false;
+    /// @brief Fetches referencing this entry, it is not evicted while non-zero
+    uint8_t users = 0;
+};
+
+Stats stats;
+
+static std::unordered_map<uint32_t, Entry> entries;
+static SemaphoreHandle_t cacheMutex = nullptr;
+
+/// @brief 32 bit FNV-1a hash, used as cache key and file name
+static uint32_t hashUrl(const String &url) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < url.length(); i++) {
+        hash ^= (uint8_t)url[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static String entryPath(const uint32_t key, const char *ext) {
+    char path[40];
+    snprintf(path, sizeof(path), HTTPCACHE_DIR "/%08lx.%s", (unsigned long)key, ext);
+    return String(path);
+}
+
+static void removeFiles(const uint32_t key) {
+    contentFS->remove(entryPath(key, "json"));
+    contentFS->remove(entryPath(key, "bin"));
+}
+
+static void saveMeta(const uint32_t key, const Entry &entry) {
+    JsonDocument doc;
+    doc["url"] = entry.url;
+    doc["etag"] = entry.etag;
+    doc["lastmod"] = entry.lastModified;
+    doc["fetched"] = entry.fetched;
+    File file = contentFS->open(entryPath(key, "json"), "w");
+    if (file) {
+        serializeJson(doc, file);
+        file.close();
+    }
+}
+
+/// @brief Drop the least recently used entry to make room, must hold cacheMutex
+static void evict() {
+    auto oldest = entries.end();
+    for (auto it = entries.begin(); it != entries.end(); ++it) {
+        if (it->second.inFlight || it->second.users) continue;
+        if (oldest == entries.end() || it->second.lastUsed < oldest->second.lastUsed) {
+            oldest = it;
+        }
+    }
+    if (oldest != entries.end()) {
+        const String bodyPath = entryPath(oldest->first, "bin");
+        FsLock::lock(bodyPath, FsLock::WRITE, "httpcache");
+        removeFiles(oldest->first);
+        FsLock::unlock(bodyPath, FsLock::WRITE);
+        entries.erase(oldest);
+    }
+}
+
+void begin() {
+    if (cacheMutex == nullptr) {
+        cacheMutex = xSemaphoreCreateMutex();
+    }
+
+    time_t now;
+    time(&now);
+
+    FsLock::lock(HTTPCACHE_DIR, FsLock::WRITE, "httpcache");
+    if (!contentFS->exists(HTTPCACHE_DIR)) {
+        contentFS->mkdir(HTTPCACHE_DIR);
+    }
+    File dir = contentFS->open(HTTPCACHE_DIR);
+    File file = dir.openNextFile();
+    while (file) {
+        const String name = file.name();
+        if (name.endsWith(".json")) {
+            const uint32_t key = strtoul(name.c_str(), nullptr, 16);
+            JsonDocument doc;
+            const DeserializationError err = deserializeJson(doc, file);
+            file.close();
+            Entry entry;
+            entry.url = doc["url"].as<String>();
+            entry.etag = doc["etag"].as<String>();
+            entry.lastModified = doc["lastmod"].as<String>();
+            entry.fetched = doc["fetched"].as<time_t>();
+            // without a valid clock the age is unknown, keep the entry for revalidation
+            const bool tooOld = now > 1672531200 && now - entry.fetched > HTTPCACHE_MAX_STALE;
+            if (err || tooOld || !contentFS->exists(entryPath(key, "bin")) || entries.size() >= HTTPCACHE_MAX_ENTRIES) {
+                removeFiles(key);
+            } else {
+                entries[key] = entry;
+            }
+        } else {
+            file.close();
+        }
+        file = dir.openNextFile();
+    }
+    dir.close();
+    FsLock::unlock(HTTPCACHE_DIR, FsLock::WRITE);
+
+    Serial.printf("[HttpCache] %d cached responses\r\n", entries.size());
+}
+
+int fetch(const String &url, const uint32_t ttl, File &body, const uint16_t timeout) {
+    if (cacheMutex == nullptr) begin();
+
+    const uint32_t key = hashUrl(url);
+    const String bodyPath = entryPath(key, "bin");
+    time_t now;
+    time(&now);
+    const bool timeValid = now > 1672531200;
+
+    xSemaphoreTake(cacheMutex, portMAX_DELAY);
+    if (entries.count(key) == 0 && entries.size() >= HTTPCACHE_MAX_ENTRIES) {
+        evict();
+    }
+    // pinned, so the reference stays valid while the mutex is released
+    Entry &entry = entries[key];
+    entry.users++;
+
+    // another task is already fetching this url, wait for its result
+    if (entry.inFlight) {
+        const uint32_t waitStart = millis();
+        while (entry.inFlight && millis() - waitStart < timeout + 1000) {
+            xSemaphoreGive(cacheMutex);
+            vTaskDelay(20 / portTICK_PERIOD_MS);
+            xSemaphoreTake(cacheMutex, portMAX_DELAY);
+        }
+        // gave up waiting, fetch it ourselves
+        if (!entry.inFlight) stats.deduplicated++;
+    }
+
+    if (entry.url != url) {
+        // new entry or hash collision, never serve someone else's body
+        entry = Entry();
+        entry.url = url;
+    }
+    entry.lastUsed = millis();
+
+    if (timeValid && entry.fetched && now >= entry.fetched && now - entry.fetched < (time_t)ttl) {
+        // held until the caller is done with the body, see close()
+        FsLock::lock(bodyPath, FsLock::READ, "httpcache");
+        body = contentFS->open(bodyPath, "r");
+        if (!body) FsLock::unlock(bodyPath, FsLock::READ);
+        if (body) {
+            stats.hits++;
+            entry.users--;
+            xSemaphoreGive(cacheMutex);
+            return 200;
+        }
+        entry.fetched = 0;
+    }
+
+    entry.inFlight = true;
+    const String etag = entry.fetched ? entry.etag : "";
+    const String lastModified = entry.fetched ? entry.lastModified : "";
+    xSemaphoreGive(cacheMutex);
+
+    const uint32_t t = millis();
+    HTTPClient http;
+    http.begin(url);
+    http.setTimeout(timeout);
+    http.setFollowRedirects(HTTPC_STRICT_FOLLOW_REDIRECTS);
+    if (!etag.isEmpty()) http.addHeader("If-None-Match", etag);
+    if (!lastModified.isEmpty()) http.addHeader("If-Modified-Since", lastModified);
+    const char *headerKeys[] = {"ETag", "Last-Modified"};
+    http.collectHeaders(headerKeys, 2);
+    int httpCode = http.GET();
+
+    bool stored = false;
+    if (httpCode == 200) {
+        FsLock::lock(bodyPath, FsLock::WRITE, "httpcache");
+        const String tmpPath = entryPath(key, "tmp");
+        File file = contentFS->open(tmpPath, "w");
+        if (file) {
+            const int written = http.writeToStream(&file);
+            file.close();
+            if (written >= 0) {
+                contentFS->remove(bodyPath);
+                stored = contentFS->rename(tmpPath, bodyPath);
+            } else {
+                contentFS->remove(tmpPath);
+                httpCode = written;
+            }
+        }
+        FsLock::unlock(bodyPath, FsLock::WRITE);
+    }
+    const String newEtag = http.header("ETag");
+    const String newLastModified = http.header("Last-Modified");
+    http.end();
+    RenderPipeline::addStageTime(RenderPipeline::STAGE_FETCH, millis() - t);
+
+    xSemaphoreTake(cacheMutex, portMAX_DELAY);
+    if (stored) {
+        stats.misses++;
+        entry.etag = newEtag;
+        entry.lastModified = newLastModified;
+        entry.fetched = timeValid ? now : 1;
+    } else if (httpCode == 304 && entry.fetched) {
+        stats.revalidated++;
+        entry.fetched = timeValid ? now : 1;
+    } else if (entry.fetched && (!timeValid || now - entry.fetched < HTTPCACHE_MAX_STALE)) {
+        stats.stale++;
+        wsErr("[HttpCache] http " + String(httpCode) + ", using cached " + url);
+    } else {
+        stats.errors++;
+        entry.inFlight = false;
+        entry.users--;
+        xSemaphoreGive(cacheMutex);
+        return httpCode == 200 ? -1 : httpCode;
+    }
+
+    FsLock::lock(bodyPath, FsLock::WRITE, "httpcache");
+    if (stored || httpCode == 304) {
+        saveMeta(key, entry);
+    }
+    FsLock::unlock(bodyPath, FsLock::WRITE);
+    FsLock::lock(bodyPath, FsLock::READ, "httpcache");
+    body = contentFS->open(bodyPath, "r");
+    if (!body) FsLock::unlock(bodyPath, FsLock::READ);
+    entry.inFlight = false;
+    entry.users--;
+    xSemaphoreGive(cacheMutex);
+
+    return body ? 200 : -1;
+}
+
+void close(File &body) {
+    const String path = body.path();
+    body.close();
+    FsLock::unlock(path, FsLock::READ);
+}
+
+void fillStats(JsonObject &obj) {
+    obj["entries"] = entries.size();
+    obj["hits"] = stats.hits;
+    obj["revalidated"] = stats.revalidated;
+    obj["misses"] = stats.misses;
+    obj["deduplicated"] = stats.deduplicated;
+    obj["stale"] = stats.stale;
+    obj["errors"] = stats.errors;
+}
+
+}  // namespace HttpCache
@@ -23,6 +23,15 @@ TFT_eSPI tft2 = TFT_eSPI();
 uint8_t YellowSense = 0;
 bool tftLogscreen = true;
 bool tftOverride = false;
+static SemaphoreHandle_t tftMutex = nullptr;
+
+void tftLock() {
+    if (tftMutex) xSemaphoreTake(tftMutex, portMAX_DELAY);
+}
+
+void tftUnlock() {
+    if (tftMutex) xSemaphoreGive(tftMutex);
+}
 
 #if defined HAS_LILYGO_TPANEL || defined HAS_4inch_TPANEL
 
@@ -336,7 +345,7 @@ void touch_loop()
 }
 #endif
 
-void TFTLog(String text) {
+static void drawLog(String &text) {
 #if defined HAS_LILYGO_TPANEL || defined HAS_4inch_TPANEL
 
     gfx->setTextSize(2);
@@ -388,6 +397,12 @@ void TFTLog(String text) {
 #endif
 }
 
+void TFTLog(String text) {
+    tftLock();
+    drawLog(text);
+    tftUnlock();
+}
+
 int32_t findId(uint8_t mac[8]) {
     for (uint32_t c = 0; c < tagDB.size(); c++) {
         tagRecord* tag = tagDB.at(c);
@@ -420,6 +435,8 @@ void sendAvail(uint8_t wakeupReason) {
 }
 
 void yellow_ap_display_init(void) {
+    if (tftMutex == nullptr) tftMutex = xSemaphoreCreateMutex();
+
 #if defined HAS_LILYGO_TPANEL || defined HAS_4inch_TPANEL
 
     tftLogscreen = true;
@@ -513,6 +530,7 @@ void yellow_ap_display_loop(void) {
                 return;
             }
 
+            tftLock();
             TFT_eSprite spr = TFT_eSprite(&tft2);
             spr.setColorDepth(16);
             if (tag->len == tft2.width() * tft2.height()) spr.setColorDepth(8);
@@ -532,6 +550,7 @@ void yellow_ap_display_loop(void) {
 #else
             spr.pushSprite(0, 0);
 #endif
+            tftUnlock();
 
             tftLogscreen = false;
 
@@ -8,6 +8,8 @@
 
 #include "contentmanager.h"
 #include "flasher.h"
+#include "httpcache.h"
+#include "renderpipeline.h"
 #include "serialap.h"
 #include "settings.h"
 #include "storage.h"
@@ -146,6 +148,8 @@ void setup() {
     } else {
         cleanupCurrent();
     }
+    HttpCache::begin();
+    RenderPipeline::begin();
     xTaskCreate(APTask, "AP Process", 6000, NULL, 5, NULL);
     vTaskDelay(10 / portTICK_PERIOD_MS);
 
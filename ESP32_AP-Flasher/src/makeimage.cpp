@@ -5,8 +5,10 @@
 #include <makeimage.h>
 #include <web.h>
 
+#include "fslock.h"
 #include "leds.h"
 #include "miniz-oepl.h"
+#include "renderpipeline.h"
 #include "storage.h"
 #include "tag_db.h"
 #include "util.h"
@@ -339,9 +341,72 @@ void rewriteHeader(File &f_out) {
 }
 
 #ifndef SAVE_SPACE
-uint8_t *g5Compress(uint16_t width, uint16_t height, uint8_t *buffer, uint16_t buffersize, uint16_t &outBufferSize) {
-    G5ENCIMAGE g5enc;
+// skip G5 when the estimate exceeds this share of the raw size, the estimate runs ~20% low
+#define G5_ESTIMATE_LIMIT 0.8
+// every n-th line is sampled for the estimate
+#define G5_ESTIMATE_STEP 4
+
+/// @brief Load 32 pixels of a 1bpp line, pixels past the end of the line are white
+static uint32_t g5LoadWord(const uint8_t *line, const uint32_t index, const uint32_t pitch) {
+    uint32_t word = 0;
+    for (uint32_t i = index * 4; i < index * 4 + 4; i++) {
+        word = (word << 8) | (i < pitch ? line[i] : 0xff);
+    }
+    return word;
+}
+
+/// @brief Approximate G5 cost of the color changes in cur, given the changes of the same direction in ref
+static uint32_t g5ChangeCost(const uint32_t cur, const uint32_t ref) {
+    const uint32_t v0 = cur & ref;
+    const uint32_t v1 = cur & ((ref << 1) | (ref >> 1)) & ~v0;
+    const uint32_t v2 = cur & ((ref << 2) | (ref >> 2)) & ~(v0 | v1);
+    const uint32_t v3 = cur & ((ref << 3) | (ref >> 3)) & ~(v0 | v1 | v2);
+    const uint32_t horiz = cur & ~(v0 | v1 | v2 | v3);
+    // vertical codes V(0) 1 bit, V(+-1) 3, V(+-2) 6, V(+-3) 7, horizontal ~6 bits per change
+    return __builtin_popcount(v0) + 3 * __builtin_popcount(v1) + 6 * __builtin_popcount(v2) + 7 * __builtin_popcount(v3) + 6 * __builtin_popcount(horiz);
+}
+
+/// @brief Estimate the G5 compressed size from the color changes of sampled line pairs
+///
+/// Changes within 3 pixels of a change in the line above are cheap vertical
+/// codes, anything else costs a horizontal code. Line art and ordered
+/// dithering stay well below the raw size, error diffused photos on large
+/// panels end up above it.
+/// @return Estimated size in bytes
+static uint32_t g5EstimateSize(const uint16_t width, const uint16_t height, const uint8_t *buffer) {
+    const uint32_t pitch = width / 8;
+    const uint32_t words = (pitch + 3) / 4;
+    uint32_t bits = 0;
+    uint32_t lines = 0;
+    for (uint32_t y = 1; y < height; y += G5_ESTIMATE_STEP) {
+        const uint8_t *ref = buffer + (y - 1) * pitch;
+        const uint8_t *cur = buffer + y * pitch;
+        uint32_t prevRef = 0xffffffff, prevCur = 0xffffffff;
+        for (uint32_t i = 0; i < words; i++) {
+            const uint32_t r = g5LoadWord(ref, i, pitch);
+            const uint32_t c = g5LoadWord(cur, i, pitch);
+            const uint32_t changesRef = r ^ ((r >> 1) | (prevRef << 31));
+            const uint32_t changesCur = c ^ ((c >> 1) | (prevCur << 31));
+            prevRef = r;
+            prevCur = c;
+            bits += g5ChangeCost(changesCur & ~c, changesRef & ~r) + g5ChangeCost(changesCur & c, changesRef & r);
+        }
+        lines++;
+    }
+    if (lines == 0) return 0;
+    return (uint64_t)bits * height / lines / 8;
+}
+
+uint8_t *g5Compress(uint16_t width, uint16_t height, uint8_t *buffer, uint32_t buffersize, uint32_t &outBufferSize) {
+    G5ENCIMAGE g5enc = {};
     int rc;
+
+    const uint32_t estimate = g5EstimateSize(width, height, buffer);
+    if (estimate > buffersize * G5_ESTIMATE_LIMIT) {
+        Serial.printf("G5 estimate %d bytes for %d raw, not compressing\r\n", estimate, buffersize);
+        return nullptr;
+    }
+
     uint8_t *outbuffer = (uint8_t *)ps_malloc(buffersize+16384);
     if (outbuffer == NULL) {
         Serial.println("Failed to allocate the output buffer for the G5 encoder");
@@ -354,6 +419,7 @@ uint8_t *g5Compress(uint16_t width, uint16_t height, uint8_t *buffer, uint16_t b
         buffer += (width / 8);
         if (rc != G5_SUCCESS) break;
     }
+    g5_encode_free(&g5enc);
     if (rc == G5_ENCODE_COMPLETE) {
         outBufferSize = g5_encode_getOutSize(&g5enc);
     } else {
@@ -422,6 +488,7 @@ void spr2buffer(TFT_eSprite &spr, String &fileout, imgParam &imageParams) {
     extern uint8_t YellowSense;
     if (fileout == "direct") {
         if (tftOverride == false) {
+            tftLock();
             TFT_eSprite spr2 = TFT_eSprite(&tft2);
 #ifdef ST7735_NANO_TLSR
             tft2.setRotation(1);
@@ -449,12 +516,13 @@ void spr2buffer(TFT_eSprite &spr, String &fileout, imgParam &imageParams) {
 #else
             spr2.pushSprite(0, 0);
 #endif
+            tftUnlock();
         }
         return;
     }
 #endif
 
-    xSemaphoreTake(fsMutex, portMAX_DELAY);
+    FsLock::lock(fileout, FsLock::WRITE, "spr2buffer");
     fs::File f_out = contentFS->open(fileout, "w");
 
     switch (imageParams.bpp) {
@@ -473,7 +541,7 @@ void spr2buffer(TFT_eSprite &spr, String &fileout, imgParam &imageParams) {
                 Serial.println("Failed to allocate buffer");
                 util::printLargestFreeBlock();
                 f_out.close();
-                xSemaphoreGive(fsMutex);
+                FsLock::unlock(fileout, FsLock::WRITE);
                 return;
             }
             spr2color(spr, imageParams, buffer, buffer_size, false);
@@ -525,7 +593,7 @@ void spr2buffer(TFT_eSprite &spr, String &fileout, imgParam &imageParams) {
                         Serial.println("Failed to allocate larger buffer for 2bpp G5");
                         free(buffer);
                         f_out.close();
-                        xSemaphoreGive(fsMutex);
+                        FsLock::unlock(fileout, FsLock::WRITE);
                         return;
                     }
                     buffer = newbuffer;
@@ -538,7 +606,7 @@ void spr2buffer(TFT_eSprite &spr, String &fileout, imgParam &imageParams) {
                         height *= 2;
                     }
                 }
-                uint16_t outbufferSize = 0;
+                uint32_t outbufferSize = 0;
                 uint8_t *outBuffer;
                 bool compressionSuccessful = true;
                 if (imageParams.rotatebuffer % 2) {
@@ -591,7 +659,7 @@ void spr2buffer(TFT_eSprite &spr, String &fileout, imgParam &imageParams) {
                 Serial.println("Failed to allocate buffer");
                 util::printLargestFreeBlock();
                 f_out.close();
-                xSemaphoreGive(fsMutex);
+                FsLock::unlock(fileout, FsLock::WRITE);
                 return;
             }
             spr2color(spr, imageParams, buffer, buffer_size, false);
@@ -607,6 +675,7 @@ void spr2buffer(TFT_eSprite &spr, String &fileout, imgParam &imageParams) {
     }
 
     f_out.close();
-    xSemaphoreGive(fsMutex);
+    FsLock::unlock(fileout, FsLock::WRITE);
     Serial.println("finished writing buffer " + String(millis() - t) + "ms");
+    RenderPipeline::addStageTime(RenderPipeline::STAGE_ENCODE, millis() - t);
 }
@@ -11,6 +11,7 @@
 #include <mutex>
 #include <vector>
 
+#include "fslock.h"
 #include "serialap.h"
 #include "settings.h"
 #include "storage.h"
@@ -95,7 +96,6 @@ void prepareDataAvail(const uint8_t* dst) {
         return;
     }
 
-    taginfo->pendingCount++;
     taginfo->pendingIdle = 0;
 
     struct pendingData pending = {0};
@@ -139,7 +139,6 @@ void prepareDataAvail(uint8_t* data, uint16_t len, uint8_t dataType, const uint8
     }
 
     memcpy(taginfo->data, data, len);
-    taginfo->pendingCount++;
     taginfo->len = len;
     taginfo->pendingIdle = 0;
     taginfo->filename = String();
@@ -196,6 +195,8 @@ bool prepareDataAvail(String& filename, uint8_t dataType, uint8_t dataTypeArgume
         wsErr("File has size 0. " + filename);
         return false;
     }
+    // freshly rendered content, a resend is already accounted for
+    if (resend == false) Storage.trackUsage(filesize);
 
     uint8_t md5bytes[16];
     {
@@ -213,6 +214,7 @@ bool prepareDataAvail(String& filename, uint8_t dataType, uint8_t dataTypeArgume
         wsSendTaginfo(dst, SYNC_TAGSTATUS);
         if (contentFS->exists(filename) && resend == false) {
             contentFS->remove(filename);
+            Storage.trackUsage(-(int64_t)filesize);
         }
         return true;
     }
@@ -241,7 +243,7 @@ bool prepareDataAvail(String& filename, uint8_t dataType, uint8_t dataTypeArgume
     taginfo->filename = filename;
     taginfo->len = filesize;
     taginfo->dataType = dataType;
-    taginfo->pendingCount++;
+    // pendingCount is updated by queueDataAvail once the item is in the queue
 
     struct pendingData pending = {0};
     memcpy(pending.targetMac, dst, 8);
@@ -289,11 +291,11 @@ void prepareExternalDataAvail(struct pendingData* pending, IPAddress remoteIP) {
                 http.begin(imageUrl);
                 int httpCode = http.GET();
                 if (httpCode == 200) {
-                    xSemaphoreTake(fsMutex, portMAX_DELAY);
+                    FsLock::lock(filename, FsLock::WRITE, "externaldata");
                     File file = contentFS->open(filename, "w");
                     http.writeToStream(&file);
                     file.close();
-                    xSemaphoreGive(fsMutex);
+                    FsLock::unlock(filename, FsLock::WRITE);
                 } else if (httpCode == 404) {
                     snprintf(imageUrl, sizeof(imageUrl), "http://%s/current/%s.raw", remoteIP.toString().c_str(), hexmac);
                     // imageUrl = "http://" + remoteIP.toString() + "/current/" + String(hexmac) + ".raw";
@@ -301,11 +303,11 @@ void prepareExternalDataAvail(struct pendingData* pending, IPAddress remoteIP) {
                     http.begin(imageUrl);
                     httpCode = http.GET();
                     if (httpCode == 200) {
-                        xSemaphoreTake(fsMutex, portMAX_DELAY);
+                        FsLock::lock(filename, FsLock::WRITE, "externaldata");
                         File file = contentFS->open(filename, "w");
                         http.writeToStream(&file);
                         file.close();
-                        xSemaphoreGive(fsMutex);
+                        FsLock::unlock(filename, FsLock::WRITE);
                     }
                 } else {
                     logLine("prepareExternalDataAvail " + String(imageUrl) + " error " + String(httpCode));
@@ -335,7 +337,6 @@ void prepareExternalDataAvail(struct pendingData* pending, IPAddress remoteIP) {
                 taginfo->filename = filename;
                 taginfo->len = filesize;
                 taginfo->dataType = pending->availdatainfo.dataType;
-                taginfo->pendingCount++;
                 break;
             }
             case DATATYPE_NFC_RAW_CONTENT:
@@ -359,7 +360,6 @@ void prepareExternalDataAvail(struct pendingData* pending, IPAddress remoteIP) {
                         WiFiClient* stream = http.getStreamPtr();
                         stream->readBytes(taginfo->data, len);
                         taginfo->dataType = pending->availdatainfo.dataType;
-                        taginfo->pendingCount++;
                         taginfo->len = len;
                     }
                 }
@@ -394,15 +394,19 @@ void processBlockRequest(struct espBlockRequest* br) {
         return;
     }
     if (queueItem->data == nullptr) {
-        fs::File file = contentFS->open(queueItem->filename);
+        const String filename = queueItem->filename;
+        FsLock::lock(filename, FsLock::READ, "blockrequest");
+        fs::File file = contentFS->open(filename);
         if (!file) {
-            Serial.print("No current file. " + String(queueItem->filename) + " Canceling request\r\n");
+            FsLock::unlock(filename, FsLock::READ);
+            Serial.print("No current file. " + filename + " Canceling request\r\n");
             prepareCancelPending(br->src);
             return;
         }
         queueItem->data = getDataForFile(file);
-        Serial.println("Reading file " + String(queueItem->filename) + " in  " + String(millis() - t) + "ms");
         file.close();
+        FsLock::unlock(filename, FsLock::READ);
+        Serial.println("Reading file " + filename + " in  " + String(millis() - t) + "ms");
     }
 
     // check if we're not exceeding max blocks (to prevent sendBlock from exceeding its boundary)
@@ -737,19 +741,18 @@ bool sendTagCommand(const uint8_t* dst, uint8_t cmd, bool local, const uint8_t*
     pending.attemptsLeft = MAX_XFER_ATTEMPTS;
     Serial.printf(">Tag CMD %02X%02X%02X%02X%02X%02X%02X%02X\r\n\0", dst[7], dst[6], dst[5], dst[4], dst[3], dst[2], dst[1], dst[0]);
 
+    bool result = queueDataAvail(&pending, local);
+    if (!local) {
+        udpsync.netSendDataAvail(&pending);
+        result = true;
+    }
+
+    // pendingCount was updated by queueDataAvail
     tagRecord* taginfo = tagRecord::findByMAC(dst);
     if (taginfo != nullptr) {
-        taginfo->pendingCount++;
         wsSendTaginfo(taginfo->mac, SYNC_TAGSTATUS);
     }
-
-    if (local) {
-        return queueDataAvail(&pending, true);
-    } else {
-        queueDataAvail(&pending, false);
-        udpsync.netSendDataAvail(&pending);
-        return true;
-    }
+    return result;
 }
 
 bool sendTagMac(const uint8_t* dst, const uint64_t newmac, bool local) {
@@ -766,19 +769,18 @@ bool sendTagMac(const uint8_t* dst, const uint64_t newmac, bool local) {
     pending.attemptsLeft = MAX_XFER_ATTEMPTS;
     Serial.printf(">Tag %02X%02X%02X%02X%02X%02X%02X%02X Mac set\r\n\0", dst[7], dst[6], dst[5], dst[4], dst[3], dst[2], dst[1], dst[0]);
 
+    bool result = queueDataAvail(&pending, local);
+    if (!local) {
+        udpsync.netSendDataAvail(&pending);
+        result = true;
+    }
+
+    // pendingCount was updated by queueDataAvail
     tagRecord* taginfo = tagRecord::findByMAC(dst);
     if (taginfo != nullptr) {
-        taginfo->pendingCount++;
         wsSendTaginfo(taginfo->mac, SYNC_TAGSTATUS);
     }
-
-    if (local) {
-        return queueDataAvail(&pending, true);
-    } else {
-        queueDataAvail(&pending, false);
-        udpsync.netSendDataAvail(&pending);
-        return true;
-    }
+    return result;
 }
 
 void updateTaginfoitem(struct TagInfo* taginfoitem, IPAddress remoteIP) {
@@ -853,7 +855,6 @@ bool checkMirror(struct tagRecord* taginfo, struct pendingData* pending) {
                 taginfo2->len = taginfo->len;
                 taginfo2->data = taginfo->data;  // copy buffer pointer
                 taginfo2->dataType = taginfo->dataType;
-                taginfo2->pendingCount++;
                 taginfo2->nextupdate = 3216153600;
 
                 struct pendingData pending2 = {0};
@@ -870,16 +871,16 @@ bool checkMirror(struct tagRecord* taginfo, struct pendingData* pending) {
                 } else {
                     char dst_path[64];
                     sprintf(dst_path, "/current/%02X%02X%02X%02X%02X%02X%02X%02X_%lu.pending", taginfo2->mac[7], taginfo2->mac[6], taginfo2->mac[5], taginfo2->mac[4], taginfo2->mac[3], taginfo2->mac[2], taginfo2->mac[1], taginfo2->mac[0], millis() % 1000000);
-                    xSemaphoreTake(fsMutex, portMAX_DELAY);
+                    FsLock::lock(dst_path, FsLock::WRITE, "mirror");
                     File file = contentFS->open(dst_path, "w");
                     if (file) {
                         file.write(taginfo2->data, taginfo2->len);
                         file.close();
-                        xSemaphoreGive(fsMutex);
+                        FsLock::unlock(dst_path, FsLock::WRITE);
                         queueDataAvail(&pending2, false);
                         udpsync.netSendDataAvail(&pending2);
                     } else {
-                        xSemaphoreGive(fsMutex);
+                        FsLock::unlock(dst_path, FsLock::WRITE);
                     }
                 }
 
@@ -953,6 +954,25 @@ PendingItem* getQueueItem(const uint8_t* targetMac, const uint64_t dataVer) {
     }
 }
 
+// copy of the queue item for tasks other than the radio path. The item may be dequeued
+// while the copy is in use, so its data is duplicated, and the caller frees copy.data
+bool copyQueueItem(const uint8_t* targetMac, const uint64_t dataVer, PendingItem& copy) {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    auto it = std::find_if(pendingQueue.begin(), pendingQueue.end(),
+                           [targetMac, dataVer](const PendingItem& item) {
+                               bool macMatches = memcmp(item.pendingdata.targetMac, targetMac, sizeof(item.pendingdata.targetMac)) == 0;
+                               bool dataVerMatches = (dataVer == 0) || (dataVer == item.pendingdata.availdatainfo.dataVer);
+                               return macMatches && dataVerMatches;
+                           });
+    if (it == pendingQueue.end()) return false;
+    copy = *it;
+    if (it->data != nullptr) {
+        copy.data = (uint8_t*)malloc(it->len);
+        if (copy.data) memcpy(copy.data, it->data, it->len);
+    }
+    return true;
+}
+
 void checkQueue(const uint8_t* targetMac) {
     uint16_t queueCount;
     queueCount = countQueueItem(targetMac);
@@ -7,9 +7,15 @@
 #include <MD5Builder.h>
 #include <Update.h>
 
+#include "ble_writer.h"
+#include "contentmanager.h"
 #include "flasher.h"
 #include "espflasher.h"
+#include "fslock.h"
+#include "httpcache.h"
 #include "leds.h"
+#include "renderpipeline.h"
+#include "scheduler.h"
 #include "serialap.h"
 #include "storage.h"
 #include "tag_db.h"
@@ -64,6 +70,22 @@ void handleSysinfoRequest(AsyncWebServerRequest* request) {
 #else
     doc["hasFlasher"] = 0;
 #endif
+
+    JsonObject httpcache = doc["httpcache"].to<JsonObject>();
+    HttpCache::fillStats(httpcache);
+    JsonObject scheduler = doc["scheduler"].to<JsonObject>();
+    ContentScheduler::fillStats(scheduler);
+    JsonObject render = doc["render"].to<JsonObject>();
+    RenderPipeline::fillStats(render);
+    JsonObject fslock = doc["fslock"].to<JsonObject>();
+    FsLock::fillStats(fslock);
+    JsonObject serialap = doc["serialap"].to<JsonObject>();
+    fillSerialApStats(serialap);
+#ifdef HAS_BLE_WRITER
+    JsonObject ble = doc["ble"].to<JsonObject>();
+    BleScheduler::fillStats(ble);
+#endif
+
     const size_t bufferSize = measureJson(doc) + 1;
     AsyncResponseStream* response = request->beginResponseStream("application/json", bufferSize);
     serializeJson(doc, *response);
@@ -142,15 +164,15 @@ void handleLittleFSUpload(AsyncWebServerRequest* request, String filename, size_
                 memcpy(&uploadInfo->buffer[uploadInfo->bufferSize], data, len);
                 uploadInfo->bufferSize += len;
             } else {
-                xSemaphoreTake(fsMutex, portMAX_DELAY);
+                FsLock::lock(uploadfilename, FsLock::WRITE, "upload");
                 File file = contentFS->open(uploadfilename, "a");
                 if (file) {
                     file.write(uploadInfo->buffer, uploadInfo->bufferSize);
                     file.close();
                     uploadInfo->bufferSize = 0;
-                    xSemaphoreGive(fsMutex);
+                    FsLock::unlock(uploadfilename, FsLock::WRITE);
                 } else {
-                    xSemaphoreGive(fsMutex);
+                    FsLock::unlock(uploadfilename, FsLock::WRITE);
                     logLine("Failed to open file for appending: " + uploadfilename);
                     final = true;
                     error = true;
@@ -162,14 +184,14 @@ void handleLittleFSUpload(AsyncWebServerRequest* request, String filename, size_
         }
         if (final) {
             if (uploadInfo->bufferSize > 0) {
-                xSemaphoreTake(fsMutex, portMAX_DELAY);
+                FsLock::lock(uploadfilename, FsLock::WRITE, "upload");
                 File file = contentFS->open(uploadfilename, "a");
                 if (file) {
                     file.write(uploadInfo->buffer, uploadInfo->bufferSize);
                     file.close();
-                    xSemaphoreGive(fsMutex);
+                    FsLock::unlock(uploadfilename, FsLock::WRITE);
                 } else {
-                    xSemaphoreGive(fsMutex);
+                    FsLock::unlock(uploadfilename, FsLock::WRITE);
                     logLine("Failed to open file for appending: " + uploadfilename);
                     error = true;
                 }
@@ -180,6 +202,7 @@ void handleLittleFSUpload(AsyncWebServerRequest* request, String filename, size_
             if (error) {
                 request->send(507, "text/plain", "Error. Disk full?");
             } else {
+                invalidateVarIndex();
                 request->send(200, "text/plain", "Ok, file written");
             }
         }
@@ -0,0 +1,197 @@
+#include "renderpipeline.h"
+
+#include <mutex>
+#include <unordered_map>
+
+#include "contentmanager.h"
+#include "newproto.h"
+#include "scheduler.h"
+
+namespace RenderPipeline {
+
+/// @brief Due tag waiting for the render task, the tag is looked up again when the job runs
+struct RenderJob {
+    uint8_t mac[8];
+    uint32_t seq;
+    bool canRender;
+};
+
+/// @brief Work for the publish task, either an image or the end of a tag's turn
+struct PublishJob {
+    uint32_t seq;
+    String filename;
+    uint8_t dataType;
+    uint8_t dataTypeArgument;
+    uint8_t mac[8];
+    uint16_t nextCheckin;
+    bool finish;
+};
+
+/// @brief Upper bounds (ms) of the histogram buckets, the last bucket takes everything above
+static const uint32_t bucketLimits[] = {10, 25, 50, 100, 250, 500, 1000, 2500, 5000};
+#define BUCKET_COUNT (sizeof(bucketLimits) / sizeof(bucketLimits[0]) + 1)
+
+static const char *stageNames[STAGE_COUNT] = {"fetch", "draw", "encode", "publish"};
+
+static QueueHandle_t renderQueue = nullptr;
+static QueueHandle_t publishQueue = nullptr;
+static TaskHandle_t renderTaskHandle = nullptr;
+
+static uint32_t histogram[STAGE_COUNT][BUCKET_COUNT] = {0};
+static uint32_t stageTotal[STAGE_COUNT] = {0};
+static uint32_t stageMax[STAGE_COUNT] = {0};
+// time spent in fetch/encode by the tag currently in the render task
+static uint32_t currentStageTime[STAGE_COUNT] = {0};
+// job of the tag currently in the render task, its publish jobs carry the same number
+static uint32_t currentSeq = 0;
+
+// jobs are numbered as they are queued, a deleted tag drops the jobs numbered before its deletion.
+// One entry per deleted mac, tags aren't deleted often
+static std::mutex seqMutex;
+static uint32_t nextSeq = 0;
+static std::unordered_map<uint64_t, uint32_t> forgotten;
+
+static uint64_t macKey(const uint8_t mac[8]) {
+    uint64_t key;
+    memcpy(&key, mac, sizeof(key));
+    return key;
+}
+
+static uint32_t newSeq() {
+    std::lock_guard<std::mutex> lock(seqMutex);
+    return ++nextSeq;
+}
+
+/// @brief Check if the tag was deleted after the job was queued
+static bool isForgotten(const uint8_t mac[8], const uint32_t seq) {
+    std::lock_guard<std::mutex> lock(seqMutex);
+    const auto it = forgotten.find(macKey(mac));
+    return it != forgotten.end() && (int32_t)(it->second - seq) > 0;
+}
+
+static void record(const Stage stage, const uint32_t ms) {
+    size_t bucket = 0;
+    while (bucket < BUCKET_COUNT - 1 && ms > bucketLimits[bucket]) bucket++;
+    histogram[stage][bucket]++;
+    stageTotal[stage] += ms;
+    if (ms > stageMax[stage]) stageMax[stage] = ms;
+}
+
+static void renderTask(void *parameter) {
+    while (true) {
+        RenderJob job;
+        if (xQueueReceive(renderQueue, &job, portMAX_DELAY) != pdTRUE) continue;
+        // the scheduler already forgot a deleted tag
+        if (isForgotten(job.mac, job.seq)) continue;
+        tagRecord *taginfo = tagRecord::findByMAC(job.mac);
+        if (taginfo == nullptr) continue;
+
+        memset(currentStageTime, 0, sizeof(currentStageTime));
+        currentSeq = job.seq;
+        const uint32_t start = millis();
+        if (renderDueTag(taginfo, job.canRender)) {
+            const uint32_t total = millis() - start;
+            const uint32_t other = currentStageTime[STAGE_FETCH] + currentStageTime[STAGE_ENCODE];
+            record(STAGE_FETCH, currentStageTime[STAGE_FETCH]);
+            record(STAGE_ENCODE, currentStageTime[STAGE_ENCODE]);
+            record(STAGE_DRAW, total > other ? total - other : 0);
+        }
+
+        PublishJob *finish = new PublishJob();
+        finish->seq = job.seq;
+        memcpy(finish->mac, job.mac, 8);
+        finish->finish = true;
+        xQueueSend(publishQueue, &finish, portMAX_DELAY);
+    }
+}
+
+static void publishTask(void *parameter) {
+    while (true) {
+        PublishJob *job = nullptr;
+        if (xQueueReceive(publishQueue, &job, portMAX_DELAY) != pdTRUE || job == nullptr) continue;
+        if (isForgotten(job->mac, job->seq)) {
+            delete job;
+            continue;
+        }
+        if (job->finish) {
+            tagRecord *taginfo = tagRecord::findByMAC(job->mac);
+            if (taginfo != nullptr) {
+                finishDueTag(taginfo);
+            }
+        } else {
+            const uint32_t start = millis();
+            prepareDataAvail(job->filename, job->dataType, job->dataTypeArgument, job->mac, job->nextCheckin);
+            record(STAGE_PUBLISH, millis() - start);
+        }
+        delete job;
+    }
+}
+
+void begin() {
+    if (renderQueue != nullptr) return;
+    renderQueue = xQueueCreate(RENDER_QUEUE_SIZE, sizeof(RenderJob));
+    publishQueue = xQueueCreate(PUBLISH_QUEUE_SIZE, sizeof(PublishJob *));
+    xTaskCreatePinnedToCore(renderTask, "render", RENDER_TASK_STACK, NULL, 1, &renderTaskHandle, RENDER_TASK_CORE);
+    xTaskCreate(publishTask, "publish", PUBLISH_TASK_STACK, NULL, 2, NULL);
+}
+
+bool hasRoom() {
+    return renderQueue == nullptr || uxQueueSpacesAvailable(renderQueue) > 0;
+}
+
+bool enqueue(tagRecord *taginfo, const bool canRender) {
+    if (renderQueue == nullptr) return false;
+    RenderJob job;
+    memcpy(job.mac, taginfo->mac, 8);
+    job.seq = newSeq();
+    job.canRender = canRender;
+    return xQueueSend(renderQueue, &job, 0) == pdTRUE;
+}
+
+void forget(const uint8_t mac[8]) {
+    std::lock_guard<std::mutex> lock(seqMutex);
+    forgotten[macKey(mac)] = ++nextSeq;
+}
+
+bool publish(String &filename, const uint8_t dataType, const uint8_t dataTypeArgument, const uint8_t *dst, const uint16_t nextCheckin) {
+    if (renderTaskHandle == nullptr || xTaskGetCurrentTaskHandle() != renderTaskHandle) {
+        return prepareDataAvail(filename, dataType, dataTypeArgument, dst, nextCheckin);
+    }
+    PublishJob *job = new PublishJob();
+    job->seq = currentSeq;
+    job->filename = filename;
+    job->dataType = dataType;
+    job->dataTypeArgument = dataTypeArgument;
+    memcpy(job->mac, dst, 8);
+    job->nextCheckin = nextCheckin;
+    job->finish = false;
+    xQueueSend(publishQueue, &job, portMAX_DELAY);
+    return true;
+}
+
+void addStageTime(const Stage stage, const uint32_t ms) {
+    if (renderTaskHandle != nullptr && xTaskGetCurrentTaskHandle() == renderTaskHandle) {
+        currentStageTime[stage] += ms;
+    }
+}
+
+void fillStats(JsonObject &obj) {
+    JsonArray buckets = obj["buckets"].to<JsonArray>();
+    for (const uint32_t limit : bucketLimits) {
+        buckets.add(limit);
+    }
+    for (uint8_t stage = 0; stage < STAGE_COUNT; stage++) {
+        JsonObject stageObj = obj[stageNames[stage]].to<JsonObject>();
+        JsonArray counts = stageObj["hist"].to<JsonArray>();
+        uint32_t count = 0;
+        for (size_t bucket = 0; bucket < BUCKET_COUNT; bucket++) {
+            counts.add(histogram[stage][bucket]);
+            count += histogram[stage][bucket];
+        }
+        stageObj["avg"] = count ? stageTotal[stage] / count : 0;
+        stageObj["max"] = stageMax[stage];
+    }
+    obj["queued"] = renderQueue ? uxQueueMessagesWaiting(renderQueue) : 0;
+}
+
+}  // namespace RenderPipeline
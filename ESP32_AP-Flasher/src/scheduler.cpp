@@ -0,0 +1,178 @@
+#include "scheduler.h"
+
+#include <WiFi.h>
+
+#include <queue>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "contentmanager.h"
+#include "web.h"
+
+namespace ContentScheduler {
+
+/// @brief Heap slot, stale once its due time no longer matches @ref scheduled
+struct Slot {
+    uint32_t due;
+    tagRecord *tag;
+
+    bool operator>(const Slot &other) const {
+        return due > other.due;
+    }
+};
+
+Stats stats;
+
+static std::priority_queue<Slot, std::vector<Slot>, std::greater<Slot>> heap;
+// authoritative due time per queued tag
+static std::unordered_map<tagRecord *, uint32_t> scheduled;
+// tags popped but not yet finished by the render pipeline
+static std::unordered_set<tagRecord *> busy;
+static SemaphoreHandle_t schedMutex = nullptr;
+static uint32_t lastRebuild = 0;
+static uint8_t lastClientCount = 0;
+
+static bool isAp(const tagRecord *taginfo) {
+    static uint8_t wifimac[8] = {0};
+    if (wifimac[0] == 0 && wifimac[1] == 0 && wifimac[2] == 0) {
+        WiFi.macAddress(wifimac);
+        memset(&wifimac[6], 0, 2);
+    }
+    return memcmp(taginfo->mac, wifimac, 8) == 0;
+}
+
+uint32_t renderDueTime(const tagRecord *taginfo) {
+    if (!taginfo->RSSI) return UINT32_MAX;
+    // a button press redraws right away, but still not earlier than 5 minutes before the check in
+    uint32_t due = needRedraw(taginfo->contentMode, taginfo->wakeupReason) ? 0 : taginfo->nextupdate;
+    // content is generated at most 5 minutes before the tag is expected to check in
+    if (!isAp(taginfo) && !(wsClientCount() && config.stopsleep == 1) && taginfo->expectedNextCheckin > 299) {
+        due = max(due, taginfo->expectedNextCheckin - 299);
+    }
+    return due;
+}
+
+uint32_t dueTime(const tagRecord *taginfo, const time_t now, const bool processed) {
+    uint32_t renderDue = renderDueTime(taginfo);
+    if (processed && renderDue <= now) {
+        renderDue = now + SCHEDULER_RENDER_RETRY;
+    }
+
+    // idle request window: expectedNextCheckin in (now - 10, now + 30)
+    uint32_t idleDue = UINT32_MAX;
+    if (taginfo->pendingIdle == 0 && taginfo->pendingCount == 0 && !isAp(taginfo) && taginfo->expectedNextCheckin + 10 > now) {
+        idleDue = taginfo->expectedNextCheckin > 29 ? taginfo->expectedNextCheckin - 29 : 0;
+        if (processed && idleDue <= now) {
+            idleDue = now + SCHEDULER_IDLE_RETRY;
+        }
+    }
+
+    return min(renderDue, idleDue);
+}
+
+static void push(tagRecord *taginfo, const uint32_t due) {
+    const auto it = scheduled.find(taginfo);
+    if (it != scheduled.end() && it->second == due) return;
+    scheduled[taginfo] = due;
+    heap.push({due, taginfo});
+}
+
+void wake(tagRecord *taginfo, const bool processed) {
+    if (taginfo == nullptr || schedMutex == nullptr) return;
+    time_t now;
+    time(&now);
+    const uint32_t due = dueTime(taginfo, now, processed);
+    xSemaphoreTake(schedMutex, portMAX_DELAY);
+    if (processed) {
+        busy.erase(taginfo);
+    }
+    push(taginfo, due);
+    xSemaphoreGive(schedMutex);
+}
+
+void forget(tagRecord *taginfo) {
+    if (schedMutex == nullptr) return;
+    xSemaphoreTake(schedMutex, portMAX_DELAY);
+    scheduled.erase(taginfo);
+    busy.erase(taginfo);
+    xSemaphoreGive(schedMutex);
+}
+
+void clear() {
+    if (schedMutex == nullptr) return;
+    xSemaphoreTake(schedMutex, portMAX_DELAY);
+    scheduled.clear();
+    busy.clear();
+    heap = decltype(heap)();
+    xSemaphoreGive(schedMutex);
+}
+
+void rebuild() {
+    if (schedMutex == nullptr) {
+        schedMutex = xSemaphoreCreateMutex();
+    }
+    time_t now;
+    time(&now);
+
+    std::vector<Slot> slots;
+    slots.reserve(tagDB.size());
+    for (tagRecord *taginfo : tagDB) {
+        slots.push_back({dueTime(taginfo, now), taginfo});
+    }
+
+    xSemaphoreTake(schedMutex, portMAX_DELAY);
+    scheduled.clear();
+    for (const Slot &slot : slots) {
+        scheduled[slot.tag] = slot.due;
+    }
+    heap = decltype(heap)(std::greater<Slot>(), std::move(slots));
+    xSemaphoreGive(schedMutex);
+
+    lastRebuild = millis();
+    lastClientCount = wsClientCount();
+}
+
+bool popDue(const time_t now, tagRecord *&taginfo) {
+    // opening or closing the web interface changes the due time of every tag (stopsleep)
+    if (schedMutex == nullptr || millis() - lastRebuild > SCHEDULER_REBUILD_INTERVAL * 1000 || wsClientCount() != lastClientCount) {
+        rebuild();
+    }
+
+    xSemaphoreTake(schedMutex, portMAX_DELAY);
+    while (!heap.empty() && heap.top().due <= now) {
+        const Slot slot = heap.top();
+        heap.pop();
+        const auto it = scheduled.find(slot.tag);
+        if (it == scheduled.end() || it->second != slot.due) {
+            continue;
+        }
+        scheduled.erase(it);
+        // still being rendered, finishing it reschedules the tag
+        if (!busy.insert(slot.tag).second) continue;
+        xSemaphoreGive(schedMutex);
+        taginfo = slot.tag;
+        return true;
+    }
+    xSemaphoreGive(schedMutex);
+    return false;
+}
+
+void recordLag(const uint32_t lag) {
+    stats.renders++;
+    stats.lastLag = lag;
+    if (lag > stats.maxLag) stats.maxLag = lag;
+    stats.avgLag = stats.renders == 1 ? lag : stats.avgLag * 0.9f + lag * 0.1f;
+}
+
+void fillStats(JsonObject &obj) {
+    obj["queued"] = scheduled.size();
+    obj["busy"] = busy.size();
+    obj["renders"] = stats.renders;
+    obj["lastlag"] = stats.lastLag;
+    obj["maxlag"] = stats.maxLag;
+    obj["avglag"] = stats.avgLag;
+    obj["lastpopped"] = stats.lastPopped;
+}
+
+}  // namespace ContentScheduler
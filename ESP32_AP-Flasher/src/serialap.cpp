@@ -21,6 +21,11 @@
 
 QueueHandle_t rxCmdQueue;
 SemaphoreHandle_t txActive;
+// given by rxSerialTask when an ACK>/NOK>/NOQ> reply comes in
+static SemaphoreHandle_t cmdReplied = nullptr;
+// woken by the UART driver when data arrives
+static TaskHandle_t rxSerialTaskHandle = nullptr;
+static SerialApStats serialStats;
 
 // If a command is sent, it will wait for a reply here
 #define CMD_REPLY_WAIT 0x00
@@ -28,6 +33,14 @@ SemaphoreHandle_t txActive;
 #define CMD_REPLY_NOK 0x02
 #define CMD_REPLY_NOQ 0x03
 volatile uint8_t cmdReplyValue = CMD_REPLY_WAIT;
+#define CMD_REPLY_TIMEOUT 200
+
+// fallback wakeup of rxSerialTask, the receive callback normally wakes it first
+#define RX_SERIAL_IDLE_WAIT 20
+// UART receive buffer, large enough for a burst of replies at 2 Mbaud
+#define AP_SERIAL_RX_BUFFER 1024
+// wake rxSerialTask after the line has been idle for this many symbols
+#define AP_SERIAL_RX_TIMEOUT 2
 
 #define AP_SERIAL_PORT Serial1
 #ifndef FLASHER_DEBUG_SHARED
@@ -97,29 +110,46 @@ void txEnd() {
         xSemaphoreGive(txActive);
     }
 }
+static void recordCmdReply(const uint32_t start) {
+    const uint32_t rtt = micros() - start;
+    serialStats.commands++;
+    serialStats.rttUs += rtt;
+    if (rtt > serialStats.maxRttUs) serialStats.maxRttUs = rtt;
+}
+
 bool waitCmdReply() {
+    const uint32_t start = micros();
     uint32_t val = millis();
-    while (millis() < val + 200) {
+    while (millis() - val < CMD_REPLY_TIMEOUT) {
         switch (cmdReplyValue) {
             case CMD_REPLY_WAIT:
                 break;
             case CMD_REPLY_ACK:
+                recordCmdReply(start);
                 lastAPActivity = millis();
                 if (apInfo.isOnline == false)
                     setAPstate(true, AP_STATE_ONLINE);
                 return true;
                 break;
             case CMD_REPLY_NOK:
+                recordCmdReply(start);
                 lastAPActivity = millis();
                 return false;
                 break;
             case CMD_REPLY_NOQ:
+                recordCmdReply(start);
                 lastAPActivity = millis();
                 return false;
                 break;
         }
-        vTaskDelay(1 / portTICK_RATE_MS);
+        if (cmdReplied) {
+            // a stale give from an earlier reply just causes another pass
+            xSemaphoreTake(cmdReplied, CMD_REPLY_TIMEOUT / portTICK_PERIOD_MS);
+        } else {
+            vTaskDelay(1 / portTICK_RATE_MS);
+        }
     }
+    serialStats.timeouts++;
     return false;
 }
 
@@ -208,6 +238,7 @@ void APTagReset() {
 // Send data to the AP
 uint16_t sendBlock(const void* data, const uint16_t len) {
     time_t timeCanary = millis();
+    const uint32_t blockStart = micros();
     if (apInfo.state == AP_STATE_NORADIO) return true;
     if (!apInfo.isOnline) return false;
     if (!txStart()) return 0;
@@ -271,6 +302,9 @@ blksend:
     AP_SERIAL_PORT.write(dummyBuffer, 32);
 
     if (apInfo.type != ESP32_C6) delay(10);
+    AP_SERIAL_PORT.flush();
+    serialStats.blocks++;
+    serialStats.blockUs += micros() - blockStart;
     txEnd();
     Serial.println("Sendblock complete, " + String(millis() - timeCanary) + "ms");
     return bd->checksum;
@@ -411,7 +445,7 @@ void rxCmdProcessor(void* parameter) {
     while (1) {
         if (apInfo.isOnline) {
             struct rxCmd* rxcmd = nullptr;
-            BaseType_t q = xQueueReceive(rxCmdQueue, &rxcmd, 10);
+            BaseType_t q = xQueueReceive(rxCmdQueue, &rxcmd, 100 / portTICK_PERIOD_MS);
             if (q == pdTRUE) {
                 switch (rxcmd->type) {
                     case RX_CMD_RQB:
@@ -450,10 +484,26 @@ void rxCmdProcessor(void* parameter) {
                 if (rxcmd->data) free(rxcmd->data);
                 if (rxcmd) free(rxcmd);
             }
+        } else {
+            vTaskDelay(10 / portTICK_PERIOD_MS);
         }
-        vTaskDelay(1 / portTICK_PERIOD_MS);
     }
 }
+
+void fillSerialApStats(JsonObject& obj) {
+    obj["commands"] = serialStats.commands;
+    obj["timeouts"] = serialStats.timeouts;
+    obj["avgrttus"] = serialStats.commands ? (uint32_t)(serialStats.rttUs / serialStats.commands) : 0;
+    obj["maxrttus"] = serialStats.maxRttUs;
+    obj["blocks"] = serialStats.blocks;
+    // sustained rate while sending, block size is fixed
+    obj["blockspersec"] = serialStats.blockUs ? (float)serialStats.blocks * 1000000.0f / serialStats.blockUs : 0;
+}
+
+// called from the UART driver's event task
+static void onApSerialReceive() {
+    if (rxSerialTaskHandle) xTaskNotifyGive(rxSerialTaskHandle);
+}
 void rxSerialTask(void* parameter) {
     static char cmdbuffer[4] = {0};
     static uint8_t* packetp = nullptr;
@@ -463,6 +513,7 @@ void rxSerialTask(void* parameter) {
     static char lastchar = 0;
     static uint8_t charindex = 0;
 
+    rxSerialTaskHandle = xTaskGetCurrentTaskHandle();
     gSerialTaskState = SERIAL_STATE_RUNNING;
     LOG("rxSerialTask starting\n");
     while (gSerialTaskState == SERIAL_STATE_RUNNING) {
@@ -482,6 +533,7 @@ void rxSerialTask(void* parameter) {
                     if ((strncmp(cmdbuffer, "ACK>", 4) == 0)) cmdReplyValue = CMD_REPLY_ACK;
                     if ((strncmp(cmdbuffer, "NOK>", 4) == 0)) cmdReplyValue = CMD_REPLY_NOK;
                     if ((strncmp(cmdbuffer, "NOQ>", 4) == 0)) cmdReplyValue = CMD_REPLY_NOQ;
+                    if (cmdReplyValue != CMD_REPLY_WAIT && cmdReplied) xSemaphoreGive(cmdReplied);
 
                     if ((strncmp(cmdbuffer, "VER>", 4) == 0)) {
                         pktindex = 0;
@@ -692,9 +744,10 @@ void rxSerialTask(void* parameter) {
                     break;
             }
         }
-        vTaskDelay(1 / portTICK_PERIOD_MS);
+        ulTaskNotifyTake(pdTRUE, RX_SERIAL_IDLE_WAIT / portTICK_PERIOD_MS);
     }  // end of while(1)
 
+    rxSerialTaskHandle = nullptr;
     AP_SERIAL_PORT.end();
     gSerialTaskState = SERIAL_STATE_STOPPED;
     LOG("rxSerialTask stopped\n");
@@ -825,6 +878,8 @@ bool bringAPOnline(uint8_t newState) {
     if (apInfo.state == AP_STATE_FLASHING) return false;
 
     if (gSerialTaskState != SERIAL_STATE_INITIALIZED) {
+        if (cmdReplied == nullptr) cmdReplied = xSemaphoreCreateBinary();
+        AP_SERIAL_PORT.setRxBufferSize(AP_SERIAL_RX_BUFFER);
 #ifdef HAS_ELECROW_ADV_2_8
         // Set GPIO45 low to connect the wireless interface to the multiplexed pins
         pinMode(45, OUTPUT);
@@ -840,6 +895,13 @@ bool bringAPOnline(uint8_t newState) {
         AP_SERIAL_PORT.begin(115200, SERIAL_8N1, FLASHER_AP_RXD, FLASHER_AP_TXD);
 #endif
 #endif
+#if defined(FLASHER_AP_RTS) && defined(FLASHER_AP_CTS)
+        // only when wired, the radio must be built with RTS/CTS enabled as well
+        AP_SERIAL_PORT.setPins(-1, -1, FLASHER_AP_CTS, FLASHER_AP_RTS);
+        AP_SERIAL_PORT.setHwFlowCtrlMode(UART_HW_FLOWCTRL_CTS_RTS, 64);
+#endif
+        AP_SERIAL_PORT.setRxTimeout(AP_SERIAL_RX_TIMEOUT);
+        AP_SERIAL_PORT.onReceive(onApSerialReceive);
         gSerialTaskState = SERIAL_STATE_INITIALIZED;
     }
     if (gSerialTaskState != SERIAL_STATE_RUNNING) {
@@ -1,5 +1,8 @@
 #include "storage.h"
 
+#include "fslock.h"
+#include "web.h"
+
 #ifdef HAS_SDCARD
 #include "FS.h"
 #ifdef SD_CARD_SDMMC
@@ -18,8 +21,6 @@
 
 DynStorage::DynStorage() : isInited(0) {}
 
-SemaphoreHandle_t fsMutex = NULL;
-
 #ifndef SD_CARD_ONLY
 static void initLittleFS() {
     LittleFS.begin();
@@ -88,81 +89,211 @@ static void initSDCard() {
 #endif
 #endif
 
-uint64_t DynStorage::freeSpace(){
+// free space as last measured, corrected by the tracked writes and removals since
+static int64_t cachedFreeSpace = -1;
+static portMUX_TYPE freeSpaceMux = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t freeSpaceTaskHandle = nullptr;
+
+static void freeSpaceTask(void *parameter) {
+    while (true) {
+        vTaskDelay(FREESPACE_RECONCILE_INTERVAL * 1000 / portTICK_PERIOD_MS);
+        Storage.updateFreeSpace();
+    }
+}
+
+void DynStorage::updateFreeSpace() {
     this->begin();
+    uint64_t measured;
 #ifdef HAS_SDCARD
-    return SDCARD.totalBytes() - SDCARD.usedBytes();
-#endif
-#ifndef SD_CARD_ONLY
-    return LittleFS.totalBytes() - LittleFS.usedBytes();
+    measured = SDCARD.totalBytes() - SDCARD.usedBytes();
+#else
+    measured = LittleFS.totalBytes() - LittleFS.usedBytes();
 #endif
+    taskENTER_CRITICAL(&freeSpaceMux);
+    cachedFreeSpace = measured;
+    taskEXIT_CRITICAL(&freeSpaceMux);
+}
+
+void DynStorage::trackUsage(const int64_t bytes) {
+    // the filesystems allocate whole blocks, this is an estimate until the next measurement
+    taskENTER_CRITICAL(&freeSpaceMux);
+    if (cachedFreeSpace >= 0) {
+        cachedFreeSpace = cachedFreeSpace > bytes ? cachedFreeSpace - bytes : 0;
+    }
+    taskEXIT_CRITICAL(&freeSpaceMux);
+}
+
+uint64_t DynStorage::freeSpace() {
+    taskENTER_CRITICAL(&freeSpaceMux);
+    const int64_t cached = cachedFreeSpace;
+    taskEXIT_CRITICAL(&freeSpaceMux);
+    if (cached >= 0) return cached;
+    updateFreeSpace();
+    return cachedFreeSpace;
 }
 
 #ifndef SD_CARD_ONLY
-void copyFile(File in, File out) {
+size_t copyFile(File in, File out) {
     Serial.print("Copying ");
     Serial.print(in.path());
     Serial.print(" to ");
     Serial.println(out.path());
 
+    // whole sectors at a time, a small buffer makes every write a read-modify-write on SD and LittleFS
+    size_t bufSize = COPY_BUFFER_SIZE;
+#ifdef BOARD_HAS_PSRAM
+    uint8_t *buf = (uint8_t *)ps_malloc(bufSize);
+#else
+    uint8_t *buf = (uint8_t *)malloc(bufSize);
+#endif
+    uint8_t fallback[256];
+    if (buf == nullptr) {
+        buf = fallback;
+        bufSize = sizeof(fallback);
+    }
+
+    size_t total = 0;
     size_t n;
-    uint8_t buf[64];
-    while ((n = in.read(buf, sizeof(buf))) > 0) {
-        out.write(buf, n);
+    while ((n = in.read(buf, bufSize)) > 0) {
+        if (out.write(buf, n) != n) {
+            Serial.println("Write failed");
+            break;
+        }
+        total += n;
     }
+    if (buf != fallback) free(buf);
+    return total;
 }
 
 #ifdef HAS_SDCARD
 
-void copyBetweenFS(FS& sourceFS, const char* source_path, FS& targetFS) {
+static TaskHandle_t copyTaskHandle = nullptr;
+
+/// @brief Check if the target already has the file, only a newer source replaces it
+static bool isUpToDate(File &source, FS &targetFS) {
+    File target = targetFS.open(source.path(), "r");
+    if (!target) return false;
+    const time_t sourceTime = source.getLastWrite();
+    const time_t targetTime = target.getLastWrite();
+    target.close();
+    // the size isn't compared, a different file on the SD card may be one the user put there.
+    // Without timestamps (clock not set when written) the target is kept
+    return sourceTime == 0 || targetTime == 0 || targetTime >= sourceTime;
+}
+
+static void copyFileBetweenFS(File &file, FS &targetFS, const bool incremental, CopyStats &stats) {
+    const String path = file.path();
+    FsLock::lock(path, FsLock::WRITE, "copy");
+    if (incremental && isUpToDate(file, targetFS)) {
+        FsLock::unlock(path, FsLock::WRITE);
+        stats.skipped++;
+        return;
+    }
+    // an incremental copy goes to a temporary name first, so an interrupted one
+    // doesn't leave a truncated file that looks up to date on the next sync
+    const String targetPath = incremental ? path + ".part" : path;
+    File target = targetFS.open(targetPath, "w");
+    if (target) {
+        const size_t copied = copyFile(file, target);
+        target.close();
+        bool ok = copied == file.size();
+        if (ok && incremental) {
+            if (targetFS.exists(path)) targetFS.remove(path);
+            ok = targetFS.rename(targetPath, path);
+        }
+        if (ok) {
+            stats.bytes += copied;
+            stats.files++;
+        } else {
+            if (incremental) targetFS.remove(targetPath);
+            stats.errors++;
+            Serial.print("Couldn't copy ");
+            Serial.println(path);
+        }
+    } else {
+        stats.errors++;
+        Serial.print("Couldn't create target file ");
+        Serial.println(file.path());
+    }
+    FsLock::unlock(path, FsLock::WRITE);
+}
+
+void copyBetweenFS(FS &sourceFS, const char *source_path, FS &targetFS, const bool incremental, CopyStats *stats) {
+    CopyStats localStats;
+    if (stats == nullptr) stats = &localStats;
     File root = sourceFS.open(source_path);
-    char next_path[128];
+    if (!root) return;
 
     if (root.isDirectory()) {
-        if (!contentFS->exists(root.path())) {
-            if (!contentFS->mkdir(root.path())) {
+        if (!targetFS.exists(root.path())) {
+            if (!targetFS.mkdir(root.path())) {
                 Serial.print("Failed to create directory ");
                 Serial.println(root.path());
+                stats->errors++;
                 return;
             }
         }
         File file = root.openNextFile();
         while (file) {
             if (file.isDirectory()) {
-                sprintf(next_path, "%s/%s\0", root.path(), file.path());
-
-                copyBetweenFS(sourceFS, file.path(), targetFS);
+                copyBetweenFS(sourceFS, file.path(), targetFS, incremental, stats);
             } else {
-                xSemaphoreTake(fsMutex, portMAX_DELAY);
-                File target = contentFS->open(file.path(), "w");
-                if (target) {
-                    copyFile(file, target);
-                    target.close();
-                    file.close();
-                    xSemaphoreGive(fsMutex);
-                } else {
-                    xSemaphoreGive(fsMutex);
-                    Serial.print("Couldn't create high target file");
-                    Serial.println(file.path());
-                    return;
+                copyFileBetweenFS(file, targetFS, incremental, *stats);
+                if (copyTaskHandle != nullptr && xTaskGetCurrentTaskHandle() == copyTaskHandle && millis() - stats->lastReport > 2000) {
+                    stats->lastReport = millis();
+                    wsLog("Syncing " + String(source_path) + ": " + String(stats->files) + " files, " + String(stats->bytes / 1024) + " kB copied");
                 }
             }
+            file.close();
             file = root.openNextFile();
+            // give the other tasks a chance to use the filesystem
+            vTaskDelay(1);
         }
     } else {
-        xSemaphoreTake(fsMutex, portMAX_DELAY);
-        File target = contentFS->open(root.path(), "w");
-        if (target) {
-            copyFile(root, target);
-            target.close();
-            xSemaphoreGive(fsMutex);
-        } else {
-            xSemaphoreGive(fsMutex);
-            Serial.print("Couldn't create target file ");
-            Serial.println(root.path());
-            return;
-        }
+        copyFileBetweenFS(root, targetFS, incremental, *stats);
+    }
+    root.close();
+}
+
+/// @brief Background copy request
+struct CopyJob {
+    FS *sourceFS;
+    FS *targetFS;
+    String path;
+    bool incremental;
+};
+
+static void copyTask(void *parameter) {
+    CopyJob *job = (CopyJob *)parameter;
+    CopyStats stats;
+    const uint32_t start = millis();
+    copyBetweenFS(*job->sourceFS, job->path.c_str(), *job->targetFS, job->incremental, &stats);
+    const String result = "Synced " + job->path + ": " + String(stats.files) + " files, " + String(stats.bytes / 1024) + " kB copied, " +
+                          String(stats.skipped) + " up to date, " + String(stats.errors) + " errors in " + String((millis() - start) / 1000) + "s";
+    Serial.println(result);
+    if (stats.errors) {
+        wsErr(result);
+    } else {
+        wsLog(result);
     }
+    delete job;
+    copyTaskHandle = nullptr;
+    vTaskDelete(NULL);
+}
+
+bool copyInBackground(FS &sourceFS, const char *path, FS &targetFS, const bool incremental) {
+    if (copyTaskHandle != nullptr) return false;
+    CopyJob *job = new CopyJob{&sourceFS, &targetFS, String(path), incremental};
+    if (xTaskCreate(copyTask, "fscopy", 5000, job, 1, &copyTaskHandle) != pdPASS) {
+        copyTaskHandle = nullptr;
+        delete job;
+        return false;
+    }
+    return true;
+}
+
+bool copyInProgress() {
+    return copyTaskHandle != nullptr;
 }
 
 void copyIfNeeded(const char* path) {
@@ -175,24 +306,26 @@ void copyIfNeeded(const char* path) {
 #endif
 
 void DynStorage::begin() {
-    if(fsMutex == NULL) {
-        fsMutex = xSemaphoreCreateMutex();
-    }
-
 #ifndef SD_CARD_ONLY
     initLittleFS();
 #endif
 
 #ifdef HAS_SDCARD
     if(!sd_init_done) {
-        xSemaphoreTake(fsMutex, portMAX_DELAY);
+        FsLock::lockAll("sdinit");
         initSDCard();
-        xSemaphoreGive(fsMutex);
+        FsLock::unlockAll();
         sd_init_done = true;
+#ifndef SD_CARD_ONLY
+        // fonts are the bulk of the data, sync them without holding up the boot
+        // and pick up files missing from an earlier, interrupted copy
+        if (LittleFS.exists("/fonts")) {
+            copyInBackground(LittleFS, "/fonts", *contentFS, true);
+        }
+#endif
     }
 #ifndef SD_CARD_ONLY
     copyIfNeeded("/index.html");
-    copyIfNeeded("/fonts");
     copyIfNeeded("/www");
     copyIfNeeded("/tagtypes");
     copyIfNeeded("/AP_FW_Pack.bin");
@@ -208,11 +341,18 @@ void DynStorage::begin() {
     if (!contentFS->exists("/temp")) {
         contentFS->mkdir("/temp");
     }
+
+    if (freeSpaceTaskHandle == nullptr) {
+        xTaskCreate(freeSpaceTask, "freespace", 4000, NULL, 1, &freeSpaceTaskHandle);
+    }
 }
 
 void DynStorage::end() {
 #ifdef HAS_SDCARD
 #ifndef SD_CARD_ONLY
+    while (copyInProgress()) {
+        vTaskDelay(100 / portTICK_PERIOD_MS);
+    }
     initLittleFS();
 #endif
 #ifdef SD_CARD_SDMMC
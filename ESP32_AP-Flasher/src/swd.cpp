@@ -5,6 +5,7 @@
 #include "swd.h"
 
 #include "Arduino.h"
+#include "swd_block.h"
 
 // Many thanks to scanlime for the work on the ESP8266 SWD Library, parts of this code have inspiration and help from it
 // https://github.com/scanlime/esp8266-arm-swd
@@ -12,8 +13,8 @@
 #define DP_IDCODE 0x00
 
 swd::swd(uint8_t swdio, uint8_t swdclk) {
-    this->swdio_pin = swdio;
-    this->swdclk_pin = swdclk;
+    this->swdio_pin = (gpio_num_t)swdio;
+    this->swdclk_pin = (gpio_num_t)swdclk;
     this->swd_Begin();
 }
 void swd::swd_Begin() {
@@ -101,11 +102,11 @@ void swd::swd_Write(uint32_t in_data, uint8_t bits) {
     if (cur_swd_direction == 0)
         swd_Direction(1);
     while (bits--) {
-        digitalWrite(this->swdio_pin, in_data & 1);
-        digitalWrite(this->swdclk_pin, LOW);
+        gpio_set_level(this->swdio_pin, in_data & 1);
+        gpio_set_level(this->swdclk_pin, 0);
         delayMicroseconds(2);
         in_data >>= 1;
-        digitalWrite(this->swdclk_pin, HIGH);
+        gpio_set_level(this->swdclk_pin, 1);
         delayMicroseconds(2);
     }
 }
@@ -115,29 +116,46 @@ uint32_t swd::swd_Read(uint8_t bits) {
     if (cur_swd_direction == 1)
         swd_Direction(0);
     while (bits--) {
-        if (digitalRead(this->swdio_pin)) {
+        if (gpio_get_level(this->swdio_pin)) {
             out_data |= input_bit;
         }
-        digitalWrite(this->swdclk_pin, LOW);
+        gpio_set_level(this->swdclk_pin, 0);
         delayMicroseconds(2);
         input_bit <<= 1;
-        digitalWrite(this->swdclk_pin, HIGH);
+        gpio_set_level(this->swdclk_pin, 1);
         delayMicroseconds(2);
     }
     return out_data;
 }
+// the pull-up set in swd_Begin stays enabled, only the output driver is switched
 void swd::swd_Direction(bool WorR) {  // 1 = Write 0 = Read
-    digitalWrite(this->swdio_pin, HIGH);
-    pinMode(this->swdio_pin, INPUT_PULLUP);
-    digitalWrite(this->swdclk_pin, LOW);
+    gpio_set_level(this->swdio_pin, 1);
+    gpio_set_direction(this->swdio_pin, GPIO_MODE_INPUT);
+    gpio_set_level(this->swdclk_pin, 0);
     delayMicroseconds(2);
-    digitalWrite(this->swdclk_pin, HIGH);
+    gpio_set_level(this->swdclk_pin, 1);
     delayMicroseconds(2);
     if (WorR)
-        pinMode(this->swdio_pin, OUTPUT);
+        gpio_set_direction(this->swdio_pin, GPIO_MODE_INPUT_OUTPUT);
     cur_swd_direction = WorR;
 }
 
+bool swd::AP_WriteBlock(uint32_t address, const uint32_t *data, uint32_t words, uint16_t wordDelayUs) {
+    uint32_t start = micros();
+    bool ok = SwdBlock::writeBlock(*this, micros, address, data, words, wordDelayUs);
+    blockBytes += words * 4;
+    blockMicros += micros() - start;
+    return ok;
+}
+
+bool swd::AP_ReadBlock(uint32_t address, uint32_t *data, uint32_t words) {
+    uint32_t start = micros();
+    bool ok = SwdBlock::readBlock(*this, address, data, words);
+    blockBytes += words * 4;
+    blockMicros += micros() - start;
+    return ok;
+}
+
 #define PORT_AP true
 #define PORT_DP false
 
@@ -148,9 +166,6 @@ void swd::swd_Direction(bool WorR) {  // 1 = Write 0 = Read
 #define AP_NRF_APPROTECTSTATUS 0x0c
 #define AP_NRF_IDR 0xfc
 
-#define AP_CSW 0x00
-#define AP_TAR 0x04
-#define AP_DRW 0x0c
 #define AP_BD0 0x10
 #define AP_BD1 0x14
 #define AP_BD2 0x18
@@ -161,7 +176,8 @@ void swd::swd_Direction(bool WorR) {  // 1 = Write 0 = Read
 #define DP_ABORT 0x00
 #define DP_CTRLSTAT 0x04
 #define DP_SELECT 0x08
-#define DP_RDBUFF 0x0c
+
+#define NRF_WORD_WRITE_US 400
 
 nrfswd::nrfswd(uint8_t swdio, uint8_t swdclk) : swd(swdio, swdclk) {
 }
@@ -213,7 +229,7 @@ void nrfswd::nrf_abort_all() {
     nrf_write_port(0, DP_CTRLSTAT, 0x50000000);
 }
 void nrfswd::nrf_halt() {
-    AP_Write(AP_CSW, 0xa2000002);
+    AP_Write(AP_CSW, CSW_32BIT);
     AP_Write(AP_TAR, 0xe000edf0);
     uint32_t retry = 500;
     while (retry--) {
@@ -322,6 +338,13 @@ uint8_t nrfswd::erase_page(uint32_t page) {
     return 0;
 }
 
+void nrfswd::take_block_stats(uint32_t &bytes, uint32_t &us) {
+    bytes = blockBytes;
+    us = blockMicros;
+    blockBytes = 0;
+    blockMicros = 0;
+}
+
 void nrfswd::nrf_soft_reset(){
   nrf_port_selection(1);
   nrf_write_port(1, AP_NRF_RESET, 1);
@@ -337,27 +360,14 @@ uint8_t nrfswd::nrf_write_bank(uint32_t address, uint32_t buffer[], int size) {
     if (size > 4096)
         return 2;  // buffer bigger then a bank
 
-    uint32_t temp;
-
     write_register(0x4001e504, 1);  // NVIC Enable writing
     long timeout = millis();
     while (read_register(0x4001e400) != 1) {
         if (millis() - timeout > 100) return 3;
     }
 
-    AP_Write(AP_CSW, 0xa2000012);
-    AP_Write(AP_TAR, address);
-
-    for (int posi = 0; posi < size; posi += 4) {
-        long end_micros = micros() + 400;  // wait till writing of nRF memory is done without asking for ready state
-        AP_Write(AP_DRW, buffer[posi / 4]);
-        while (micros() < end_micros) {
-        };
-    }
-
-    AP_Write(AP_CSW, 0xa2000002);
-    DP_Read(DP_RDBUFF, temp);
-    DP_Read(DP_RDBUFF, temp);
+    // wait till writing of nRF memory is done without asking for ready state
+    bool ok = AP_WriteBlock(address, buffer, size / 4, NRF_WORD_WRITE_US);
 
     write_register(0x4001e504, 0);  // NVIC Diasble writing
     timeout = millis();
@@ -365,27 +375,14 @@ uint8_t nrfswd::nrf_write_bank(uint32_t address, uint32_t buffer[], int size) {
         if (millis() - timeout > 100) return 3;
     }
 
-    return 0;
+    return ok ? 0 : 3;
 }
 uint8_t nrfswd::nrf_read_bank(uint32_t address, uint32_t buffer[], int size) {
     if (!isConnected)
         return 1;  // not connected to an nRF
 
-    uint32_t temp;
-
-    AP_Write(AP_CSW, 0xa2000012);
-    AP_Write(AP_TAR, address);
-    AP_Read(AP_DRW, temp);
-
-    uint32_t curr_word = 0;
-    for (int posi = 0; posi < size; posi += 4) {
-        AP_Read(AP_DRW, curr_word);
-        buffer[posi / 4] = curr_word;
-    }
-
-    AP_Write(AP_CSW, 0xa2000002);
-    DP_Read(DP_RDBUFF, temp);
-    DP_Read(DP_RDBUFF, temp);
+    if (!AP_ReadBlock(address, buffer, size / 4))
+        return 2;
 
     return 0;
 }
\ No newline at end of file
@@ -5,6 +5,7 @@
 #include <Preferences.h>
 #include <esp_sntp.h>
 
+#include "fslock.h"
 #include "storage.h"
 #include "tag_db.h"
 #include "wifimanager.h"
@@ -49,25 +50,32 @@ void logLine(const String& text) {
     const char* format = (now < (time_t)1672531200) ? "           %H:%M:%S " : "%Y-%m-%d %H:%M:%S ";
     strftime(timeStr, sizeof(timeStr), format, localtime(&now));
 
-    xSemaphoreTake(fsMutex, portMAX_DELAY);
+    // rotation only happens here, so this lock covers /logold.txt as well
+    FsLock::lock("/log.txt", FsLock::WRITE, "logline");
     File logFile = contentFS->open("/log.txt", "a");
     if (logFile) {
         if (logFile.size() >= 10 * 1024) {
             logFile.close();
+            File oldLog = contentFS->open("/logold.txt", "r");
+            if (oldLog) {
+                Storage.trackUsage(-(int64_t)oldLog.size());
+                oldLog.close();
+            }
             contentFS->remove("/logold.txt");
             contentFS->rename("/log.txt", "/logold.txt");
             logFile = contentFS->open("/log.txt", "a");
             if (!logFile) {
-                xSemaphoreGive(fsMutex);
+                FsLock::unlock("/log.txt", FsLock::WRITE);
                 return;
             }
         }
 
-        logFile.print(timeStr);
-        logFile.println(text);
+        size_t written = logFile.print(timeStr);
+        written += logFile.println(text);
         logFile.close();
+        Storage.trackUsage(written);
     }
-    xSemaphoreGive(fsMutex);
+    FsLock::unlock("/log.txt", FsLock::WRITE);
 }
 
 void logStartUp() {
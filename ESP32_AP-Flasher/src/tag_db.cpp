@@ -7,7 +7,10 @@
 #include <unordered_map>
 #include <vector>
 
+#include "fslock.h"
 #include "language.h"
+#include "renderpipeline.h"
+#include "scheduler.h"
 #include "storage.h"
 #include "util.h"
 
@@ -37,6 +40,8 @@ bool deleteRecord(const uint8_t mac[8], bool allVersions) {
                 free(tag->data);
             }
             tag->data = nullptr;
+            ContentScheduler::forget(tag);
+            RenderPipeline::forget(tag->mac);
             delete tagDB[c];
             tagDB.erase(tagDB.begin() + c);
             return true;
@@ -129,25 +134,25 @@ void saveDB(const String& filename) {
 
     const long t = millis();
 
-    xSemaphoreTake(fsMutex, portMAX_DELAY);
+    FsLock::lock(filename, FsLock::WRITE, "savedb");
 
     fs::File existingFile = contentFS->open(filename, "r");
     if (existingFile) {
         existingFile.close();
         vTaskDelay(pdMS_TO_TICKS(100));
         String backupFilename = filename + ".bak";
+        FsLock::lock(backupFilename, FsLock::WRITE, "savedb");
         if (!contentFS->rename(filename.c_str(), backupFilename.c_str())) {
-            xSemaphoreGive(fsMutex);
             logLine("error renaming tagDB to .bak");
             wsErr("error renaming tagDB to .bak");
-            xSemaphoreTake(fsMutex, portMAX_DELAY);
         }
+        FsLock::unlock(backupFilename, FsLock::WRITE);
     }
 
     fs::File file = contentFS->open(filename, "w");
     if (!file) {
         Serial.println("saveDB: Failed to open file for writing");
-        xSemaphoreGive(fsMutex);
+        FsLock::unlock(filename, FsLock::WRITE);
         return;
     }
 
@@ -168,7 +173,7 @@ void saveDB(const String& filename) {
     file.write(']');
 
     file.close();
-    xSemaphoreGive(fsMutex);
+    FsLock::unlock(filename, FsLock::WRITE);
     Serial.println("DB saved " + String(millis() - t) + "ms");
 }
 
@@ -256,6 +261,7 @@ bool loadDB(const String& filename) {
 void destroyDB() {
     Serial.println("destroying DB");
     util::printHeap();
+    ContentScheduler::clear();
     for (tagRecord*& tag : tagDB) {
         if (tag->data != nullptr) {
             free(tag->data);
@@ -352,7 +358,7 @@ void initAPconfig() {
 }
 
 void saveAPconfig() {
-    xSemaphoreTake(fsMutex, portMAX_DELAY);
+    FsLock::lock("/current/apconfig.json", FsLock::WRITE, "saveapconfig");
     fs::File configFile = contentFS->open("/current/apconfig.json", "w");
     JsonDocument APconfig;
     APconfig["channel"] = config.channel;
@@ -377,7 +383,7 @@ void saveAPconfig() {
     APconfig["showtimestamp"] = config.showtimestamp;
     serializeJsonPretty(APconfig, configFile);
     configFile.close();
-    xSemaphoreGive(fsMutex);
+    FsLock::unlock("/current/apconfig.json", FsLock::WRITE);
 }
 
 HwType getHwType(const uint8_t id) {
@@ -485,9 +491,10 @@ void cleanupCurrent() {
             }
             if (!found || filename.endsWith(".pending")) {
                 filename = file.path();
+                const size_t size = file.size();
                 file.close();
                 Serial.println("remove " + filename);
-                contentFS->remove(filename);
+                if (contentFS->remove(filename)) Storage.trackUsage(-(int64_t)size);
             }
         }
         file = dir.openNextFile();
@@ -497,10 +504,17 @@ void cleanupCurrent() {
     dir = contentFS->open("/temp");
     file = dir.openNextFile();
     while (file) {
+        // subdirectories (like the http cache) survive a reboot
+        if (file.isDirectory()) {
+            file.close();
+            file = dir.openNextFile();
+            continue;
+        }
         String filename = file.name();
         filename = file.path();
+        const size_t size = file.size();
         file.close();
-        contentFS->remove(filename);
+        if (contentFS->remove(filename)) Storage.trackUsage(-(int64_t)size);
         file = dir.openNextFile();
     }
     dir.close();
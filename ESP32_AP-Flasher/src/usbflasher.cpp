@@ -335,6 +335,13 @@ uint8_t selectedFlasherPort;
 uint32_t currentFlasherOffset;
 flasher* zbsflasherp = nullptr;
 nrfswd* nrfflasherp = nullptr;
+
+static void logNrfThroughput(const char* what) {
+    uint32_t bytes, us;
+    nrfflasherp->take_block_stats(bytes, us);
+    if (us == 0) return;
+    wsSerial(String(what) + " " + String(bytes) + " bytes at " + String(bytes * 1000000.0 / us / 1024, 1) + " kB/s");
+}
 CC_interface *ccflasherp = nullptr;
 
 void processFlasherCommand(struct flasherCommand* cmd, uint8_t transportType) {
@@ -473,6 +480,7 @@ void processFlasherCommand(struct flasherCommand* cmd, uint8_t transportType) {
             if (selectedController == CONTROLLER_NRF82511) {
                 if (nrfflasherp == nullptr) return;
                 if (currentFlasherOffset >= nrfflasherp->nrf_info.flash_size) {
+                    logNrfThroughput("nRF read");
                     sendFlasherAnswer(CMD_COMPLETE, temp_buff, 1, transportType);
                 } else {
                     bufferp = (uint8_t*)malloc(1024);
@@ -548,6 +556,7 @@ void processFlasherCommand(struct flasherCommand* cmd, uint8_t transportType) {
             if (selectedController == CONTROLLER_NRF82511) {
                 if (nrfflasherp == nullptr) return;
                 if (currentFlasherOffset >= nrfflasherp->nrf_info.flash_size) {
+                    logNrfThroughput("nRF write");
                     sendFlasherAnswer(CMD_COMPLETE, temp_buff, 1, transportType);
                 } else {
                     for (uint32_t c = currentFlasherOffset; c < (currentFlasherOffset + cmd->len);) {
@@ -14,11 +14,14 @@
 #include "AsyncJson.h"
 #include "LittleFS.h"
 #include "SPIFFSEditor.h"
+#include "ble_writer.h"
 #include "commstructs.h"
+#include "fslock.h"
 #include "language.h"
 #include "leds.h"
 #include "newproto.h"
 #include "ota.h"
+#include "scheduler.h"
 #include "serialap.h"
 #include "settings.h"
 #include "storage.h"
@@ -71,25 +74,27 @@ void wsSendSysteminfo() {
     JsonObject sys = doc["sys"].to<JsonObject>();
     time_t now;
     time(&now);
-    static int freeSpaceLastRun = 0;
+    static int tagDBsizeLastRun = 0;
     static size_t tagDBsize = 0;
-    static uint64_t freeSpace = Storage.freeSpace();
 
     sys["currtime"] = now;
     sys["heap"] = ESP.getFreeHeap();
     sys["recordcount"] = tagDBsize;
     sys["dbsize"] = dbSize();
 
-    if (millis() - freeSpaceLastRun > 30000 || freeSpaceLastRun == 0) {
-        freeSpace = Storage.freeSpace();
+    if (millis() - tagDBsizeLastRun > 30000 || tagDBsizeLastRun == 0) {
         tagDBsize = tagDB.size();
-        freeSpaceLastRun = millis();
+        tagDBsizeLastRun = millis();
     }
-    sys["littlefsfree"] = freeSpace;
+    sys["littlefsfree"] = Storage.freeSpace();
 
 #if BOARD_HAS_PSRAM
     sys["psfree"] = ESP.getFreePsram();
 #endif
+#ifdef HAS_BLE_WRITER
+    sys["bleactive"] = BleScheduler::getActiveCount();
+    sys["blequeue"] = BleScheduler::getQueueDepth();
+#endif
 
     sys["apstate"] = apInfo.state;
     sys["runstate"] = config.runStatus;
@@ -176,6 +181,10 @@ void wsSendTaginfo(const uint8_t *mac, uint8_t syncMode) {
         ws.textAll(json);
         xSemaphoreGive(wsMutex);
     }
+    if (syncMode != SYNC_DELETE) {
+        // every change of a tag's schedule-relevant state ends up here
+        ContentScheduler::wake(tagRecord::findByMAC(mac));
+    }
     if (syncMode > SYNC_NOSYNC) {
         const tagRecord *taginfo = tagRecord::findByMAC(mac);
         if (taginfo != nullptr) {
@@ -894,15 +903,15 @@ void doImageUpload(AsyncWebServerRequest *request, String filename, size_t index
                 memcpy(&uploadInfo->buffer[uploadInfo->bufferSize], data, len);
                 uploadInfo->bufferSize += len;
             } else {
-                xSemaphoreTake(fsMutex, portMAX_DELAY);
+                FsLock::lock("/temp/" + uploadfilename, FsLock::WRITE, "imageupload");
                 File file = contentFS->open("/temp/" + uploadfilename, "a");
                 if (file) {
-                    file.write(uploadInfo->buffer, uploadInfo->bufferSize);
+                    Storage.trackUsage(file.write(uploadInfo->buffer, uploadInfo->bufferSize));
                     file.close();
                     uploadInfo->bufferSize = 0;
-                    xSemaphoreGive(fsMutex);
+                    FsLock::unlock("/temp/" + uploadfilename, FsLock::WRITE);
                 } else {
-                    xSemaphoreGive(fsMutex);
+                    FsLock::unlock("/temp/" + uploadfilename, FsLock::WRITE);
                     logLine("Failed to open file for appending: " + uploadfilename);
                 }
 
@@ -913,14 +922,14 @@ void doImageUpload(AsyncWebServerRequest *request, String filename, size_t index
 
         if (final) {
             if (uploadInfo->bufferSize > 0) {
-                xSemaphoreTake(fsMutex, portMAX_DELAY);
+                FsLock::lock("/temp/" + uploadfilename, FsLock::WRITE, "imageupload");
                 File file = contentFS->open("/temp/" + uploadfilename, "a");
                 if (file) {
-                    file.write(uploadInfo->buffer, uploadInfo->bufferSize);
+                    Storage.trackUsage(file.write(uploadInfo->buffer, uploadInfo->bufferSize));
                     file.close();
-                    xSemaphoreGive(fsMutex);
+                    FsLock::unlock("/temp/" + uploadfilename, FsLock::WRITE);
                 } else {
-                    xSemaphoreGive(fsMutex);
+                    FsLock::unlock("/temp/" + uploadfilename, FsLock::WRITE);
                     logLine("Failed to open file for appending: " + uploadfilename);
                 }
                 request->_tempObject = nullptr;
@@ -991,16 +1000,17 @@ void doJsonUpload(AsyncWebServerRequest *request) {
         String dst = request->getParam("mac", true)->value();
         uint8_t mac[8];
         if (hex2mac(dst, mac)) {
-            xSemaphoreTake(fsMutex, portMAX_DELAY);
-            File file = contentFS->open("/current/" + dst + ".json", "w");
+            const String jsonPath = "/current/" + dst + ".json";
+            FsLock::lock(jsonPath, FsLock::WRITE, "jsonupload");
+            File file = contentFS->open(jsonPath, "w");
             if (!file) {
                 request->send(400, "text/plain", "Failed to create file");
-                xSemaphoreGive(fsMutex);
+                FsLock::unlock(jsonPath, FsLock::WRITE);
                 return;
             }
             file.print(request->getParam("json", true)->value());
             file.close();
-            xSemaphoreGive(fsMutex);
+            FsLock::unlock(jsonPath, FsLock::WRITE);
             tagRecord *taginfo = tagRecord::findByMAC(mac);
             if (taginfo != nullptr) {
                 uint32_t ttl = 0;
@@ -1024,7 +1034,7 @@ void doJsonUpload(AsyncWebServerRequest *request) {
 void dotagDBUpload(AsyncWebServerRequest *request, String filename, size_t index, uint8_t *data, size_t len, bool final) {
     if (!index) {
         logLine("restore tagDB");
-        xSemaphoreTake(fsMutex, portMAX_DELAY);
+        FsLock::lock("/current/tagDBrestored.json", FsLock::WRITE, "restoredb");
         request->_tempFile = contentFS->open("/current/tagDBrestored.json", "w");
     }
     if (len) {
@@ -1032,7 +1042,7 @@ void dotagDBUpload(AsyncWebServerRequest *request, String filename, size_t index
     }
     if (final) {
         request->_tempFile.close();
-        xSemaphoreGive(fsMutex);
+        FsLock::unlock("/current/tagDBrestored.json", FsLock::WRITE);
         destroyDB();
         loadDB("/current/tagDBrestored.json");
         request->send(200, "text/plain", "Ok, restored.");
@@ -13,6 +13,15 @@
 
 #include "powermgt.h"
 
+// chip select setup and hold time in page mode, the same as the byte mode by default.
+// Boards known to work with shorter ones can set them as build flags
+#ifndef ZBS_BURST_CS_SETUP
+#define ZBS_BURST_CS_SETUP 5
+#endif
+#ifndef ZBS_BURST_CS_HOLD
+#define ZBS_BURST_CS_HOLD 2
+#endif
+
 uint8_t ZBS_interface::begin(uint8_t SS, uint8_t CLK, uint8_t MOSI, uint8_t MISO, uint8_t RESET, uint8_t* POWER, uint8_t powerPins, uint32_t spi_speed) {
     _SS_PIN = SS;
     _CLK_PIN = CLK;
@@ -176,6 +185,55 @@ uint8_t ZBS_interface::read_flash(uint16_t addr) {
     return data;
 }
 
+void ZBS_interface::begin_burst() {
+    if (!spi_ready) {
+        spi_ready = 1;
+        spi->begin(_CLK_PIN, _MISO_PIN, _MOSI_PIN);
+    }
+    spi->beginTransaction(spiSettings);
+}
+
+// the debug interface still needs a chip select pulse per byte, but not a new transaction
+uint8_t ZBS_interface::burst_byte(uint8_t data) {
+    digitalWrite(_SS_PIN, LOW);
+    delayMicroseconds(ZBS_BURST_CS_SETUP);
+    data = spi->transfer(data);
+    delayMicroseconds(ZBS_BURST_CS_HOLD);
+    digitalWrite(_SS_PIN, HIGH);
+    return data;
+}
+
+void ZBS_interface::write_flash_page(uint16_t addr, const uint8_t* data, uint16_t len) {
+    begin_burst();
+    for (uint16_t c = 0; c < len; c++) {
+        if (data[c] == 0xFF) continue;
+        const uint16_t a = addr + c;
+        burst_byte(ZBS_CMD_W_FLASH);
+        burst_byte(a >> 8);
+        burst_byte(a);
+        burst_byte(data[c]);
+        // byte programming time
+        delayMicroseconds(after_byte_delay);
+    }
+    spi->endTransaction();
+}
+
+void ZBS_interface::read_flash_page(uint16_t addr, uint8_t* data, uint16_t len, const uint8_t* expected) {
+    begin_burst();
+    for (uint16_t c = 0; c < len; c++) {
+        if (expected && expected[c] == 0xFF) {
+            data[c] = 0xFF;
+            continue;
+        }
+        const uint16_t a = addr + c;
+        burst_byte(ZBS_CMD_R_FLASH);
+        burst_byte(a >> 8);
+        burst_byte(a);
+        data[c] = burst_byte(0xff);
+    }
+    spi->endTransaction();
+}
+
 void ZBS_interface::write_ram(uint8_t addr, uint8_t data) {
     write_byte(ZBS_CMD_W_RAM, addr, data);
 }
@@ -0,0 +1,211 @@
+// Gicisky line packing against the per byte loop it replaced, run with: pio test -e native
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unity.h>
+
+#include "ble_pack.h"
+
+// width_display and height_display of the screenResolution cases in compress_image
+static const struct {
+    uint16_t width;
+    uint16_t height;
+} resolutions[] = {
+    {216, 104}, {296, 128}, {300, 400}, {640, 384}, {960, 640}, {250, 136},
+    {196, 96}, {640, 480}, {250, 128}, {800, 480}, {280, 480},
+};
+
+// the loop compress_image used before packLine, from the black plane to the color plane.
+// The black plane read past the end of a short image, callers here always pass a full one
+static uint32_t referencePack(const uint8_t *data, uint32_t len, uint8_t *buffer, int width_display, int byte_per_line, bool extra_color, bool canDoCompression, bool mirror_width) {
+    uint8_t *Mirrorbuffer = (uint8_t *)malloc(byte_per_line + 1);
+    uint32_t len_compressed = 0;
+    uint32_t curr_input_posi = 0;
+    for (int i = 0; i < width_display; i++) {
+        if (canDoCompression) {
+            buffer[len_compressed++] = 0x75;
+            buffer[len_compressed++] = byte_per_line + 7;
+            buffer[len_compressed++] = byte_per_line;
+            buffer[len_compressed++] = 0x00;
+            buffer[len_compressed++] = 0x00;
+            buffer[len_compressed++] = 0x00;
+            buffer[len_compressed++] = 0x00;
+        }
+        if (mirror_width) {
+            for (int b = 0; b < byte_per_line; b++) {
+                Mirrorbuffer[b] = ~data[curr_input_posi++];
+            }
+            for (int b = byte_per_line - 1; b >= 0; b--) {
+                buffer[len_compressed++] = BlePack::swapBits(Mirrorbuffer[b]);
+            }
+        } else {
+            for (int b = 0; b < byte_per_line; b++) {
+                buffer[len_compressed++] = ~data[curr_input_posi++];
+            }
+        }
+    }
+    if (extra_color) {
+        for (int i = 0; i < width_display; i++) {
+            if (canDoCompression) {
+                buffer[len_compressed++] = 0x75;
+                buffer[len_compressed++] = byte_per_line + 7;
+                buffer[len_compressed++] = byte_per_line;
+                buffer[len_compressed++] = 0x00;
+                buffer[len_compressed++] = 0x00;
+                buffer[len_compressed++] = 0x00;
+                buffer[len_compressed++] = 0x00;
+            }
+            if (mirror_width) {
+                for (int b = 0; b < byte_per_line; b++) {
+                    if (len <= curr_input_posi)
+                        Mirrorbuffer[b] = 0x00;
+                    else
+                        Mirrorbuffer[b] = data[curr_input_posi++];
+                }
+                for (int b = byte_per_line - 1; b >= 0; b--) {
+                    buffer[len_compressed++] = BlePack::swapBits(Mirrorbuffer[b]);
+                }
+            } else {
+                for (int b = 0; b < byte_per_line; b++) {
+                    if (len <= curr_input_posi) {
+                        buffer[len_compressed++] = 0x00;
+                    } else {
+                        buffer[len_compressed++] = data[curr_input_posi++];
+                    }
+                }
+            }
+        }
+    }
+    free(Mirrorbuffer);
+    return len_compressed;
+}
+
+static uint32_t bytesPerLine(uint16_t height) {
+    return (height + 7) / 8;
+}
+
+static uint8_t *makeImage(uint32_t len) {
+    uint8_t *data = (uint8_t *)malloc(len);
+    uint32_t seed = len;
+    for (uint32_t c = 0; c < len; c++) {
+        seed = seed * 1103515245 + 12345;
+        data[c] = seed >> 16;
+    }
+    return data;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_reverse_bits32_matches_swap_bits() {
+    uint32_t seed = 1;
+    for (int i = 0; i < 100000; i++) {
+        seed = seed * 1103515245 + 12345;
+        uint8_t in[4], out[4], expect[4];
+        memcpy(in, &seed, 4);
+        const uint32_t w = BlePack::reverseBits32(seed);
+        memcpy(out, &w, 4);
+        for (int b = 0; b < 4; b++) expect[3 - b] = BlePack::swapBits(in[b]);
+        TEST_ASSERT_EQUAL_MEMORY(expect, out, 4);
+    }
+}
+
+void test_pack_matches_reference_for_all_resolutions() {
+    for (const auto &r : resolutions) {
+        const uint32_t n = bytesPerLine(r.height);
+        for (uint32_t planes = 1; planes <= 2; planes++) {
+            const uint32_t len = planes * r.width * n;
+            uint8_t *data = makeImage(len);
+            for (int variant = 0; variant < 4; variant++) {
+                const bool headers = variant & 1;
+                const bool mirror = variant & 2;
+                const uint32_t size = BlePack::packedSize(r.width, n, planes, headers);
+                uint8_t *expect = (uint8_t *)malloc(size);
+                uint8_t *out = (uint8_t *)malloc(size);
+                TEST_ASSERT_EQUAL(size, referencePack(data, len, expect, r.width, n, planes == 2, headers, mirror));
+                TEST_ASSERT_EQUAL(size, BlePack::packImage(data, len, out, r.width, n, planes, headers, mirror));
+                char msg[64];
+                snprintf(msg, sizeof(msg), "%dx%d planes %u headers %d mirror %d", r.width, r.height, planes, headers, mirror);
+                TEST_ASSERT_EQUAL_MEMORY_MESSAGE(expect, out, size, msg);
+                free(out);
+                free(expect);
+            }
+            free(data);
+        }
+    }
+}
+
+// the old loop only checked the end of the data in the color plane, padding there is unchanged
+void test_short_color_plane_matches_reference() {
+    const uint16_t width = 296, height = 128;
+    const uint32_t n = bytesPerLine(height);
+    const uint32_t len = width * n + width * n / 3 + 2;
+    uint8_t *data = makeImage(len);
+    for (int mirror = 0; mirror < 2; mirror++) {
+        const uint32_t size = BlePack::packedSize(width, n, 2, true);
+        uint8_t *expect = (uint8_t *)malloc(size);
+        uint8_t *out = (uint8_t *)malloc(size);
+        referencePack(data, len, expect, width, n, true, true, mirror);
+        BlePack::packImage(data, len, out, width, n, 2, true, mirror);
+        TEST_ASSERT_EQUAL_MEMORY(expect, out, size);
+        free(out);
+        free(expect);
+    }
+    free(data);
+}
+
+// a short black plane is padded with white instead of reading past the data
+void test_short_black_plane_is_padded() {
+    const uint32_t n = 16;
+    uint8_t data[40];
+    memset(data, 0x00, sizeof(data));
+    uint8_t out[3 * 16];
+    BlePack::packImage(data, sizeof(data), out, 3, n, 1, false, false);
+    for (uint32_t c = 0; c < sizeof(out); c++) TEST_ASSERT_EQUAL_HEX8(0xFF, out[c]);
+    BlePack::packImage(data, sizeof(data), out, 3, n, 1, false, true);
+    for (uint32_t c = 0; c < sizeof(out); c++) TEST_ASSERT_EQUAL_HEX8(0xFF, out[c]);
+}
+
+static double elapsedMs(const timespec &from, const timespec &to) {
+    return (to.tv_sec - from.tv_sec) * 1e3 + (to.tv_nsec - from.tv_nsec) / 1e6;
+}
+
+// host timing, the ESP32 figures differ but the ratio is what the change is about
+void test_pack_time() {
+    const int rounds = 20;
+    for (const auto &r : resolutions) {
+        const uint32_t n = bytesPerLine(r.height);
+        const uint32_t len = 2 * r.width * n;
+        const uint32_t size = BlePack::packedSize(r.width, n, 2, true);
+        uint8_t *data = makeImage(len);
+        uint8_t *out = (uint8_t *)malloc(size);
+        double oldMs[2], newMs[2];
+        for (int mirror = 0; mirror < 2; mirror++) {
+            timespec t0, t1, t2;
+            clock_gettime(CLOCK_MONOTONIC, &t0);
+            for (int i = 0; i < rounds; i++) referencePack(data, len, out, r.width, n, true, true, mirror);
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            for (int i = 0; i < rounds; i++) BlePack::packImage(data, len, out, r.width, n, 2, true, mirror);
+            clock_gettime(CLOCK_MONOTONIC, &t2);
+            oldMs[mirror] = elapsedMs(t0, t1) / rounds;
+            newMs[mirror] = elapsedMs(t1, t2) / rounds;
+        }
+        char msg[160];
+        snprintf(msg, sizeof(msg), "%4dx%-4d 2 planes: old %.3fms new %.3fms, mirrored old %.3fms new %.3fms",
+                 r.width, r.height, oldMs[0], newMs[0], oldMs[1], newMs[1]);
+        TEST_MESSAGE(msg);
+        free(out);
+        free(data);
+    }
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_reverse_bits32_matches_swap_bits);
+    RUN_TEST(test_pack_matches_reference_for_all_resolutions);
+    RUN_TEST(test_short_color_plane_matches_reference);
+    RUN_TEST(test_short_black_plane_is_padded);
+    RUN_TEST(test_pack_time);
+    return UNITY_END();
+}
@@ -0,0 +1,194 @@
+// BLE session retry and ordering policy, run with: pio test -e native
+#include <stdio.h>
+#include <string.h>
+#include <unity.h>
+
+#include "ble_schedule.h"
+
+// Rough figures for the drain simulation, not measured: connection setup and service discovery
+// hold the connect mutex, the image transfer runs in parallel with the other sessions
+#define CONNECT_MS 2000
+#define TRANSFER_MS 8000
+#define TICK_MS 100
+#define START_MS 5000  // BLETask starts scheduling after 5s
+
+void setUp() {}
+void tearDown() {}
+
+void test_failures_back_off_and_give_up() {
+    BleSchedule::TagState state;
+    uint32_t now = START_MS;
+    TEST_ASSERT_TRUE(BleSchedule::ready(state, now));
+    TEST_ASSERT_EQUAL_UINT32(now, state.pendingSince);
+    for (uint8_t f = 1; f < BLE_MAX_FAILURES; f++) {
+        state.active = true;
+        TEST_ASSERT_FALSE(BleSchedule::ready(state, now));
+        TEST_ASSERT_FALSE(BleSchedule::finish(state, BleSchedule::RESULT_FAILED, now));
+        TEST_ASSERT_EQUAL(f, state.failures);
+        const uint32_t wait = (uint32_t)BLE_RETRY_BASE_MS << (f - 1);
+        TEST_ASSERT_EQUAL_UINT32(wait, BleSchedule::retryIn(state, now));
+        TEST_ASSERT_FALSE(BleSchedule::ready(state, now + wait - 1));
+        TEST_ASSERT_TRUE(BleSchedule::ready(state, now + wait));
+        now += wait;
+    }
+    // the pending wait keeps counting from the first time the tag was seen
+    TEST_ASSERT_EQUAL_UINT32(START_MS, state.pendingSince);
+    state.active = true;
+    TEST_ASSERT_TRUE(BleSchedule::finish(state, BleSchedule::RESULT_FAILED, now));
+    TEST_ASSERT_EQUAL(0, state.failures);
+    TEST_ASSERT_EQUAL_UINT32(0, state.pendingSince);
+    TEST_ASSERT_FALSE(state.active);
+}
+
+void test_not_ready_waits_without_counting_a_failure() {
+    BleSchedule::TagState state;
+    BleSchedule::ready(state, 1000);
+    state.active = true;
+    TEST_ASSERT_FALSE(BleSchedule::finish(state, BleSchedule::RESULT_NOT_READY, 1000));
+    TEST_ASSERT_EQUAL(0, state.failures);
+    TEST_ASSERT_FALSE(BleSchedule::ready(state, 1000 + BLE_RETRY_BASE_MS - 1));
+    TEST_ASSERT_TRUE(BleSchedule::ready(state, 1000 + BLE_RETRY_BASE_MS));
+    state.active = true;
+    TEST_ASSERT_FALSE(BleSchedule::finish(state, BleSchedule::RESULT_COMPLETE, 12000));
+    TEST_ASSERT_FALSE(state.notReady);
+    TEST_ASSERT_EQUAL_UINT32(0, state.pendingSince);
+    TEST_ASSERT_EQUAL_UINT32(0, BleSchedule::retryIn(state, 12000));
+}
+
+// millis() wraps after 49 days, the retry wait has to survive it
+void test_retry_across_millis_wrap() {
+    BleSchedule::TagState state;
+    const uint32_t now = 0xFFFFF000;
+    BleSchedule::ready(state, now);
+    BleSchedule::finish(state, BleSchedule::RESULT_FAILED, now);
+    TEST_ASSERT_FALSE(BleSchedule::ready(state, now + 0x1000));
+    TEST_ASSERT_FALSE(BleSchedule::ready(state, now + BLE_RETRY_BASE_MS - 1));
+    TEST_ASSERT_TRUE(BleSchedule::ready(state, now + BLE_RETRY_BASE_MS));
+}
+
+void test_oldest_first_keeps_queue_order_on_ties() {
+    std::vector<std::pair<uint32_t, uint8_t>> candidates = {{100, 0}, {300, 1}, {100, 2}, {300, 3}, {0, 4}};
+    BleSchedule::oldestFirst(candidates);
+    const uint8_t expect[] = {1, 3, 0, 2, 4};
+    for (uint8_t i = 0; i < sizeof(expect); i++) TEST_ASSERT_EQUAL(expect[i], candidates[i].second);
+}
+
+// BLE_reap_sessions and BLE_schedule on a simulated clock
+struct SimTag {
+    BleSchedule::TagState state;
+    bool pending = true;
+    bool gaveUp = false;
+    uint32_t attempts = 0;
+    uint32_t doneAt = 0;
+};
+
+struct SimSession {
+    int tag = -1;
+    uint32_t endAt = 0;
+    bool fails = false;
+};
+
+struct SimResult {
+    uint32_t drainMs;
+    uint32_t maxStartWaitMs;
+    uint32_t sessions;
+    uint32_t gaveUp;
+    bool inOrder;  // first sessions started in pending order
+};
+
+static bool sessionFails(int tag, uint32_t attempt, uint8_t failPercent) {
+    uint32_t h = (tag + 1) * 0x9E3779B1u ^ (attempt + 1) * 0x85EBCA77u;
+    h ^= h >> 15;
+    h *= 0x2C1B3C6Du;
+    h ^= h >> 13;
+    return h % 100 < failPercent;
+}
+
+static SimResult simDrain(int tagCount, uint8_t maxSessions, uint8_t failPercent) {
+    SimTag tags[32];
+    SimSession sessions[3];
+    uint32_t connectFreeAt = 0;
+    uint32_t lastFirstStart = 0;
+    SimResult r = {0, 0, 0, 0, true};
+    uint32_t now = START_MS;
+    for (int left = tagCount; left && now < START_MS + 3600000; now += TICK_MS) {
+        for (SimSession &s : sessions) {
+            if (s.tag < 0 || s.endAt > now) continue;
+            SimTag &t = tags[s.tag];
+            const bool gaveUp = BleSchedule::finish(t.state, s.fails ? BleSchedule::RESULT_FAILED : BleSchedule::RESULT_COMPLETE, now);
+            if (!s.fails || gaveUp) {
+                t.pending = false;
+                t.gaveUp = gaveUp;
+                t.doneAt = now;
+                left--;
+            }
+            s.tag = -1;
+        }
+        std::vector<std::pair<uint32_t, uint8_t>> candidates;
+        uint8_t active = 0;
+        for (const SimSession &s : sessions) active += s.tag >= 0;
+        for (int c = 0; c < tagCount; c++) {
+            if (tags[c].pending && BleSchedule::ready(tags[c].state, now)) candidates.push_back({now - tags[c].state.pendingSince, (uint8_t)c});
+        }
+        BleSchedule::oldestFirst(candidates);
+        for (const auto &candidate : candidates) {
+            if (active >= maxSessions) break;
+            SimSession *s = nullptr;
+            for (SimSession &free : sessions) {
+                if (free.tag < 0) {
+                    s = &free;
+                    break;
+                }
+            }
+            SimTag &t = tags[candidate.second];
+            if (t.attempts++ == 0) {
+                if (candidate.second < lastFirstStart) r.inOrder = false;
+                lastFirstStart = candidate.second;
+                if (now - START_MS > r.maxStartWaitMs) r.maxStartWaitMs = now - START_MS;
+            }
+            // connection setup one at a time, the transfers overlap
+            const uint32_t connected = (now > connectFreeAt ? now : connectFreeAt) + CONNECT_MS;
+            connectFreeAt = connected;
+            s->tag = candidate.second;
+            s->fails = sessionFails(candidate.second, t.attempts, failPercent);
+            s->endAt = connected + (s->fails ? TRANSFER_MS / 2 : TRANSFER_MS);
+            t.state.active = true;
+            active++;
+            r.sessions++;
+        }
+    }
+    for (int c = 0; c < tagCount; c++) {
+        if (tags[c].doneAt - START_MS > r.drainMs) r.drainMs = tags[c].doneAt - START_MS;
+        r.gaveUp += tags[c].gaveUp;
+    }
+    return r;
+}
+
+void test_drain_time() {
+    const struct {
+        const char *name;
+        uint8_t failPercent;
+    } cases[] = {{"no failures", 0}, {"20% failed sessions", 20}, {"50% failed sessions", 50}};
+    for (const auto &c : cases) {
+        const SimResult one = simDrain(12, 1, c.failPercent);
+        const SimResult three = simDrain(12, 3, c.failPercent);
+        char msg[200];
+        snprintf(msg, sizeof(msg), "12 tags, %s: 1 session %.0fs (last start %.0fs), 3 sessions %.0fs (last start %.0fs), %u/%u sessions, %u/%u given up",
+                 c.name, one.drainMs / 1e3, one.maxStartWaitMs / 1e3, three.drainMs / 1e3, three.maxStartWaitMs / 1e3,
+                 one.sessions, three.sessions, one.gaveUp, three.gaveUp);
+        TEST_MESSAGE(msg);
+        TEST_ASSERT_TRUE(three.drainMs < one.drainMs);
+        TEST_ASSERT_TRUE(one.inOrder);
+        TEST_ASSERT_TRUE(three.inOrder);
+    }
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_failures_back_off_and_give_up);
+    RUN_TEST(test_not_ready_waits_without_counting_a_failure);
+    RUN_TEST(test_retry_across_millis_wrap);
+    RUN_TEST(test_oldest_first_keeps_queue_order_on_ties);
+    RUN_TEST(test_drain_time);
+    return UNITY_END();
+}
@@ -0,0 +1,308 @@
+// G5 encoder and decoder round trips, run with: pio test -e native
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unity.h>
+
+#include "../../src/g5/g5enc.inl"
+#include "../../src/g5/g5dec.inl"
+
+// widths of the panels in the tag types, plus the widest one the flip buffers must cover.
+// 122 and 250 are the 2.13" panels, their lines end in the middle of a byte
+static const int widths[] = {122, 128, 152, 200, 250, 256, 296, 400, 640, 800, 960, 1304};
+
+enum pattern { PATTERN_TEXT, PATTERN_DITHER, PATTERN_NOISE, PATTERN_SPARSE };
+
+static int pitch(int width) {
+    return (width + 7) / 8;
+}
+
+// the pad bits at the end of a line are random, the encoder has to ignore them
+static void makeImage(uint8_t *image, int width, int height, pattern p) {
+    const int pitch = ::pitch(width);
+    uint32_t seed = width * 31 + height + p;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < pitch; x++) {
+            seed = seed * 1103515245 + 12345;
+            uint8_t b;
+            switch (p) {
+                case PATTERN_TEXT:
+                    // white with dark blocks, runs shared between neighbouring lines
+                    b = ((x / 3 + y / 12) % 4 == 0 && y % 12 < 9) ? (uint8_t)(0x18 << (y % 3)) : 0xFF;
+                    break;
+                case PATTERN_SPARSE:
+                    // a few lines of text on a white tag
+                    b = (y % 40 < 12 && x % 20 < 8 && (x + y) % 3) ? (uint8_t)(0xC3 >> (y & 3)) : 0xFF;
+                    break;
+                case PATTERN_DITHER:
+                    b = (y & 1) ? 0xAA : 0x55;
+                    break;
+                default:
+                    b = seed >> 16;
+                    break;
+            }
+            if (x == pitch - 1 && (width & 7)) b = (b & (0xFF00 >> (width & 7))) | ((seed >> 8) & (0xFF >> (width & 7)));
+            image[y * pitch + x] = b;
+        }
+    }
+}
+
+// the decoder leaves pad bits white, only the pixels inside the width have to match
+static void assertLineEqual(const uint8_t *expect, const uint8_t *line, int width, int y) {
+    const int pitch = ::pitch(width);
+    char msg[48];
+    snprintf(msg, sizeof(msg), "width %d line %d", width, y);
+    if (pitch > 1) TEST_ASSERT_EQUAL_MEMORY_MESSAGE(expect, line, pitch - 1, msg);
+    const uint8_t mask = (width & 7) ? (uint8_t)(0xFF00 >> (width & 7)) : 0xFF;
+    TEST_ASSERT_EQUAL_HEX8_MESSAGE(expect[pitch - 1] & mask, line[pitch - 1] & mask, msg);
+}
+
+// the byte table run scan G5ENCEncodeLine used before it scanned a word at a time.
+// It reads one byte past the end of the line, callers pass a padded buffer
+static uint8_t bitcount[256];
+
+static void initBitcount() {
+    for (int c = 0; c < 256; c++) {
+        uint8_t n = 0;
+        while (n < 8 && (c & (0x80 >> n))) n++;
+        bitcount[c] = n;
+    }
+}
+
+static int referenceEncodeLine(unsigned char *buf, int xsize, int16_t *pDest, int iMaxFlips) {
+    int iCount, xborder;
+    uint8_t i, c;
+    int8_t cBits;
+    int iLen;
+    int16_t x;
+    int16_t *pLimit = pDest + (iMaxFlips - 4);
+
+    xborder = xsize;
+    iCount = (xsize + 7) >> 3;
+    cBits = 8;
+    iLen = 0;
+    x = 0;
+
+    c = *buf++;
+    iCount--;
+    while (iCount >= 0) {
+        if (pDest >= pLimit) return G5_MAX_FLIPS_EXCEEDED;
+        i = bitcount[c];
+        iLen += i;
+        c <<= i;
+        cBits -= i;
+        if (cBits <= 0) {
+            iLen += cBits;
+            cBits = 8;
+            c = *buf++;
+            iCount--;
+            continue;
+        }
+        c = ~c;
+        xborder -= iLen;
+        if (xborder < 0) {
+            iLen += xborder;
+            break;
+        }
+        x += iLen;
+        *pDest++ = x;
+        iLen = 0;
+    doblack:
+        i = bitcount[c];
+        iLen += i;
+        c <<= i;
+        cBits -= i;
+        if (cBits <= 0) {
+            iLen += cBits;
+            cBits = 8;
+            c = *buf++;
+            c = ~c;
+            iCount--;
+            if (iCount < 0)
+                break;
+            goto doblack;
+        }
+        c = ~c;
+        xborder -= iLen;
+        if (xborder < 0) {
+            iLen += xborder;
+            break;
+        }
+        x += iLen;
+        *pDest++ = x;
+        iLen = 0;
+    }
+
+    x += iLen;
+    if (pDest >= pLimit) return G5_MAX_FLIPS_EXCEEDED;
+    *pDest++ = x;
+    *pDest++ = x;
+    *pDest++ = x;
+    *pDest++ = x;
+    return G5_SUCCESS;
+}
+
+static void roundTrip(int width, int height, pattern p) {
+    const int pitch = ::pitch(width);
+    const int size = pitch * height;
+    uint8_t *image = (uint8_t *)malloc(size);
+    // noise doesn't compress, G5 output can be larger than the raw image
+    const int outSize = size * 2 + 16384;
+    uint8_t *out = (uint8_t *)malloc(outSize);
+    uint8_t *line = (uint8_t *)malloc(pitch + 8);
+    TEST_ASSERT_NOT_NULL(image);
+    TEST_ASSERT_NOT_NULL(out);
+    TEST_ASSERT_NOT_NULL(line);
+    makeImage(image, width, height, p);
+
+    G5ENCIMAGE enc = {};
+    int rc = g5_encode_init(&enc, width, height, out, outSize);
+    for (int y = 0; y < height && rc == G5_SUCCESS; y++) {
+        rc = g5_encode_encodeLine(&enc, image + y * pitch);
+    }
+    g5_encode_free(&enc);
+    TEST_ASSERT_EQUAL(G5_ENCODE_COMPLETE, rc);
+    const int encoded = g5_encode_getOutSize(&enc);
+
+    G5DECIMAGE dec = {};
+    TEST_ASSERT_EQUAL(G5_SUCCESS, g5_decode_init(&dec, width, height, out, encoded));
+    for (int y = 0; y < height; y++) {
+        TEST_ASSERT_EQUAL(y == height - 1 ? G5_DECODE_COMPLETE : G5_SUCCESS, g5_decode_line(&dec, line));
+        assertLineEqual(image + y * pitch, line, width, y);
+    }
+    g5_decode_free(&dec);
+    free(line);
+    free(out);
+    free(image);
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_round_trip_text() {
+    for (int w : widths) roundTrip(w, 64, PATTERN_TEXT);
+}
+
+void test_round_trip_dither() {
+    for (int w : widths) roundTrip(w, 64, PATTERN_DITHER);
+}
+
+// a flip on almost every pixel, needs the flip buffers sized from the width
+void test_round_trip_noise() {
+    for (int w : widths) roundTrip(w, 16, PATTERN_NOISE);
+}
+
+// the word scan has to find the same run ends as the byte table, the rest of the encoder is shared
+void test_encode_line_matches_reference() {
+    const pattern patterns[] = {PATTERN_SPARSE, PATTERN_TEXT, PATTERN_DITHER, PATTERN_NOISE};
+    for (int w : widths) {
+        for (pattern p : patterns) {
+            const int pitch = ::pitch(w);
+            const int height = 32;
+            uint8_t *image = (uint8_t *)malloc(pitch * height + 1);
+            makeImage(image, w, height, p);
+            image[pitch * height] = 0x00;
+            const int maxFlips = G5_FLIPS_FOR_WIDTH(w);
+            int16_t *expect = (int16_t *)malloc(maxFlips * sizeof(int16_t));
+            int16_t *flips = (int16_t *)malloc(maxFlips * sizeof(int16_t));
+            for (int y = 0; y < height; y++) {
+                // unused entries keep the fill, the whole buffer can be compared
+                memset(expect, 0x7F, maxFlips * sizeof(int16_t));
+                memset(flips, 0x7F, maxFlips * sizeof(int16_t));
+                TEST_ASSERT_EQUAL(G5_SUCCESS, referenceEncodeLine(image + y * pitch, w, expect, maxFlips));
+                TEST_ASSERT_EQUAL(G5_SUCCESS, G5ENCEncodeLine(image + y * pitch, w, flips, maxFlips));
+                char msg[48];
+                snprintf(msg, sizeof(msg), "width %d pattern %d line %d", w, p, y);
+                TEST_ASSERT_EQUAL_MEMORY_MESSAGE(expect, flips, maxFlips * sizeof(int16_t), msg);
+            }
+            free(flips);
+            free(expect);
+            free(image);
+        }
+    }
+}
+
+static double elapsedMs(const timespec &from, const timespec &to) {
+    return (to.tv_sec - from.tv_sec) * 1e3 + (to.tv_nsec - from.tv_nsec) / 1e6;
+}
+
+// host timing of the run scan before and after, and of a whole encode and decode.
+// The ESP32 figures differ but the ratio is what the change is about
+void test_encode_time() {
+    const int width = 800, height = 480, rounds = 20;
+    const int pitch = ::pitch(width);
+    const int size = pitch * height;
+    const pattern patterns[] = {PATTERN_SPARSE, PATTERN_TEXT, PATTERN_NOISE};
+    const char *names[] = {"sparse", "text", "noise"};
+    uint8_t *image = (uint8_t *)malloc(size + 1);
+    const int outSize = size * 2 + 16384;
+    uint8_t *out = (uint8_t *)malloc(outSize);
+    uint8_t *line = (uint8_t *)malloc(pitch + 8);
+    const int maxFlips = G5_FLIPS_FOR_WIDTH(width);
+    int16_t *flips = (int16_t *)malloc(maxFlips * sizeof(int16_t));
+    for (int i = 0; i < 3; i++) {
+        makeImage(image, width, height, patterns[i]);
+        image[size] = 0x00;
+        timespec t0, t1, t2, t3, t4;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (int r = 0; r < rounds; r++)
+            for (int y = 0; y < height; y++) referenceEncodeLine(image + y * pitch, width, flips, maxFlips);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        for (int r = 0; r < rounds; r++)
+            for (int y = 0; y < height; y++) G5ENCEncodeLine(image + y * pitch, width, flips, maxFlips);
+        clock_gettime(CLOCK_MONOTONIC, &t2);
+        int encoded = 0;
+        for (int r = 0; r < rounds; r++) {
+            G5ENCIMAGE enc = {};
+            g5_encode_init(&enc, width, height, out, outSize);
+            for (int y = 0; y < height; y++) g5_encode_encodeLine(&enc, image + y * pitch);
+            encoded = g5_encode_getOutSize(&enc);
+            g5_encode_free(&enc);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t3);
+        for (int r = 0; r < rounds; r++) {
+            G5DECIMAGE dec = {};
+            g5_decode_init(&dec, width, height, out, encoded);
+            for (int y = 0; y < height; y++) g5_decode_line(&dec, line);
+            g5_decode_free(&dec);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t4);
+        char msg[160];
+        snprintf(msg, sizeof(msg), "%dx%d %s: line scan old %.3fms new %.3fms, encode %.3fms, decode %.3fms, %d bytes",
+                 width, height, names[i], elapsedMs(t0, t1) / rounds, elapsedMs(t1, t2) / rounds,
+                 elapsedMs(t2, t3) / rounds, elapsedMs(t3, t4) / rounds, encoded);
+        TEST_MESSAGE(msg);
+    }
+    free(flips);
+    free(line);
+    free(out);
+    free(image);
+}
+
+void test_free_after_failed_init() {
+    G5ENCIMAGE enc;
+    memset(&enc, 0xA5, sizeof(enc));
+    uint8_t out[16];
+    TEST_ASSERT_EQUAL(G5_INVALID_PARAMETER, g5_encode_init(&enc, 0, 10, out, sizeof(out)));
+    TEST_ASSERT_TRUE(enc.CurFlips == NULL);
+    g5_encode_free(&enc);
+
+    G5DECIMAGE dec;
+    memset(&dec, 0xA5, sizeof(dec));
+    TEST_ASSERT_EQUAL(G5_INVALID_PARAMETER, g5_decode_init(&dec, 10, 10, NULL, 0));
+    TEST_ASSERT_TRUE(dec.CurFlips == NULL);
+    g5_decode_free(&dec);
+}
+
+int main() {
+    initBitcount();
+    UNITY_BEGIN();
+    RUN_TEST(test_round_trip_text);
+    RUN_TEST(test_round_trip_dither);
+    RUN_TEST(test_round_trip_noise);
+    RUN_TEST(test_encode_line_matches_reference);
+    RUN_TEST(test_free_after_failed_init);
+    RUN_TEST(test_encode_time);
+    return UNITY_END();
+}
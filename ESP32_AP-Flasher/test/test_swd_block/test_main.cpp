@@ -0,0 +1,292 @@
+// SwdBlock against an emulated DAP with an AHB-AP, run with: pio test -e native
+#include <stdio.h>
+#include <string.h>
+#include <unity.h>
+
+#include "swd_block.h"
+
+#define MEM_WORDS 4096  // 16K of target RAM at address 0
+#define BANK_WORDS 1024  // an nRF bank, 4K
+
+// Rough figure for the time model, not measured: 46 clocks per transfer at the 2us half period
+#define T_TRANSACTION_US 184
+#define NRF_WORD_WRITE_US 400
+
+// DAP emulator. TAR auto-increment only carries within a 1KB block, the smallest the ADI spec
+// allows, and AP reads are posted: a DRW read returns the result of the previous AP read, the
+// last one is in RDBUFF. Any transfer can be made to fault
+class DapModel {
+   public:
+    uint32_t mem[MEM_WORDS];
+    uint32_t csw = CSW_32BIT;
+    uint32_t tar = 0;
+    uint32_t posted = 0;
+    uint32_t us = 0;
+    uint32_t transactions = 0;
+    uint32_t tarWrites = 0;
+    uint32_t readLow = UINT32_MAX;  // range of the memory reads
+    uint32_t readHigh = 0;
+    uint32_t drwWrites = 0;
+    uint32_t lastDrwWrite = 0;
+    uint32_t minDrwSpacing = UINT32_MAX;
+    int32_t failAt = -1;  // transaction that faults
+
+    DapModel() {
+        memset(mem, 0xFF, sizeof(mem));
+    }
+
+    bool AP_Write(unsigned addr, uint32_t data) {
+        const uint32_t start = us;
+        if (!transfer()) return false;
+        switch (addr) {
+            case AP_CSW:
+                csw = data;
+                break;
+            case AP_TAR:
+                tar = data;
+                tarWrites++;
+                break;
+            case AP_DRW:
+                if (drwWrites++ && start - lastDrwWrite < minDrwSpacing) minDrwSpacing = start - lastDrwWrite;
+                lastDrwWrite = start;
+                if (tar / 4 < MEM_WORDS) mem[tar / 4] = data;
+                increment();
+                break;
+        }
+        return true;
+    }
+    bool AP_Read(unsigned addr, uint32_t &data) {
+        if (!transfer()) return false;
+        data = posted;
+        switch (addr) {
+            case AP_CSW:
+                posted = csw;
+                break;
+            case AP_TAR:
+                posted = tar;
+                break;
+            case AP_DRW:
+                if (tar < readLow) readLow = tar;
+                if (tar > readHigh) readHigh = tar;
+                posted = tar / 4 < MEM_WORDS ? mem[tar / 4] : 0xDEADBEEF;
+                increment();
+                break;
+        }
+        return true;
+    }
+    bool DP_Read(unsigned addr, uint32_t &data) {
+        if (!transfer()) return false;
+        data = addr == DP_RDBUFF ? posted : 0;
+        return true;
+    }
+    uint32_t micros() {
+        return ++us;
+    }
+
+   private:
+    bool transfer() {
+        us += T_TRANSACTION_US;
+        return (int32_t)transactions++ != failAt;
+    }
+    // CSW AddrInc single, only the low 10 bits of TAR count
+    void increment() {
+        if ((csw & 0x30) != 0x10) return;
+        tar = (tar & ~(uint32_t)(TAR_AUTOINC_BOUNDARY - 1)) | ((tar + 4) & (TAR_AUTOINC_BOUNDARY - 1));
+    }
+};
+
+// nrf_write_bank and nrf_read_bank before the block transfers: TAR set once for the bank,
+// the read loop starts one word early and reads one word past the end
+static void oldWriteBank(DapModel &dap, uint32_t address, const uint32_t *data, uint32_t words) {
+    uint32_t temp;
+    dap.AP_Write(AP_CSW, CSW_32BIT_AUTOINC);
+    dap.AP_Write(AP_TAR, address);
+    for (uint32_t i = 0; i < words; i++) {
+        uint32_t end_micros = dap.micros() + NRF_WORD_WRITE_US;
+        dap.AP_Write(AP_DRW, data[i]);
+        while ((int32_t)(end_micros - dap.micros()) > 0) {
+        };
+    }
+    dap.AP_Write(AP_CSW, CSW_32BIT);
+    dap.DP_Read(DP_RDBUFF, temp);
+    dap.DP_Read(DP_RDBUFF, temp);
+}
+
+static void oldReadBank(DapModel &dap, uint32_t address, uint32_t *data, uint32_t words) {
+    uint32_t temp;
+    dap.AP_Write(AP_CSW, CSW_32BIT_AUTOINC);
+    dap.AP_Write(AP_TAR, address);
+    dap.AP_Read(AP_DRW, temp);
+    for (uint32_t i = 0; i < words; i++) dap.AP_Read(AP_DRW, data[i]);
+    dap.AP_Write(AP_CSW, CSW_32BIT);
+    dap.DP_Read(DP_RDBUFF, temp);
+    dap.DP_Read(DP_RDBUFF, temp);
+}
+
+static bool writeBlock(DapModel &dap, uint32_t address, const uint32_t *data, uint32_t words, uint16_t wordDelayUs = 0) {
+    return SwdBlock::writeBlock(dap, [&dap]() { return dap.micros(); }, address, data, words, wordDelayUs);
+}
+
+static uint32_t pattern[MEM_WORDS];
+
+static void makePattern() {
+    uint32_t seed = 12345;
+    for (uint32_t c = 0; c < MEM_WORDS; c++) {
+        seed = seed * 1103515245 + 12345;
+        pattern[c] = seed ^ (c << 16);
+    }
+}
+
+static void assertErased(const DapModel &dap, uint32_t fromWord, uint32_t toWord) {
+    for (uint32_t c = fromWord; c < toWord; c++) TEST_ASSERT_EQUAL_UINT32(0xFFFFFFFF, dap.mem[c]);
+}
+
+void setUp() {}
+void tearDown() {}
+
+// 700 words from 0xF00 cross the 1KB boundaries at 0x1000, 0x1400 and 0x1800
+void test_write_across_1k_boundaries() {
+    static DapModel dap;
+    const uint32_t address = 0xF00, words = 700;
+    TEST_ASSERT_TRUE(writeBlock(dap, address, pattern, words));
+    TEST_ASSERT_EQUAL_MEMORY(pattern, dap.mem + address / 4, words * 4);
+    assertErased(dap, 0, address / 4);
+    assertErased(dap, address / 4 + words, MEM_WORDS);
+    TEST_ASSERT_EQUAL(4, dap.tarWrites);
+    TEST_ASSERT_EQUAL_UINT32(CSW_32BIT, dap.csw);
+}
+
+void test_read_across_1k_boundaries() {
+    static DapModel dap;
+    memcpy(dap.mem, pattern, sizeof(dap.mem));
+    const uint32_t address = 0xF00, words = 700;
+    static uint32_t data[700];
+    TEST_ASSERT_TRUE(SwdBlock::readBlock(dap, address, data, words));
+    TEST_ASSERT_EQUAL_MEMORY(pattern + address / 4, data, words * 4);
+    TEST_ASSERT_EQUAL(4, dap.tarWrites);
+    // the last word comes from RDBUFF, nothing past the end is read
+    TEST_ASSERT_EQUAL_UINT32(address, dap.readLow);
+    TEST_ASSERT_EQUAL_UINT32(address + (words - 1) * 4, dap.readHigh);
+    TEST_ASSERT_EQUAL_UINT32(CSW_32BIT, dap.csw);
+}
+
+// a boundary on the last word, and transfers starting right on one
+void test_boundary_at_the_ends() {
+    const struct {
+        uint32_t address, words;
+    } cases[] = {{0x3FC, 1}, {0x3FC, 2}, {0x400, 1}, {0x400, 256}, {0x400, 257}, {0x0, MEM_WORDS}};
+    for (const auto &t : cases) {
+        static DapModel dap;
+        dap = DapModel();
+        TEST_ASSERT_TRUE(writeBlock(dap, t.address, pattern, t.words));
+        TEST_ASSERT_EQUAL_MEMORY(pattern, dap.mem + t.address / 4, t.words * 4);
+        static uint32_t data[MEM_WORDS];
+        TEST_ASSERT_TRUE(SwdBlock::readBlock(dap, t.address, data, t.words));
+        TEST_ASSERT_EQUAL_MEMORY(pattern, data, t.words * 4);
+        TEST_ASSERT_EQUAL_UINT32(t.address + (t.words - 1) * 4, dap.readHigh);
+    }
+}
+
+void test_empty_transfer() {
+    static DapModel dap;
+    uint32_t data = 0x12345678;
+    TEST_ASSERT_TRUE(writeBlock(dap, 0x100, &data, 0));
+    TEST_ASSERT_TRUE(SwdBlock::readBlock(dap, 0x100, &data, 0));
+    TEST_ASSERT_EQUAL_UINT32(0x12345678, data);
+    TEST_ASSERT_EQUAL(0, dap.tarWrites);
+    TEST_ASSERT_EQUAL(0, dap.drwWrites);
+    TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, dap.readLow);
+}
+
+// the bank loops before TAR was reloaded wrap inside the first 1KB of a 4K bank
+void test_old_bank_loops_wrap() {
+    static DapModel dap;
+    static uint32_t data[BANK_WORDS];
+    oldWriteBank(dap, 0x1000, pattern, BANK_WORDS);
+    TEST_ASSERT_EQUAL_MEMORY(pattern + 768, dap.mem + 0x1000 / 4, 256 * 4);
+    assertErased(dap, 0x1400 / 4, 0x2000 / 4);
+    memcpy(dap.mem, pattern, sizeof(dap.mem));
+    oldReadBank(dap, 0x1000, data, BANK_WORDS);
+    TEST_ASSERT_EQUAL_MEMORY(pattern + 0x1000 / 4, data + 768, 256 * 4);
+
+    dap = DapModel();
+    TEST_ASSERT_TRUE(writeBlock(dap, 0x1000, pattern, BANK_WORDS, NRF_WORD_WRITE_US));
+    TEST_ASSERT_EQUAL_MEMORY(pattern, dap.mem + 0x1000 / 4, BANK_WORDS * 4);
+    TEST_ASSERT_TRUE(SwdBlock::readBlock(dap, 0x1000, data, BANK_WORDS));
+    TEST_ASSERT_EQUAL_MEMORY(pattern, data, BANK_WORDS * 4);
+}
+
+// a faulted transfer is reported, nothing after it is written
+void test_fault_stops_the_transfer() {
+    static DapModel dap;
+    dap.failAt = 10;
+    TEST_ASSERT_FALSE(writeBlock(dap, 0x800, pattern, 100));
+    TEST_ASSERT_TRUE(dap.drwWrites < 10);
+    assertErased(dap, 0x800 / 4 + dap.drwWrites, MEM_WORDS);
+
+    const uint32_t faults[] = {0, 1, 2, 50, 258, 259, 260};
+    for (uint32_t f : faults) {
+        static uint32_t data[300];
+        dap = DapModel();
+        dap.failAt = f;
+        TEST_ASSERT_FALSE(SwdBlock::readBlock(dap, 0x300, data, 300));
+    }
+}
+
+// the nRF needs 400us per word, counted from the start of the word's DRW write
+void test_word_delay() {
+    static DapModel dap;
+    TEST_ASSERT_TRUE(writeBlock(dap, 0x3F0, pattern, 40, NRF_WORD_WRITE_US));
+    TEST_ASSERT_EQUAL(40, dap.drwWrites);
+    TEST_ASSERT_TRUE(dap.minDrwSpacing >= NRF_WORD_WRITE_US);
+    TEST_ASSERT_TRUE(dap.minDrwSpacing < NRF_WORD_WRITE_US + T_TRANSACTION_US);
+}
+
+// write_register/read_register for every word against the block transfers, 4K bank
+void test_transfer_time() {
+    static DapModel perWord, block;
+    static uint32_t data[BANK_WORDS];
+    uint32_t temp;
+    for (uint32_t i = 0; i < BANK_WORDS; i++) {
+        perWord.AP_Write(AP_TAR, i * 4);
+        perWord.AP_Write(AP_DRW, pattern[i]);
+        perWord.DP_Read(DP_RDBUFF, temp);
+    }
+    const uint32_t perWordWrite = perWord.transactions;
+    for (uint32_t i = 0; i < BANK_WORDS; i++) {
+        perWord.AP_Write(AP_TAR, i * 4);
+        perWord.AP_Read(AP_DRW, temp);
+        perWord.DP_Read(DP_RDBUFF, data[i]);
+        perWord.DP_Read(DP_RDBUFF, temp);
+    }
+    const uint32_t perWordRead = perWord.transactions - perWordWrite;
+    TEST_ASSERT_EQUAL_MEMORY(pattern, data, sizeof(data));
+
+    TEST_ASSERT_TRUE(writeBlock(block, 0, pattern, BANK_WORDS));
+    const uint32_t blockWrite = block.transactions;
+    TEST_ASSERT_TRUE(SwdBlock::readBlock(block, 0, data, BANK_WORDS));
+    const uint32_t blockRead = block.transactions - blockWrite;
+    TEST_ASSERT_EQUAL_MEMORY(pattern, data, sizeof(data));
+
+    char msg[160];
+    snprintf(msg, sizeof(msg), "4K bank: write %u vs %u transfers, read %u vs %u transfers, %.1fms vs %.1fms at %dus per transfer",
+             perWordWrite, blockWrite, perWordRead, blockRead,
+             (perWordWrite + perWordRead) * T_TRANSACTION_US / 1e3, (blockWrite + blockRead) * T_TRANSACTION_US / 1e3, T_TRANSACTION_US);
+    TEST_MESSAGE(msg);
+    TEST_ASSERT_TRUE(blockWrite < perWordWrite / 2);
+    TEST_ASSERT_TRUE(blockRead < perWordRead / 3);
+}
+
+int main() {
+    makePattern();
+    UNITY_BEGIN();
+    RUN_TEST(test_write_across_1k_boundaries);
+    RUN_TEST(test_read_across_1k_boundaries);
+    RUN_TEST(test_boundary_at_the_ends);
+    RUN_TEST(test_empty_transfer);
+    RUN_TEST(test_old_bank_loops_wrap);
+    RUN_TEST(test_fault_stops_the_transfer);
+    RUN_TEST(test_word_delay);
+    RUN_TEST(test_transfer_time);
+    return UNITY_END();
+}
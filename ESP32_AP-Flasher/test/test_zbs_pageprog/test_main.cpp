@@ -0,0 +1,208 @@
+// ZbsPageProg against an emulated ZBS243 debug interface, run with: pio test -e native
+#include <stdio.h>
+#include <string.h>
+#include <unity.h>
+
+#include "zbs_pageprog.h"
+
+#define MAX_WRITE_ATTEMPTS 5
+#define IMAGE_SIZE 0x10000
+
+// Rough ESP32 figures for the time model, not measured. A byte on the bus is 1us at 8MHz,
+// chip select setup and hold are 5us and 2us in both modes, programming takes after_byte_delay
+#define T_BYTE_US 1.0
+#define T_CS_US 7.0
+#define T_TRANSACTION_US 3.0
+#define T_AFTER_BYTE_US 10.0
+
+// Flash and debug command emulator. Programming can only clear bits, like the real flash.
+// Bytes can be made weak (need more writes before they stick) and the burst read can be
+// made to return a wrong value once
+class ZbsEmulator {
+   public:
+    uint8_t flash[IMAGE_SIZE];
+    uint8_t weak[IMAGE_SIZE];
+    int32_t burstGlitch = -1;
+    double us = 0;
+    uint32_t byteWrites = 0;
+    uint32_t byteReads = 0;
+    uint32_t burstReads = 0;
+
+    ZbsEmulator() {
+        memset(flash, 0xFF, sizeof(flash));
+        memset(weak, 0, sizeof(weak));
+    }
+
+    // send_byte/read_byte, every byte is its own SPI transaction
+    void write_flash(uint16_t addr, uint8_t data) {
+        us += 4 * (T_TRANSACTION_US + T_CS_US + T_BYTE_US) + T_AFTER_BYTE_US;
+        byteWrites++;
+        program(addr, data);
+    }
+    uint8_t read_flash(uint16_t addr) {
+        us += 4 * (T_TRANSACTION_US + T_CS_US + T_BYTE_US) + T_AFTER_BYTE_US;
+        byteReads++;
+        return flash[addr];
+    }
+
+    // begin_burst/burst_byte, one transaction for the page
+    void write_flash_page(uint16_t addr, const uint8_t *data, uint16_t len) {
+        us += T_TRANSACTION_US;
+        for (uint16_t c = 0; c < len; c++) {
+            if (data[c] == 0xFF) continue;
+            us += 4 * (T_CS_US + T_BYTE_US) + T_AFTER_BYTE_US;
+            program(addr + c, data[c]);
+        }
+    }
+    void read_flash_page(uint16_t addr, uint8_t *data, uint16_t len, const uint8_t *expected = nullptr) {
+        us += T_TRANSACTION_US;
+        for (uint16_t c = 0; c < len; c++) {
+            if (expected && expected[c] == 0xFF) {
+                data[c] = 0xFF;
+                continue;
+            }
+            us += 4 * (T_CS_US + T_BYTE_US);
+            burstReads++;
+            data[c] = flash[(uint16_t)(addr + c)];
+            if (burstGlitch == addr + c) {
+                data[c] ^= 0x01;
+                burstGlitch = -1;
+            }
+        }
+    }
+
+   private:
+    void program(uint16_t addr, uint8_t data) {
+        if (weak[addr]) {
+            weak[addr]--;
+            return;
+        }
+        flash[addr] &= data;
+    }
+};
+
+static uint8_t image[IMAGE_SIZE];
+
+// code in the first 40K with the odd 0xFF byte, erased flash after it
+static void makeImage() {
+    uint32_t seed = 12345;
+    for (uint32_t c = 0; c < IMAGE_SIZE; c++) {
+        seed = seed * 1103515245 + 12345;
+        const uint8_t b = seed >> 16;
+        image[c] = (c < 40 * 1024 && (b & 15) != 0) ? b : 0xFF;
+    }
+}
+
+// the byte mode loop the flasher used before page mode
+static bool byteModeFlash(ZbsEmulator &zbs, const uint8_t *data, uint32_t size) {
+    for (uint32_t c = 0; c < size; c++) {
+        if (data[c] == 0xFF) continue;
+        uint8_t i = 0;
+        for (; i < MAX_WRITE_ATTEMPTS; i++) {
+            zbs.write_flash(c, data[c]);
+            if (zbs.read_flash(c) == data[c]) break;
+        }
+        if (i == MAX_WRITE_ATTEMPTS) return false;
+    }
+    return true;
+}
+
+static bool pageModeFlash(ZbsEmulator &zbs, const uint8_t *data, uint32_t size, bool fullVerify, uint16_t &fallbacks) {
+    for (uint32_t c = 0; c < size; c += 256) {
+        const uint16_t len = (size - c > 256) ? 256 : size - c;
+        if (!ZbsPageProg::writePage(zbs, c, data + c, len, MAX_WRITE_ATTEMPTS, fallbacks)) return false;
+    }
+    if (!fullVerify) return true;
+    for (uint32_t c = 0; c < size; c += 256) {
+        const uint16_t len = (size - c > 256) ? 256 : size - c;
+        if (!ZbsPageProg::verifyPage(zbs, c, data + c, len)) return false;
+    }
+    return true;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_page_mode_programs_the_same_image() {
+    static ZbsEmulator byteMode, pageMode;
+    uint16_t fallbacks = 0;
+    TEST_ASSERT_TRUE(byteModeFlash(byteMode, image, IMAGE_SIZE));
+    TEST_ASSERT_TRUE(pageModeFlash(pageMode, image, IMAGE_SIZE, false, fallbacks));
+    TEST_ASSERT_EQUAL_MEMORY(image, byteMode.flash, IMAGE_SIZE);
+    TEST_ASSERT_EQUAL_MEMORY(image, pageMode.flash, IMAGE_SIZE);
+    TEST_ASSERT_EQUAL(0, fallbacks);
+    TEST_ASSERT_EQUAL(0, pageMode.byteWrites);
+    TEST_ASSERT_EQUAL(0, pageMode.byteReads);
+}
+
+void test_erased_bytes_are_not_read_back() {
+    static ZbsEmulator zbs;
+    uint8_t page[256];
+    uint16_t fallbacks = 0;
+    memset(page, 0xFF, sizeof(page));
+    page[10] = 0x12;
+    page[200] = 0x34;
+    TEST_ASSERT_TRUE(ZbsPageProg::writePage(zbs, 0x100, page, sizeof(page), MAX_WRITE_ATTEMPTS, fallbacks));
+    TEST_ASSERT_EQUAL(2, zbs.burstReads);
+    TEST_ASSERT_TRUE(ZbsPageProg::verifyPage(zbs, 0x100, page, sizeof(page)));
+    TEST_ASSERT_EQUAL(4, zbs.burstReads);
+}
+
+void test_weak_byte_is_rewritten_in_byte_mode() {
+    static ZbsEmulator zbs;
+    uint16_t fallbacks = 0;
+    zbs.weak[0x205] = 3;
+    TEST_ASSERT_TRUE(ZbsPageProg::writePage(zbs, 0x200, image + 0x200, 256, MAX_WRITE_ATTEMPTS, fallbacks));
+    TEST_ASSERT_EQUAL_MEMORY(image + 0x200, zbs.flash + 0x200, 256);
+    TEST_ASSERT_EQUAL(1, fallbacks);
+    TEST_ASSERT_EQUAL(3, zbs.byteWrites);
+}
+
+void test_dead_byte_fails_the_page() {
+    static ZbsEmulator zbs;
+    uint16_t fallbacks = 0;
+    zbs.weak[0x305] = 255;
+    TEST_ASSERT_FALSE(ZbsPageProg::writePage(zbs, 0x300, image + 0x300, 256, MAX_WRITE_ATTEMPTS, fallbacks));
+    TEST_ASSERT_EQUAL(MAX_WRITE_ATTEMPTS, zbs.byteWrites);
+}
+
+void test_burst_read_glitch_is_checked_in_byte_mode() {
+    static ZbsEmulator zbs;
+    uint16_t fallbacks = 0;
+    zbs.burstGlitch = 0x405;
+    TEST_ASSERT_TRUE(ZbsPageProg::writePage(zbs, 0x400, image + 0x400, 256, MAX_WRITE_ATTEMPTS, fallbacks));
+    TEST_ASSERT_EQUAL(0, fallbacks);
+    TEST_ASSERT_EQUAL(0, zbs.byteWrites);
+    TEST_ASSERT_EQUAL(1, zbs.byteReads);
+
+    zbs.burstGlitch = 0x406;
+    TEST_ASSERT_TRUE(ZbsPageProg::verifyPage(zbs, 0x400, image + 0x400, 256));
+    zbs.flash[0x407] ^= 0x80;
+    TEST_ASSERT_FALSE(ZbsPageProg::verifyPage(zbs, 0x400, image + 0x400, 256));
+}
+
+void test_flash_time() {
+    static ZbsEmulator byteMode, pageMode, pageModeVerify;
+    uint16_t fallbacks = 0;
+    TEST_ASSERT_TRUE(byteModeFlash(byteMode, image, IMAGE_SIZE));
+    TEST_ASSERT_TRUE(pageModeFlash(pageMode, image, IMAGE_SIZE, false, fallbacks));
+    TEST_ASSERT_TRUE(pageModeFlash(pageModeVerify, image, IMAGE_SIZE, true, fallbacks));
+    char msg[160];
+    snprintf(msg, sizeof(msg), "64K image: byte mode %.2fs, page mode %.2fs, page mode with full verify %.2fs",
+             byteMode.us / 1e6, pageMode.us / 1e6, pageModeVerify.us / 1e6);
+    TEST_MESSAGE(msg);
+    TEST_ASSERT_TRUE(pageMode.us < byteMode.us);
+    TEST_ASSERT_TRUE(pageModeVerify.us < byteMode.us);
+}
+
+int main() {
+    makeImage();
+    UNITY_BEGIN();
+    RUN_TEST(test_page_mode_programs_the_same_image);
+    RUN_TEST(test_erased_bytes_are_not_read_back);
+    RUN_TEST(test_weak_byte_is_rewritten_in_byte_mode);
+    RUN_TEST(test_dead_byte_fails_the_page);
+    RUN_TEST(test_burst_read_glitch_is_checked_in_byte_mode);
+    RUN_TEST(test_flash_time);
+    return UNITY_END();
+}
@@ -15,8 +15,10 @@
 
 // Converted from C to Javascript by Nic Limper
 
-// Define constants
-const MAX_IMAGE_FLIPS = 640;
+// Flip buffers are sized from the image width, a line can't have more color changes than pixels
+function G5_FLIPS_FOR_WIDTH(width) {
+    return width + 8;
+}
 
 // Horizontal prefix bits
 const HORIZ_SHORT_SHORT = 0;
@@ -93,8 +95,9 @@ class G5DECIMAGE {
         this.pSrc = null; // Input buffer
         this.pBuf = null; // Current buffer index
         this.pBufIndex = 0;
-        this.pCur = new Int16Array(MAX_IMAGE_FLIPS); // Current state
-        this.pRef = new Int16Array(MAX_IMAGE_FLIPS); // Reference state
+        this.iMaxFlips = 0;
+        this.pCur = null; // Current state
+        this.pRef = null; // Reference state
     }
 }
 
@@ -111,6 +114,9 @@ function g5_decode_init(pImage, iWidth, iHeight, pData, iDataSize) {
         return G5_INVALID_PARAMETER;
     }
 
+    pImage.iMaxFlips = G5_FLIPS_FOR_WIDTH(iWidth);
+    pImage.pCur = new Int16Array(pImage.iMaxFlips);
+    pImage.pRef = new Int16Array(pImage.iMaxFlips);
     pImage.iVLCSize = iDataSize;
     pImage.pSrc = pData;
     pImage.ulBitOff = 0;
@@ -176,15 +182,16 @@ function Decode_Begin(pPage) {
     const xsize = pPage.iWidth;
 
     // Seed the current and reference lines with xsize for V(0) codes
-    for (let i = 0; i < MAX_IMAGE_FLIPS - 2; i++) {
+    const maxFlips = pPage.iMaxFlips;
+    for (let i = 0; i < maxFlips - 2; i++) {
         pPage.pRef[i] = xsize;
         pPage.pCur[i] = xsize;
     }
 
     // Prefill both current and reference lines with 0x7fff to prevent walking off the end
     // if the data gets bunged and the current X is > XSIZE
-    pPage.pCur[MAX_IMAGE_FLIPS - 2] = pPage.pRef[MAX_IMAGE_FLIPS - 2] = 0x7fff;
-    pPage.pCur[MAX_IMAGE_FLIPS - 1] = pPage.pRef[MAX_IMAGE_FLIPS - 1] = 0x7fff;
+    pPage.pCur[maxFlips - 2] = pPage.pRef[maxFlips - 2] = 0x7fff;
+    pPage.pCur[maxFlips - 1] = pPage.pRef[maxFlips - 1] = 0x7fff;
 
     pPage.pBuf = pPage.pSrc; // Start buffer
     pPage.pBufIndex = 0;
@@ -211,8 +218,7 @@ function DecodeLine(pPage) {
     let pBufIndex = pPage.pBufIndex;
     const pBuf = pPage.pBuf;
     const xsize = pPage.iWidth;
-    const u32HLen = pPage.iHLen;
-    const u32HMask = (1 << u32HLen) - 1;
+    const runLengths = [3, pPage.iHLen]; // short and long horizontal run code lengths
     let tot_run, tot_run1;
 
     while (a0 < xsize) {
@@ -269,40 +275,18 @@ function DecodeLine(pPage) {
                     const lBits = (ulBits >> ((REGISTER_WIDTH - 2) - ulBitOff)) & 0x3;
                     ulBitOff += 2;
 
-                    switch (lBits) {
-                        case HORIZ_SHORT_SHORT:
-                            tot_run = (ulBits >> ((REGISTER_WIDTH - 3) - ulBitOff)) & 0x7;
-                            ulBitOff += 3;
-                            tot_run1 = (ulBits >> ((REGISTER_WIDTH - 3) - ulBitOff)) & 0x7;
-                            ulBitOff += 3;
-                            break;
-
-                        case HORIZ_SHORT_LONG:
-                            tot_run = (ulBits >> ((REGISTER_WIDTH - 3) - ulBitOff)) & 0x7;
-                            ulBitOff += 3;
-                            tot_run1 = (ulBits >> ((REGISTER_WIDTH - u32HLen) - ulBitOff)) & u32HMask;
-                            ulBitOff += u32HLen;
-                            break;
-
-                        case HORIZ_LONG_SHORT:
-                            tot_run = (ulBits >> ((REGISTER_WIDTH - u32HLen) - ulBitOff)) & u32HMask;
-                            ulBitOff += u32HLen;
-                            tot_run1 = (ulBits >> ((REGISTER_WIDTH - 3) - ulBitOff)) & 0x7;
-                            ulBitOff += 3;
-                            break;
-
-                        case HORIZ_LONG_LONG:
-                            tot_run = (ulBits >> ((REGISTER_WIDTH - u32HLen) - ulBitOff)) & u32HMask;
-                            ulBitOff += u32HLen;
-                            if (ulBitOff > (REGISTER_WIDTH - 16)) {
-                                pBufIndex += (ulBitOff >> 3);
-                                ulBitOff &= 7;
-                                ulBits = TIFFMOTOLONG(pBuf, pBufIndex);
-                            }
-                            tot_run1 = (ulBits >> ((REGISTER_WIDTH - u32HLen) - ulBitOff)) & u32HMask;
-                            ulBitOff += u32HLen;
-                            break;
+                    // each prefix bit selects the length of one run (short = 3 bits, long = iHLen bits)
+                    let runLen = runLengths[lBits >> 1];
+                    tot_run = (ulBits >> ((REGISTER_WIDTH - runLen) - ulBitOff)) & ((1 << runLen) - 1);
+                    ulBitOff += runLen;
+                    if (ulBitOff > (REGISTER_WIDTH - 16)) {
+                        pBufIndex += (ulBitOff >> 3);
+                        ulBitOff &= 7;
+                        ulBits = TIFFMOTOLONG(pBuf, pBufIndex);
                     }
+                    runLen = runLengths[lBits & 1];
+                    tot_run1 = (ulBits >> ((REGISTER_WIDTH - runLen) - ulBitOff)) & ((1 << runLen) - 1);
+                    ulBitOff += runLen;
                     a0 = a0_p + tot_run;
                     pCur[pCurIndex++] = a0;
                     a0 += tot_run1;
@@ -263,6 +263,9 @@ function connect() {
 			} else {
 				str += `filesystem free: ${convertSize(msg.sys.littlefsfree)}`;
 			}
+			if (msg.sys.blequeue !== undefined) {
+				str += ` &#x2507; BLE: ${msg.sys.bleactive} active, ${msg.sys.blequeue} queued`;
+			}
 			str += ` &#x2507; uptime: ${formatUptime(msg.sys.uptime)}`;
 
 			$("#sysinfo").innerHTML = str;
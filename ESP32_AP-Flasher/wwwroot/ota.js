@@ -567,6 +567,12 @@ export function print(line, color = "white") {
     const consoleDiv = document.getElementById('updateconsole');
     if (consoleDiv) {
         const isScrolledToBottom = consoleDiv.scrollHeight - consoleDiv.clientHeight <= consoleDiv.scrollTop;
+        const lastLine = consoleDiv.lastElementChild;
+        if (line.startsWith("Progress:") && lastLine && lastLine.textContent.startsWith("Progress:")) {
+            // progress updates overwrite each other instead of flooding the console
+            lastLine.textContent = line;
+            return;
+        }
         const newLine = document.createElement('div');
         newLine.style.color = color;
         if (line == "[reboot]") {